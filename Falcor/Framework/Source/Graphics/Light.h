@@ -293,6 +293,11 @@ namespace Falcor
         */
         const Model::MeshInstance::SharedPtr& getMeshData() const { return mpMeshInstance; }
 
+        /** Obtain the model instance of the geometry mesh
+            \return Model instance for this light
+        */
+        const ObjectInstance<Model>::SharedPtr& getModelInstance() const { return mpModelInstance; }
+
         /** Compute surface area of the mesh
         */
         void computeSurfaceArea();
@@ -301,6 +306,10 @@ namespace Falcor
         */
         float getSurfaceArea() const { return mAreaLightData.surfaceArea; }
 
+        /** Get the light data. The transformation matrices are only updated when the light is set into program vars.
+        */
+        const AreaLightData& getAreaLightData() const { return mAreaLightData; }
+
         /** Get the probability distribution of the mesh
         */
         const std::vector<float>& getMeshCDF() const { return mMeshCDF; }
@@ -21,9 +21,8 @@ template<typename T>
 inline void writeBuffer(Buffer::SharedPtr buffer, std::vector<T> dataVec)
 {
     T* pData = static_cast<T*> (buffer->map(Buffer::MapType::WriteDiscard));
-    size_t numElements = buffer->getSize() / sizeof(T);
-    std::vector<T> vec(numElements);
-    std::memcpy(pData, vec.data(), numElements * sizeof(T));
+    size_t numElements = std::min(buffer->getSize() / sizeof(T), dataVec.size());
+    std::memcpy(pData, dataVec.data(), numElements * sizeof(T));
     buffer->unmap();
 }
 
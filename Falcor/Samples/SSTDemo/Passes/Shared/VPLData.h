@@ -9,7 +9,23 @@
     #define CONST_MOD const
     #define MUTATING
     using uint2 = glm::uvec2;
+    using uint3 = glm::uvec3;
     using uint = unsigned int;
+
+    /** Host counterparts of the half packing helpers in Packing.slang.
+    */
+    inline void packFloatLow(float v, uint& u)
+    {
+        u &= 0xFFFF0000;
+        u |= glm::packHalf2x16(float2(v, 0.f)) & 0x0000FFFF;
+    }
+
+    inline void packFloat3(const float3& v, uint2& u)
+    {
+        u.x = glm::packHalf2x16(float2(v.x, v.y));
+        u.y &= 0x0000FFFF;
+        u.y |= glm::packHalf2x16(float2(0.f, v.z)) & 0xFFFF0000;
+    }
 #else
     #define SHADER_CODE
     #include "Packing.slang"
@@ -26,11 +42,38 @@ struct VPLStats
     int pad3        DEFAULTS(-1);
 };
 
-struct LightInfo
+/** Light source of the VPL paths in world space.
+*/
+struct EmitterData
+{
+    float3 posW         DEFAULTS(float3(0.f));  ///< Point light: position. Area light: center.
+    uint   type         DEFAULTS(LightPoint);   ///< LightPoint or LightArea
+    float3 dirW         DEFAULTS(float3(0.f));  ///< Area light: normal (normal matrix applied, not normalized).
+    float  surfaceArea  DEFAULTS(0.f);          ///< Area light: scaled surface area.
+    float3 tangentW     DEFAULTS(float3(0.f));  ///< Area light: first edge, the full extent.
+    float  power        DEFAULTS(0.f);          ///< Light::getPower()
+    float3 bitangentW   DEFAULTS(float3(0.f));  ///< Area light: second edge, the full extent.
+    float  pdf          DEFAULTS(0.f);          ///< Selection probability, power / total power.
+    float3 intensity    DEFAULTS(float3(0.f));
+    float  pad          DEFAULTS(0.f);
+};
+
+/** Alias table entry of the emitter selection (Vose's alias method).
+    A ray that falls into bucket i at the fraction f takes emitter i if f < threshold, otherwise emitter alias.
+*/
+struct EmitterAliasEntry
 {
-    int  type     DEFAULTS(-1);
-    int  index    DEFAULTS(-1);
-    int2 rayRange DEFAULTS(int2(-1, -1));
+    float threshold     DEFAULTS(1.f);
+    uint  alias         DEFAULTS(0);
+};
+
+/** Tag of a slot of the persistent VPL pool. Path p owns the slots [p * maxBounces, (p + 1) * maxBounces),
+    one per bounce. Slots of bounces the path did not reach are empty.
+*/
+struct VPLSlotTag
+{
+    int  pathId         DEFAULTS(-1);           ///< Path that placed the VPL, -1 if the slot is empty.
+    uint birthFrame     DEFAULTS(0);            ///< Frame count at which the path was traced.
 };
 
 struct VPLData
@@ -128,7 +171,16 @@ struct VPLData
 #endif
     }
 
-#ifdef SHADER_CODE
+    /** Half-angle in radians of the cone around getNormW() that bounds the normals of all VPLs in the subtree. 0 for leaves.
+    */
+    inline float getConeAngle() CONST_MOD
+    {
+#if defined(HOST_CODE)
+        return glm::unpackHalf2x16(normW.y).x;
+#else
+        return unpackFloatLow(normW.y);
+#endif
+    }
 
     /** Setter methods
     */
@@ -172,7 +224,11 @@ struct VPLData
     {
         packFloatLow(f, var.y);
     }
-#endif
+
+    MUTATING inline void setConeAngle(float a)
+    {
+        packFloatLow(a, normW.y);
+    }
 };
 
 #endif
@@ -20,6 +20,96 @@ struct VPLMerge
     float2 ApproxScore;
 };
 
+/** Collapsed node of the 4-wide SST. Holds the data of up to four children of a binary node that
+    the traversal needs to pick one, so a step is a single contiguous 176 byte fetch.
+    Positions, normals and bounds are half-packed like in VPLData.
+*/
+struct WideTreeNode
+{
+    uint2 aabbMin[4];
+    uint2 aabbMax[4];
+    uint2 posW[4];
+    uint2 normW[4];
+    float intensity[4];  // == 0 for empty slots
+    int   child[4];      // Index of the wide node of an internal child, -1 for leaves and empty slots
+    uint  vplIdx[4];     // Index of the child in the VPL data array, kWideEarlyStopBit set if the approximation is good enough
+};
+
+static const uint kWideEarlyStopBit = 0x80000000;
+
+/** Compressed 32 byte SST node. Nodes are stored in depth-first order, so the children are implicit:
+    the left child follows its parent, the right child follows the subtree of the left child.
+    Bounds are quantized relative to the decoded bounds of the parent, the root relative to the tree bounds.
+    The intensity is the luminance of the color, like in addVPL() and the merge.
+*/
+struct CompressedTreeNode
+{
+    uint aabb0;     // aabbMin.xyz, aabbMax.x (8 bit unorm each)
+    uint aabb1;     // aabbMax.yz (8 bit unorm each), flags in the upper 16 bits
+    uint posXY;     // 16 bit unorm each, relative to the own bounds
+    uint posZ;      // 16 bit unorm, upper 16 bits unused
+    uint normW;     // Octahedral map, 16 bit snorm each
+    uint color;     // RGB9E5
+    uint variance;  // RGB9E5
+    uint count;     // Leaf: VPL id. Internal node: number of nodes in the subtree below (numVPLSubTree)
+};
+
+static const uint kCompressedLeafFlag      = 0x10000;
+static const uint kCompressedEarlyStopFlag = 0x20000;
+static const uint kCompressedOmniFlag      = 0x40000;   // Normal is zero (omnidirectional)
+
+/** Node of the lightcut of a screen tile, see buildTileCuts() in VPLSampling.rt.hlsl.
+    The cut of a tile is stored in kMaxTileCutNodes consecutive entries, unused entries have nodeIdx -1 and cdf 1.
+*/
+struct TileCutNode
+{
+    int   nodeIdx;  // Index of the node in the VPL data array
+    float pdf;      // Probability to start the traversal at this node
+    float cdf;      // Inclusive prefix sum of pdf over the cut, 1 for the last node
+    float pad;
+};
+
+static const uint  kMaxTileCutNodes        = 32;     // Nodes per cut
+static const uint  kTileCutRepresentatives = 4;      // Representative samples per tile, one per tile quadrant
+static const float kTileCutUniformMix      = 0.1f;   // Uniform share of the cut node probabilities
+
+/** Deferred shadow ray of a VPL sample, see resolveShadowRays() in VPLSampling.rt.hlsl.
+    Record i belongs to sample i % numSamples of pixel i / numSamples, samples without a shadow ray have nodeIdx -1.
+*/
+struct ShadowRayRecord
+{
+    float3 origin;      // Sampled position on the selected node
+    int    nodeIdx;     // Index of the selected node in the VPL data array
+    float3 target;      // Shading point
+    float  pad;
+    float3 radiance;    // Contribution if visible, already divided by the sample probability. Set to 0 if occluded
+    float  pad2;
+};
+
+static const uint kInvalidShadowRayBin = 0xFFFFFFFF;    // Bin key of records without a shadow ray, sorted behind all rays
+
+// Bin key of the shadow ray sort, selected by SHADOW_RAY_BINNING
+static const uint kShadowRayBinningPixelOrder = 0;      // No sort, rays are traced in the order of the samples
+static const uint kShadowRayBinningNode       = 1;      // Selected node
+static const uint kShadowRayBinningOctant     = 2;      // Octant of the ray direction
+
+#if defined(HOST_CODE)
+/** Shadow ray binning of the host port, see HostShadowRayBinning.h.
+*/
+enum class ShadowRayBinning : uint32_t
+{
+    PixelOrder = kShadowRayBinningPixelOrder,
+    Node = kShadowRayBinningNode,
+    Octant = kShadowRayBinningOctant,
+    Count
+};
+#endif
+
+/** Padding of the orientation cone angles in radians. Covers the half precision of the stored axes and angles,
+    so the cone of a node always contains the stored normals of its subtree.
+*/
+static const float kConeAngleEpsilon = 0.002f;
+
 struct TreeApproxParams
 {
     float minNormalScore  DEFAULTS(0.25f);
@@ -205,6 +205,27 @@ float maxNdotAABB(in const float3 P, in const float3 N, in const float3 aabbMin,
     return zMax / length(float3(xMin, yMin, zMax)); // Div by zero not possible since zMax > 0
 }
 
+/** Returns an upper bound for the cosine between the normals of a node and the directions from the node to point P.
+    The normals lie in the cone (axis, coneAngle) and the positions in the AABB, whose bounding sphere subtends asin(r / d) at P.
+    A zero bound means that no VPL of the node emits towards P.
+*/
+float maxEmitterCosCone(in const float3 P, in const float3 axis, in const float coneAngle, in const float3 aabbMin, in const float3 aabbMax)
+{
+    const float3 center = (aabbMin + aabbMax) * 0.5f;
+    const float radius = length(aabbMax - aabbMin) * 0.5f;
+    const float3 d = P - center;
+    const float dist = length(d);
+    const float axisLength = length(axis);
+    if (dist <= radius || !(axisLength > 0.f)) // P within the bounding sphere or omnidirectional node
+        return 1.f;
+
+    const float theta = acos(clamp(dot(axis, d) / (axisLength * dist), -1.f, 1.f));
+    const float angle = theta - coneAngle - asin(radius / dist);
+    if (angle <= 0.f)
+        return 1.f;
+    return angle < M_PI * 0.5f ? cos(angle) : 0.f;
+}
+
 /** Returns the closet point on an AABB to a ray.
 */
 float3 closestPointOnAABBRay(in float3 rayOrigin, in float3 rayDir, in float3 aabbMin, in float3 aabbMax)
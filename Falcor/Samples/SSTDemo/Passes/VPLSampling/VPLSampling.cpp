@@ -12,6 +12,25 @@ namespace
   const char* kEntryPointRayGen   = "rayGeneration";
   const char* kEntryPointMiss0    = "shadowRayMiss";
   const char* kEntryPointAnyHit0  = "shadowRayAnyHit";
+
+  // Screen tile lightcut pre-pass, launched once per tile
+  const char* kEntryPointTileCuts = "buildTileCuts";
+
+  // Binned shadow rays, launched once per record and once per pixel
+  const char* kEntryPointResolveShadowRays   = "resolveShadowRays";
+  const char* kEntryPointCompositeShadowRays = "compositeShadowRays";
+
+  // Records and keys take 56 bytes per sample, larger launches trace their shadow rays inline
+  const uint32_t kMaxShadowRayRecords = 1 << 24;
+
+  const Gui::DropdownList kTileCutSizes = { { 8, "8x8" }, { 16, "16x16" } };
+
+  const Gui::DropdownList kShadowRayBinnings =
+  {
+    { (uint32_t)ShadowRayBinning::PixelOrder, "Pixel order" },
+    { (uint32_t)ShadowRayBinning::Node,       "Selected node" },
+    { (uint32_t)ShadowRayBinning::Octant,     "Direction octant" },
+  };
 }
 
 VPLSampling::SharedPtr VPLSampling::create()
@@ -22,6 +41,7 @@ VPLSampling::SharedPtr VPLSampling::create()
 
 VPLSampling::VPLSampling()
 {
+    mpBitonicSort = BitonicSort::create();
     createPrograms();
 }
 
@@ -44,6 +64,31 @@ void VPLSampling::createPrograms()
   mpState = RtState::create();
   mpState->setMaxTraceRecursionDepth(1);
   mpState->setProgram(mTracer.pProgram);
+
+  createRayGenPass(kEntryPointTileCuts, mTileCuts);
+  createRayGenPass(kEntryPointResolveShadowRays, mResolveShadowRays);
+  createRayGenPass(kEntryPointCompositeShadowRays, mCompositeShadowRays);
+
+  // The shadow ray buffers depend on the number of samples, see createShadowRayBuffers()
+  mpShadowRays = nullptr;
+  mpShadowRayKeys = nullptr;
+}
+
+void VPLSampling::createRayGenPass(const char* entryPoint, RayGenPass& pass)
+{
+  // Same file and shadow ray type as the main program, so the passes share defines and globals
+  RtProgram::Desc desc;
+  desc.addShaderLibrary(kFileRayTrace);
+  desc.setRayGen(entryPoint);
+  desc.addMiss(0, kEntryPointMiss0);
+  desc.addHitGroup(0, "", kEntryPointAnyHit0);
+
+  pass.pProgram = RtProgram::create(desc);
+  pass.pVars = RtProgramVars::create(pass.pProgram, mpScene);
+
+  pass.pState = RtState::create();
+  pass.pState->setMaxTraceRecursionDepth(1);
+  pass.pState->setProgram(pass.pProgram);
 }
 
 void VPLSampling::createResources(PassData& passData)
@@ -71,15 +116,63 @@ void VPLSampling::createResources(PassData& passData)
     passData.addResource("gDirect", pDirect);
     passData.addResource("gIndirect", pIndirect);
 
+    // Cuts of the smallest tiles, so the tile size can change without reallocation
+    const uint32_t numTiles = ((passData.getWidth() + 7) / 8) * ((passData.getHeight() + 7) / 8);
+    mpTileCuts = StructuredBuffer::create(mTileCuts.pProgram->getRayGenProgram(), "gTileCuts", numTiles * kMaxTileCutNodes,
+        Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess);
+
     mReloadResources = false;
 }
 
 void VPLSampling::toogleProgramDefine(bool enabled, std::string name, std::string value)
 {
-    if (enabled)
-        mTracer.pProgram->addDefine(name, value);
-    else
-        mTracer.pProgram->removeDefine(name);
+    // The additional passes evaluate the same node weights and outputs
+    for (const auto& pProgram : { mTracer.pProgram, mTileCuts.pProgram, mResolveShadowRays.pProgram, mCompositeShadowRays.pProgram })
+    {
+        if (enabled)
+            pProgram->addDefine(name, value);
+        else
+            pProgram->removeDefine(name);
+    }
+}
+
+void VPLSampling::buildTileCuts(RenderContext* pRenderContext, const uvec3& rayLaunchDims)
+{
+    PROFILE("TileCuts");
+
+    const uvec3 numTiles = uvec3((rayLaunchDims.x + mTileCutSize - 1) / mTileCutSize, (rayLaunchDims.y + mTileCutSize - 1) / mTileCutSize, 1);
+    mTracer.pSceneRenderer->renderScene(pRenderContext, mTileCuts.pVars, mTileCuts.pState, numTiles, mpScene->getActiveCamera().get());
+    pRenderContext->uavBarrier(mpTileCuts.get());
+}
+
+bool VPLSampling::createShadowRayBuffers(uint32_t numRecords)
+{
+    if (numRecords == 0 || numRecords > kMaxShadowRayRecords)
+        return false;
+    if (mpShadowRays && mpShadowRays->getElementCount() == numRecords)
+        return true;
+
+    auto bindFlags = Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess;
+    mpShadowRays = StructuredBuffer::create(mResolveShadowRays.pProgram->getRayGenProgram(), "gShadowRays", numRecords, bindFlags);
+    mpShadowRayKeys = StructuredBuffer::create(mResolveShadowRays.pProgram->getRayGenProgram(), "gShadowRayKeys", numRecords, bindFlags);
+    return true;
+}
+
+void VPLSampling::resolveShadowRays(RenderContext* pRenderContext, const uvec3& rayLaunchDims, uint32_t numRecords)
+{
+    PROFILE("ShadowRays");
+
+    pRenderContext->uavBarrier(mpShadowRays.get());
+    pRenderContext->uavBarrier(mpShadowRayKeys.get());
+
+    // The record index in the low bits keeps the order within a bin, records without a ray sort to the back
+    if ((ShadowRayBinning)mShadowRayBinning != ShadowRayBinning::PixelOrder)
+        mpBitonicSort->execute(pRenderContext, mpShadowRayKeys, numRecords, int2(63, 0), 128, 256);
+
+    mTracer.pSceneRenderer->renderScene(pRenderContext, mResolveShadowRays.pVars, mResolveShadowRays.pState, uvec3(numRecords, 1, 1), mpScene->getActiveCamera().get());
+    pRenderContext->uavBarrier(mpShadowRays.get());
+
+    mTracer.pSceneRenderer->renderScene(pRenderContext, mCompositeShadowRays.pVars, mCompositeShadowRays.pState, rayLaunchDims, mpScene->getActiveCamera().get());
 }
 
 void VPLSampling::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
@@ -121,6 +214,26 @@ void VPLSampling::onGuiRender(Gui* pGui)
     pGui->addSeparator();
     pGui->addCheckBox("Use uniform sampling", mUseUniformSampling);
     pGui->addTooltip("Use uniform sampling strategy by picking a random VPL", true);
+    if (pGui->addIntVar("Indirect samples", mNumVPLSamples, 1, 64))
+        mNumAccumulatedSamples = 0;
+    pGui->addTooltip("Number of VPL samples per pixel and frame", true);
+    pGui->addCheckBox("Group traversal", mUseGroupTraversal);
+    pGui->addTooltip("All indirect samples of a pixel descend the tree together and split at every node, upper levels are evaluated once per pixel", true);
+    if (pGui->addCheckBox("Orientation cones", mUseOrientationCones))
+        mNumAccumulatedSamples = 0;
+    pGui->addTooltip("Bounds the emitter cosine of every node with its normal cone, subtrees that face away from the shading point are never selected", true);
+    if (pGui->addCheckBox("Tile cuts", mUseTileCuts))
+        mNumAccumulatedSamples = 0;
+    pGui->addTooltip("A pre-pass builds a cut of the tree per screen tile from four representative pixels, the samples of a pixel start at a cut node instead of the root. Not used by the group traversal", true);
+    if (mUseTileCuts)
+    {
+        if (pGui->addDropdown("Tile size", kTileCutSizes, mTileCutSize))
+            mNumAccumulatedSamples = 0;
+    }
+    pGui->addCheckBox("Binned shadow rays", mUseBinnedShadowRays);
+    pGui->addTooltip("The samples write their shadow rays to a buffer that is sorted by bin and traced in a separate pass. Not used by the uniform sampling and the group traversal, or above 16M samples per frame", true);
+    if (mUseBinnedShadowRays)
+        pGui->addDropdown("Bin by", kShadowRayBinnings, mShadowRayBinning);
    
     pGui->addFloatVar("minT", mMinT, 0.f, 10.f);
     pGui->addFloatVar("maxG", mGMax, 0.01f, 1000.f);
@@ -164,30 +277,42 @@ void VPLSampling::onFrameRender(RenderContext* pRenderContext, PassData& passDat
   Texture::SharedPtr pDirect             = asTexture(passData["gDirect"]);
   Texture::SharedPtr pIndirect           = asTexture(passData["gIndirect"]);
 
-  // Bind resources
-  auto globalVars = mTracer.pVars->getGlobalVars();
-  globalVars->setTexture("gPosW", pGBufferWorldPosition);
-  globalVars->setTexture("gPacked1", pGBufferPacked1);
-  globalVars->setTexture("gPacked2", pGBufferPacked2);
-
-  globalVars->setStructuredBuffer("gVPLData", pBufferVPLData);
-  globalVars->setStructuredBuffer("gVPLStats", pBufferVPLStats);
-
-  globalVars->setTexture("gAlbedo", pAlbedo);
-  globalVars->setTexture("gCombined", pCombined);
-  globalVars->setTexture("gDirect", pDirect);
-  globalVars->setTexture("gIndirect", pIndirect);
-
-  // Set constant buffer
-  globalVars["CB"]["gGMax"]                  = mGMax;
-  globalVars["CB"]["gAttenuationEpsilon"]    = mAttenuationEpsilon;
-  globalVars["CB"]["gMaxVPLs"]               = maxVPLs;
-  globalVars["CB"]["gNumDirectSamples"]      = mNumDirectSamples;
-  globalVars["CB"]["gNumIndirectSamples"]    = mNumVPLSamples;
-  globalVars["CB"]["gNumAccumulatedSamples"] = mNumAccumulatedSamples;
+  uvec3 rayLaunchDims = uvec3(pCombined->getWidth(), pCombined->getHeight(), 1);
 
-  globalVars["PerFrameCB"]["gMinT"]       = mMinT;
-  globalVars["PerFrameCB"]["gFrameCount"] = mFrameCount;
+  // Binned shadow rays need a record per sample
+  const uint32_t numShadowRays = rayLaunchDims.x * rayLaunchDims.y * (uint32_t)mNumVPLSamples;
+  const bool binShadowRays = mUseBinnedShadowRays && mEnableVPLSampling && !mUseUniformSampling && !mUseGroupTraversal && createShadowRayBuffers(numShadowRays);
+
+  // Bind resources, the additional passes share the globals of the shader file
+  for (const auto& pVars : { mTracer.pVars, mTileCuts.pVars, mResolveShadowRays.pVars, mCompositeShadowRays.pVars })
+  {
+    auto globalVars = pVars->getGlobalVars();
+    globalVars->setTexture("gPosW", pGBufferWorldPosition);
+    globalVars->setTexture("gPacked1", pGBufferPacked1);
+    globalVars->setTexture("gPacked2", pGBufferPacked2);
+
+    globalVars->setStructuredBuffer("gVPLData", pBufferVPLData);
+    globalVars->setStructuredBuffer("gVPLStats", pBufferVPLStats);
+    globalVars->setStructuredBuffer("gTileCuts", mpTileCuts);
+    globalVars->setStructuredBuffer("gShadowRays", mpShadowRays);
+    globalVars->setStructuredBuffer("gShadowRayKeys", mpShadowRayKeys);
+
+    globalVars->setTexture("gAlbedo", pAlbedo);
+    globalVars->setTexture("gCombined", pCombined);
+    globalVars->setTexture("gDirect", pDirect);
+    globalVars->setTexture("gIndirect", pIndirect);
+
+    // Set constant buffer
+    globalVars["CB"]["gGMax"]                  = mGMax;
+    globalVars["CB"]["gAttenuationEpsilon"]    = mAttenuationEpsilon;
+    globalVars["CB"]["gMaxVPLs"]               = maxVPLs;
+    globalVars["CB"]["gNumDirectSamples"]      = mNumDirectSamples;
+    globalVars["CB"]["gNumIndirectSamples"]    = mNumVPLSamples;
+    globalVars["CB"]["gNumAccumulatedSamples"] = mNumAccumulatedSamples;
+
+    globalVars["PerFrameCB"]["gMinT"]       = mMinT;
+    globalVars["PerFrameCB"]["gFrameCount"] = mFrameCount;
+  }
 
   toogleProgramDefine(mUseDirectGGX,         "USE_DIRECT_GGX");
   toogleProgramDefine(mUseIndirectGGX,       "USE_INDIRECT_GGX");
@@ -195,10 +320,21 @@ void VPLSampling::onFrameRender(RenderContext* pRenderContext, PassData& passDat
   toogleProgramDefine(mEnableVPLSampling,    "INDIRECT_SAMPLING_ENABLED");
   toogleProgramDefine(mAccumulateSamples,    "ACCUMULATE_SAMPLES");
   toogleProgramDefine(mUseUniformSampling,   "USE_UNIFORM_SAMPLING");
+  toogleProgramDefine(mUseGroupTraversal,    "USE_GROUP_TRAVERSAL");
+  toogleProgramDefine(mUseOrientationCones,  "USE_ORIENTATION_CONES");
+  toogleProgramDefine(mUseTileCuts,          "USE_TILE_CUTS");
+  toogleProgramDefine(true,                  "TILE_CUT_SIZE", std::to_string(mTileCutSize));
+  toogleProgramDefine(binShadowRays,         "USE_BINNED_SHADOW_RAYS");
+  toogleProgramDefine(true,                  "SHADOW_RAY_BINNING", std::to_string(mShadowRayBinning));
+
+  if (mUseTileCuts && mEnableVPLSampling && !mUseUniformSampling && !mUseGroupTraversal)
+    buildTileCuts(pRenderContext, rayLaunchDims);
 
-  uvec3 rayLaunchDims = uvec3(pCombined->getWidth(), pCombined->getHeight(), 1);
   mTracer.pSceneRenderer->renderScene(pRenderContext, mTracer.pVars, mpState, rayLaunchDims, mpScene->getActiveCamera().get());
 
+  if (binShadowRays)
+    resolveShadowRays(pRenderContext, rayLaunchDims, numShadowRays);
+
   if (mAccumulateSamples) mNumAccumulatedSamples++;
 
   mLastCameraMatrix = mpScene->getActiveCamera()->getViewMatrix();
@@ -4,6 +4,7 @@
 
 #include "Passes/BasePass.h"
 #include "Passes/Shared/VPLData.h"
+#include "Passes/VPLTree/Sort/BitonicSort.h"
 
 using namespace Falcor;
 
@@ -31,6 +32,9 @@ private:
     void createPrograms();
     void createResources(PassData& passData);
     void toogleProgramDefine(bool enabled, std::string name, std::string value = "");
+    void buildTileCuts(RenderContext* pRenderContext, const uvec3& rayLaunchDims);
+    bool createShadowRayBuffers(uint32_t numRecords);
+    void resolveShadowRays(RenderContext* pRenderContext, const uvec3& rayLaunchDims, uint32_t numRecords);
 
     // Ray tracing program.
     struct
@@ -40,6 +44,25 @@ private:
         RtSceneRenderer::SharedPtr pSceneRenderer;
     } mTracer;
 
+    // Additional ray generation shader of the same file.
+    struct RayGenPass
+    {
+        RtProgram::SharedPtr       pProgram;
+        RtProgramVars::SharedPtr   pVars;
+        RtState::SharedPtr         pState;
+    };
+
+    void createRayGenPass(const char* entryPoint, RayGenPass& pass);
+
+    RayGenPass mTileCuts;               // Screen tile lightcut pre-pass
+    RayGenPass mResolveShadowRays;      // Visibility of the binned shadow rays
+    RayGenPass mCompositeShadowRays;    // Indirect output of the binned shadow rays
+
+    StructuredBuffer::SharedPtr mpTileCuts;
+    StructuredBuffer::SharedPtr mpShadowRays;
+    StructuredBuffer::SharedPtr mpShadowRayKeys;
+    BitonicSort::SharedPtr mpBitonicSort;
+
     RtState::SharedPtr mpState;
     RtScene::SharedPtr mpScene;
 
@@ -57,6 +80,12 @@ private:
     bool  mEnableVPLSampling    = true;
     bool  mAccumulateSamples    = false;
     bool  mUseUniformSampling   = false;
+    bool  mUseGroupTraversal    = false;
+    bool  mUseOrientationCones  = false;
+    bool  mUseTileCuts          = false;
+    uint32_t mTileCutSize       = 16;
+    bool  mUseBinnedShadowRays  = false;
+    uint32_t mShadowRayBinning  = 1;    // See ShadowRayBinning
 
     int   mNumDirectSamples      = 1;
     int   mNumVPLSamples         = 1;
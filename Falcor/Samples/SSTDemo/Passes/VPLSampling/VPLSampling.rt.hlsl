@@ -43,6 +43,28 @@ shared cbuffer CB
     int   gNumAccumulatedSamples; // Number of accumulated samples
 };
 
+// Maximum number of samples that descend the SST as one group, bounds the traversal stack. See kMaxGroupSamples.
+#define MAX_GROUP_SAMPLES 16
+
+// Screen tile lightcuts, see buildTileCuts() and HostTileCuts.h
+#ifndef TILE_CUT_SIZE
+#define TILE_CUT_SIZE 16              // Tile edge in pixels
+#endif
+
+// Cut of every screen tile, kMaxTileCutNodes entries per tile in row-major tile order
+shared RWStructuredBuffer<TileCutNode> gTileCuts;
+
+// Binned shadow rays, see resolveShadowRays() and HostShadowRayBinning.h
+#ifndef SHADOW_RAY_BINNING
+#define SHADOW_RAY_BINNING kShadowRayBinningNode  // One of the kShadowRayBinning* values
+#endif
+
+// gNumIndirectSamples records per pixel in row-major pixel order, and their sort keys (bin << 32 | record index)
+shared RWStructuredBuffer<ShadowRayRecord> gShadowRays;
+shared RWStructuredBuffer<uint64_t>        gShadowRayKeys;
+
+static uint gShadowRaySlot; // Record of the current sample, set by rayGeneration()
+
 // Per frame constant buffer
 shared cbuffer PerFrameCB
 {
@@ -194,13 +216,16 @@ void rayGeneration()
   uint2 launchIndex = DispatchRaysIndex().xy;
   uint2 launchDim   = DispatchRaysDimensions().xy;
 
-  // Load g-buffer data
-  float4 posW    = gPosW[launchIndex];
-  float4 packed1 = gPacked1[launchIndex];
-  float4 packed2 = gPacked2[launchIndex];
+#ifdef USE_BINNED_SHADOW_RAYS
+  // Samples without a shadow ray leave their record cleared
+  const uint shadowRayBase = (launchIndex.y * launchDim.x + launchIndex.x) * gNumIndirectSamples;
+  for (int i = 0; i < gNumIndirectSamples; i++)
+    clearShadowRay(shadowRayBase + i);
+#endif
 
-  // Does this Gbuffer pixel contain a valid piece of geometry?  (0 in pos.w for invalid)
-  bool isGeometryValid = (posW.w != 0.0f);
+  // Load g-buffer data
+  ShadingDataCompact sd;
+  bool isGeometryValid = loadShadingData(launchIndex, sd);
 
   float3 albedo        = float3(0.f);
   float3 directColor   = float3(0.f);
@@ -213,15 +238,6 @@ void rayGeneration()
     uint seed     = wang_hash((launchIndex.x + launchIndex.y * launchDim.x));
     uint randSeed = initRand(seed, gFrameCount, 32);
 
-    // Prepare shading data
-    ShadingDataCompact sd;
-    sd.posW = posW.xyz;
-    sd.V = normalize(gCamera.posW - posW.xyz);
-    unpackGBufPacked1(packed1, sd.N, sd.emissive);
-    unpackGBufPacked2(packed2, sd.diffuse, sd.opacity, sd.specular, sd.linearRoughness);
-    sd.roughness = sd.linearRoughness * sd.linearRoughness;
-    sd.NdotV = dot(sd.N, sd.V);
-
     // If this is an emissive surface we just return the emissive color
     bool isEmissive = any(sd.emissive);
     if (isEmissive)
@@ -239,9 +255,18 @@ void rayGeneration()
         // Sample indirect contribution
 #ifdef INDIRECT_SAMPLING_ENABLED
         const int RootNodeIndex = gMaxVPLs; // Root node index is always the maximum number of VPLs!
+#if defined(USE_GROUP_TRAVERSAL) && !defined(USE_UNIFORM_SAMPLING)
+        indirectColor = sampleVPLsGroup(sd, randSeed, RootNodeIndex, gVPLData, gVPLStats[0].numPaths, gVPLStats[0].numVPLs, gNumIndirectSamples);
+#else
         [unroll]
         for (int i = 0; i < gNumIndirectSamples; i++)
+        {
+#ifdef USE_BINNED_SHADOW_RAYS
+            gShadowRaySlot = shadowRayBase + i;
+#endif
             indirectColor += sampleVPLs(sd, randSeed, RootNodeIndex, gVPLData, gVPLStats[0].numPaths, gVPLStats[0].numVPLs);
+        }
+#endif
 #endif
 
 #ifdef ACCUMULATE_SAMPLES
@@ -256,11 +281,254 @@ void rayGeneration()
   }
 
   gAlbedo[launchIndex]   = float4(albedo, 1.f);
-  gCombined[launchIndex] = float4(directColor + indirectColor, 1.f);
   gDirect[launchIndex]   = float4(directColor, 1.f);
+#ifndef USE_BINNED_SHADOW_RAYS
+  // With binned shadow rays the indirect part is only known after resolveShadowRays(), see compositeShadowRays()
+  gCombined[launchIndex] = float4(directColor + indirectColor, 1.f);
   gIndirect[launchIndex] = float4(indirectColor, 1.f);
+#endif
+}
+
+/** Octant of the shadow ray direction, one bit per negative component. See getShadowRayOctantHost().
+*/
+uint getShadowRayOctant(in const float3 origin, in const float3 target)
+{
+  const float3 dir = target - origin;
+  return (dir.x < 0.f ? 1 : 0) | (dir.y < 0.f ? 2 : 0) | (dir.z < 0.f ? 4 : 0);
+}
+
+/** Bin of a shadow ray, the upper 32 bits of its sort key. See getShadowRayBinHost().
+*/
+uint getShadowRayBin(in const float3 origin, in const float3 target, in const int nodeIdx)
+{
+  if (SHADOW_RAY_BINNING == kShadowRayBinningNode)
+    return uint(nodeIdx);
+  else if (SHADOW_RAY_BINNING == kShadowRayBinningOctant)
+    return getShadowRayOctant(origin, target);
+  return 0;
+}
+
+/** Writes the shadow ray of a sample instead of tracing it, see USE_BINNED_SHADOW_RAYS.
+*/
+void writeShadowRay(in const uint slot, in const float3 origin, in const float3 target, in const float3 radiance, in const int nodeIdx)
+{
+  ShadowRayRecord record;
+  record.origin   = origin;
+  record.nodeIdx  = nodeIdx;
+  record.target   = target;
+  record.pad      = 0.f;
+  record.radiance = radiance;
+  record.pad2     = 0.f;
+  gShadowRays[slot]    = record;
+  gShadowRayKeys[slot] = (uint64_t(getShadowRayBin(origin, target, nodeIdx)) << 32) | slot;
+}
+
+/** Marks a record as a sample without shadow ray. Its key sorts behind all rays.
+*/
+void clearShadowRay(in const uint slot)
+{
+  ShadowRayRecord record;
+  record.origin   = float3(0.f);
+  record.nodeIdx  = -1;
+  record.target   = float3(0.f);
+  record.pad      = 0.f;
+  record.radiance = float3(0.f);
+  record.pad2     = 0.f;
+  gShadowRays[slot]    = record;
+  gShadowRayKeys[slot] = (uint64_t(kInvalidShadowRayBin) << 32) | slot;
+}
+
+/** Visibility pass of USE_BINNED_SHADOW_RAYS, launched once per record. Traces the shadow rays in the order of the
+    sorted keys, so neighbouring threads trace rays of the same bin. The radiance of occluded records is set to 0.
+*/
+[shader("raygeneration")]
+void resolveShadowRays()
+{
+  const uint64_t key = gShadowRayKeys[DispatchRaysIndex().x];
+  if (uint(key >> 32) == kInvalidShadowRayBin)
+    return; // Sample without a shadow ray, with binning all of them follow
+
+  const uint slot = uint(key & 0xFFFFFFFF);
+  const ShadowRayRecord record = gShadowRays[slot];
+  if (!(shootShadowRay(record.origin, record.target) > 0.f))
+    gShadowRays[slot].radiance = float3(0.f);
+}
+
+/** Last pass of USE_BINNED_SHADOW_RAYS, launched once per pixel. Sums the resolved records of the pixel and writes the
+    indirect and combined outputs like rayGeneration() does without binning.
+*/
+[shader("raygeneration")]
+void compositeShadowRays()
+{
+  const uint2 launchIndex = DispatchRaysIndex().xy;
+  const uint2 launchDim   = DispatchRaysDimensions().xy;
+
+  const uint shadowRayBase = (launchIndex.y * launchDim.x + launchIndex.x) * gNumIndirectSamples;
+  float3 indirectColor = float3(0.f);
+  for (int i = 0; i < gNumIndirectSamples; i++)
+    indirectColor += gShadowRays[shadowRayBase + i].radiance;
+
+#ifdef ACCUMULATE_SAMPLES
+  indirectColor /= max(gNumIndirectSamples, 1);
+  indirectColor = (gNumAccumulatedSamples * gIndirect[launchIndex].xyz + indirectColor) / (gNumAccumulatedSamples + 1);
+#endif
+
+  gCombined[launchIndex] = float4(gDirect[launchIndex].xyz + indirectColor, 1.f);
+  gIndirect[launchIndex] = float4(indirectColor, 1.f);
+}
+
+/** Loads the shading data of a pixel from the G-buffer.
+    Returns false if the pixel doesn't contain geometry (0 in pos.w).
+*/
+bool loadShadingData(in const uint2 pixel, out ShadingDataCompact sd)
+{
+  const float4 posW = gPosW[pixel];
+  sd.posW = posW.xyz;
+  sd.V = normalize(gCamera.posW - posW.xyz);
+  unpackGBufPacked1(gPacked1[pixel], sd.N, sd.emissive);
+  unpackGBufPacked2(gPacked2[pixel], sd.diffuse, sd.opacity, sd.specular, sd.linearRoughness);
+  sd.roughness = sd.linearRoughness * sd.linearRoughness;
+  sd.NdotV = dot(sd.N, sd.V);
+  return posW.w != 0.0f;
+}
+
+/** Pre-pass of USE_TILE_CUTS, launched once per screen tile. Builds a cut of the SST from one random representative
+    pixel per tile quadrant: the cut node the representatives reach with the highest probability is replaced by its
+    children until the cut is full. Leaves and early stop nodes are not split, so every traversal from the root passes
+    exactly one cut node. See buildTileCutHost(), keep both in sync!
+*/
+[shader("raygeneration")]
+void buildTileCuts()
+{
+  const uint2 tile     = DispatchRaysIndex().xy;
+  const uint2 numTiles = DispatchRaysDimensions().xy;
+  const uint  cutBase  = (tile.y * numTiles.x + tile.x) * kMaxTileCutNodes;
+
+  uint2 frameDim;
+  gPosW.GetDimensions(frameDim.x, frameDim.y);
+
+  uint randSeed = initRand(wang_hash(tile.x + tile.y * numTiles.x), gFrameCount, 32);
+
+  // Representatives, pixels without geometry and emissive surfaces don't sample the VPLs
+  const uint halfSize = TILE_CUT_SIZE / 2;
+  ShadingDataCompact reps[kTileCutRepresentatives];
+  uint numReps = 0;
+  for (uint i = 0; i < kTileCutRepresentatives; i++)
+  {
+    const uint2 offset = uint2(min(uint(nextRand(randSeed) * halfSize), halfSize - 1), min(uint(nextRand(randSeed) * halfSize), halfSize - 1));
+    const uint2 pixel  = tile * TILE_CUT_SIZE + uint2(i & 1, i >> 1) * halfSize + offset;
+    ShadingDataCompact sd;
+    if (all(pixel < frameDim) && loadShadingData(pixel, sd) && !any(sd.emissive))
+      reps[numReps++] = sd;
+  }
+
+  const int rootIdx = gMaxVPLs;
+  const int numVPLs = gVPLStats[0].numVPLs;
+
+  int   cutNode[kMaxTileCutNodes];
+  bool  cutSplittable[kMaxTileCutNodes];
+  float cutReach[kMaxTileCutNodes * kTileCutRepresentatives]; // Probability of the representatives to reach the node
+
+  uint numCut = 1;
+  const VPLData root = gVPLData[rootIdx];
+  cutNode[0] = rootIdx;
+  cutSplittable[0] = numReps > 0 && numVPLs > 0 && !(root.getEarlyStop() > 0.f) && root.numVPLSubTree > 0;
+  for (uint r = 0; r < numReps; r++) cutReach[r] = 1.f;
+
+  while (numCut < kMaxTileCutNodes)
+  {
+    // Split the node the representatives reach with the highest probability
+    int best = -1;
+    float bestReach = 0.f;
+    for (uint c = 0; c < numCut; c++)
+    {
+      if (!cutSplittable[c]) continue;
+      float reach = 0.f;
+      for (uint r = 0; r < numReps; r++) reach += cutReach[c * kTileCutRepresentatives + r];
+      if (reach > bestReach)
+      {
+        best = int(c);
+        bestReach = reach;
+      }
+    }
+    if (best < 0)
+      break;
+
+    const VPLData node   = gVPLData[cutNode[best]];
+    const VPLData child1 = gVPLData[node.idChild1];
+    const VPLData child2 = gVPLData[node.idChild2];
+
+    // Importance weights of the diffuse lobe, same terms as in sampleVPLTree()
+    for (uint r = 0; r < numReps; r++)
+    {
+      const float w1 = evalMaterial(reps[r], child1, 0, numVPLs, true, randSeed) * evalAttenuation(reps[r], child1) * child1.getIntensity();
+      const float w2 = evalMaterial(reps[r], child2, 0, numVPLs, true, randSeed) * evalAttenuation(reps[r], child2) * child2.getIntensity();
+      const float p1 = (w1 + w2 > 0) ? w1 / (w1 + w2) : 0.f;
+      const float p2 = (w1 + w2 > 0) ? 1.f - p1 : 0.f; // Dead branch for this representative
+      cutReach[numCut * kTileCutRepresentatives + r] = cutReach[best * kTileCutRepresentatives + r] * p2;
+      cutReach[best * kTileCutRepresentatives + r] *= p1;
+    }
+
+    cutNode[numCut] = node.idChild2;
+    cutSplittable[numCut] = !(child2.getEarlyStop() > 0.f) && child2.numVPLSubTree > 0;
+    cutNode[best] = node.idChild1;
+    cutSplittable[best] = !(child1.getEarlyStop() > 0.f) && child1.numVPLSubTree > 0;
+    numCut++;
+  }
+
+  float totalReach = 0.f;
+  for (uint c = 0; c < numCut; c++)
+    for (uint r = 0; r < numReps; r++) totalReach += cutReach[c * kTileCutRepresentatives + r];
+
+  // Mean reach probability mixed with a uniform share, so that every pixel of the tile can reach every VPL.
+  // The pdf is the difference of the stored cdf values, so it matches the binary search of sampleTileCut() exactly.
+  float cdf = 0.f;
+  for (uint c = 0; c < kMaxTileCutNodes; c++)
+  {
+    TileCutNode entry;
+    entry.pad = 0.f;
+    if (c < numCut)
+    {
+      float reach = 0.f;
+      for (uint r = 0; r < numReps; r++) reach += cutReach[c * kTileCutRepresentatives + r];
+
+      const float uniform = 1.f / float(numCut);
+      const float q = (totalReach > 0.f) ? (1.f - kTileCutUniformMix) * reach / totalReach + kTileCutUniformMix * uniform : uniform;
+      const float next = (c + 1 == numCut) ? 1.f : min(cdf + q, 1.f);
+      entry.nodeIdx = cutNode[c];
+      entry.pdf = next - cdf;
+      entry.cdf = next;
+      cdf = next;
+    }
+    else
+    {
+      entry.nodeIdx = -1;
+      entry.pdf = 0.f;
+      entry.cdf = 1.f;
+    }
+    gTileCuts[cutBase + c] = entry;
+  }
 }
 
+/** Selects a node of the cut of the tile of a pixel with probability TileCutNode::pdf. See sampleTileCutHost().
+*/
+TileCutNode sampleTileCut(in const uint2 pixel, in const uint2 frameDim, inout uint rand_seed)
+{
+  const uint numTilesX = (frameDim.x + TILE_CUT_SIZE - 1) / TILE_CUT_SIZE;
+  const uint cutBase   = ((pixel.y / TILE_CUT_SIZE) * numTilesX + pixel.x / TILE_CUT_SIZE) * kMaxTileCutNodes;
+  const float u = nextRand(rand_seed);
+
+  // First entry with cdf > u, the last used entry and all unused entries have cdf 1
+  uint lo = 0;
+  uint hi = kMaxTileCutNodes - 1;
+  while (lo < hi)
+  {
+    const uint mid = (lo + hi) / 2;
+    if (gTileCuts[cutBase + mid].cdf > u) hi = mid;
+    else lo = mid + 1;
+  }
+  return gTileCuts[cutBase + lo];
+}
 
 /** VPL sampling
 */
@@ -314,7 +582,14 @@ float3 sampleVPLTree(in const RWStructuredBuffer<VPLData> vplData, in const int
   float p = chooseDiffuse ? probDiffuse : (1.f - probDiffuse);
   float r = nextRand(rand_seed);
 
-  // Get root node.
+#ifdef USE_TILE_CUTS
+  // Start at a node of the cut of the screen tile instead of the root, the cut nodes partition the tree
+  const TileCutNode cutNode = sampleTileCut(DispatchRaysIndex().xy, DispatchRaysDimensions().xy, rand_seed);
+  parentIdx = cutNode.nodeIdx;
+  p *= cutNode.pdf;
+#endif
+
+  // Get root node, or the cut node with USE_TILE_CUTS.
   VPLData vpl1 = vplData[parentIdx];
 
   while (true)
@@ -381,15 +656,168 @@ float3 sampleVPLTree(in const RWStructuredBuffer<VPLData> vplData, in const int
   const float3 samplePosW = normalPointOnPlane(vpl.getNormW(), vpl.getPosW(), vpl.getVariance(), vpl.getAABBMin(), vpl.getAABBMax(), rand_seed);
   VPLLightSample ls = evalVPL(samplePosW, vpl.getNormW(), vpl.getColor(), sd);
 
+#ifdef USE_BINNED_SHADOW_RAYS
+  // Only write the ray, resolveShadowRays() traces it after binning and compositeShadowRays() adds the contribution
+  const float3 radiance = (p > 0.f) ? evalVPL(ls, sd, gGMax, chooseDiffuse).rgb / p : float3(0.f);
+  if (any(radiance > 0.f))
+    writeShadowRay(gShadowRaySlot, ls.posW, sd.posW, radiance, parentIdx);
+  return float3(0.f);
+#else
   float visible = shootShadowRay(ls.posW, sd.posW);
   return (p > 0.f && visible > 0.f) ? evalVPL(ls, sd, gGMax, chooseDiffuse).rgb / p : float3(0.f);
+#endif
+}
+
+/** Grouped VPL sampling. Takes numSamples samples from the SST in groups of at most MAX_GROUP_SAMPLES.
+    Returns the sum of all samples like numSamples calls of sampleVPLs().
+*/
+float3 sampleVPLsGroup(in const ShadingDataCompact sd, inout uint randSeed, in const int rootNodeIdx, in const RWStructuredBuffer<VPLData> vplData, in const int numPaths, in const int numLeafs, in const int numSamples)
+{
+  if (numLeafs <= 0) return float3(0.f);
+
+  float3 value = float3(0.f);
+  for (int s = 0; s < numSamples; s += MAX_GROUP_SAMPLES)
+    value += sampleVPLTreeGroup(vplData, rootNodeIdx, numLeafs, numPaths, sd, min(MAX_GROUP_SAMPLES, numSamples - s), randSeed);
+  return value;
+}
+
+/** Splits n samples between two children, stratified so that E[n1] = n * p1. Returns the number of samples of the first child.
+*/
+uint splitSamples(in const uint n, in const float p1, inout uint rand_seed)
+{
+  return min(n, (uint)(n * p1 + nextRand(rand_seed)));
+}
+
+/** Sample numSamples VPLs from SST that descend the tree as one group.
+    The children of a node are evaluated once for the whole group and the samples are split between them, every sample keeps the
+    probability of its own path. Upper levels are shared by all samples of a pixel instead of being evaluated once per sample.
+    See sampleVPLTreeGroupHost(), keep both in sync!
+*/
+float3 sampleVPLTreeGroup(in const RWStructuredBuffer<VPLData> vplData, in const int rootIndex, in const int numVPLs, in const int numPaths, in ShadingDataCompact sd, in const uint numSamples, inout uint rand_seed)
+{
+#if defined(USE_INDIRECT_GGX)
+  const float probDiffuse = probabilityToSampleDiffuse(sd.diffuse, sd.specular);
+  const uint numDiffuse   = splitSamples(numSamples, probDiffuse, rand_seed);
+#else
+  const float probDiffuse = 1.f;
+  const uint numDiffuse   = numSamples;
+#endif
+
+  float3 value = float3(0.f);
+  if (numDiffuse > 0)
+    value += sampleVPLTreeGroupLobe(vplData, rootIndex, numVPLs, sd, numDiffuse, true, probDiffuse, rand_seed);
+  if (numSamples > numDiffuse)
+    value += sampleVPLTreeGroupLobe(vplData, rootIndex, numVPLs, sd, numSamples - numDiffuse, false, 1.f - probDiffuse, rand_seed);
+  return value;
+}
+
+float3 sampleVPLTreeGroupLobe(in const RWStructuredBuffer<VPLData> vplData, in const int rootIndex, in const int numVPLs, in ShadingDataCompact sd, in const uint numSamples, in const bool chooseDiffuse, in const float pLobe, inout uint rand_seed)
+{
+  // Groups that still have to descend. Every group holds at least one sample.
+  int   stackNode[MAX_GROUP_SAMPLES];
+  int   stackDepth[MAX_GROUP_SAMPLES];
+  uint  stackCount[MAX_GROUP_SAMPLES];
+  float stackP[MAX_GROUP_SAMPLES];
+  int   stackSize = 0;
+
+  // Current group
+  int   parentIdx = rootIndex;
+  int   currentDepth = 0;
+  uint  count = numSamples;
+  float p = pLobe;
+
+  float3 value = float3(0.f);
+  VPLData vpl1 = vplData[parentIdx];
+
+  while (true)
+  {
+    bool finished = true;
+
+    // Approximation good enough? Or did we reach a leaf node?
+    if ((vpl1.getEarlyStop() > 0.f && chooseDiffuse) || vpl1.numVPLSubTree <= 0)
+    {
+      for (uint s = 0; s < count; s++)
+      {
+        const float3 samplePosW = normalPointOnPlane(vpl1.getNormW(), vpl1.getPosW(), vpl1.getVariance(), vpl1.getAABBMin(), vpl1.getAABBMax(), rand_seed);
+        VPLLightSample ls = evalVPL(samplePosW, vpl1.getNormW(), vpl1.getColor(), sd);
+
+        float visible = shootShadowRay(ls.posW, sd.posW);
+        value += (p > 0.f && visible > 0.f) ? evalVPL(ls, sd, gGMax, chooseDiffuse).rgb / p : float3(0.f);
+      }
+    }
+    else
+    {
+      // Get child nodes
+      const int child1Id = vpl1.idChild1;
+      const int child2Id = vpl1.idChild2;
+
+      vpl1 = vplData[child1Id];
+      VPLData vpl2 = vplData[child2Id];
+
+      // Importance weights, same terms as in sampleVPLTree()
+      const float w1 = evalMaterial(sd, vpl1, currentDepth, numVPLs, chooseDiffuse, rand_seed) * evalAttenuation(sd, vpl1) * vpl1.getIntensity();
+      const float w2 = evalMaterial(sd, vpl2, currentDepth, numVPLs, chooseDiffuse, rand_seed) * evalAttenuation(sd, vpl2) * vpl2.getIntensity();
+
+      // Split the group, a dead branch ends all of its samples
+      if (w1 + w2 > 0)
+      {
+        const float p1 = w1 / (w1 + w2);
+        const uint n1 = splitSamples(count, p1, rand_seed);
+        currentDepth++;
+
+        if (n1 > 0 && n1 < count)
+        {
+          stackNode[stackSize]  = child2Id;
+          stackDepth[stackSize] = currentDepth;
+          stackCount[stackSize] = count - n1;
+          stackP[stackSize]     = p * (1.f - p1);
+          stackSize++;
+        }
+
+        if (n1 > 0)
+        {
+          p = p * p1;
+          count = n1;
+          parentIdx = child1Id;
+        }
+        else
+        {
+          p = p * (1.f - p1);
+          parentIdx = child2Id;
+          vpl1 = vpl2;
+        }
+        finished = false;
+      }
+    }
+
+    if (finished)
+    {
+      if (stackSize == 0)
+        break;
+
+      stackSize--;
+      parentIdx    = stackNode[stackSize];
+      currentDepth = stackDepth[stackSize];
+      count        = stackCount[stackSize];
+      p            = stackP[stackSize];
+      vpl1 = vplData[parentIdx];
+    }
+  }
+
+  return value;
 }
 
 float evalMaterial(in ShadingDataCompact sd, in VPLData vpl, in int depth, in int vplNum, in bool chooseDiffuse, inout uint randSeed)
 {
     VPLLightSample ls = evalVPL(vpl, sd);
     const float brdf = evalBrdf(sd, ls, vpl, chooseDiffuse, depth, vplNum, randSeed);
+#ifdef USE_ORIENTATION_CONES
+    // Subtrees that face away from the shading point get probability 0
+    const float emitterCos = maxEmitterCosCone(sd.posW, vpl.getNormW(), vpl.getConeAngle(), vpl.getAABBMin(), vpl.getAABBMax());
+    return brdf * maxNdotAABB(sd.posW, sd.N, vpl.getAABBMin(), vpl.getAABBMax()) * emitterCos;
+#else
     return brdf * maxNdotAABB(sd.posW, sd.N, vpl.getAABBMin(), vpl.getAABBMax());
+#endif
 }
 
 float evalAttenuation(in ShadingDataCompact sd, in VPLData vpl)
@@ -0,0 +1,36 @@
+#include "HostDeviceSharedMacros.h"
+#include "HostDeviceData.h"
+
+#include "Passes/Shared/VPLData.h"
+
+
+RWStructuredBuffer<VPLData>    gVPLData;
+RWStructuredBuffer<float3>     gVPLPositions;
+RWStructuredBuffer<VPLStats>   gVPLStats;
+StructuredBuffer<VPLData>      gVPLPool;
+StructuredBuffer<VPLSlotTag>   gVPLPoolTags;
+
+cbuffer CB
+{
+    uint gNumSlots;
+    int  gNumPaths;
+}
+
+// Copies the occupied slots of the persistent VPL pool to the front of gVPLData, like the ids handed out by getNextID().
+// Runs after resetVPLs, every path of the pool counts towards numPaths regardless of when it was traced.
+[numthreads(256, 1, 1)]
+void compactVPLPool(uint3 DTid : SV_DispatchThreadID)
+{
+    if (DTid.x >= gNumSlots) return;
+    if (DTid.x == 0) gVPLStats[0].numPaths = gNumPaths;
+
+    if (gVPLPoolTags[DTid.x].pathId < 0) return;
+
+    int id = 0;
+    InterlockedAdd(gVPLStats[0].numVPLs, 1, id);
+
+    VPLData vpl = gVPLPool[DTid.x];
+    vpl.id = id;
+    gVPLData[id] = vpl;
+    gVPLPositions[id] = vpl.getPosW();
+}
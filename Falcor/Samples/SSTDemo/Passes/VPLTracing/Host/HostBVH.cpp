@@ -0,0 +1,323 @@
+// Binned SAH triangle BVH for host ray casts, see HostBVH.h
+
+#include "HostBVH.h"
+#include "../../VPLTree/Host/HostUtils.h"
+
+namespace
+{
+    const uint32_t kNumBins = 16;
+    const uint32_t kMaxDepth = 64;     // Size of the traversal stack. Deeper nodes are turned into leaves.
+
+    /** Bounds and triangle count of a bin.
+    */
+    struct Bin
+    {
+        float3 aabbMin = float3(FLT_MAX);
+        float3 aabbMax = float3(-FLT_MAX);
+        uint32_t count = 0;
+
+        void add(const float3& itemMin, const float3& itemMax, uint32_t itemCount)
+        {
+            aabbMin = min(aabbMin, itemMin);
+            aabbMax = max(aabbMax, itemMax);
+            count += itemCount;
+        }
+
+        float halfArea() const
+        {
+            const float3 d = aabbMax - aabbMin;
+            return d.x * d.y + d.y * d.z + d.z * d.x;
+        }
+    };
+
+    inline float maxComponent(const float3& v) { return std::max(v.x, std::max(v.y, v.z)); }
+    inline float minComponent(const float3& v) { return std::min(v.x, std::min(v.y, v.z)); }
+
+    /** Slab test. Returns the entry distance or FLT_MAX if the box is missed.
+    */
+    inline float intersectAABB(const float3& aabbMin, const float3& aabbMax, const float3& origin, const float3& invDir, float tMin, float tMax)
+    {
+        const float3 t0 = (aabbMin - origin) * invDir;
+        const float3 t1 = (aabbMax - origin) * invDir;
+        const float tNear = std::max(maxComponent(min(t0, t1)), tMin);
+        const float tFar  = std::min(minComponent(max(t0, t1)), tMax);
+        return tNear <= tFar ? tNear : FLT_MAX;
+    }
+}
+
+HostBVH::SharedPtr HostBVH::create()
+{
+    return SharedPtr(new HostBVH());
+}
+
+void HostBVH::build(const std::vector<float3>& positions, uint32_t maxLeafSize)
+{
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+
+    const uint32_t numTriangles = (uint32_t)(positions.size() / 3);
+    mMaxLeafSize = std::max(1u, maxLeafSize);
+    mDepth = 0;
+    mNodes.clear();
+    mItems.resize(numTriangles);
+    mTriangles.resize(numTriangles);
+    mTriIndices.resize(numTriangles);
+
+    if (numTriangles == 0)
+    {
+        mBuildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+        return;
+    }
+
+    parallelFor(0, numTriangles, [&](size_t i)
+    {
+        const float3& p0 = positions[3 * i + 0];
+        const float3& p1 = positions[3 * i + 1];
+        const float3& p2 = positions[3 * i + 2];
+
+        Item& item = mItems[i];
+        item.aabbMin  = min(p0, min(p1, p2));
+        item.aabbMax  = max(p0, max(p1, p2));
+        item.centroid = (item.aabbMin + item.aabbMax) * 0.5f;
+        item.triIdx   = (uint32_t)i;
+    });
+
+    // Split the top of the tree serially until there are enough subtrees for all threads.
+    mMaxTaskSize = std::max<size_t>(4096, (size_t)numTriangles / (8 * getNumHostThreads()));
+    std::vector<Task> tasks;
+    mNodes.resize(1);
+    split(mNodes, 0, 0, numTriangles, 0, &tasks, mDepth);
+
+    // Every task builds its subtree into its own node array with the subtree root at index 0.
+    std::vector<std::vector<Node>> taskNodes(tasks.size());
+    std::vector<uint32_t> taskDepth(tasks.size(), 0);
+    parallelForChunks(tasks.size(), [&](size_t t, uint32_t)
+    {
+        const Task& task = tasks[t];
+        taskNodes[t].resize(1);
+        split(taskNodes[t], 0, task.begin, task.end, task.depth, nullptr, taskDepth[t]);
+    });
+
+    // Append the subtrees in task order, so the layout does not depend on the thread timing.
+    // Node i > 0 of a subtree is moved to base + i - 1, its root replaces the placeholder node of the task.
+    for (size_t t = 0; t < tasks.size(); t++)
+    {
+        const uint32_t base = (uint32_t)mNodes.size();
+        auto remap = [base](Node node)
+        {
+            if (node.count == 0) node.index = base + node.index - 1;
+            return node;
+        };
+
+        const std::vector<Node>& nodes = taskNodes[t];
+        mNodes[tasks[t].nodeIdx] = remap(nodes[0]);
+        for (size_t i = 1; i < nodes.size(); i++)
+            mNodes.push_back(remap(nodes[i]));
+        mDepth = std::max(mDepth, taskDepth[t]);
+    }
+
+    // Store the triangles in leaf order
+    parallelFor(0, numTriangles, [&](size_t i)
+    {
+        const uint32_t triIdx = mItems[i].triIdx;
+        const float3& p0 = positions[3 * triIdx + 0];
+        mTriIndices[i] = triIdx;
+        mTriangles[i].v0 = p0;
+        mTriangles[i].e1 = positions[3 * triIdx + 1] - p0;
+        mTriangles[i].e2 = positions[3 * triIdx + 2] - p0;
+    });
+
+    mItems.clear();
+    mItems.shrink_to_fit();
+
+    mBuildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+}
+
+void HostBVH::split(std::vector<Node>& nodes, uint32_t nodeIdx, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Task>* pTasks, uint32_t& maxDepth)
+{
+    maxDepth = std::max(maxDepth, depth);
+
+    float3 aabbMin(FLT_MAX), aabbMax(-FLT_MAX);
+    float3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+    for (uint32_t i = begin; i < end; i++)
+    {
+        aabbMin = min(aabbMin, mItems[i].aabbMin);
+        aabbMax = max(aabbMax, mItems[i].aabbMax);
+        centroidMin = min(centroidMin, mItems[i].centroid);
+        centroidMax = max(centroidMax, mItems[i].centroid);
+    }
+    nodes[nodeIdx].aabbMin = aabbMin;
+    nodes[nodeIdx].aabbMax = aabbMax;
+
+    if (end - begin <= mMaxLeafSize || depth + 1 >= kMaxDepth)
+    {
+        nodes[nodeIdx].index = begin;
+        nodes[nodeIdx].count = end - begin;
+        return;
+    }
+
+    if (pTasks && end - begin <= mMaxTaskSize)
+    {
+        nodes[nodeIdx].count = 0;
+        pTasks->push_back({ begin, end, nodeIdx, depth });
+        return;
+    }
+
+    const uint32_t mid = partition(begin, end, centroidMin, centroidMax, aabbMin, aabbMax);
+
+    // Children are allocated in pairs. The array may grow, so no references are kept across the recursion.
+    const uint32_t childIdx = (uint32_t)nodes.size();
+    nodes.resize(childIdx + 2);
+    nodes[nodeIdx].index = childIdx;
+    nodes[nodeIdx].count = 0;
+
+    split(nodes, childIdx, begin, mid, depth + 1, pTasks, maxDepth);
+    split(nodes, childIdx + 1, mid, end, depth + 1, pTasks, maxDepth);
+}
+
+uint32_t HostBVH::partition(uint32_t begin, uint32_t end, const float3& centroidMin, const float3& centroidMax, const float3& aabbMin, const float3& aabbMax)
+{
+    float bestCost = FLT_MAX;
+    uint32_t bestAxis = 3;
+    uint32_t bestBin = 0;
+
+    // Bin the centroids along every axis and sweep the split planes
+    for (uint32_t a = 0; a < 3; a++)
+    {
+        const float extent = centroidMax[a] - centroidMin[a];
+        if (!(extent > 0.f))
+            continue;
+        const float scale = (float)kNumBins / extent;
+
+        Bin bins[kNumBins];
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const Item& item = mItems[i];
+            const uint32_t b = std::min((uint32_t)((item.centroid[a] - centroidMin[a]) * scale), kNumBins - 1);
+            bins[b].add(item.aabbMin, item.aabbMax, 1);
+        }
+
+        float rightCost[kNumBins];
+        Bin right;
+        for (uint32_t b = kNumBins - 1; b > 0; b--)
+        {
+            right.add(bins[b].aabbMin, bins[b].aabbMax, bins[b].count);
+            rightCost[b] = right.count > 0 ? right.halfArea() * right.count : FLT_MAX;
+        }
+
+        Bin left;
+        for (uint32_t b = 0; b + 1 < kNumBins; b++)
+        {
+            left.add(bins[b].aabbMin, bins[b].aabbMax, bins[b].count);
+            if (left.count == 0 || left.count == end - begin)
+                continue;
+            const float cost = left.halfArea() * left.count + rightCost[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = a;
+                bestBin = b;
+            }
+        }
+    }
+
+    if (bestAxis < 3)
+    {
+        const float scale = (float)kNumBins / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+        auto it = std::partition(mItems.begin() + begin, mItems.begin() + end, [&](const Item& item)
+        {
+            return std::min((uint32_t)((item.centroid[bestAxis] - centroidMin[bestAxis]) * scale), kNumBins - 1) <= bestBin;
+        });
+        return (uint32_t)(it - mItems.begin());
+    }
+
+    // All centroids are the same, split in the middle.
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(mItems.begin() + begin, mItems.begin() + mid, mItems.begin() + end, [](const Item& a, const Item& b) { return a.triIdx < b.triIdx; });
+    return mid;
+}
+
+bool HostBVH::intersect(const float3& origin, const float3& dir, float tMin, float tMax, Hit& hit) const
+{
+    hit = Hit();
+    if (mNodes.empty())
+        return false;
+
+    const float3 invDir = float3(1.f / dir.x, 1.f / dir.y, 1.f / dir.z);
+    float tClosest = tMax;
+    uint32_t hitIdx = 0xFFFFFFFF;
+
+    uint32_t stack[kMaxDepth];
+    uint32_t stackSize = 0;
+    uint32_t nodeIdx = 0;
+
+    while (true)
+    {
+        const Node& node = mNodes[nodeIdx];
+        if (node.count > 0)
+        {
+            // Moeller-Trumbore, both faces
+            for (uint32_t i = node.index; i < node.index + node.count; i++)
+            {
+                const Triangle& tri = mTriangles[i];
+                const float3 p = cross(dir, tri.e2);
+                const float det = dot(tri.e1, p);
+                if (det == 0.f)
+                    continue;
+                const float invDet = 1.f / det;
+
+                const float3 s = origin - tri.v0;
+                const float u = dot(s, p) * invDet;
+                if (u < 0.f || u > 1.f)
+                    continue;
+
+                const float3 q = cross(s, tri.e1);
+                const float v = dot(dir, q) * invDet;
+                if (v < 0.f || u + v > 1.f)
+                    continue;
+
+                const float t = dot(tri.e2, q) * invDet;
+                if (t >= tMin && t < tClosest)
+                {
+                    tClosest = t;
+                    hitIdx = i;
+                    hit.u = u;
+                    hit.v = v;
+                }
+            }
+        }
+        else
+        {
+            // Visit the closer child first
+            const float tLeft  = intersectAABB(mNodes[node.index].aabbMin, mNodes[node.index].aabbMax, origin, invDir, tMin, tClosest);
+            const float tRight = intersectAABB(mNodes[node.index + 1].aabbMin, mNodes[node.index + 1].aabbMax, origin, invDir, tMin, tClosest);
+            if (tLeft != FLT_MAX && tRight != FLT_MAX)
+            {
+                const bool leftFirst = tLeft <= tRight;
+                stack[stackSize++] = leftFirst ? node.index + 1 : node.index;
+                nodeIdx = leftFirst ? node.index : node.index + 1;
+                continue;
+            }
+            if (tLeft != FLT_MAX)
+            {
+                nodeIdx = node.index;
+                continue;
+            }
+            if (tRight != FLT_MAX)
+            {
+                nodeIdx = node.index + 1;
+                continue;
+            }
+        }
+
+        if (stackSize == 0)
+            break;
+        nodeIdx = stack[--stackSize];
+    }
+
+    if (hitIdx == 0xFFFFFFFF)
+        return false;
+
+    hit.t = tClosest;
+    hit.triangle = mTriIndices[hitIdx];
+    return true;
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Falcor.h"
+
+using namespace Falcor;
+
+
+/** Triangle BVH for ray casts on the host.
+    Binned SAH build, the top of the tree is split serially and the subtrees are built on all threads.
+    The build only depends on the input, so two builds of the same triangles are identical.
+    Nodes are 32 bytes, the two children of a node are stored next to each other.
+*/
+class HostBVH : public std::enable_shared_from_this<HostBVH>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostBVH>;
+    using SharedConstPtr = std::shared_ptr<const HostBVH>;
+    virtual ~HostBVH() = default;
+
+    struct Node
+    {
+        float3 aabbMin;
+        uint32_t index;     ///< Internal node: index of the left child, the right child is at index + 1. Leaf: first triangle.
+        float3 aabbMax;
+        uint32_t count;     ///< Number of triangles, 0 for internal nodes.
+    };
+
+    /** Closest hit of a ray.
+    */
+    struct Hit
+    {
+        float t = FLT_MAX;
+        uint32_t triangle = 0xFFFFFFFF;     ///< Index of the triangle in the input.
+        float u = 0.f;                      ///< Barycentric coordinate of the second vertex.
+        float v = 0.f;                      ///< Barycentric coordinate of the third vertex.
+
+        bool isValid() const { return triangle != 0xFFFFFFFF; }
+    };
+
+    /** Create a new (empty) BVH.
+    */
+    static SharedPtr create();
+
+    /** Builds the BVH.
+        \param[in] positions Vertex positions, 3 per triangle.
+        \param[in] maxLeafSize Maximum number of triangles per leaf.
+    */
+    void build(const std::vector<float3>& positions, uint32_t maxLeafSize = 4);
+
+    /** Finds the closest hit in [tMin, tMax). Back faces are not culled, like the VPL rays in VPLTracing.rt.hlsl.
+        Thread-safe.
+        \return True if a triangle was hit.
+    */
+    bool intersect(const float3& origin, const float3& dir, float tMin, float tMax, Hit& hit) const;
+
+    const std::vector<Node>& getNodes() const { return mNodes; }
+    uint32_t getTriangleCount() const { return (uint32_t)mTriIndices.size(); }
+    uint32_t getDepth() const { return mDepth; }
+    float getBuildTime() const { return mBuildTime; }
+
+protected:
+    HostBVH() = default;
+
+    /** Triangle as seen by the split search.
+    */
+    struct Item
+    {
+        float3 aabbMin;
+        float3 aabbMax;
+        float3 centroid;
+        uint32_t triIdx;
+    };
+
+    /** Subtree that is built on a worker thread.
+    */
+    struct Task
+    {
+        uint32_t begin;
+        uint32_t end;
+        uint32_t nodeIdx;
+        uint32_t depth;
+    };
+
+    /** Vertex and edges of a triangle in leaf order.
+    */
+    struct Triangle
+    {
+        float3 v0;
+        float3 e1;
+        float3 e2;
+    };
+
+    void split(std::vector<Node>& nodes, uint32_t nodeIdx, uint32_t begin, uint32_t end, uint32_t depth, std::vector<Task>* pTasks, uint32_t& maxDepth);
+    uint32_t partition(uint32_t begin, uint32_t end, const float3& centroidMin, const float3& centroidMax, const float3& aabbMin, const float3& aabbMax);
+
+    uint32_t mMaxLeafSize = 4;
+    size_t mMaxTaskSize = 0;
+    uint32_t mDepth = 0;
+
+    std::vector<Item> mItems;
+    std::vector<Node> mNodes;               ///< Root at index 0.
+    std::vector<Triangle> mTriangles;       ///< Triangles in leaf order.
+    std::vector<uint32_t> mTriIndices;      ///< Input index of every triangle in leaf order.
+    float mBuildTime = 0.f;
+};
@@ -0,0 +1,745 @@
+// Distributed VPL bake with local worker processes, see HostDistributedBake.h
+
+#include "HostDistributedBake.h"
+#include <fstream>
+#include <thread>
+#include "../../VPLTree/Host/HostMerge.h"
+#include "../../VPLTree/Host/HostTreeCache.h"
+#include "../../VPLTree/Host/HostTreeValidation.h"
+#include "../../VPLTree/Host/HostOutOfCoreBuilder.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    const uint32_t kPipeBufferSize = 1 << 20;
+    const size_t kMaxPipeTransfer = 1 << 24;        // Bytes per read or write call
+
+    struct HostSceneHeader
+    {
+        uint32_t magic = kHostSceneMagic;
+        uint32_t version = kHostSceneVersion;
+        uint32_t numTriangles = 0;
+        uint32_t numEmitters = 0;
+    };
+
+    /** Work of one worker process, passed hex encoded on the command line. Both sides are the same executable.
+    */
+    struct WorkerJob
+    {
+        HostVPLTracer::Desc tracerDesc;     ///< Path range of the worker.
+        uint32_t workerIdx = 0;
+        uint32_t numSphereSections = 3;
+        uint3 mortonBits = uint3(10);
+        TreeApproxParams approxParams;
+        uint32_t useTightBounds = 1;
+        uint32_t force128BitCodes = 0;
+        uint32_t useSimd = 1;
+        uint32_t deterministic = 0;
+    };
+
+    /** Sent by a worker in front of its tree: numVPLs leaves, then the numVPLs - 1 internal nodes starting at maxVPLs.
+    */
+    struct WorkerTreeHeader
+    {
+        uint32_t magic = kWorkerTreeMagic;
+        uint32_t workerIdx = 0;
+        int32_t pathOffset = 0;
+        int32_t numPaths = 0;               ///< Paths the radiance was divided by.
+        int32_t numVPLs = 0;
+        int32_t maxVPLs = 0;                ///< Capacity of the local tree, the root is at maxVPLs.
+        VPLMerge rootMerge;
+        float traceTime = 0.f;
+        float buildTime = 0.f;
+    };
+
+#if defined(_WIN32)
+    using ProcessHandle = HANDLE;
+    using PipeHandle = HANDLE;
+    const ProcessHandle kInvalidProcess = nullptr;
+    const PipeHandle kInvalidPipe = nullptr;
+#else
+    using ProcessHandle = pid_t;
+    using PipeHandle = int;
+    const ProcessHandle kInvalidProcess = -1;
+    const PipeHandle kInvalidPipe = -1;
+#endif
+
+    /** Worker process and the read end of the pipe it writes its tree to.
+    */
+    struct WorkerProcess
+    {
+        ProcessHandle process = kInvalidProcess;
+        PipeHandle pipe = kInvalidPipe;
+        WorkerTreeHeader header;
+        int leafBase = 0;                   ///< Index of the first leaf in the merged tree.
+        int nodeBase = 0;                   ///< Index of the first internal node in the merged tree.
+        bool valid = false;
+    };
+
+    VPLData getInvalidRecord()
+    {
+        VPLData vpl = {};
+        vpl.id = -1;
+        vpl.idChild1 = -1;
+        vpl.idChild2 = -1;
+        vpl.numVPLSubTree = 0;
+        return vpl;
+    }
+
+    inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    std::string encodeHex(const void* pData, size_t size)
+    {
+        static const char kDigits[] = "0123456789abcdef";
+        const uint8_t* pBytes = (const uint8_t*)pData;
+        std::string hex(2 * size, '0');
+        for (size_t i = 0; i < size; i++)
+        {
+            hex[2 * i]     = kDigits[pBytes[i] >> 4];
+            hex[2 * i + 1] = kDigits[pBytes[i] & 0xF];
+        }
+        return hex;
+    }
+
+    bool decodeHex(const std::string& hex, void* pData, size_t size)
+    {
+        if (hex.size() != 2 * size)
+            return false;
+        auto digit = [](char c) { return c >= '0' && c <= '9' ? c - '0' : c >= 'a' && c <= 'f' ? c - 'a' + 10 : -1; };
+        uint8_t* pBytes = (uint8_t*)pData;
+        for (size_t i = 0; i < size; i++)
+        {
+            const int hi = digit(hex[2 * i]);
+            const int lo = digit(hex[2 * i + 1]);
+            if (hi < 0 || lo < 0)
+                return false;
+            pBytes[i] = (uint8_t)(hi << 4 | lo);
+        }
+        return true;
+    }
+
+    std::string getExecutablePath()
+    {
+#if defined(_WIN32)
+        char path[MAX_PATH];
+        const DWORD length = GetModuleFileNameA(nullptr, path, MAX_PATH);
+        return length > 0 && length < MAX_PATH ? std::string(path, length) : std::string();
+#else
+        char path[4096];
+        const ssize_t length = readlink("/proc/self/exe", path, sizeof(path));
+        return length > 0 && length < (ssize_t)sizeof(path) ? std::string(path, (size_t)length) : std::string();
+#endif
+    }
+
+    bool writePipe(PipeHandle pipe, const void* pData, size_t size)
+    {
+        const char* pBytes = (const char*)pData;
+        while (size > 0)
+        {
+            const size_t count = std::min(size, kMaxPipeTransfer);
+#if defined(_WIN32)
+            DWORD written = 0;
+            if (!WriteFile(pipe, pBytes, (DWORD)count, &written, nullptr) || written == 0)
+                return false;
+#else
+            const ssize_t written = write(pipe, pBytes, count);
+            if (written <= 0)
+                return false;
+#endif
+            pBytes += written;
+            size -= (size_t)written;
+        }
+        return true;
+    }
+
+    /** Reads exactly size bytes.
+        \return False if the pipe was closed before, e.g. because the worker failed.
+    */
+    bool readPipe(PipeHandle pipe, void* pData, size_t size)
+    {
+        char* pBytes = (char*)pData;
+        while (size > 0)
+        {
+            const size_t count = std::min(size, kMaxPipeTransfer);
+#if defined(_WIN32)
+            DWORD read = 0;
+            if (!ReadFile(pipe, pBytes, (DWORD)count, &read, nullptr) || read == 0)
+                return false;
+#else
+            const ssize_t read = ::read(pipe, pBytes, count);
+            if (read <= 0)
+                return false;
+#endif
+            pBytes += read;
+            size -= (size_t)read;
+        }
+        return true;
+    }
+
+    void closePipe(PipeHandle& pipe)
+    {
+        if (pipe == kInvalidPipe)
+            return;
+#if defined(_WIN32)
+        CloseHandle(pipe);
+#else
+        close(pipe);
+#endif
+        pipe = kInvalidPipe;
+    }
+
+    /** Starts "executable -vplWorker <pipe> arguments" with an inherited write end of a new pipe.
+        Workers are started one after another and the write end is closed here right after the start,
+        so no other worker inherits it and the pipe breaks when its worker exits.
+    */
+    bool startWorker(const std::string& executable, const std::vector<std::string>& arguments, WorkerProcess& worker)
+    {
+#if defined(_WIN32)
+        SECURITY_ATTRIBUTES attributes = { sizeof(SECURITY_ATTRIBUTES), nullptr, TRUE };
+        HANDLE readPipe = nullptr;
+        HANDLE writePipe = nullptr;
+        if (!CreatePipe(&readPipe, &writePipe, &attributes, kPipeBufferSize))
+            return false;
+        SetHandleInformation(readPipe, HANDLE_FLAG_INHERIT, 0);
+
+        std::string commandLine = "\"" + executable + "\" -vplWorker " + std::to_string((uint64_t)(uintptr_t)writePipe);
+        for (const std::string& argument : arguments)
+            commandLine += " " + argument;
+
+        STARTUPINFOA startupInfo = {};
+        startupInfo.cb = sizeof(STARTUPINFOA);
+        PROCESS_INFORMATION processInfo = {};
+        const BOOL started = CreateProcessA(nullptr, &commandLine[0], nullptr, nullptr, TRUE, CREATE_NO_WINDOW, nullptr, nullptr, &startupInfo, &processInfo);
+        CloseHandle(writePipe);
+        if (!started)
+        {
+            CloseHandle(readPipe);
+            return false;
+        }
+        CloseHandle(processInfo.hThread);
+        worker.process = processInfo.hProcess;
+        worker.pipe = readPipe;
+        return true;
+#else
+        int fds[2];
+        if (pipe(fds) != 0)
+            return false;
+        fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+
+        std::vector<std::string> argv = { executable, "-vplWorker", std::to_string(fds[1]) };
+        argv.insert(argv.end(), arguments.begin(), arguments.end());
+        std::vector<char*> pArgv;
+        for (std::string& argument : argv) pArgv.push_back(&argument[0]);
+        pArgv.push_back(nullptr);
+
+        const pid_t pid = fork();
+        if (pid == 0)
+        {
+            execv(executable.c_str(), pArgv.data());
+            _exit(127);
+        }
+        close(fds[1]);
+        if (pid < 0)
+        {
+            close(fds[0]);
+            return false;
+        }
+        worker.process = pid;
+        worker.pipe = fds[0];
+        return true;
+#endif
+    }
+
+    /** Waits for the worker to exit. Kills it first if terminate is set.
+        \return True if the worker exited with code 0.
+    */
+    bool finishWorker(WorkerProcess& worker, bool terminate)
+    {
+        if (worker.process == kInvalidProcess)
+            return false;
+        bool success = false;
+#if defined(_WIN32)
+        if (terminate) TerminateProcess(worker.process, 1);
+        WaitForSingleObject(worker.process, INFINITE);
+        DWORD exitCode = 1;
+        success = GetExitCodeProcess(worker.process, &exitCode) && exitCode == 0;
+        CloseHandle(worker.process);
+#else
+        if (terminate) kill(worker.process, SIGKILL);
+        int status = 0;
+        success = waitpid(worker.process, &status, 0) == worker.process && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+#endif
+        worker.process = kInvalidProcess;
+        return success;
+    }
+
+    /** Builds the top-level tree over the worker roots in pre-order, so the root ends up at maxVPLs.
+        Workers are overlapping samples of the whole scene, so they are split in the middle.
+    */
+    void buildTopLevelNode(const std::vector<uint32_t>& roots, const std::vector<WorkerProcess>& workers, uint32_t first, uint32_t last,
+        const TreeApproxParams& approxParams, int maxVPLs, int& nextTopIdx, std::vector<VPLData>& vplData, VPLData& node, VPLMerge& merge)
+    {
+        if (first == last)
+        {
+            const WorkerProcess& worker = workers[roots[first]];
+            node = vplData[worker.header.numVPLs > 1 ? worker.nodeBase : worker.leafBase];
+            merge = worker.header.rootMerge;
+            return;
+        }
+
+        const int topIdx = maxVPLs + nextTopIdx++;
+        const uint32_t split = (first + last) >> 1;
+
+        VPLData lhs, rhs;
+        VPLMerge lhsMerge, rhsMerge;
+        buildTopLevelNode(roots, workers, first, split, approxParams, maxVPLs, nextTopIdx, vplData, lhs, lhsMerge);
+        buildTopLevelNode(roots, workers, split + 1, last, approxParams, maxVPLs, nextTopIdx, vplData, rhs, rhsMerge);
+
+        node = mergeVPLData(lhs, rhs, lhsMerge, rhsMerge, (uint)topIdx, approxParams, merge);
+        vplData[topIdx] = node;
+    }
+}
+
+bool writeHostTracerScene(const std::string& filename, const HostTracerScene& scene)
+{
+    HostSceneHeader header;
+    header.numTriangles = scene.getTriangleCount();
+    header.numEmitters = (uint32_t)scene.emitters.size();
+    if (scene.positions.size() != 3 * (size_t)header.numTriangles || scene.normals.size() != scene.positions.size())
+    {
+        logWarning("writeHostTracerScene: Inconsistent scene.");
+        return false;
+    }
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write((const char*)&header, sizeof(HostSceneHeader));
+    file.write((const char*)scene.positions.data(), (std::streamsize)(scene.positions.size() * sizeof(float3)));
+    file.write((const char*)scene.normals.data(), (std::streamsize)(scene.normals.size() * sizeof(float3)));
+    file.write((const char*)scene.diffuse.data(), (std::streamsize)(scene.diffuse.size() * sizeof(float3)));
+    file.write((const char*)scene.emitters.data(), (std::streamsize)(scene.emitters.size() * sizeof(EmitterData)));
+    if (!file.good())
+    {
+        logWarning("writeHostTracerScene: Can't write '" + filename + "'.");
+        return false;
+    }
+    return true;
+}
+
+bool readHostTracerScene(const std::string& filename, HostTracerScene& scene)
+{
+    std::ifstream file(filename, std::ios::binary);
+    HostSceneHeader header;
+    if (!file || !file.read((char*)&header, sizeof(HostSceneHeader)) || header.magic != kHostSceneMagic || header.version != kHostSceneVersion)
+    {
+        logWarning("readHostTracerScene: '" + filename + "' is not a host scene of this build.");
+        return false;
+    }
+
+    scene.positions.resize(3 * (size_t)header.numTriangles);
+    scene.normals.resize(3 * (size_t)header.numTriangles);
+    scene.diffuse.resize(header.numTriangles);
+    scene.emitters.resize(header.numEmitters);
+    file.read((char*)scene.positions.data(), (std::streamsize)(scene.positions.size() * sizeof(float3)));
+    file.read((char*)scene.normals.data(), (std::streamsize)(scene.normals.size() * sizeof(float3)));
+    file.read((char*)scene.diffuse.data(), (std::streamsize)(scene.diffuse.size() * sizeof(float3)));
+    file.read((char*)scene.emitters.data(), (std::streamsize)(scene.emitters.size() * sizeof(EmitterData)));
+    if (!file)
+    {
+        logWarning("readHostTracerScene: '" + filename + "' is truncated.");
+        return false;
+    }
+    return true;
+}
+
+bool runDistributedBake(const DistributedBakeDesc& desc, std::vector<VPLData>& vplData, VPLStats& stats, DistributedBakeStats& bakeStats)
+{
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+
+    stats = VPLStats();
+    bakeStats = DistributedBakeStats();
+    const HostVPLTracer::Desc& tracerDesc = desc.tracerDesc;
+    const int numTotalPaths = tracerDesc.maxBounces > 0 ? tracerDesc.maxVPLs / tracerDesc.maxBounces : 0;
+    if (numTotalPaths <= 0 || desc.numWorkers == 0)
+    {
+        logWarning("runDistributedBake: Invalid number of paths or workers.");
+        return false;
+    }
+
+    const std::string executable = desc.workerExecutable.empty() ? getExecutablePath() : desc.workerExecutable;
+    const uint32_t numWorkers = std::min(desc.numWorkers, (uint32_t)numTotalPaths);
+    std::vector<WorkerProcess> workers(numWorkers);
+    bakeStats.workers.resize(numWorkers);
+
+    // Every worker gets a range of whole paths, so the local capacities sum up to at most maxVPLs
+    for (uint32_t w = 0; w < numWorkers; w++)
+    {
+        const int pathBegin = (int)((int64_t)numTotalPaths * w / numWorkers);
+        const int pathEnd   = (int)((int64_t)numTotalPaths * (w + 1) / numWorkers);
+
+        WorkerJob job;
+        job.tracerDesc               = tracerDesc;
+        job.tracerDesc.maxVPLs       = (pathEnd - pathBegin) * tracerDesc.maxBounces;
+        job.tracerDesc.pathOffset    = pathBegin;
+        job.tracerDesc.numTotalPaths = numTotalPaths;
+        job.workerIdx                = w;
+        job.numSphereSections        = desc.buildDesc.numSphereSections;
+        job.mortonBits               = desc.buildDesc.mortonBits;
+        job.approxParams             = desc.buildDesc.approxParams;
+        job.useTightBounds           = desc.buildDesc.useTightBounds ? 1 : 0;
+        job.force128BitCodes         = desc.buildDesc.force128BitCodes ? 1 : 0;
+        job.useSimd                  = desc.buildDesc.useSimd ? 1 : 0;
+        job.deterministic            = desc.buildDesc.deterministic ? 1 : 0;
+        bakeStats.workers[w].pathOffset = pathBegin;
+
+        // The scene filename is last, the worker reads the rest of the line
+        if (!startWorker(executable, { encodeHex(&job, sizeof(WorkerJob)), desc.sceneFilename }, workers[w]))
+            logWarning("runDistributedBake: Can't start worker " + std::to_string(w) + " '" + executable + "'.");
+    }
+
+    // Headers in worker order. The workers trace and build in parallel and block on the pipe until their tree is read.
+    int numPaths = 0;
+    int numVPLs = 0;
+    for (uint32_t w = 0; w < numWorkers; w++)
+    {
+        WorkerProcess& worker = workers[w];
+        if (worker.process == kInvalidProcess)
+            continue;
+
+        WorkerTreeHeader& header = worker.header;
+        worker.valid = readPipe(worker.pipe, &header, sizeof(WorkerTreeHeader)) && header.magic == kWorkerTreeMagic && header.workerIdx == w &&
+            header.numPaths > 0 && header.numVPLs >= 0 && header.numVPLs <= header.maxVPLs && numVPLs + header.numVPLs <= tracerDesc.maxVPLs;
+        if (!worker.valid)
+        {
+            logWarning("runDistributedBake: Worker " + std::to_string(w) + " failed.");
+            closePipe(worker.pipe);
+            finishWorker(worker, true);
+            continue;
+        }
+        numPaths += header.numPaths;
+        numVPLs += header.numVPLs;
+    }
+    const auto t1 = CpuTimer::getCurrentTimePoint();
+
+    // Workers with VPLs are merged under the top-level tree
+    std::vector<uint32_t> roots;
+    for (uint32_t w = 0; w < numWorkers; w++)
+    {
+        bakeStats.workers[w].valid = workers[w].valid;
+        if (!workers[w].valid)
+        {
+            bakeStats.numFailedWorkers++;
+            continue;
+        }
+        bakeStats.workers[w].numPaths  = workers[w].header.numPaths;
+        bakeStats.workers[w].numVPLs   = workers[w].header.numVPLs;
+        bakeStats.workers[w].traceTime = workers[w].header.traceTime;
+        bakeStats.workers[w].buildTime = workers[w].header.buildTime;
+        if (workers[w].header.numVPLs > 0)
+            roots.push_back(w);
+    }
+
+    // A missing worker drops whole emitter strata, there is no unbiased result without its paths
+    const int maxVPLs = desc.compactLeaves ? numVPLs : tracerDesc.maxVPLs;
+    bool success = bakeStats.numFailedWorkers == 0 && numPaths > 0 && maxVPLs > 0;
+    if (bakeStats.numFailedWorkers > 0)
+        logWarning("runDistributedBake: " + std::to_string(bakeStats.numFailedWorkers) + " of " + std::to_string(numWorkers) + " workers failed, the bake is incomplete.");
+    else if (!success)
+        logWarning("runDistributedBake: No worker traced any " + std::string(numPaths > 0 ? "VPLs." : "paths."));
+
+    if (success)
+    {
+        vplData.assign(2 * (size_t)maxVPLs, getInvalidRecord());
+
+        int leafBase = 0;
+        int nodeBase = maxVPLs + std::max((int)roots.size() - 1, 0);
+        for (uint32_t w : roots)
+        {
+            workers[w].leafBase = leafBase;
+            workers[w].nodeBase = nodeBase;
+            leafBase += workers[w].header.numVPLs;
+            nodeBase += workers[w].header.numVPLs - 1;
+        }
+
+        // One thread per worker receives the tree into its ranges, renumbers and scales it
+        std::vector<char> received(numWorkers, 0);
+        std::vector<std::thread> threads;
+        for (uint32_t w : roots)
+        {
+            threads.emplace_back([&, w]()
+            {
+                const WorkerProcess& worker = workers[w];
+                const int localVPLs = worker.header.numVPLs;
+                const int localMax = worker.header.maxVPLs;
+                VPLData* pLeaves = &vplData[worker.leafBase];
+                VPLData* pNodes = &vplData[worker.nodeBase];
+                if (!readPipe(worker.pipe, pLeaves, localVPLs * sizeof(VPLData)) || !readPipe(worker.pipe, pNodes, (localVPLs - 1) * sizeof(VPLData)))
+                    return;
+
+                const float scale = (float)worker.header.numPaths / (float)numPaths;
+                auto toMergedIndex = [&](int localIdx)
+                {
+                    return localIdx < 0 ? localIdx : localIdx < localMax ? worker.leafBase + localIdx : worker.nodeBase + (localIdx - localMax);
+                };
+                auto remap = [&](VPLData& node)
+                {
+                    node.id       = toMergedIndex(node.id);
+                    node.idChild1 = toMergedIndex(node.idChild1);
+                    node.idChild2 = toMergedIndex(node.idChild2);
+                    node.setIntensity(node.getIntensity() * scale);
+                    node.setColor(node.getColor() * scale);
+                };
+                for (int i = 0; i < localVPLs; i++) remap(pLeaves[i]);
+                for (int i = 0; i < localVPLs - 1; i++) remap(pNodes[i]);
+                received[w] = 1;
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        for (uint32_t w : roots)
+        {
+            if (!received[w])
+            {
+                logWarning("runDistributedBake: Worker " + std::to_string(w) + " failed while sending its tree.");
+                success = false;
+            }
+        }
+    }
+
+    for (uint32_t w = 0; w < numWorkers; w++)
+    {
+        closePipe(workers[w].pipe);
+        if (workers[w].valid && !finishWorker(workers[w], !success))
+        {
+            logWarning("runDistributedBake: Worker " + std::to_string(w) + " exited with an error.");
+            success = false;
+        }
+    }
+    if (!success)
+        return false;
+
+    // Like HostTreeBuilder a single VPL is copied to the root
+    if (roots.size() == 1 && numVPLs == 1)
+        vplData[maxVPLs] = vplData[0];
+    else if (roots.size() > 1)
+    {
+        int nextTopIdx = 0;
+        VPLData root;
+        VPLMerge rootMerge;
+        buildTopLevelNode(roots, workers, 0, (uint32_t)roots.size() - 1, desc.buildDesc.approxParams, maxVPLs, nextTopIdx, vplData, root, rootMerge);
+    }
+    const auto t2 = CpuTimer::getCurrentTimePoint();
+
+    stats.numVPLs = numVPLs;
+    stats.numPaths = numPaths;
+    bakeStats.maxVPLs = maxVPLs;
+    bakeStats.workerTime = (float)CpuTimer::calcDuration(t0, t1);
+    bakeStats.mergeTime = (float)CpuTimer::calcDuration(t1, t2);
+    bakeStats.totalTime = (float)CpuTimer::calcDuration(t0, t2);
+
+    logInfo("runDistributedBake: " + std::to_string(numVPLs) + " VPLs of " + std::to_string(numPaths) + " paths from " + std::to_string(numWorkers) +
+        " workers, " + std::to_string(bakeStats.totalTime) + " ms (merge " + std::to_string(bakeStats.mergeTime) + " ms)");
+    return true;
+}
+
+bool writeDistributedBake(const std::string& filename, const DistributedBakeDesc& desc, const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numWorkers)
+{
+    if (maxVPLs <= 0 || vplData.size() != 2 * (size_t)maxVPLs)
+        return false;
+
+    float3 boundsMin(FLT_MAX);
+    float3 boundsMax(-FLT_MAX);
+    uint64_t numVPLs = 0;
+    for (int i = 0; i < maxVPLs; i++)
+    {
+        if (vplData[i].id < 0)
+            continue;
+        boundsMin = min(boundsMin, vplData[i].getPosW());
+        boundsMax = max(boundsMax, vplData[i].getPosW());
+        numVPLs++;
+    }
+
+    OutOfCoreTreeHeader header;
+    header.headerSize        = sizeof(OutOfCoreTreeHeader);
+    header.vplDataStride     = sizeof(VPLData);
+    header.maxVPLs           = maxVPLs;
+    header.numChunks         = numWorkers;
+    header.numSphereSections = desc.buildDesc.numSphereSections;
+    header.vplDataOffset     = alignUp(sizeof(OutOfCoreTreeHeader), kTreeCacheAlignment);
+    header.vplDataCount      = vplData.size();
+    header.fileSize          = header.vplDataOffset + header.vplDataCount * sizeof(VPLData);
+    header.numInputVPLs      = numVPLs;
+    header.boundsMin         = numVPLs > 0 ? boundsMin : float3(0.f);
+    header.boundsMax         = numVPLs > 0 ? boundsMax : float3(0.f);
+    header.approxParams      = desc.buildDesc.approxParams;
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write((const char*)&header, sizeof(OutOfCoreTreeHeader));
+    file.seekp((std::streamoff)header.vplDataOffset);
+    file.write((const char*)vplData.data(), (std::streamsize)(vplData.size() * sizeof(VPLData)));
+    if (!file.good())
+    {
+        logWarning("writeDistributedBake: Can't write '" + filename + "'.");
+        return false;
+    }
+    return true;
+}
+
+int runVPLBakeWorker(std::istream& args)
+{
+    uint64_t pipeValue = 0;
+    std::string jobHex, sceneFilename;
+    args >> pipeValue >> jobHex;
+    std::getline(args >> std::ws, sceneFilename);
+    sceneFilename.erase(sceneFilename.find_last_not_of(" \t\r\n") + 1);
+#if defined(_WIN32)
+    const PipeHandle pipe = (HANDLE)(uintptr_t)pipeValue;
+#else
+    const PipeHandle pipe = (int)pipeValue;
+#endif
+
+    WorkerJob job;
+    HostTracerScene scene;
+    if (!decodeHex(jobHex, &job, sizeof(WorkerJob)) || !readHostTracerScene(sceneFilename, scene))
+    {
+        logWarning("runVPLBakeWorker: Invalid arguments.");
+        return 1;
+    }
+
+    HostTreeBuilder::Desc buildDesc;
+    buildDesc.numSphereSections = job.numSphereSections;
+    buildDesc.mortonBits        = job.mortonBits;
+    buildDesc.approxParams      = job.approxParams;
+    buildDesc.useTightBounds    = job.useTightBounds != 0;
+    buildDesc.force128BitCodes  = job.force128BitCodes != 0;
+    buildDesc.useSimd           = job.useSimd != 0;
+    buildDesc.deterministic     = job.deterministic != 0;
+    if (!scene.positions.empty())
+    {
+        buildDesc.minExtent = buildDesc.maxExtent = scene.positions[0];
+        for (const float3& p : scene.positions)
+        {
+            buildDesc.minExtent = min(buildDesc.minExtent, p);
+            buildDesc.maxExtent = max(buildDesc.maxExtent, p);
+        }
+    }
+
+    HostVPLTracer::SharedPtr pTracer = HostVPLTracer::create();
+    pTracer->setScene(std::move(scene));
+
+    const HostVPLTracer::Desc& tracerDesc = job.tracerDesc;
+    std::vector<VPLData> vplData;
+    VPLStats stats;
+    if (!pTracer->trace(tracerDesc, vplData, stats))
+        return 1;
+
+    WorkerTreeHeader header;
+    header.workerIdx  = job.workerIdx;
+    header.pathOffset = tracerDesc.pathOffset;
+    header.numPaths   = tracerDesc.maxVPLs / tracerDesc.maxBounces;
+    header.numVPLs    = stats.numVPLs;
+    header.maxVPLs    = tracerDesc.maxVPLs;
+    header.rootMerge.ApproxScore = float2(1.f, 0.f);
+    header.traceTime  = pTracer->getTraceTime();
+
+    if (stats.numVPLs > 1)
+    {
+        HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+        if (!pBuilder->build(buildDesc, vplData, stats.numVPLs, tracerDesc.maxVPLs))
+            return 1;
+        header.rootMerge = pBuilder->getMerge()[tracerDesc.maxVPLs];
+        header.buildTime = pBuilder->getTimings().total;
+    }
+
+    const bool sent = writePipe(pipe, &header, sizeof(WorkerTreeHeader)) &&
+        writePipe(pipe, vplData.data(), (size_t)stats.numVPLs * sizeof(VPLData)) &&
+        (stats.numVPLs <= 1 || writePipe(pipe, &vplData[tracerDesc.maxVPLs], (size_t)(stats.numVPLs - 1) * sizeof(VPLData)));
+    return sent ? 0 : 1;
+}
+
+DistributedBakeCheck checkDistributedBake(HostVPLTracer& tracer, const HostVPLTracer::Desc& desc, uint32_t numWorkers, const std::string& sceneFilename)
+{
+    DistributedBakeCheck result;
+    result.numWorkers = numWorkers;
+
+    // Single process trace and build for comparison
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+    std::vector<VPLData> singleData;
+    VPLStats singleStats;
+    if (!tracer.trace(desc, singleData, singleStats))
+        return result;
+    if (singleStats.numVPLs > 1)
+    {
+        HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+        std::vector<VPLData> treeData = singleData;
+        pBuilder->build(HostTreeBuilder::Desc(), treeData, singleStats.numVPLs, desc.maxVPLs);
+    }
+    result.singleTime = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    result.singleNumVPLs = singleStats.numVPLs;
+    result.singleNumPaths = singleStats.numPaths;
+
+    if (!writeHostTracerScene(sceneFilename, tracer.getScene()))
+        return result;
+
+    DistributedBakeDesc bakeDesc;
+    bakeDesc.tracerDesc = desc;
+    bakeDesc.numWorkers = numWorkers;
+    bakeDesc.sceneFilename = sceneFilename;
+    std::vector<VPLData> vplData;
+    VPLStats stats;
+    DistributedBakeStats bakeStats;
+    const bool baked = runDistributedBake(bakeDesc, vplData, stats, bakeStats);
+    std::remove(sceneFilename.c_str());
+    if (!baked)
+        return result;
+    result.distributedTime = bakeStats.totalTime;
+    result.numVPLs = stats.numVPLs;
+    result.numPaths = stats.numPaths;
+
+    const TreeValidationResult validation = validateTree(vplData, bakeStats.maxVPLs);
+    if (!validation.valid)
+        logWarning("checkDistributedBake: " + to_string(validation));
+
+    // The workers trace the same paths, only the order of the VPLs differs
+    auto collectPositions = [](const std::vector<VPLData>& data, int maxVPLs)
+    {
+        std::vector<uint64_t> positions;
+        for (int i = 0; i < maxVPLs; i++)
+        {
+            if (data[i].id >= 0)
+                positions.push_back((uint64_t)data[i].posW.x << 32 | data[i].posW.y);
+        }
+        std::sort(positions.begin(), positions.end());
+        return positions;
+    };
+    result.sameVPLs = collectPositions(vplData, bakeStats.maxVPLs) == collectPositions(singleData, desc.maxVPLs);
+
+    double singleIntensity = 0.0;
+    for (int i = 0; i < singleStats.numVPLs; i++)
+        singleIntensity += singleData[i].getIntensity();
+    const double intensity = stats.numVPLs > 0 ? vplData[bakeStats.maxVPLs].getIntensity() : 0.0;
+    result.intensityError = singleIntensity > 0.0 ? (float)(std::abs(intensity - singleIntensity) / singleIntensity) : 0.f;
+
+    result.valid = validation.valid && bakeStats.numFailedWorkers == 0 && result.numPaths == result.singleNumPaths &&
+        result.numVPLs == result.singleNumVPLs && result.sameVPLs && result.intensityError < 1e-2f;
+
+    const std::string message = "checkDistributedBake: " + std::to_string(numWorkers) + " workers, #VPLs " + std::to_string(result.numVPLs) + " (single " +
+        std::to_string(result.singleNumVPLs) + "), #paths " + std::to_string(result.numPaths) + " (single " + std::to_string(result.singleNumPaths) + "), " +
+        (result.sameVPLs ? "same VPLs" : "different VPLs") + ", intensity error " + std::to_string(result.intensityError) + ", " +
+        std::to_string(result.distributedTime) + " ms (single " + std::to_string(result.singleTime) + " ms)";
+    if (result.valid)
+        logInfo(message);
+    else
+        logWarning(message + ", invalid");
+    return result;
+}
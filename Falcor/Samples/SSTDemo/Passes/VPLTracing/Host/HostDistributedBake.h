@@ -0,0 +1,120 @@
+#pragma once
+
+#include "Falcor.h"
+#include <istream>
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "../../VPLTree/Host/HostTreeBuilder.h"
+#include "HostVPLTracer.h"
+
+using namespace Falcor;
+
+
+/** Distributed VPL bake with local worker processes.
+    The coordinator splits the light paths of one trace into disjoint ranges and starts a worker process per range
+    (this executable with -vplWorker, see runVPLBakeWorker()). A worker loads a scene snapshot, traces its paths with
+    HostVPLTracer, builds a local SST with HostTreeBuilder and streams the tree through a pipe to the coordinator.
+    The coordinator merges the worker trees under a top-level tree:
+    - A worker divides the radiance by its own number of paths P_w. The coordinator scales every worker tree by
+      P_w / sum(P_w), so all VPLs are weighted by the paths of the whole bake. Merged intensities and colors are sums and
+      positions, normals and variances are intensity weighted, so scaling the nodes of a tree is the same as scaling its VPLs.
+    - The path ranges use the random streams and emitter strata of one trace of all paths, so the VPLs are the same as
+      those of a single process trace up to the scale rounding.
+    - The result has the layout of gVPLData: [leaves, unused leaves, top-level nodes, internal nodes of worker 0, worker 1, ...],
+      root at the capacity. Leaves are stored worker by worker and renumbered, node ids are indices into the array.
+    - Any worker that can't be started or fails fails the bake. A worker traces a contiguous range of the emitter strata,
+      so leaving its paths out would drop whole emitters and renormalizing by the remaining paths would bias the result.
+*/
+
+static const uint32_t kHostSceneMagic   = 0x48545353;  // "SSTH"
+static const uint32_t kHostSceneVersion = 1;
+static const uint32_t kWorkerTreeMagic  = 0x57545353;  // "SSTW"
+
+/** Writes the scene of the host tracer to a file, so that worker processes can trace it without a device.
+    \return True if successful.
+*/
+bool writeHostTracerScene(const std::string& filename, const HostTracerScene& scene);
+
+/** Reads a scene written by writeHostTracerScene().
+    \return True if successful.
+*/
+bool readHostTracerScene(const std::string& filename, HostTracerScene& scene);
+
+/** Bake parameters.
+*/
+struct DistributedBakeDesc
+{
+    HostVPLTracer::Desc tracerDesc;     ///< Parameters of the whole trace. maxVPLs / maxBounces paths are split over the workers.
+    HostTreeBuilder::Desc buildDesc;    ///< Parameters of the worker builds. The direction code table and the refit state are not passed on.
+    uint32_t numWorkers = 4;
+    bool compactLeaves = false;         ///< Capacity of the merged tree is the number of VPLs instead of tracerDesc.maxVPLs, e.g. for files.
+    std::string sceneFilename;          ///< Scene snapshot written by writeHostTracerScene().
+    std::string workerExecutable;       ///< Started with -vplWorker. Empty: this executable.
+};
+
+/** Statistics of a bake. Times in milliseconds.
+*/
+struct DistributedBakeStats
+{
+    struct Worker
+    {
+        bool valid = false;
+        int pathOffset = 0;
+        int numPaths = 0;               ///< Paths the radiance of the worker was divided by.
+        int numVPLs = 0;
+        float traceTime = 0.f;          ///< Measured by the worker.
+        float buildTime = 0.f;
+    };
+
+    std::vector<Worker> workers;
+    uint32_t numFailedWorkers = 0;      ///< Workers that couldn't be started or sent no valid header, the bake fails if not 0.
+    int maxVPLs = 0;                    ///< Capacity of the merged tree, the root is at maxVPLs.
+    float workerTime = 0.f;             ///< Start of the workers until the last header arrived.
+    float mergeTime = 0.f;              ///< Receiving, scaling and merging the worker trees.
+    float totalTime = 0.f;
+};
+
+/** Runs a bake with worker processes and merges their trees.
+    \param[in] desc Bake parameters.
+    \param[out] vplData Merged tree, 2 * maxVPLs elements.
+    \param[out] stats Number of VPLs and paths of the bake.
+    \param[out] bakeStats Bake statistics.
+    \return True if all workers succeeded and their trees were merged. Errors are logged.
+*/
+bool runDistributedBake(const DistributedBakeDesc& desc, std::vector<VPLData>& vplData, VPLStats& stats, DistributedBakeStats& bakeStats);
+
+/** Writes a merged tree in the format of HostOutOfCoreBuilder, so readOutOfCoreTree() can load it.
+    \return True if successful.
+*/
+bool writeDistributedBake(const std::string& filename, const DistributedBakeDesc& desc, const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numWorkers);
+
+/** Entry point of a worker process, called by WinMain for -vplWorker. Reads the arguments written by the coordinator.
+    \return Exit code of the process, 0 if successful.
+*/
+int runVPLBakeWorker(std::istream& args);
+
+/** Result of checkDistributedBake().
+*/
+struct DistributedBakeCheck
+{
+    bool valid = false;
+    uint32_t numWorkers = 0;
+    int numVPLs = 0;
+    int numPaths = 0;
+    int singleNumVPLs = 0;          ///< Single process trace for comparison.
+    int singleNumPaths = 0;
+    bool sameVPLs = false;          ///< The positions of all VPLs agree with the single process trace.
+    float intensityError = 0.f;     ///< Relative error of the root intensity against the sum over the single process VPLs.
+    float singleTime = 0.f;         ///< Trace and build in this process in milliseconds.
+    float distributedTime = 0.f;
+};
+
+/** Bakes with worker processes and compares the merged tree against a trace and build in this process: the number of
+    paths and VPLs, the VPL positions and the total intensity. The tree is validated with validateTree().
+    \param[in] tracer Tracer with a scene, saved to sceneFilename for the workers.
+    \param[in] desc Tracer parameters.
+    \param[in] numWorkers Number of worker processes.
+    \param[in] sceneFilename Scene snapshot, deleted afterwards.
+    \return Check result, also logged.
+*/
+DistributedBakeCheck checkDistributedBake(HostVPLTracer& tracer, const HostVPLTracer::Desc& desc, uint32_t numWorkers, const std::string& sceneFilename);
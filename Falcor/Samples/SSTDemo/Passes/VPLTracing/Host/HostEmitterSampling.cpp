@@ -0,0 +1,94 @@
+// Alias table of the VPL emitter selection, see HostEmitterSampling.h
+
+#include "HostEmitterSampling.h"
+
+std::vector<EmitterAliasEntry> buildEmitterAliasTable(std::vector<EmitterData>& emitters)
+{
+    const uint32_t numEmitters = (uint32_t)emitters.size();
+
+    double totalPower = 0.0;
+    for (const EmitterData& emitter : emitters)
+        totalPower += std::max(emitter.power, 0.f);
+
+    if (!(totalPower > 0.0))
+    {
+        for (EmitterData& emitter : emitters) emitter.pdf = 0.f;
+        return {};
+    }
+
+    // Probabilities scaled by the number of buckets, an average bucket holds exactly 1
+    std::vector<double> scaled(numEmitters);
+    std::vector<uint32_t> small, large;
+    small.reserve(numEmitters);
+    large.reserve(numEmitters);
+    for (uint32_t i = 0; i < numEmitters; i++)
+    {
+        const double p = std::max(emitters[i].power, 0.f) / totalPower;
+        emitters[i].pdf = (float)p;
+        scaled[i] = p * numEmitters;
+        if (scaled[i] < 1.0) small.push_back(i);
+        else large.push_back(i);
+    }
+
+    // Fill every small bucket with the remainder of a large one
+    std::vector<EmitterAliasEntry> table(numEmitters);
+    while (!small.empty() && !large.empty())
+    {
+        const uint32_t s = small.back();
+        small.pop_back();
+        const uint32_t l = large.back();
+
+        table[s].threshold = (float)scaled[s];
+        table[s].alias = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0)
+        {
+            large.pop_back();
+            small.push_back(l);
+        }
+    }
+
+    // Left overs are full buckets, up to rounding
+    for (uint32_t i : large)
+    {
+        table[i].threshold = 1.f;
+        table[i].alias = i;
+    }
+    for (uint32_t i : small)
+    {
+        table[i].threshold = 1.f;
+        table[i].alias = i;
+    }
+
+    return table;
+}
+
+EmitterSelectionCheck checkEmitterSelection(std::vector<EmitterData> emitters, uint32_t numRays, uint32_t frameCount)
+{
+    EmitterSelectionCheck result;
+    result.numEmitters = (uint32_t)emitters.size();
+    result.numRays = numRays;
+
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+    const std::vector<EmitterAliasEntry> table = buildEmitterAliasTable(emitters);
+    result.buildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    if (table.empty())
+        return result;
+
+    // Same random stream as VPLTracingRayGen(), the selection takes the first random number
+    std::vector<uint32_t> rayCounts(emitters.size(), 0);
+    for (uint32_t rayIdx = 0; rayIdx < numRays; rayIdx++)
+    {
+        uint32_t rngState = initRandHost(wangHashHost(rayIdx), frameCount, 16);
+        rayCounts[selectEmitterHost(table, rayIdx, numRays, rngState)]++;
+    }
+
+    for (size_t i = 0; i < emitters.size(); i++)
+        result.maxRayError = std::max(result.maxRayError, std::abs((float)rayCounts[i] - emitters[i].pdf * numRays));
+
+    logInfo("Emitter selection: " + std::to_string(result.numEmitters) + " emitters, " + std::to_string(numRays) + " rays, max ray count error " +
+        std::to_string(result.maxRayError) + ", alias table build " + std::to_string(result.buildTime) + " ms");
+
+    return result;
+}
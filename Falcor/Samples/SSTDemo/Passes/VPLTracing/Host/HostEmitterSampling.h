@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../VPLTree/Host/HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** Builds the alias table of the emitter selection in O(n) with Vose's method and writes the selection pdf
+    (power / total power) of every emitter. Emitters without power are never selected.
+    \param[in,out] emitters Emitters of the scene.
+    \return Alias table with one entry per emitter. Empty if no emitter has power.
+*/
+std::vector<EmitterAliasEntry> buildEmitterAliasTable(std::vector<EmitterData>& emitters);
+
+/** See selectEmitter() in VPLTracing.rt.hlsl.
+    Every ray owns a stratum of [0, 1) and jitters inside of it. The strata are mapped to the buckets of the alias table
+    in order, so the number of rays of an emitter deviates from numRays * pdf by at most one per bucket it occupies.
+    \param[in] table Alias table, not empty.
+    \param[in] rayIndex Index of the ray.
+    \param[in] numRays Number of rays of the launch.
+    \param[in,out] rngState Random state of the ray.
+    \return Index of the selected emitter.
+*/
+inline uint32_t selectEmitterHost(const std::vector<EmitterAliasEntry>& table, uint32_t rayIndex, uint32_t numRays, uint32_t& rngState)
+{
+    const uint32_t numEmitters = (uint32_t)table.size();
+    const float u = ((float)rayIndex + nextRandHost(rngState)) / (float)numRays;
+    const float scaled = u * (float)numEmitters;
+    const uint32_t bucket = std::min((uint32_t)scaled, numEmitters - 1);
+    return scaled - (float)bucket < table[bucket].threshold ? bucket : table[bucket].alias;
+}
+
+/** Result of checkEmitterSelection().
+*/
+struct EmitterSelectionCheck
+{
+    uint32_t numEmitters = 0;
+    uint32_t numRays = 0;
+    float maxRayError = 0.f;        ///< Largest difference of the ray count of an emitter to numRays * pdf.
+    float buildTime = 0.f;          ///< Time in milliseconds to build the alias table.
+};
+
+/** Builds the alias table, selects an emitter for every ray like VPLTracingRayGen() and compares the ray counts against the selection pdfs.
+    \param[in] emitters Emitters of the scene.
+    \param[in] numRays Number of rays.
+    \param[in] frameCount Seed of the random streams.
+    \return Check result. Results are logged.
+*/
+EmitterSelectionCheck checkEmitterSelection(std::vector<EmitterData> emitters, uint32_t numRays, uint32_t frameCount);
@@ -0,0 +1,226 @@
+// Copies a Falcor scene to the host for the host VPL tracer, see HostVPLTracer.h
+
+#include "HostVPLTracer.h"
+
+namespace
+{
+    /** Reads a float vertex attribute of a mesh. Missing components are set to zero.
+        \return False if the attribute is missing or not stored as floats.
+    */
+    bool readVertexAttribute(const Vao* pVao, uint32_t location, uint32_t vertexCount, std::vector<float3>& data)
+    {
+        const Vao::ElementDesc element = pVao->getElementIndexByLocation(location);
+        if (element.vbIndex == Vao::ElementDesc::kInvalidIndex)
+            return false;
+
+        const VertexBufferLayout* pLayout = pVao->getVertexLayout()->getBufferLayout(element.vbIndex).get();
+        const ResourceFormat format = pLayout->getElementFormat(element.elementIndex);
+        const uint32_t numChannels = getFormatChannelCount(format);
+        if (getFormatType(format) != FormatType::Float || getFormatBytesPerBlock(format) != numChannels * sizeof(float))
+            return false;
+
+        const uint32_t offset = pLayout->getElementOffset(element.elementIndex);
+        const uint32_t stride = pLayout->getStride();
+        const Buffer::SharedPtr& pBuffer = pVao->getVertexBuffer(element.vbIndex);
+        const uint8_t* pData = (const uint8_t*)pBuffer->map(Buffer::MapType::Read);
+
+        data.assign(vertexCount, float3(0.f));
+        for (uint32_t i = 0; i < vertexCount; i++)
+        {
+            const float* pValue = (const float*)(pData + (size_t)i * stride + offset);
+            for (uint32_t c = 0; c < std::min(numChannels, 3u); c++)
+                data[i][c] = pValue[c];
+        }
+
+        pBuffer->unmap();
+        return true;
+    }
+
+    /** Reads the index buffer of a mesh. Meshes without index buffer are drawn in vertex order.
+        \return False if the index format is not supported.
+    */
+    bool readIndices(const Mesh* pMesh, std::vector<uint32_t>& indices)
+    {
+        const Vao* pVao = pMesh->getVao().get();
+        const Buffer::SharedPtr pBuffer = pVao->getIndexBuffer();
+        if (!pBuffer)
+        {
+            indices.resize(pMesh->getVertexCount());
+            for (uint32_t i = 0; i < (uint32_t)indices.size(); i++) indices[i] = i;
+            return true;
+        }
+
+        const uint32_t indexCount = pMesh->getIndexCount();
+        indices.resize(indexCount);
+        const void* pData = pBuffer->map(Buffer::MapType::Read);
+        bool valid = true;
+        if (pVao->getIndexBufferFormat() == ResourceFormat::R32Uint)
+            std::memcpy(indices.data(), pData, indexCount * sizeof(uint32_t));
+        else if (pVao->getIndexBufferFormat() == ResourceFormat::R16Uint)
+            for (uint32_t i = 0; i < indexCount; i++) indices[i] = ((const uint16_t*)pData)[i];
+        else
+            valid = false;
+        pBuffer->unmap();
+        return valid;
+    }
+
+    /** Average linear color of a texture. Reads back the smallest mip level, only 8 bit RGBA/BGRA formats are supported.
+        \return False if the format is not supported.
+    */
+    bool averageTextureColor(RenderContext* pRenderContext, const Texture* pTexture, float4& color)
+    {
+        const ResourceFormat format = pTexture->getFormat();
+        const bool isBGRA = format == ResourceFormat::BGRA8Unorm || format == ResourceFormat::BGRA8UnormSrgb;
+        const bool isRGBA = format == ResourceFormat::RGBA8Unorm || format == ResourceFormat::RGBA8UnormSrgb;
+        if (!isBGRA && !isRGBA)
+            return false;
+
+        const uint32_t mipLevel = pTexture->getMipCount() - 1;
+        const std::vector<uint8> texels = pRenderContext->readTextureSubresource(pTexture, pTexture->getSubresourceIndex(0, mipLevel));
+        const size_t numTexels = std::min<size_t>(texels.size() / 4, (size_t)pTexture->getWidth(mipLevel) * pTexture->getHeight(mipLevel));
+        if (numTexels == 0)
+            return false;
+
+        float4 sum(0.f);
+        for (size_t i = 0; i < numTexels; i++)
+        {
+            float4 texel = float4(texels[4 * i + 0], texels[4 * i + 1], texels[4 * i + 2], texels[4 * i + 3]) / 255.f;
+            if (isBGRA) std::swap(texel.x, texel.z);
+            if (isSrgbFormat(format)) texel = float4(sRGBToLinear(float3(texel)), texel.w);
+            sum += texel;
+        }
+        color = sum / (float)numTexels;
+        return true;
+    }
+
+    /** Constant diffuse albedo of a material, see _prepareShadingData() in Shading.slang.
+    */
+    float3 getMaterialDiffuse(RenderContext* pRenderContext, const Material* pMaterial)
+    {
+        float4 baseColor = pMaterial->getBaseColor();
+        const Texture::SharedPtr pBaseColorTexture = pMaterial->getBaseColorTexture();
+        if (pBaseColorTexture && pRenderContext && !averageTextureColor(pRenderContext, pBaseColorTexture.get(), baseColor))
+            logWarning("HostTracerScene: Unsupported base color texture format of material '" + pMaterial->getName() + "', using the base color.");
+
+        if (pMaterial->getShadingModel() == ShadingModelMetalRough)
+            return float3(baseColor) * (1.f - pMaterial->getSpecularParams().b);
+        return float3(baseColor);
+    }
+}
+
+bool extractHostTracerScene(const Scene* pScene, RenderContext* pRenderContext, HostTracerScene& scene)
+{
+    scene = HostTracerScene();
+    bool valid = true;
+    std::map<const Material*, float3> materialDiffuse;
+
+    // Triangles of all mesh instances of all model instances
+    for (uint32_t modelId = 0; modelId < pScene->getModelCount(); modelId++)
+    {
+        const Model* pModel = pScene->getModel(modelId).get();
+        for (uint32_t meshId = 0; meshId < pModel->getMeshCount(); meshId++)
+        {
+            const Mesh* pMesh = pModel->getMesh(meshId).get();
+            const Vao* pVao = pMesh->getVao().get();
+            if (pVao->getPrimitiveTopology() != Vao::Topology::TriangleList)
+            {
+                logWarning("HostTracerScene: Only triangle lists are supported, skipping a mesh.");
+                valid = false;
+                continue;
+            }
+
+            std::vector<float3> positions, normals;
+            std::vector<uint32_t> indices;
+            if (!readVertexAttribute(pVao, VERTEX_POSITION_LOC, pMesh->getVertexCount(), positions) || !readIndices(pMesh, indices))
+            {
+                logWarning("HostTracerScene: Unsupported vertex or index format, skipping a mesh.");
+                valid = false;
+                continue;
+            }
+            const bool hasNormals = readVertexAttribute(pVao, VERTEX_NORMAL_LOC, pMesh->getVertexCount(), normals);
+
+            const Material* pMaterial = pMesh->getMaterial().get();
+            auto it = materialDiffuse.find(pMaterial);
+            if (it == materialDiffuse.end())
+                it = materialDiffuse.emplace(pMaterial, pMaterial ? getMaterialDiffuse(pRenderContext, pMaterial) : float3(0.f)).first;
+            const float3 diffuse = it->second;
+
+            for (uint32_t modelInstanceId = 0; modelInstanceId < pScene->getModelInstanceCount(modelId); modelInstanceId++)
+            {
+                const glm::mat4& modelTransform = pScene->getModelInstance(modelId, modelInstanceId)->getTransformMatrix();
+                for (uint32_t meshInstanceId = 0; meshInstanceId < pModel->getMeshInstanceCount(meshId); meshInstanceId++)
+                {
+                    const glm::mat4 transform = modelTransform * pModel->getMeshInstance(meshId, meshInstanceId)->getTransformMatrix();
+                    const glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+                    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+                    {
+                        float3 p[3], n[3];
+                        for (uint32_t k = 0; k < 3; k++)
+                            p[k] = float3(transform * float4(positions[indices[i + k]], 1.f));
+
+                        // Meshes without normals use the geometric normal
+                        const float3 faceN = normalize(cross(p[1] - p[0], p[2] - p[0]));
+                        for (uint32_t k = 0; k < 3; k++)
+                        {
+                            n[k] = hasNormals ? normalMat * normals[indices[i + k]] : faceN;
+                            if (!(dot(n[k], n[k]) > 0.f)) n[k] = faceN;
+                            scene.positions.push_back(p[k]);
+                            scene.normals.push_back(n[k]);
+                        }
+                        scene.diffuse.push_back(diffuse);
+                    }
+                }
+            }
+        }
+    }
+
+    scene.emitters = extractEmitters(pScene);
+    return valid;
+}
+
+std::vector<EmitterData> extractEmitters(const Scene* pScene)
+{
+    std::vector<EmitterData> emitters;
+    for (uint32_t i = 0; i < pScene->getLightCount(); i++)
+    {
+        const Light* pLight = pScene->getLight(i).get();
+        if (pLight->getType() != LightPoint)
+            continue;
+
+        const LightData& data = pLight->getData();
+        EmitterData emitter;
+        emitter.type      = LightPoint;
+        emitter.power     = pLight->getPower();
+        emitter.intensity = data.intensity;
+        emitter.posW      = data.posW;
+        emitter.dirW      = data.dirW;
+        emitters.push_back(emitter);
+    }
+
+    for (uint32_t i = 0; i < pScene->getAreaLightCount(); i++)
+    {
+        const AreaLight* pAreaLight = pScene->getAreaLight(i).get();
+        const AreaLightData& data = pAreaLight->getAreaLightData();
+
+        // Same transformation as in AreaLight::setIntoProgramVars()
+        const auto& pModelInstance = pAreaLight->getModelInstance();
+        const glm::mat4 transform = pModelInstance ? pModelInstance->getTransformMatrix() * pAreaLight->getMeshData()->getTransformMatrix() : data.transMat;
+        const float3 scale = pModelInstance ? pModelInstance->getScaling() : float3(1.f);
+        const glm::mat3 normalMat = glm::transpose(glm::inverse(glm::mat3(transform)));
+
+        // See VPLTracingRayGen()
+        EmitterData emitter;
+        emitter.type        = LightArea;
+        emitter.power       = pAreaLight->getPower();
+        emitter.intensity   = data.intensity;
+        emitter.posW        = float3(transform * float4(data.posW, 1.f));
+        emitter.dirW        = normalMat * data.dirW;
+        emitter.tangentW    = glm::mat3(transform) * data.tangent;
+        emitter.bitangentW  = glm::mat3(transform) * data.bitangent;
+        emitter.surfaceArea = data.surfaceArea * scale.x * scale.z;
+        emitters.push_back(emitter);
+    }
+
+    return emitters;
+}
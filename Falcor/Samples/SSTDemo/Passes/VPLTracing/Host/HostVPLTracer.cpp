@@ -0,0 +1,277 @@
+// Host VPL tracer, see HostVPLTracer.h
+
+#include "HostVPLTracer.h"
+#include "../../VPLTree/Host/HostUtils.h"
+#include "../../VPLTree/Host/HostTreeSampling.h"
+
+namespace
+{
+    const uint32_t kRaysPerChunk = 256;
+
+    /** See perp_stark() in Random.slang.
+    */
+    inline float3 perpStarkHost(const float3& u)
+    {
+        const float3 a = abs(u);
+        const uint32_t uyx = (a.x - a.y) < 0 ? 1 : 0;
+        const uint32_t uzx = (a.x - a.z) < 0 ? 1 : 0;
+        const uint32_t uzy = (a.y - a.z) < 0 ? 1 : 0;
+        const uint32_t xm = uyx & uzx;
+        const uint32_t ym = (1 ^ xm) & uzy;
+        const uint32_t zm = 1 ^ (xm | ym);
+        return cross(u, float3((float)xm, (float)ym, (float)zm));
+    }
+
+    /** See fromLocal() in Random.slang.
+    */
+    inline float3 fromLocalHost(const float3& v, const float3& N)
+    {
+        const float3 B = perpStarkHost(N);
+        const float3 T = cross(B, N);
+        return T * v.x + B * v.y + N * v.z;
+    }
+
+    /** See uniformSphereSample() in Random.slang.
+    */
+    inline float3 uniformSphereSampleHost(const float3& N, float rn0, float rn1)
+    {
+        const float z = 1.f - 2.f * rn0;
+        const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        const float phi = 2.f * (float)M_PI * rn1;
+        return fromLocalHost(float3(r * std::cos(phi), r * std::sin(phi), z), N);
+    }
+
+    /** See cosineHemisphereSample() in Random.slang.
+    */
+    inline float3 cosineHemisphereSampleHost(const float3& N, float rn0, float rn1)
+    {
+        const float r = std::sqrt(rn0);
+        const float phi = rn1 * (float)M_PI2;
+        return fromLocalHost(float3(r * std::cos(phi), r * std::sin(phi), std::sqrt(std::max(0.f, 1.f - rn0))), N);
+    }
+
+    /** See addVPL() in VPLTracing.rt.hlsl. The id is assigned after the trace.
+    */
+    inline VPLData createVPL(const float3& posW, const float3& normW, const float3& radiance)
+    {
+        VPLData vpl = {};
+        vpl.setPosW(posW);
+        vpl.setEarlyStop(0.f);
+
+        vpl.setNormW(normW);
+        vpl.setConeAngle(0.f);
+        vpl.setColor(radiance);
+        vpl.setIntensity(luminance(radiance));
+
+        vpl.setAABBMin(posW);
+        vpl.setAABBMax(posW);
+        vpl.setVariance(float3(0.f));
+
+        vpl.id = -1;
+        vpl.idChild1 = -1;
+        vpl.idChild2 = -1;
+        vpl.numVPLSubTree = 0;
+        return vpl;
+    }
+
+    /** VPLs and counters of a chunk of consecutive rays.
+    */
+    struct ChunkResult
+    {
+        std::vector<VPLData> vpls;
+        int numPaths = 0;
+        uint64_t numRays = 0;
+    };
+}
+
+HostVPLTracer::SharedPtr HostVPLTracer::create()
+{
+    return SharedPtr(new HostVPLTracer());
+}
+
+void HostVPLTracer::setScene(HostTracerScene scene)
+{
+    mScene = std::move(scene);
+    if (!mpBVH) mpBVH = HostBVH::create();
+    mpBVH->build(mScene.positions);
+    mEmitterAliasTable = buildEmitterAliasTable(mScene.emitters);
+}
+
+bool HostVPLTracer::trace(const Desc& desc, std::vector<VPLData>& vplData, VPLStats& stats)
+{
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+
+    stats = VPLStats();
+    mNumRays = 0;
+    if (!mpBVH || desc.maxVPLs <= 0)
+    {
+        logWarning("HostVPLTracer: No scene or invalid number of VPLs.");
+        return false;
+    }
+
+    // Reset the VPL buffer like ResetVPLs.cs.hlsl
+    VPLData emptyVPL = {};
+    emptyVPL.id = -1;
+    vplData.assign(2 * (size_t)desc.maxVPLs, emptyVPL);
+
+    const int numPaths = desc.maxBounces > 0 ? desc.maxVPLs / desc.maxBounces : 0;
+    const uint32_t numTotalRays = mEmitterAliasTable.empty() ? 0 : (uint32_t)numPaths;
+    const uint32_t numStrata = desc.numTotalPaths > 0 ? (uint32_t)desc.numTotalPaths : (uint32_t)numPaths;
+    if (desc.pathOffset < 0 || (desc.numTotalPaths > 0 && desc.pathOffset + numPaths > desc.numTotalPaths))
+    {
+        logWarning("HostVPLTracer: Path range exceeds the total number of paths.");
+        return false;
+    }
+
+    const uint32_t numChunks = (numTotalRays + kRaysPerChunk - 1) / kRaysPerChunk;
+    std::vector<ChunkResult> chunks(numChunks);
+
+    parallelForChunks(numChunks, [&](size_t chunkIdx, uint32_t)
+    {
+        ChunkResult& chunk = chunks[chunkIdx];
+        const uint32_t rayBegin = (uint32_t)chunkIdx * kRaysPerChunk;
+        const uint32_t rayEnd = std::min(rayBegin + kRaysPerChunk, numTotalRays);
+
+        for (uint32_t rayIdx = rayBegin; rayIdx < rayEnd; rayIdx++)
+        {
+            const uint32_t pathId = (uint32_t)desc.pathOffset + rayIdx;
+            uint32_t rngState = initRandHost(wangHashHost(pathId), desc.frameCount, 16);
+            const EmitterData& light = mScene.emitters[selectEmitterHost(mEmitterAliasTable, pathId, numStrata, rngState)];
+
+            float3 origin, dir, radiance;
+            if (light.type == LightPoint)
+            {
+                const float pdf = 1.f / (float)M_PI;
+                radiance = light.intensity / pdf / light.pdf / (float)numPaths;
+
+                origin = light.posW;
+                const float rn0 = nextRandHost(rngState);
+                const float rn1 = nextRandHost(rngState);
+                dir = uniformSphereSampleHost(float3(1.f, 0.f, 0.f), rn0, rn1);
+            }
+            else if (light.type == LightArea)
+            {
+                const float pdf = 1.f / light.surfaceArea;
+                radiance = light.intensity / pdf / light.pdf / (float)numPaths;
+
+                const float rnX = nextRandHost(rngState) - 0.5f;
+                const float rnY = nextRandHost(rngState) - 0.5f;
+                origin = light.posW + light.bitangentW * rnX - light.tangentW * rnY + light.dirW * 0.0001f;
+                const float rn0 = nextRandHost(rngState);
+                const float rn1 = nextRandHost(rngState);
+                dir = cosineHemisphereSampleHost(light.dirW, rn0, rn1);
+            }
+            else
+                continue;
+
+            chunk.numPaths++;
+            if (desc.maxBounces <= 0)
+                continue;
+
+            // See VPLTraceClosestHit(), the recursion is unrolled.
+            float q = 1.f;
+            int bounces = 0;
+            while (true)
+            {
+                HostBVH::Hit hit;
+                chunk.numRays++;
+                if (!mpBVH->intersect(origin, dir, desc.minT, FLT_MAX, hit))
+                    break;
+
+                const uint32_t v = 3 * hit.triangle;
+                const float w = 1.f - hit.u - hit.v;
+                const float3 posW = mScene.positions[v] * w + mScene.positions[v + 1] * hit.u + mScene.positions[v + 2] * hit.v;
+                float3 N = mScene.normals[v] * w + mScene.normals[v + 1] * hit.u + mScene.normals[v + 2] * hit.v;
+                N = normalize(N);
+
+                // Reject VPLs which hit back side of triangles
+                if (dot(-dir, N) < 0.f)
+                    break;
+
+                // Russian roulette on the albedo, but only after the minimum number of bounces
+                const float3& diffuse = mScene.diffuse[hit.triangle];
+                const float qNext = bounces > desc.minBounces ? std::max(diffuse.x, std::max(diffuse.y, diffuse.z)) : 1.f;
+
+                radiance *= diffuse / q;
+                q = qNext;
+                bounces += 1;
+
+                chunk.vpls.push_back(createVPL(posW, N, radiance));
+
+                if (bounces >= desc.maxBounces)
+                    break;
+
+                const float r = nextRandHost(rngState);
+                if (r < (1 - q))
+                    break;
+
+                origin = posW;
+                const float rn0 = nextRandHost(rngState);
+                const float rn1 = nextRandHost(rngState);
+                dir = cosineHemisphereSampleHost(N, rn0, rn1);
+            }
+        }
+    });
+
+    // Assign the ids in ray order. Every path has at most maxBounces VPLs, so the leaf range cannot overflow.
+    std::vector<int> chunkOffsets(numChunks + 1, 0);
+    for (uint32_t c = 0; c < numChunks; c++)
+    {
+        chunkOffsets[c + 1] = chunkOffsets[c] + (int)chunks[c].vpls.size();
+        stats.numPaths += chunks[c].numPaths;
+        mNumRays += chunks[c].numRays;
+    }
+    stats.numVPLs = std::min(chunkOffsets[numChunks], desc.maxVPLs);
+
+    parallelForChunks(numChunks, [&](size_t c, uint32_t)
+    {
+        const std::vector<VPLData>& vpls = chunks[c].vpls;
+        for (size_t i = 0; i < vpls.size(); i++)
+        {
+            const int id = chunkOffsets[c] + (int)i;
+            if (id >= desc.maxVPLs)
+                break;
+            vplData[id] = vpls[i];
+            vplData[id].id = id;
+        }
+    });
+
+    mTraceTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    return true;
+}
+
+HostTracerCheck checkHostTracer(HostVPLTracer& tracer, const HostVPLTracer::Desc& desc, const VPLStats& gpuStats)
+{
+    HostTracerCheck result;
+    result.gpuNumVPLs = gpuStats.numVPLs;
+    result.gpuNumPaths = gpuStats.numPaths;
+    if (tracer.getBVH())
+        result.bvhBuildTime = tracer.getBVH()->getBuildTime();
+
+    std::vector<VPLData> vplData[2];
+    VPLStats stats[2];
+    for (uint32_t i = 0; i < 2; i++)
+    {
+        if (!tracer.trace(desc, vplData[i], stats[i]))
+            return result;
+    }
+
+    result.numVPLs = stats[0].numVPLs;
+    result.numPaths = stats[0].numPaths;
+    result.numRays = tracer.getNumRays();
+    result.traceTime = tracer.getTraceTime();
+    result.deterministic = stats[0].numVPLs == stats[1].numVPLs && stats[0].numPaths == stats[1].numPaths &&
+        std::memcmp(vplData[0].data(), vplData[1].data(), vplData[0].size() * sizeof(VPLData)) == 0;
+
+    const float mraysPerSecond = result.traceTime > 0.f ? (float)result.numRays / (result.traceTime * 1000.f) : 0.f;
+    logInfo("Host VPL tracer: " + std::string(result.deterministic ? "deterministic" : "NOT DETERMINISTIC") +
+        ", #VPLs " + std::to_string(result.numVPLs) + " (GPU " + std::to_string(result.gpuNumVPLs) + ")" +
+        ", #paths " + std::to_string(result.numPaths) + " (GPU " + std::to_string(result.gpuNumPaths) + ")" +
+        ", #triangles " + std::to_string(tracer.getScene().getTriangleCount()) +
+        ", BVH build " + std::to_string(result.bvhBuildTime) + " ms" +
+        ", trace " + std::to_string(result.traceTime) + " ms (" + std::to_string(mraysPerSecond) + " MRays/s)");
+    if (!result.deterministic)
+        logWarning("Host VPL tracer: Two traces with the same parameters differ.");
+
+    return result;
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostBVH.h"
+#include "HostEmitterSampling.h"
+
+using namespace Falcor;
+
+
+/** Host port of VPLTracing.rt.hlsl. Keep both files in sync!
+    Shoots the same light paths as VPLTracingRayGen/VPLTraceClosestHit: every ray selects an emitter proportional
+    to its power from the alias table of VPLTracing::uploadEmitters(), every ray uses the random stream of its launch index,
+    bounces are cosine distributed and paths are terminated by russian roulette on the diffuse albedo.
+    Differences to the shader:
+    - The diffuse albedo is constant per triangle (base color, or the average color of the base color texture).
+    - VPL ids are assigned in path order instead of by an atomic counter, so the result only depends on the
+      scene, the parameters and the frame count, not on the number of threads.
+*/
+
+/** Triangle soup of a scene in world space.
+*/
+struct HostTracerScene
+{
+    std::vector<float3> positions;          ///< Vertex positions, 3 per triangle.
+    std::vector<float3> normals;            ///< Vertex normals, 3 per triangle.
+    std::vector<float3> diffuse;            ///< Diffuse albedo, 1 per triangle.
+    std::vector<EmitterData> emitters;      ///< Emitters in the order of extractEmitters().
+
+    uint32_t getTriangleCount() const { return (uint32_t)diffuse.size(); }
+};
+
+/** Copies the triangles, materials and lights of a scene to the host. Reads back vertex, index and texture data.
+    \param[in] pScene Scene to extract.
+    \param[in] pRenderContext Used to read back the base color textures. Textures are ignored if null.
+    \param[out] scene Extracted scene.
+    \return True if successful, false if meshes were skipped because of an unsupported layout.
+*/
+bool extractHostTracerScene(const Scene* pScene, RenderContext* pRenderContext, HostTracerScene& scene);
+
+/** Collects the emitters of the VPL tracer in world space: point lights first, then the area lights.
+    Directional lights are skipped, they have no position to start a path from.
+    \param[in] pScene Scene with the lights.
+    \return Emitters with power, the selection pdf is not set yet.
+*/
+std::vector<EmitterData> extractEmitters(const Scene* pScene);
+
+class HostVPLTracer : public std::enable_shared_from_this<HostVPLTracer>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostVPLTracer>;
+    using SharedConstPtr = std::shared_ptr<const HostVPLTracer>;
+    virtual ~HostVPLTracer() = default;
+
+    /** Tracer parameters. Mirrors the constant buffer of VPLTracing.rt.hlsl.
+    */
+    struct Desc
+    {
+        int maxVPLs = 100000;
+        int maxBounces = 3;
+        int minBounces = 1;
+        float minT = 0.001f;
+        uint32_t frameCount = 0x1337u;      ///< Seed of the random streams.
+        int pathOffset = 0;                 ///< First path of a range of a larger trace, like gPathOffset. Selects the random streams and emitter strata.
+        int numTotalPaths = 0;              ///< Paths of the whole trace the emitters are stratified over. 0: the paths of this trace.
+    };
+
+    /** Create a new tracer without a scene.
+    */
+    static SharedPtr create();
+
+    /** Sets the scene and builds the BVH.
+    */
+    void setScene(HostTracerScene scene);
+
+    /** Traces the VPLs.
+        \param[in] desc Tracer parameters.
+        \param[out] vplData VPL buffer, resized to 2 * maxVPLs. Same layout as gVPLData after the VPLTracing pass:
+                    VPL i is stored at index i, unused leaves have id -1, the internal node range is cleared.
+        \param[out] stats Number of VPLs and paths.
+        The paths [pathOffset, pathOffset + maxVPLs / maxBounces) of a trace of numTotalPaths paths are traced, so traces of
+        disjoint ranges together shoot the same rays as one trace of all paths. The radiance is divided by the paths of this
+        trace, every range is an estimate of its own.
+        \return True if successful, false if no scene is set or the parameters are invalid.
+    */
+    bool trace(const Desc& desc, std::vector<VPLData>& vplData, VPLStats& stats);
+
+    const HostTracerScene& getScene() const { return mScene; }
+    const HostBVH::SharedPtr& getBVH() const { return mpBVH; }
+    const std::vector<EmitterAliasEntry>& getEmitterAliasTable() const { return mEmitterAliasTable; }
+    uint64_t getNumRays() const { return mNumRays; }
+    float getTraceTime() const { return mTraceTime; }
+
+protected:
+    HostVPLTracer() = default;
+
+    HostTracerScene mScene;
+    HostBVH::SharedPtr mpBVH;
+    std::vector<EmitterAliasEntry> mEmitterAliasTable;
+    uint64_t mNumRays = 0;                  ///< Rays cast by the last trace.
+    float mTraceTime = 0.f;
+};
+
+/** Result of checkHostTracer().
+*/
+struct HostTracerCheck
+{
+    bool deterministic = false;     ///< Two traces with the same parameters are identical.
+    int numVPLs = 0;
+    int numPaths = 0;
+    int gpuNumVPLs = 0;             ///< VPLStats of the shader for comparison.
+    int gpuNumPaths = 0;
+    uint64_t numRays = 0;
+    float bvhBuildTime = 0.f;       ///< Time in milliseconds.
+    float traceTime = 0.f;          ///< Time in milliseconds of one trace.
+};
+
+/** Traces the VPLs twice and checks that both results are identical. The counts are compared to the shader,
+    the number of VPLs only agrees statistically because the shader samples the albedo per hit.
+    \param[in] tracer Tracer with a scene.
+    \param[in] desc Tracer parameters.
+    \param[in] gpuStats VPLStats written by VPLTracing.rt.hlsl with the same parameters.
+    \return Check result. Results are logged.
+*/
+HostTracerCheck checkHostTracer(HostVPLTracer& tracer, const HostVPLTracer::Desc& desc, const VPLStats& gpuStats);
@@ -1,12 +1,13 @@
 #include "VPLTracing.h"
 
 const char* VPLTracing::kDesc = "VPL generation";
-const uint32_t kNumMaxLightSources = 100;
 
 namespace
 {
   const char kShaderFile[]  = "Passes/VPLTracing/VPLTracing.rt.hlsl";
   const char kComputeFile[] = "Passes/VPLTracing/ResetVPLs.cs.hlsl";
+  const char kCompactFile[] = "Passes/VPLTracing/CompactVPLPool.cs.hlsl";
+  const char kHostSceneExtension[] = "hostscene";
 }
 
 VPLTracing::SharedPtr VPLTracing::create()
@@ -30,7 +31,7 @@ void VPLTracing::createPrograms()
     progDesc.setRayGen("VPLTracingRayGen");
     progDesc.addMiss(0, "VPLTraceMiss");
     progDesc.addHitGroup(0, "VPLTraceClosestHit", "");
-    progDesc.addDefine("NUM_LIGHT_SOURCES", "20");
+    if (mTemporalReuse) progDesc.addDefine("TEMPORAL_REUSE");
     mTracer.pProgram = RtProgram::create(progDesc);
     mTracer.pVars = RtProgramVars::create(mTracer.pProgram, mpScene);
 
@@ -44,6 +45,12 @@ void VPLTracing::createPrograms()
     mVPLReset.pVars    = ComputeVars::create(mVPLReset.pProgram->getReflector());
     mVPLReset.pState   = ComputeState::create();
     mVPLReset.pState->setProgram(mVPLReset.pProgram);
+
+    // Create pool compaction program
+    mPoolCompact.pProgram = ComputeProgram::createFromFile(kCompactFile, "compactVPLPool");
+    mPoolCompact.pVars    = ComputeVars::create(mPoolCompact.pProgram->getReflector());
+    mPoolCompact.pState   = ComputeState::create();
+    mPoolCompact.pState->setProgram(mPoolCompact.pProgram);
 }
 
 void VPLTracing::createResources(PassData& passData)
@@ -54,7 +61,8 @@ void VPLTracing::createResources(PassData& passData)
     mMaxVPLs = mGuiMaxVPLs;
 
     createPrograms();
-    determineConstantBufferAddresses();
+    mpEmitterBuffer = nullptr;
+    mpEmitterAliasTableBuffer = nullptr;
 
     auto bindFlags = Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess;
     auto pBufferVPLData      = StructuredBuffer::create(mTracer.pProgram->getHitProgram(0), "gVPLData",      mMaxVPLs * 2,  bindFlags);
@@ -65,7 +73,14 @@ void VPLTracing::createResources(PassData& passData)
     passData.addResource("gVPLPositions", pBufferVPLPositions);
     passData.addResource("gVPLStats",     pBufferVPLStats);
 
+    // The pool is private to the pass, it has one slot per bounce of every path.
+    // The compaction program always declares it, the tracer only with TEMPORAL_REUSE.
+    mpVPLPool     = StructuredBuffer::create(mPoolCompact.pProgram, "gVPLPool",     mMaxVPLs, bindFlags);
+    mpVPLPoolTags = StructuredBuffer::create(mPoolCompact.pProgram, "gVPLPoolTags", mMaxVPLs, bindFlags);
+    mResetPool = true;
+
     mReloadResources = false;
+    mHostSceneDirty = true;
 }
 
 void VPLTracing::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
@@ -76,6 +91,8 @@ void VPLTracing::setScene(RenderContext* pRenderContext, const Scene::SharedPtr&
         mTracer.pSceneRenderer = RtSceneRenderer::create(mpScene);
         createPrograms();
         mReloadResources = true;
+        mHostSceneDirty = true;
+        mResetPool = true;
     }
 }
 
@@ -94,21 +111,6 @@ void VPLTracing::onDataReload()
     createPrograms();
 }
 
-void VPLTracing::determineConstantBufferAddresses()
-{
-  // Get RT-Shader CB sizes and offsets for VPL-Tracing
-  {
-    auto globalVars = mTracer.pVars->getGlobalVars();
-    auto pReflector = globalVars->getReflection();
-    const ParameterBlockReflection* pBlock = pReflector->getDefaultParameterBlock().get();
-    const ReflectionVar* pVar = pBlock->getResource("CB").get();
-    const ReflectionType* pType = pVar->getType().get();
-
-    msLightInfosOffset    = pType->findMember("gLightInfos[0]")->getOffset();
-    msLightInfosArraySize = pType->findMember("gLightInfos")->getType()->getTotalArraySize();
-  }
-}
-
 void VPLTracing::onGuiRender(Gui* pGui)
 {
     pGui->addIntVar("Max #VPLs", mGuiMaxVPLs);
@@ -117,66 +119,106 @@ void VPLTracing::onGuiRender(Gui* pGui)
         mReloadResources = true;
 
     if (pGui->addIntVar("max Bounces", mMaxBounces, 0, 30))
+    {
         if (mTracer.pState) mTracer.pState->setMaxTraceRecursionDepth(mMaxBounces + 1); // IMPORTANT: must be in the range of 0 to 31
+        mResetPool = true; // The slot layout of the pool depends on the number of bounces
+    }
     pGui->addTooltip("Maximum number of bounces", true);
-    pGui->addIntVar("min Bounces", mMinBounces);
+    if (pGui->addIntVar("min Bounces", mMinBounces))
+        mResetPool = true;
     pGui->addTooltip("Minimum number of bounces", true);
 
-}
-
-uint VPLTracing::uploadSceneLightInfos(RenderContext* pRenderContext)
-{
-    // Determine total power of scene lighting
-    float totalPower = 0.f;
-    float totalSurfaceArea = 0.f;
-    for (uint32_t i = 0; i < mpScene->getLightCount(); i++)
-        totalPower += mpScene->getLight(i)->getPower();
-    for (uint32_t i = 0; i < mpScene->getAreaLightCount(); i++)
+    if (pGui->addCheckBox("Temporal reuse", mTemporalReuse))
     {
-        totalSurfaceArea += mpScene->getAreaLight(i)->getSurfaceArea();
-        totalPower += mpScene->getAreaLight(i)->getPower();
+        if (mTracer.pProgram)
+        {
+            if (mTemporalReuse) mTracer.pProgram->addDefine("TEMPORAL_REUSE");
+            else mTracer.pProgram->removeDefine("TEMPORAL_REUSE");
+        }
+        mResetPool = true;
+    }
+    pGui->addTooltip("Keeps a persistent pool of paths and retraces only a fraction of them per frame. Not used by the host tracer", true);
+    if (mTemporalReuse)
+    {
+        pGui->addFloatVar("Regenerated fraction", mRegenerateFraction, 0.01f, 1.f);
+        pGui->addTooltip("Fraction of the paths retraced per frame. Changes of the lights are fully visible after 1 / fraction frames", true);
+        if (pGui->addButton("Reset pool"))
+            mResetPool = true;
+        pGui->addText(("  Paths per frame = " + std::to_string(mNumRegeneratedPaths) + " / " + std::to_string(mNumPaths)).c_str());
+        pGui->addText(("  Max VPL age     = " + std::to_string((int)std::ceil(1.f / mRegenerateFraction)) + " frames").c_str());
     }
 
-    // Determine light type and number of rays to shoot per scene light source
-    const uint numTotalLights = mpScene->getLightCount() + mpScene->getAreaLightCount();
-    mLightInfos.resize(numTotalLights);
-    uint nextLightRayStartIndex = 0;
-    const uint raysToLaunch = mNumPaths = mMaxBounces > 0 ? mMaxVPLs / mMaxBounces : 0;
+    pGui->addCheckBox("Trace on CPU", mUseHostTracer);
+    pGui->addTooltip("Traces the VPLs with the multithreaded host tracer and uploads them. The scene is copied to the host on load and on Apply", true);
+    if (mUseHostTracer && mpHostTracer)
+    {
+        pGui->addText(("Host trace     = " + std::to_string(mpHostTracer->getTraceTime()) + " ms").c_str());
+    }
+    if (pGui->addButton("Check host tracer"))
+        mRunHostTracerCheck = true;
+    pGui->addTooltip("Traces the VPLs twice on the host, checks that both results are identical and compares the counts to the shader", true);
+    if (mHostTracerCheck.numPaths > 0)
+    {
+        pGui->addText(mHostTracerCheck.deterministic ? "  Deterministic" : "  NOT deterministic");
+        pGui->addText(("  #VPLs host/GPU  = " + std::to_string(mHostTracerCheck.numVPLs) + " / " + std::to_string(mHostTracerCheck.gpuNumVPLs)).c_str());
+        pGui->addText(("  #paths host/GPU = " + std::to_string(mHostTracerCheck.numPaths) + " / " + std::to_string(mHostTracerCheck.gpuNumPaths)).c_str());
+        pGui->addText(("  BVH/trace       = " + std::to_string(mHostTracerCheck.bvhBuildTime) + " / " + std::to_string(mHostTracerCheck.traceTime) + " ms").c_str());
+    }
 
-    // Analytic Lights
-    for (uint32_t i = 0; i < mpScene->getLightCount(); i++)
+    if (pGui->addButton("Save host scene"))
+        mSaveHostScene = true;
+    pGui->addTooltip("Writes the host scene next to the scene file, input of SSTDemo -distributedBake <scene>.hostscene <tree> [numWorkers] [maxVPLs]", true);
+    pGui->addIntVar("Bake workers", mNumBakeWorkers, 1, 64);
+    if (pGui->addButton("Check distributed bake"))
+        mRunDistributedBakeCheck = true;
+    pGui->addTooltip("Traces and builds the VPLs in worker processes, merges their trees and compares the result against a trace in this process", true);
+    if (mDistributedBakeCheck.numWorkers > 0)
     {
-        auto pLight = mpScene->getLight(i);
-        mLightInfos[i].type = pLight->getType();
-        mLightInfos[i].index = i;
-        const float powerProportion = pLight->getPower() / totalPower;
-        const uint numRays = static_cast<uint> (std::floor(raysToLaunch * powerProportion));
-        mLightInfos[i].rayRange.x = nextLightRayStartIndex;
-        nextLightRayStartIndex += numRays;
-        mLightInfos[i].rayRange.y = nextLightRayStartIndex;
+        pGui->addText(mDistributedBakeCheck.valid ? "  Valid" : "  NOT valid");
+        pGui->addText(("  #VPLs dist/single  = " + std::to_string(mDistributedBakeCheck.numVPLs) + " / " + std::to_string(mDistributedBakeCheck.singleNumVPLs)).c_str());
+        pGui->addText(("  #paths dist/single = " + std::to_string(mDistributedBakeCheck.numPaths) + " / " + std::to_string(mDistributedBakeCheck.singleNumPaths)).c_str());
+        pGui->addText(("  Intensity error    = " + std::to_string(mDistributedBakeCheck.intensityError)).c_str());
+        pGui->addText(("  Time dist/single   = " + std::to_string(mDistributedBakeCheck.distributedTime) + " / " + std::to_string(mDistributedBakeCheck.singleTime) + " ms").c_str());
     }
 
-    // Area lights
-    const uint32_t numLights = mpScene->getLightCount();
-    for (uint32_t i = 0; i < mpScene->getAreaLightCount(); i++)
+    pGui->addText(("#Emitters = " + std::to_string(mEmitters.size())).c_str());
+    if (pGui->addButton("Check emitter selection"))
+        mRunEmitterSelectionCheck = true;
+    pGui->addTooltip("Selects an emitter for every path like the shader and compares the ray counts of the emitters to their selection pdf", true);
+    if (mEmitterSelectionCheck.numRays > 0)
     {
-        auto pAreaLight = mpScene->getAreaLight(i);
-        mLightInfos[numLights + i].type = pAreaLight->getType();
-        mLightInfos[numLights + i].index = i;
-        const float powerProportion = pAreaLight->getPower() / totalPower;
-        const uint numRays = static_cast<uint> (std::floor(raysToLaunch * powerProportion));
-        const float surfaceAreaProportion = pAreaLight->getSurfaceArea() / totalSurfaceArea;
-        mLightInfos[numLights + i].rayRange.x = nextLightRayStartIndex;
-        nextLightRayStartIndex += numRays;
-        mLightInfos[numLights + i].rayRange.y = nextLightRayStartIndex;
+        pGui->addText(("  Max ray count error = " + std::to_string(mEmitterSelectionCheck.maxRayError)).c_str());
+        pGui->addText(("  Alias table build   = " + std::to_string(mEmitterSelectionCheck.buildTime) + " ms").c_str());
     }
+}
+
+uint VPLTracing::uploadEmitters(RenderContext* pRenderContext)
+{
+    // Point and area lights in world space, every path selects one proportional to its power
+    mEmitters = extractEmitters(mpScene.get());
+    const std::vector<EmitterAliasEntry> aliasTable = buildEmitterAliasTable(mEmitters);
+    const uint32_t numEmitters = (uint32_t)aliasTable.size();
+
+    mNumPaths = mMaxBounces > 0 ? mMaxVPLs / mMaxBounces : 0;
 
-    assert(mLightInfos.size() <= msLightInfosArraySize);
+    auto globalVars = mTracer.pVars->getGlobalVars();
+    globalVars->getConstantBuffer("CB")["gNumEmitters"] = numEmitters;
+    if (numEmitters == 0)
+        return 0;
+
+    // Grow the buffers on demand, the number of emitters is not limited by the light arrays of the scene
+    if (!mpEmitterBuffer || mpEmitterBuffer->getSize() < numEmitters * sizeof(EmitterData))
+    {
+        mpEmitterBuffer           = StructuredBuffer::create(mTracer.pProgram->getRayGenProgram(), "gEmitters",          numEmitters, Resource::BindFlags::ShaderResource);
+        mpEmitterAliasTableBuffer = StructuredBuffer::create(mTracer.pProgram->getRayGenProgram(), "gEmitterAliasTable", numEmitters, Resource::BindFlags::ShaderResource);
+    }
+    mpEmitterBuffer->setBlob(mEmitters.data(), 0, numEmitters * sizeof(EmitterData));
+    mpEmitterAliasTableBuffer->setBlob(aliasTable.data(), 0, numEmitters * sizeof(EmitterAliasEntry));
 
-    ConstantBuffer::SharedPtr pCB = mTracer.pVars->getGlobalVars()->getConstantBuffer("CB");
-    pCB->setBlob(mLightInfos.data(), msLightInfosOffset, sizeof(LightInfo) * numTotalLights);
+    globalVars->setStructuredBuffer("gEmitters", mpEmitterBuffer);
+    globalVars->setStructuredBuffer("gEmitterAliasTable", mpEmitterAliasTableBuffer);
 
-    return totalPower > 0.f ? mLightInfos.at(numTotalLights - 1).rayRange.y : 0;
+    return mNumPaths;
 }
 
 void VPLTracing::onFrameRender(RenderContext* pRenderContext, PassData& passData)
@@ -189,9 +231,17 @@ void VPLTracing::onFrameRender(RenderContext* pRenderContext, PassData& passData
     if (!mUpdateVPLs)
         return;
 
+    // The VPL buffers are created here also when a tree cache is active, its upload writes into them
     if (mReloadResources)
         createResources(passData);
 
+    // VPLs and tree come from the tree cache of the VPLTree pass, which checks the cache against maxVPLs
+    if (passData.getVariable<int>("VPLCacheActive"))
+    {
+        passData.getVariable<int>("maxVPLs") = mMaxVPLs;
+        return;
+    }
+
     StructuredBuffer::SharedPtr pBufferVPLData      = asStructuredBuffer(passData["gVPLData"]);
     StructuredBuffer::SharedPtr pBufferVPLPositions = asStructuredBuffer(passData["gVPLPositions"]);
     StructuredBuffer::SharedPtr pBufferVPLStats     = asStructuredBuffer(passData["gVPLStats"]);
@@ -202,6 +252,14 @@ void VPLTracing::onFrameRender(RenderContext* pRenderContext, PassData& passData
 
     passData.getVariable<int>("maxVPLs")  = mMaxVPLs;
 
+    if (mUseHostTracer)
+    {
+        traceOnHost(pRenderContext, passData);
+        mResetPool = true;
+        mFrameCount++;
+        return;
+    }
+
     // Reset VPL data
     {
         auto pCB = mVPLReset.pVars->getConstantBuffer("CB");
@@ -226,9 +284,9 @@ void VPLTracing::onFrameRender(RenderContext* pRenderContext, PassData& passData
         pCB["gFrameCount"]    = mFrameCount;
         pCB["gNumMaxBounces"] = mMaxBounces;
         pCB["gNumMinBounces"] = mMinBounces;
-        pCB["gNumPaths"]      = mNumPaths;
 
-        const uint raysToLaunch = uploadSceneLightInfos(pRenderContext);
+        const uint raysToLaunch = uploadEmitters(pRenderContext);
+        pCB["gNumPaths"]      = mNumPaths;
         passData.getVariable<int>("numPaths") = mNumPaths;
 
         // Set buffers
@@ -237,10 +295,146 @@ void VPLTracing::onFrameRender(RenderContext* pRenderContext, PassData& passData
         globalVars->setStructuredBuffer("gVPLStats", pBufferVPLStats);
 
         // Launch VPL tracer
-        mTracer.pSceneRenderer->renderScene(pRenderContext, mTracer.pVars, mTracer.pState, uvec3(raysToLaunch, 1, 1));
+        if (mTemporalReuse && raysToLaunch > 0)
+        {
+            globalVars->setStructuredBuffer("gVPLPool", mpVPLPool);
+            globalVars->setStructuredBuffer("gVPLPoolTags", mpVPLPoolTags);
+            pCB["gPathOffset"] = mPoolCursor;
+            const uint pathsToLaunch = getNumPathsToRegenerate();
+            mTracer.pSceneRenderer->renderScene(pRenderContext, mTracer.pVars, mTracer.pState, uvec3(pathsToLaunch, 1, 1));
+            compactVPLPool(pRenderContext, passData);
+        }
+        else
+        {
+            mTracer.pSceneRenderer->renderScene(pRenderContext, mTracer.pVars, mTracer.pState, uvec3(raysToLaunch, 1, 1));
+            mResetPool = true;
+        }
 
         passData.getVariable<int>("VPLUpdate") = 1;
     }
 
+    // Compare the host tracer against the shader with the same frame count
+    if (mRunHostTracerCheck)
+    {
+        updateHostTracerScene(pRenderContext);
+        const VPLStats gpuStats = readBuffer<VPLStats>(pBufferVPLStats)[0];
+        mHostTracerCheck = checkHostTracer(*mpHostTracer, getHostTracerDesc(), gpuStats);
+        mRunHostTracerCheck = false;
+    }
+
+    if (mSaveHostScene)
+    {
+        updateHostTracerScene(pRenderContext);
+        const std::string filename = mpScene->getFilename() + "." + kHostSceneExtension;
+        if (writeHostTracerScene(filename, mpHostTracer->getScene()))
+            logInfo("VPLTracing: Host scene written to '" + filename + "'.");
+        mSaveHostScene = false;
+    }
+
+    if (mRunDistributedBakeCheck)
+    {
+        updateHostTracerScene(pRenderContext);
+        mDistributedBakeCheck = checkDistributedBake(*mpHostTracer, getHostTracerDesc(), (uint32_t)mNumBakeWorkers, mpScene->getFilename() + ".bakecheck." + kHostSceneExtension);
+        mRunDistributedBakeCheck = false;
+    }
+
+    if (mRunEmitterSelectionCheck)
+    {
+        mEmitterSelectionCheck = checkEmitterSelection(mEmitters, (uint32_t)mNumPaths, mFrameCount);
+        mRunEmitterSelectionCheck = false;
+    }
+
     mFrameCount++;
 }
+
+uint VPLTracing::getNumPathsToRegenerate()
+{
+    if (mResetPool)
+    {
+        mPoolCursor = 0;
+        mResetPool = false;
+        mNumRegeneratedPaths = mNumPaths;
+        return mNumRegeneratedPaths;
+    }
+
+    const uint numPaths = (uint)mNumPaths;
+    mNumRegeneratedPaths = std::min(numPaths, (uint)std::ceil(mRegenerateFraction * numPaths));
+    mPoolCursor = (mPoolCursor + mNumRegeneratedPaths) % numPaths;
+    return mNumRegeneratedPaths;
+}
+
+void VPLTracing::compactVPLPool(RenderContext* pRenderContext, PassData& passData)
+{
+    PROFILE("CompactPool");
+
+    const uint numSlots = (uint)(mNumPaths * mMaxBounces);
+
+    StructuredBuffer::SharedPtr pBufferVPLStats = asStructuredBuffer(passData["gVPLStats"]);
+    pRenderContext->uavBarrier(mpVPLPool.get());
+    pRenderContext->uavBarrier(mpVPLPoolTags.get());
+    pRenderContext->uavBarrier(pBufferVPLStats.get());
+
+    auto pCB = mPoolCompact.pVars->getConstantBuffer("CB");
+    pCB["gNumSlots"] = numSlots;
+    pCB["gNumPaths"] = mNumPaths;
+
+    mPoolCompact.pVars->setStructuredBuffer("gVPLData", asStructuredBuffer(passData["gVPLData"]));
+    mPoolCompact.pVars->setStructuredBuffer("gVPLPositions", asStructuredBuffer(passData["gVPLPositions"]));
+    mPoolCompact.pVars->setStructuredBuffer("gVPLStats", pBufferVPLStats);
+    mPoolCompact.pVars->setStructuredBuffer("gVPLPool", mpVPLPool);
+    mPoolCompact.pVars->setStructuredBuffer("gVPLPoolTags", mpVPLPoolTags);
+
+    const glm::uvec3 numGroups = div_round_up(glm::uvec3(numSlots, 1u, 1u), mPoolCompact.pProgram->getReflector()->getThreadGroupSize());
+    pRenderContext->setComputeState(mPoolCompact.pState);
+    pRenderContext->setComputeVars(mPoolCompact.pVars);
+    pRenderContext->dispatch(numGroups.x, numGroups.y, numGroups.z);
+}
+
+void VPLTracing::traceOnHost(RenderContext* pRenderContext, PassData& passData)
+{
+    PROFILE("HostTrace");
+
+    updateHostTracerScene(pRenderContext);
+
+    std::vector<VPLData> vplData;
+    VPLStats stats;
+    if (!mpHostTracer->trace(getHostTracerDesc(), vplData, stats))
+        return;
+
+    std::vector<float3> positions(mMaxVPLs, float3(FLT_MAX));
+    for (int i = 0; i < stats.numVPLs; i++)
+        positions[i] = vplData[i].getPosW();
+
+    asStructuredBuffer(passData["gVPLData"])->setBlob(vplData.data(), 0, vplData.size() * sizeof(VPLData));
+    asStructuredBuffer(passData["gVPLPositions"])->setBlob(positions.data(), 0, positions.size() * sizeof(float3));
+    asStructuredBuffer(passData["gVPLStats"])->setBlob(&stats, 0, sizeof(VPLStats));
+
+    mNumPaths = mMaxBounces > 0 ? mMaxVPLs / mMaxBounces : 0;
+    passData.getVariable<int>("numPaths") = mNumPaths;
+    passData.getVariable<int>("VPLUpdate") = 1;
+}
+
+void VPLTracing::updateHostTracerScene(RenderContext* pRenderContext)
+{
+    if (!mpHostTracer)
+        mpHostTracer = HostVPLTracer::create();
+    if (!mHostSceneDirty)
+        return;
+
+    HostTracerScene scene;
+    if (!extractHostTracerScene(mpScene.get(), pRenderContext, scene))
+        logWarning("VPLTracing: Could not copy the scene to the host, some meshes are missing.");
+    mpHostTracer->setScene(std::move(scene));
+    mHostSceneDirty = false;
+}
+
+HostVPLTracer::Desc VPLTracing::getHostTracerDesc() const
+{
+    HostVPLTracer::Desc desc;
+    desc.maxVPLs    = mMaxVPLs;
+    desc.maxBounces = mMaxBounces;
+    desc.minBounces = mMinBounces;
+    desc.minT       = mMinT;
+    desc.frameCount = mFrameCount;
+    return desc;
+}
@@ -5,6 +5,8 @@
 
 #include "Passes/BasePass.h"
 #include "Passes/Shared/VPLData.h"
+#include "Host/HostVPLTracer.h"
+#include "Host/HostDistributedBake.h"
 
 using namespace Falcor;
 
@@ -35,11 +37,23 @@ private:
 
   RtScene::SharedPtr mpScene;
 
-  /** Examine scene lights and update constant buffer. Returns number of rays to launch.
+  /** Uploads the emitters and their alias table and sets gNumEmitters. Returns number of rays to launch.
   */
-  uint uploadSceneLightInfos(RenderContext* pRenderContext);
+  uint uploadEmitters(RenderContext* pRenderContext);
 
-  void determineConstantBufferAddresses();
+  /** Traces the VPLs with the host tracer and uploads them instead of running the shader.
+  */
+  void traceOnHost(RenderContext* pRenderContext, PassData& passData);
+  void updateHostTracerScene(RenderContext* pRenderContext);
+  HostVPLTracer::Desc getHostTracerDesc() const;
+
+  /** Returns the number of pool paths to regenerate this frame and advances the ring. All paths after a reset.
+  */
+  uint getNumPathsToRegenerate();
+
+  /** Copies the occupied pool slots to gVPLData and sets the VPL stats of the whole pool.
+  */
+  void compactVPLPool(RenderContext* pRenderContext, PassData& passData);
 
   // Ray tracing program.
   struct
@@ -58,9 +72,13 @@ private:
       ComputeState::SharedPtr   pState;
   } mVPLReset;
 
-  // Constant buffer infos
-  size_t msLightInfosOffset = -1;
-  size_t msLightInfosArraySize = -1;
+  // VPL pool compaction program.
+  struct
+  {
+      ComputeProgram::SharedPtr pProgram;
+      ComputeVars::SharedPtr    pVars;
+      ComputeState::SharedPtr   pState;
+  } mPoolCompact;
 
   // Various internal parameters
   bool mReloadResources = false;
@@ -74,5 +92,33 @@ private:
   int mMaxBounces = 3;
   int mMinBounces = 1;
   uint32_t mFrameCount = 0x1337u;  // Frame counter to vary random numbers over time
-  std::vector<LightInfo> mLightInfos;
+
+  // Emitter selection
+  std::vector<EmitterData> mEmitters;
+  StructuredBuffer::SharedPtr mpEmitterBuffer;
+  StructuredBuffer::SharedPtr mpEmitterAliasTableBuffer;
+  bool mRunEmitterSelectionCheck = false;
+  EmitterSelectionCheck mEmitterSelectionCheck;
+
+  // Temporal reuse: persistent pool of paths, a window of the ring is retraced every frame
+  bool mTemporalReuse = false;
+  bool mResetPool = true;             // Regenerate all paths in the next frame
+  float mRegenerateFraction = 0.125f; // Fraction of the paths retraced per frame
+  uint mPoolCursor = 0;               // First path of the next window
+  uint mNumRegeneratedPaths = 0;
+  StructuredBuffer::SharedPtr mpVPLPool;
+  StructuredBuffer::SharedPtr mpVPLPoolTags;
+
+  // Host tracing
+  bool mUseHostTracer = false;
+  bool mHostSceneDirty = true;
+  bool mRunHostTracerCheck = false;
+  HostVPLTracer::SharedPtr mpHostTracer;
+  HostTracerCheck mHostTracerCheck;
+
+  // Distributed bake with worker processes
+  bool mSaveHostScene = false;
+  bool mRunDistributedBakeCheck = false;
+  int mNumBakeWorkers = 4;
+  DistributedBakeCheck mDistributedBakeCheck;
 };
@@ -13,19 +13,22 @@ import Passes.Shared.Random;
 shared RWStructuredBuffer<VPLData>  gVPLData;
 shared RWStructuredBuffer<VPLStats> gVPLStats;
 shared RWStructuredBuffer<float3>   gVPLPositions;
+shared RWStructuredBuffer<VPLData>     gVPLPool;
+shared RWStructuredBuffer<VPLSlotTag>  gVPLPoolTags;
+shared StructuredBuffer<EmitterData>       gEmitters;
+shared StructuredBuffer<EmitterAliasEntry> gEmitterAliasTable;
 
 #include "Passes/Shared/Utils.slang"
 
-AREA_LIGHTS
-
 shared cbuffer CB
 {
-  LightInfo gLightInfos[NUM_LIGHT_SOURCES];
   float  gMinT;
   uint   gFrameCount;
   int    gNumMaxBounces;
   int    gNumMinBounces;
   int    gNumPaths;
+  uint   gNumEmitters;
+  uint   gPathOffset;   // TEMPORAL_REUSE: first path of the ring that is regenerated
 };
 
 struct VPLrayLoad
@@ -34,21 +37,18 @@ struct VPLrayLoad
     float   q;
     int     bounces;
     uint    rngState;
+    uint    pathId;
 };
 
-LightInfo determineLightInfo(in const uint rayIndex)
+// Selects an emitter proportional to its power with the alias table. Every ray jitters inside of its own stratum of [0, 1),
+// so the number of rays of an emitter differs from numRays * pdf by at most one per bucket. See selectEmitterHost().
+uint selectEmitter(in const uint rayIndex, in const uint numRays, inout uint rngState)
 {
-  uint lastLaunchRange = 0;
-  [unroll]
-  for (int i = 0; i < NUM_LIGHT_SOURCES; i++)
-  {
-    const uint currentLaunchRange = gLightInfos[i].rayRange.y;
-    if (rayIndex < currentLaunchRange)
-    {
-      return gLightInfos[i];
-    }
-    lastLaunchRange = currentLaunchRange;
-  }
+  const float u = ((float) rayIndex + nextRand(rngState)) / (float) numRays;
+  const float scaled = u * (float) gNumEmitters;
+  const uint bucket = min((uint) scaled, gNumEmitters - 1);
+  const EmitterAliasEntry entry = gEmitterAliasTable[bucket];
+  return scaled - (float) bucket < entry.threshold ? bucket : entry.alias;
 }
 
 [shader("raygeneration")]
@@ -57,15 +57,27 @@ void VPLTracingRayGen()
   uint2 launchIndex = DispatchRaysIndex().xy;
   uint2 launchDim = DispatchRaysDimensions().xy;
 
-  LightInfo li = determineLightInfo(launchIndex.x);
-  const uint numRays = li.rayRange.y - li.rayRange.x;
+#ifdef TEMPORAL_REUSE
+  // Regenerate a window of the ring of pool paths. Every path keeps its stratum of the emitter selection,
+  // so the pool as a whole stays distributed like a full launch of gNumPaths rays.
+  const uint pathId = (gPathOffset + launchIndex.x) % (uint) gNumPaths;
+  const uint numTotalRays = gNumPaths;
+
+  // Clear the slots of the previous path
+  for (int b = 0; b < gNumMaxBounces; b++)
+    gVPLPoolTags[pathId * gNumMaxBounces + b].pathId = -1;
+#else
+  const uint pathId = launchIndex.x;
   const uint numTotalRays = DispatchRaysDimensions().x;
-  const float rayRatio = (float) numRays / numTotalRays; // This accounts for distribution of rays for lightsources based on intensity
+#endif
 
   // Prepare rng
-  uint seed = wang_hash(launchIndex.x);
+  uint seed = wang_hash(pathId);
   uint rngState = initRand(seed, gFrameCount, 16);
 
+  // Select the light source, the selection pdf accounts for the distribution of rays based on power
+  const EmitterData e = gEmitters[selectEmitter(pathId, numTotalRays, rngState)];
+
   // Setup ray description
   RayDesc rayDesc;
   rayDesc.TMin = gMinT;
@@ -76,29 +88,28 @@ void VPLTracingRayGen()
   rayLoad.rngState = rngState;
   rayLoad.bounces  = 0;
   rayLoad.q        = 1.f;  // Path start has survivabilty of 100%
+  rayLoad.pathId   = pathId;
 
   // Which type of light?
-  if (li.type == LightPoint)
+  if (e.type == LightPoint)
   {
-      LightData ld = gLights[li.index];
       const float pdf = 1.f / M_PI;
-      const float3 radiance = ld.intensity / pdf / rayRatio / gNumPaths;
+      const float3 radiance = e.intensity / pdf / e.pdf / gNumPaths;
 
-      rayDesc.Origin    = ld.posW;
+      rayDesc.Origin    = e.posW;
       rayDesc.Direction = uniformSphereSample(float3(1,0,0), nextRand2(rayLoad.rngState));
       rayLoad.radiance  = radiance;
   }
-  else if (li.type == LightArea)
+  else if (e.type == LightArea)
   {
-      AreaLightData ld = gAreaLights[li.index];
-      const float pdf = 1.f / ld.scaledSurfaceArea;
-      const float3 radiance = ld.intensity / pdf / rayRatio / gNumPaths;
+      const float pdf = 1.f / e.surfaceArea;
+      const float3 radiance = e.intensity / pdf / e.pdf / gNumPaths;
 
       // Note: Tangent and bitangent are the actual extents! We assume that all area light sources are rectangular and consist of only 2 triangles!
+      // The emitter is already transformed to world space, see extractEmitters().
       float2 rn = float2(nextRand(rayLoad.rngState), nextRand(rayLoad.rngState)) - 0.5f;
-      const float3 dirL = mul(ld.dirW, ld.normMat).xyz;
-      rayDesc.Origin = mul(float4(ld.posW,1.f), ld.transMat).xyz + mul(ld.bitangent, float3x3(ld.transMat)).xyz * rn.x - mul(ld.tangent, float3x3(ld.transMat)).xyz * rn.y + dirL * 0.0001f;
-      rayDesc.Direction = cosineHemisphereSample(dirL, float2(nextRand(rayLoad.rngState), nextRand(rayLoad.rngState)));
+      rayDesc.Origin = e.posW + e.bitangentW * rn.x - e.tangentW * rn.y + e.dirW * 0.0001f;
+      rayDesc.Direction = cosineHemisphereSample(e.dirW, float2(nextRand(rayLoad.rngState), nextRand(rayLoad.rngState)));
       rayLoad.radiance = radiance;
   }
   else
@@ -148,7 +159,11 @@ void VPLTraceClosestHit(inout VPLrayLoad rayLoad, in BuiltInTriangleIntersection
     rayLoad.bounces  += 1;
 
     // Place VPL at current position
+#ifdef TEMPORAL_REUSE
+    addPoolVPL(rayLoad.pathId, rayLoad.bounces, sd.posW, sd.N, rayLoad.radiance);
+#else
     addVPL(gVPLData, gVPLPositions, getNextID(), sd.posW, sd.N, rayLoad.radiance);
+#endif
 
     // Maximum bounces reached
     if (rayLoad.bounces >= gNumMaxBounces)
@@ -182,13 +197,14 @@ int incrementVPLPaths()
   return numPaths;
 }
 
-void addVPL(in RWStructuredBuffer<VPLData> vplData, in RWStructuredBuffer<float3> vplPositions, in int id, in float3 posW, in float3 normW, in float3 radiance)
+VPLData createVPL(in int id, in float3 posW, in float3 normW, in float3 radiance)
 {
   VPLData vpl;
   vpl.setPosW(posW);
   vpl.setEarlyStop(0.f);
 
   vpl.setNormW(normW);
+  vpl.setConeAngle(0.f);
   vpl.setColor(radiance);
   const float intensity = luminance(radiance);
   vpl.setIntensity(intensity);
@@ -201,8 +217,26 @@ void addVPL(in RWStructuredBuffer<VPLData> vplData, in RWStructuredBuffer<float3
   vpl.idChild1 = -1;
   vpl.idChild2 = -1;
   vpl.numVPLSubTree = 0;
+  return vpl;
+}
+
+void addVPL(in RWStructuredBuffer<VPLData> vplData, in RWStructuredBuffer<float3> vplPositions, in int id, in float3 posW, in float3 normW, in float3 radiance)
+{
+  VPLData vpl = createVPL(id, posW, normW, radiance);
 
   // Write data to buffers
   vplData[vpl.id]      = vpl;
   vplPositions[vpl.id] = posW;
 }
+
+// Stores the VPL in the pool slot of its path and bounce. The id is assigned by CompactVPLPool.cs.hlsl.
+void addPoolVPL(in uint pathId, in int bounce, in float3 posW, in float3 normW, in float3 radiance)
+{
+  const uint slot = pathId * gNumMaxBounces + (bounce - 1);
+  gVPLPool[slot] = createVPL(-1, posW, normW, radiance);
+
+  VPLSlotTag tag;
+  tag.pathId     = pathId;
+  tag.birthFrame = gFrameCount;
+  gVPLPoolTags[slot] = tag;
+}
@@ -0,0 +1,113 @@
+// Tuner for the early stop thresholds, see HostApproxTuner.h
+
+#include "HostApproxTuner.h"
+#include "HostUtils.h"
+
+namespace
+{
+    std::string to_string(const TreeApproxParams& params)
+    {
+        return "min normal score " + std::to_string(params.minNormalScore) + ", max normal z std " + std::to_string(params.maxNormalZStd);
+    }
+
+    /** Builds the tree with the given thresholds and measures the traversal depth and the error at the receivers.
+        The point stays invalid if the build fails.
+    */
+    void measureSetting(HostTreeBuilder& builder, HostTreeBuilder::Desc buildDesc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs,
+        const std::vector<HostShadingPoint>& receivers, const std::vector<float>& reference, uint32_t numEstimates, ApproxTuningPoint& point)
+    {
+        buildDesc.approxParams = point.params;
+        if (!builder.build(buildDesc, vplData, numVPLs, maxVPLs))
+        {
+            logWarning("tuneApproxParams: Build with " + to_string(point.params) + " failed, setting skipped.");
+            return;
+        }
+
+        const HostSamplingError samplingError = estimateSamplingError(vplData, maxVPLs, receivers, reference, nullptr, numEstimates);
+        point.avgSteps = samplingError.avgSteps;
+        point.error = samplingError.error;
+        point.valid = true;
+    }
+}
+
+ApproxTuningResult tuneApproxParams(const HostTreeBuilder::Desc& buildDesc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs,
+    const std::vector<HostShadingPoint>& receivers, const ApproxTuningDesc& desc)
+{
+    ApproxTuningResult result;
+    if (numVPLs <= 1 || maxVPLs <= 0 || vplData.size() < (size_t)maxVPLs || receivers.empty() || desc.numEstimates == 0)
+        return result;
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, HostSamplingParams());
+
+    // The build only writes the internal node range, the leaves stay the same for every setting
+    std::vector<VPLData> treeData(vplData.begin(), vplData.begin() + maxVPLs);
+    HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+
+    // No node passes a normal score above 1
+    result.fullDepth.params.minNormalScore = 2.f;
+    result.fullDepth.params.maxNormalZStd = 0.f;
+    measureSetting(*pBuilder, buildDesc, treeData, numVPLs, maxVPLs, receivers, reference, desc.numEstimates, result.fullDepth);
+    if (!result.fullDepth.valid)
+    {
+        logWarning("tuneApproxParams: The full depth tree can't be built, there is no quality target.");
+        return result;
+    }
+    result.numReceivers = (uint32_t)receivers.size();
+
+    for (float minNormalScore : desc.minNormalScores)
+    {
+        for (float maxNormalZStd : desc.maxNormalZStds)
+        {
+            ApproxTuningPoint point;
+            point.params.minNormalScore = minNormalScore;
+            point.params.maxNormalZStd = maxNormalZStd;
+            measureSetting(*pBuilder, buildDesc, treeData, numVPLs, maxVPLs, receivers, reference, desc.numEstimates, point);
+            result.points.push_back(point);
+        }
+    }
+
+    // Pareto front: walk the valid settings from the cheapest one and keep every setting that improves the error
+    std::vector<uint32_t> order;
+    for (uint32_t i = 0; i < (uint32_t)result.points.size(); i++)
+    {
+        if (result.points[i].valid) order.push_back(i);
+    }
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b)
+    {
+        const ApproxTuningPoint& pa = result.points[a];
+        const ApproxTuningPoint& pb = result.points[b];
+        return pa.avgSteps != pb.avgSteps ? pa.avgSteps < pb.avgSteps : pa.error < pb.error;
+    });
+
+    float bestError = FLT_MAX;
+    const float maxError = result.fullDepth.error * (1.f + desc.errorTolerance);
+    for (uint32_t i : order)
+    {
+        ApproxTuningPoint& point = result.points[i];
+        if (point.error < bestError)
+        {
+            point.pareto = true;
+            bestError = point.error;
+            logInfo("tuneApproxParams: Pareto " + to_string(point.params) + ": " + std::to_string(point.avgSteps) + " steps, error " + std::to_string(point.error));
+        }
+        // The cheapest setting within the target is on the front
+        if (result.selected < 0 && point.error <= maxError)
+            result.selected = (int)i;
+    }
+
+    result.time = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+
+    logInfo("tuneApproxParams: Full depth " + std::to_string(result.fullDepth.avgSteps) + " steps, error " + std::to_string(result.fullDepth.error)
+        + ", " + std::to_string(order.size()) + " of " + std::to_string(result.points.size()) + " settings built in " + std::to_string(result.time) + " ms");
+    if (result.selected >= 0)
+    {
+        const ApproxTuningPoint& point = result.points[result.selected];
+        logInfo("tuneApproxParams: Selected " + to_string(point.params) + ": " + std::to_string(point.avgSteps) + " steps, error " + std::to_string(point.error));
+    }
+    else
+    {
+        logWarning("tuneApproxParams: No setting meets the error target of " + std::to_string(maxError) + ", use the full depth traversal.");
+    }
+    return result;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeBuilder.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** Offline tuner for the early stop thresholds of TreeApproxParams.
+    Rebuilds a captured VPL set with HostTreeBuilder for every pair of thresholds on a grid and samples the tree at
+    captured receivers (G-buffer samples) with sampleVPLTreeHost(). Every setting is measured by its mean traversal depth
+    and its relative RMS error against the sum over all VPLs, which is what a full depth traversal converges to.
+    The selected setting is the cheapest one whose error stays within a tolerance of the full depth traversal.
+*/
+
+/** Tuning parameters.
+*/
+struct ApproxTuningDesc
+{
+    std::vector<float> minNormalScores = { 0.f, 0.125f, 0.25f, 0.375f, 0.5f, 0.625f, 0.75f, 0.875f, 1.f };
+    std::vector<float> maxNormalZStds = { 0.f, 0.025f, 0.05f, 0.1f, 0.15f, 0.2f, 0.3f, 0.4f };
+    float errorTolerance = 0.05f;   ///< Quality target: error at most (1 + errorTolerance) * error of the full depth traversal.
+    uint32_t numEstimates = 16;     ///< One sample estimates per receiver and setting.
+};
+
+/** Measurement of one setting.
+*/
+struct ApproxTuningPoint
+{
+    TreeApproxParams params;
+    float avgSteps = 0.f;           ///< Mean traversal depth per sample.
+    float error = 0.f;              ///< Mean relative RMS error of a one sample estimate.
+    bool valid = false;             ///< The tree of the setting was built, avgSteps and error are only measured then.
+    bool pareto = false;            ///< No other valid setting is both cheaper and more accurate.
+};
+
+/** Result of tuneApproxParams().
+*/
+struct ApproxTuningResult
+{
+    std::vector<ApproxTuningPoint> points;  ///< All settings of the grid, in grid order.
+    ApproxTuningPoint fullDepth;            ///< Traversal without early stops.
+    int selected = -1;                      ///< Index of the cheapest valid setting that meets the quality target, -1 if none does.
+    uint32_t numReceivers = 0;              ///< 0 if the tuning failed, e.g. the full depth tree couldn't be built.
+    float time = 0.f;                       ///< Time in milliseconds.
+
+    /** Returns the selected parameters, or the ones of the full depth traversal if no setting meets the quality target.
+    */
+    const TreeApproxParams& getSelectedParams() const { return selected >= 0 ? points[selected].params : fullDepth.params; }
+};
+
+/** Sweeps the thresholds of the approximation parameters.
+    \param[in] buildDesc Build parameters. The approximation parameters are replaced by the grid.
+    \param[in] vplData VPL buffer as written by the VPL tracer. Only the leaf range is used.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] receivers Receivers to sample the trees at, e.g. G-buffer samples.
+    \param[in] desc Tuning parameters.
+    \return Tuning result. The Pareto front and the selected setting are logged, settings whose build failed are logged and skipped.
+*/
+ApproxTuningResult tuneApproxParams(const HostTreeBuilder::Desc& buildDesc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs,
+    const std::vector<HostShadingPoint>& receivers, const ApproxTuningDesc& desc = ApproxTuningDesc());
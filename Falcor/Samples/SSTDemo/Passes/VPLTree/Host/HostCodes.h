@@ -0,0 +1,277 @@
+#pragma once
+
+#include "Falcor.h"
+#include <cstring>
+#include "../../Shared/VPLTreeStructs.h"
+
+/** Host port of Codes.slangh. Keep both files in sync!
+*/
+
+inline uint32_t expand_bits(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+inline uint32_t morton_code(float3 xyz, float resolution = 1024.0f)
+{
+    xyz.x = std::min(std::max(xyz.x * resolution, 0.0f), resolution - 1.0f);
+    xyz.y = std::min(std::max(xyz.y * resolution, 0.0f), resolution - 1.0f);
+    xyz.z = std::min(std::max(xyz.z * resolution, 0.0f), resolution - 1.0f);
+    uint32_t xx = expand_bits(uint32_t(xyz.x));
+    uint32_t yy = expand_bits(uint32_t(xyz.y));
+    uint32_t zz = expand_bits(uint32_t(xyz.z));
+    return xx * 4 + yy * 2 + zz;
+}
+
+/** Order preserving uint key of a float, see TreeBounds.cs.slang.
+*/
+inline uint32_t float_to_ordered(float f)
+{
+    uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return (u & 0x80000000u) != 0 ? ~u : u | 0x80000000u;
+}
+
+inline float ordered_to_float(uint32_t u)
+{
+    u = (u & 0x80000000u) != 0 ? u & 0x7FFFFFFFu : ~u;
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/** Maximum number of morton code bits per axis.
+*/
+const uint32_t kMaxMortonBitsPerAxis = 21;
+
+/** Morton code with a configurable number of bits per axis.
+    The bits are interleaved from the most significant level down in x, y, z order. An axis without bits left at a level is skipped.
+    With 10 bits per axis this is morton_code().
+*/
+inline uint64_t morton_code_bits(float3 xyz, uint3 bits)
+{
+    uint32_t cells[3];
+    for (int a = 0; a < 3; a++)
+    {
+        const float resolution = float(1u << bits[a]);
+        cells[a] = uint32_t(std::min(std::max(xyz[a] * resolution, 0.0f), resolution - 1.0f));
+    }
+
+    const int maxBits = (int)std::max(bits.x, std::max(bits.y, bits.z));
+    uint64_t code = 0;
+    for (int b = maxBits - 1; b >= 0; b--)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (b < (int)bits[a])
+                code = (code << 1) | ((cells[a] >> b) & 1);
+        }
+    }
+    return code;
+}
+
+/** Returns the size of the volume used for the morton codes. Flat volumes, e.g. the tight bounds of VPLs on a single wall,
+    get a minimal extent along the flat axes instead of dividing by zero. Matches TreeCode.cs.slang.
+*/
+inline float3 getCodeExtent(const float3& minExtent, const float3& maxExtent)
+{
+    return max(maxExtent - minExtent, float3(1e-20f));
+}
+
+/** Bit layout of the sort codes [Morton|Direction|Id].
+    64bit codes store all fields in one word and the id takes all bits below the direction code.
+    128bit codes are stored as (high, low) words with [Morton|Direction] in the high word and the id in the low word,
+    so the morton code can use up to 64 bits minus the direction code without limiting the number of VPLs.
+*/
+struct TreeCodeLayout
+{
+    uint3 mortonBits = uint3(10);   ///< Morton code bits per axis.
+    uint32_t numMortonBits = 0;
+    uint32_t numDirBits = 0;
+    uint32_t numIdBits = 0;
+    uint32_t beginMorton = 0;       ///< Bit offsets in the whole code. Offsets >= 64 are in the high word of 128bit codes.
+    uint32_t beginDir = 0;
+    uint32_t beginId = 0;
+    bool use128Bit = false;
+    bool valid = false;
+};
+
+/** Computes the code layout. Falls back to 128bit codes if the id of maxVPLs doesn't fit into the bits left by a 64bit code.
+    \param[in] mortonBits Morton code bits per axis, each in [1, kMaxMortonBitsPerAxis].
+    \param[in] numSphereSections Number of sphere subdivisions of the direction code.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] force128Bit Use 128bit codes even if all fields fit into 64 bits.
+    \return The layout. Not valid if the morton and direction codes don't fit into one word.
+*/
+inline TreeCodeLayout computeTreeCodeLayout(uint3 mortonBits, uint32_t numSphereSections, int maxVPLs, bool force128Bit)
+{
+    TreeCodeLayout layout;
+    layout.mortonBits    = mortonBits;
+    layout.numMortonBits = mortonBits.x + mortonBits.y + mortonBits.z;
+    layout.numDirBits    = numDirCodeBits(numSphereSections);
+
+    for (int a = 0; a < 3; a++)
+    {
+        if (mortonBits[a] < 1 || mortonBits[a] > kMaxMortonBitsPerAxis)
+            return layout;
+    }
+
+    const uint32_t numKeyBits = layout.numMortonBits + layout.numDirBits;
+    if (numKeyBits > 64 || maxVPLs < 0)
+        return layout;
+
+    const uint32_t numFreeBits = 64 - numKeyBits;
+    const bool fits64Bit = numFreeBits > 0 && (uint64_t)maxVPLs <= (1llu << numFreeBits) - 1;
+
+    layout.use128Bit = force128Bit || !fits64Bit;
+    if (layout.use128Bit)
+    {
+        layout.numIdBits   = 32;
+        layout.beginId     = 0;
+        layout.beginDir    = 64;
+        layout.beginMorton = 64 + layout.numDirBits;
+    }
+    else
+    {
+        layout.numIdBits   = numFreeBits;
+        layout.beginId     = 0;
+        layout.beginDir    = layout.numIdBits;
+        layout.beginMorton = layout.numDirBits + layout.numIdBits;
+    }
+    layout.valid = true;
+    return layout;
+}
+
+inline void updateSmallestIndexAndDistance(float& smallestDistance, int& smallestIndex, float currentDistance, int currentIndex)
+{
+    if (currentDistance < smallestDistance)
+    {
+        smallestIndex = currentIndex;
+        smallestDistance = currentDistance;
+    }
+}
+
+inline void shift_update(int& integer, int value, int value_size_in_bit = 1)
+{
+    integer <<= value_size_in_bit;
+    integer |= value;
+}
+
+inline uint32_t direction_code_bits(const int sections)
+{
+    return (3 + 2 * sections + 1) + 1;
+}
+
+inline int direction_code(const float3 vec, const int sections)
+{
+    if (dot(vec, vec) < 0.0001f)
+    {
+        // Omnidirectional source, see Codes.slangh
+        return (1 << (3 + 2 * sections + 1));
+    }
+
+    int final_int = 0;
+    float3 x_base_vec = float3(0.f);
+    float3 y_base_vec = float3(0.f);
+    float3 z_base_vec = float3(0.f);
+
+    float3 plane_normal = float3(0.f);
+    float normal_constant = 1.f / std::sqrt(3.f);
+    if (vec.x >= 0)
+    {
+        x_base_vec.x = 1;
+        shift_update(final_int, 1);
+        plane_normal.x = normal_constant;
+    }
+    else
+    {
+        x_base_vec.x = -1;
+        shift_update(final_int, 0);
+        plane_normal.x = -normal_constant;
+    }
+    if (vec.y >= 0)
+    {
+        y_base_vec.y = 1;
+        shift_update(final_int, 1);
+        plane_normal.y = normal_constant;
+    }
+    else
+    {
+        y_base_vec.y = -1;
+        shift_update(final_int, 0);
+        plane_normal.y = -normal_constant;
+    }
+    if (vec.z >= 0)
+    {
+        z_base_vec.z = 1;
+        shift_update(final_int, 1);
+        plane_normal.z = normal_constant;
+    }
+    else
+    {
+        z_base_vec.z = -1;
+        shift_update(final_int, 0);
+        plane_normal.z = -normal_constant;
+    }
+
+    float scaling_factor = normal_constant / dot(plane_normal, vec);
+
+    float3 projected_vec = vec * scaling_factor;
+
+    for (int i = 0; i < sections; i++)
+    {
+        float3 xy_mix_vector = normalize(x_base_vec + y_base_vec);
+        float3 xz_mix_vector = normalize(x_base_vec + z_base_vec);
+        float3 yz_mix_vector = normalize(y_base_vec + z_base_vec);
+
+        float distSq_x = dot(projected_vec, x_base_vec);
+        float distSq_y = dot(projected_vec, y_base_vec);
+        float distSq_z = dot(projected_vec, z_base_vec);
+
+        float distSq_xy = dot(projected_vec, xy_mix_vector);
+        float distSq_xz = dot(projected_vec, xz_mix_vector);
+        float distSq_yz = dot(projected_vec, yz_mix_vector);
+
+        float subsection0 = distSq_y + distSq_xy + distSq_yz;
+        float subsection1 = distSq_z + distSq_xz + distSq_yz;
+        float subsection2 = distSq_x + distSq_xy + distSq_xz;
+        float subsection3 = (distSq_xz + distSq_xy + distSq_yz) * 0.85f;
+
+        float smallest_distance = 100;
+        int smallest_index = -1;
+
+        updateSmallestIndexAndDistance(smallest_distance, smallest_index, subsection0, 0);
+        updateSmallestIndexAndDistance(smallest_distance, smallest_index, subsection1, 1);
+        updateSmallestIndexAndDistance(smallest_distance, smallest_index, subsection2, 2);
+        updateSmallestIndexAndDistance(smallest_distance, smallest_index, subsection3, 3);
+
+        if (smallest_index == 0)
+        {
+            x_base_vec = xy_mix_vector;
+            z_base_vec = yz_mix_vector;
+        }
+        if (smallest_index == 1)
+        {
+            x_base_vec = xz_mix_vector;
+            y_base_vec = yz_mix_vector;
+        }
+        if (smallest_index == 2)
+        {
+            y_base_vec = xy_mix_vector;
+            z_base_vec = xz_mix_vector;
+        }
+        if (smallest_index == 3)
+        {
+            x_base_vec = xy_mix_vector;
+            y_base_vec = yz_mix_vector;
+            z_base_vec = xz_mix_vector;
+        }
+
+        shift_update(final_int, smallest_index, 2);
+    }
+    return final_int;
+}
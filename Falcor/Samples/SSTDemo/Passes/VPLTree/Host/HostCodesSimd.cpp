@@ -0,0 +1,380 @@
+#include "HostCodesSimd.h"
+#include "HostCodes.h"
+#include <random>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define AVX2_FUNC
+#else
+#include <cpuid.h>
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+namespace
+{
+    // Omnidirectional code, see direction_code().
+    inline int omniDirectionCode(int sections)
+    {
+        return (1 << (3 + 2 * sections + 1));
+    }
+
+    inline void storeCode(uint64_t& code, uint64_t mortonCode, uint64_t dirCode, uint64_t idCode, const TreeCodeLayout& layout)
+    {
+        code = (mortonCode << layout.beginMorton) | (dirCode << layout.beginDir) | (idCode << layout.beginId);
+    }
+
+    inline void storeCode(Key128& code, uint64_t mortonCode, uint64_t dirCode, uint64_t idCode, const TreeCodeLayout& layout)
+    {
+        code.hi = (mortonCode << (layout.beginMorton - 64)) | (dirCode << (layout.beginDir - 64));
+        code.lo = idCode << layout.beginId;
+    }
+
+    inline void storeInvalidCode(uint64_t& code) { code = uint64_t(-1); }
+    inline void storeInvalidCode(Key128& code) { code = { uint64_t(-1), uint64_t(-1) }; }
+
+    AVX2_FUNC inline __m256i expandBits8(__m256i v)
+    {
+        v = _mm256_and_si256(_mm256_mullo_epi32(v, _mm256_set1_epi32(0x00010001)), _mm256_set1_epi32(0xFF0000FF));
+        v = _mm256_and_si256(_mm256_mullo_epi32(v, _mm256_set1_epi32(0x00000101)), _mm256_set1_epi32(0x0F00F00F));
+        v = _mm256_and_si256(_mm256_mullo_epi32(v, _mm256_set1_epi32(0x00000011)), _mm256_set1_epi32(0xC30C30C3));
+        v = _mm256_and_si256(_mm256_mullo_epi32(v, _mm256_set1_epi32(0x00000005)), _mm256_set1_epi32(0x49249249));
+        return v;
+    }
+
+    AVX2_FUNC inline __m256i quantize8(__m256 x, __m256 resolution, __m256 maxValue)
+    {
+        x = _mm256_min_ps(_mm256_max_ps(_mm256_mul_ps(x, resolution), _mm256_setzero_ps()), maxValue);
+        return _mm256_cvttps_epi32(x);
+    }
+
+    AVX2_FUNC void mortonCodes8Avx2(const float* pX, const float* pY, const float* pZ, uint32_t* pCodes)
+    {
+        const __m256 resolution = _mm256_set1_ps(1024.0f);
+        const __m256 maxValue = _mm256_set1_ps(1024.0f - 1.0f);
+
+        const __m256i xx = expandBits8(quantize8(_mm256_loadu_ps(pX), resolution, maxValue));
+        const __m256i yy = expandBits8(quantize8(_mm256_loadu_ps(pY), resolution, maxValue));
+        const __m256i zz = expandBits8(quantize8(_mm256_loadu_ps(pZ), resolution, maxValue));
+
+        // xx * 4 + yy * 2 + zz
+        const __m256i code = _mm256_add_epi32(_mm256_add_epi32(_mm256_slli_epi32(xx, 2), _mm256_slli_epi32(yy, 1)), zz);
+        _mm256_storeu_si256((__m256i*)pCodes, code);
+    }
+
+    struct Vec8
+    {
+        __m256 x, y, z;
+    };
+
+    // Same operation order as glm::dot: (a.x * b.x + a.y * b.y) + a.z * b.z. No FMA to stay bit-exact.
+    AVX2_FUNC inline __m256 dot8(const Vec8& a, const Vec8& b)
+    {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(a.x, b.x), _mm256_mul_ps(a.y, b.y)), _mm256_mul_ps(a.z, b.z));
+    }
+
+    // Same as glm::normalize: v * (1 / sqrt(dot(v, v)))
+    AVX2_FUNC inline Vec8 normalizeSum8(const Vec8& a, const Vec8& b)
+    {
+        Vec8 s = { _mm256_add_ps(a.x, b.x), _mm256_add_ps(a.y, b.y), _mm256_add_ps(a.z, b.z) };
+        const __m256 invLength = _mm256_div_ps(_mm256_set1_ps(1.f), _mm256_sqrt_ps(dot8(s, s)));
+        s.x = _mm256_mul_ps(s.x, invLength);
+        s.y = _mm256_mul_ps(s.y, invLength);
+        s.z = _mm256_mul_ps(s.z, invLength);
+        return s;
+    }
+
+    AVX2_FUNC inline void select8(Vec8& dst, const Vec8& src, __m256 mask)
+    {
+        dst.x = _mm256_blendv_ps(dst.x, src.x, mask);
+        dst.y = _mm256_blendv_ps(dst.y, src.y, mask);
+        dst.z = _mm256_blendv_ps(dst.z, src.z, mask);
+    }
+
+    AVX2_FUNC inline void updateSmallest8(__m256& smallestDistance, __m256i& smallestIndex, __m256 currentDistance, int currentIndex)
+    {
+        const __m256 lt = _mm256_cmp_ps(currentDistance, smallestDistance, _CMP_LT_OQ);
+        smallestDistance = _mm256_blendv_ps(smallestDistance, currentDistance, lt);
+        smallestIndex = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(smallestIndex), _mm256_castsi256_ps(_mm256_set1_epi32(currentIndex)), lt));
+    }
+
+    AVX2_FUNC void directionCodes8Avx2(const float* pX, const float* pY, const float* pZ, int sections, int* pCodes)
+    {
+        const Vec8 vec = { _mm256_loadu_ps(pX), _mm256_loadu_ps(pY), _mm256_loadu_ps(pZ) };
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.f);
+        const __m256 minusOne = _mm256_set1_ps(-1.f);
+        const float normal_constant = 1.f / std::sqrt(3.f);
+        const __m256 nc = _mm256_set1_ps(normal_constant);
+        const __m256 minusNc = _mm256_set1_ps(-normal_constant);
+
+        const __m256 omni = _mm256_cmp_ps(dot8(vec, vec), _mm256_set1_ps(0.0001f), _CMP_LT_OQ);
+
+        // Octant
+        const __m256 geX = _mm256_cmp_ps(vec.x, zero, _CMP_GE_OQ);
+        const __m256 geY = _mm256_cmp_ps(vec.y, zero, _CMP_GE_OQ);
+        const __m256 geZ = _mm256_cmp_ps(vec.z, zero, _CMP_GE_OQ);
+
+        const __m256i bitOne = _mm256_set1_epi32(1);
+        __m256i code = _mm256_and_si256(_mm256_castps_si256(geX), bitOne);
+        code = _mm256_or_si256(_mm256_slli_epi32(code, 1), _mm256_and_si256(_mm256_castps_si256(geY), bitOne));
+        code = _mm256_or_si256(_mm256_slli_epi32(code, 1), _mm256_and_si256(_mm256_castps_si256(geZ), bitOne));
+
+        Vec8 xBase = { _mm256_blendv_ps(minusOne, one, geX), zero, zero };
+        Vec8 yBase = { zero, _mm256_blendv_ps(minusOne, one, geY), zero };
+        Vec8 zBase = { zero, zero, _mm256_blendv_ps(minusOne, one, geZ) };
+        const Vec8 planeNormal = { _mm256_blendv_ps(minusNc, nc, geX), _mm256_blendv_ps(minusNc, nc, geY), _mm256_blendv_ps(minusNc, nc, geZ) };
+
+        const __m256 scalingFactor = _mm256_div_ps(nc, dot8(planeNormal, vec));
+        const Vec8 projected = { _mm256_mul_ps(vec.x, scalingFactor), _mm256_mul_ps(vec.y, scalingFactor), _mm256_mul_ps(vec.z, scalingFactor) };
+
+        const __m256 subsection3Scale = _mm256_set1_ps(0.85f);
+        for (int i = 0; i < sections; i++)
+        {
+            const Vec8 xyMix = normalizeSum8(xBase, yBase);
+            const Vec8 xzMix = normalizeSum8(xBase, zBase);
+            const Vec8 yzMix = normalizeSum8(yBase, zBase);
+
+            const __m256 distX = dot8(projected, xBase);
+            const __m256 distY = dot8(projected, yBase);
+            const __m256 distZ = dot8(projected, zBase);
+
+            const __m256 distXY = dot8(projected, xyMix);
+            const __m256 distXZ = dot8(projected, xzMix);
+            const __m256 distYZ = dot8(projected, yzMix);
+
+            const __m256 subsection0 = _mm256_add_ps(_mm256_add_ps(distY, distXY), distYZ);
+            const __m256 subsection1 = _mm256_add_ps(_mm256_add_ps(distZ, distXZ), distYZ);
+            const __m256 subsection2 = _mm256_add_ps(_mm256_add_ps(distX, distXY), distXZ);
+            const __m256 subsection3 = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(distXZ, distXY), distYZ), subsection3Scale);
+
+            __m256 smallestDistance = _mm256_set1_ps(100.f);
+            __m256i smallestIndex = _mm256_set1_epi32(-1);
+            updateSmallest8(smallestDistance, smallestIndex, subsection0, 0);
+            updateSmallest8(smallestDistance, smallestIndex, subsection1, 1);
+            updateSmallest8(smallestDistance, smallestIndex, subsection2, 2);
+            updateSmallest8(smallestDistance, smallestIndex, subsection3, 3);
+
+            const __m256 is0 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(smallestIndex, _mm256_set1_epi32(0)));
+            const __m256 is1 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(smallestIndex, _mm256_set1_epi32(1)));
+            const __m256 is2 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(smallestIndex, _mm256_set1_epi32(2)));
+            const __m256 is3 = _mm256_castsi256_ps(_mm256_cmpeq_epi32(smallestIndex, _mm256_set1_epi32(3)));
+
+            select8(xBase, xyMix, _mm256_or_ps(is0, is3));
+            select8(xBase, xzMix, is1);
+            select8(yBase, yzMix, _mm256_or_ps(is1, is3));
+            select8(yBase, xyMix, is2);
+            select8(zBase, yzMix, is0);
+            select8(zBase, xzMix, _mm256_or_ps(is2, is3));
+
+            code = _mm256_or_si256(_mm256_slli_epi32(code, 2), smallestIndex);
+        }
+
+        code = _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(code), _mm256_castsi256_ps(_mm256_set1_epi32(omniDirectionCode(sections))), omni));
+        _mm256_storeu_si256((__m256i*)pCodes, code);
+    }
+}
+
+bool hasAVX2()
+{
+    static const bool supported = []()
+    {
+#if defined(_MSC_VER)
+        int info[4];
+        __cpuid(info, 0);
+        if (info[0] < 7) return false;
+        __cpuid(info, 1);
+        const bool osxsave = (info[2] & (1 << 27)) != 0;
+        const bool avx = (info[2] & (1 << 28)) != 0;
+        if (!osxsave || !avx) return false;
+        if ((_xgetbv(0) & 0x6) != 0x6) return false; // OS saves the YMM registers
+        __cpuidex(info, 7, 0);
+        return (info[1] & (1 << 5)) != 0;
+#else
+        return __builtin_cpu_supports("avx2") != 0;
+#endif
+    }();
+    return supported;
+}
+
+void mortonCodes8(const float* pX, const float* pY, const float* pZ, uint32_t* pCodes)
+{
+    if (hasAVX2())
+    {
+        mortonCodes8Avx2(pX, pY, pZ, pCodes);
+        return;
+    }
+    for (int i = 0; i < 8; i++)
+        pCodes[i] = morton_code(float3(pX[i], pY[i], pZ[i]));
+}
+
+void directionCodes8(const float* pX, const float* pY, const float* pZ, int sections, int* pCodes)
+{
+    if (hasAVX2())
+    {
+        directionCodes8Avx2(pX, pY, pZ, sections, pCodes);
+        return;
+    }
+    for (int i = 0; i < 8; i++)
+        pCodes[i] = direction_code(float3(pX[i], pY[i], pZ[i]), sections);
+}
+
+namespace
+{
+    template<typename Code>
+    void computeCodesBatchImpl(const VPLData* pVPLs, size_t count, const float3& minExtent, const float3& maxExtent, uint32_t numSphereSections,
+        const TreeCodeLayout& layout, Code* pCodes, bool useSimd, const HostDirectionCodeLUT* pDirCodeLUT)
+    {
+        const float3 extent = getCodeExtent(minExtent, maxExtent);
+        const bool defaultMortonBits = layout.mortonBits == uint3(10);
+
+        size_t i = 0;
+        if (useSimd && hasAVX2())
+        {
+            alignas(32) float px[8], py[8], pz[8];
+            alignas(32) float nx[8], ny[8], nz[8];
+            alignas(32) uint32_t mortonCodes[8];
+            alignas(32) int dirCodes[8];
+
+            for (; i + 8 <= count; i += 8)
+            {
+                // Unpack the half precision data into SoA layout.
+                for (int j = 0; j < 8; j++)
+                {
+                    const VPLData& vpl = pVPLs[i + j];
+                    const float3 position = (vpl.getPosW() - minExtent) / extent;
+                    const float3 normal = vpl.getNormW();
+                    px[j] = position.x; py[j] = position.y; pz[j] = position.z;
+                    nx[j] = normal.x;   ny[j] = normal.y;   nz[j] = normal.z;
+                }
+
+                if (defaultMortonBits)
+                    mortonCodes8Avx2(px, py, pz, mortonCodes);
+                if (pDirCodeLUT)
+                {
+                    for (int j = 0; j < 8; j++)
+                        dirCodes[j] = pDirCodeLUT->lookup(float3(nx[j], ny[j], nz[j]));
+                }
+                else
+                {
+                    directionCodes8Avx2(nx, ny, nz, (int)numSphereSections, dirCodes);
+                }
+
+                for (int j = 0; j < 8; j++)
+                {
+                    const int id = pVPLs[i + j].id;
+                    if (id < 0)
+                    {
+                        storeInvalidCode(pCodes[i + j]);
+                        continue;
+                    }
+                    const uint64_t mortonCode = defaultMortonBits ? mortonCodes[j] : morton_code_bits(float3(px[j], py[j], pz[j]), layout.mortonBits);
+                    storeCode(pCodes[i + j], mortonCode, (uint64_t)dirCodes[j], (uint64_t)id, layout);
+                }
+            }
+        }
+
+        // Remainder and scalar fallback
+        for (; i < count; i++)
+        {
+            const VPLData& vpl = pVPLs[i];
+            if (vpl.id < 0)
+            {
+                storeInvalidCode(pCodes[i]);
+                continue;
+            }
+
+            float3 position = vpl.getPosW();
+            position -= minExtent;
+            position /= extent;
+
+            const uint64_t mortonCode = defaultMortonBits ? morton_code(position) : morton_code_bits(position, layout.mortonBits);
+            const float3 normal = vpl.getNormW();
+            const uint64_t dirCode = pDirCodeLUT ? pDirCodeLUT->lookup(normal) : direction_code(normal, numSphereSections);
+            storeCode(pCodes[i], mortonCode, dirCode, (uint64_t)vpl.id, layout);
+        }
+    }
+}
+
+void computeCodesBatch(const VPLData* pVPLs, size_t count, const float3& minExtent, const float3& maxExtent, uint32_t numSphereSections,
+    const TreeCodeLayout& layout, uint64_t* pCodes, bool useSimd, const HostDirectionCodeLUT* pDirCodeLUT)
+{
+    assert(!layout.use128Bit);
+    computeCodesBatchImpl(pVPLs, count, minExtent, maxExtent, numSphereSections, layout, pCodes, useSimd, pDirCodeLUT);
+}
+
+void computeCodesBatch(const VPLData* pVPLs, size_t count, const float3& minExtent, const float3& maxExtent, uint32_t numSphereSections,
+    const TreeCodeLayout& layout, Key128* pCodes, bool useSimd, const HostDirectionCodeLUT* pDirCodeLUT)
+{
+    assert(layout.use128Bit);
+    computeCodesBatchImpl(pVPLs, count, minExtent, maxExtent, numSphereSections, layout, pCodes, useSimd, pDirCodeLUT);
+}
+
+size_t checkCodeKernels(size_t numSamples, uint32_t numSphereSections, uint32_t seed)
+{
+    if (!hasAVX2())
+    {
+        logInfo("checkCodeKernels: AVX2 is not supported, the scalar fallback is used.");
+        return 0;
+    }
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+    // Random positions/normals followed by degenerate normals (axes, octant borders, near zero).
+    std::vector<float3> positions, normals;
+    const float special[] = { 0.f, -0.f, 1.f, -1.f, 0.5f, 1e-3f, -1e-3f, 0.0057735f };
+    for (float a : special)
+        for (float b : special)
+            for (float c : special)
+            {
+                positions.push_back(float3(a, b, c));
+                normals.push_back(float3(a, b, c));
+            }
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        positions.push_back(float3(u(rng), u(rng), u(rng)) * 1.5f); // also out of [0,1]
+        const float3 n = float3(u(rng), u(rng), u(rng));
+        normals.push_back(dot(n, n) > 0.f ? normalize(n) : n);
+    }
+    while (positions.size() % 8 != 0)
+    {
+        positions.push_back(float3(0.f));
+        normals.push_back(float3(0.f));
+    }
+
+    size_t numMismatches = 0;
+    float px[8], py[8], pz[8], nx[8], ny[8], nz[8];
+    uint32_t mortonCodes[8];
+    int dirCodes[8];
+
+    for (size_t i = 0; i < positions.size(); i += 8)
+    {
+        for (int j = 0; j < 8; j++)
+        {
+            px[j] = positions[i + j].x; py[j] = positions[i + j].y; pz[j] = positions[i + j].z;
+            nx[j] = normals[i + j].x;   ny[j] = normals[i + j].y;   nz[j] = normals[i + j].z;
+        }
+        mortonCodes8Avx2(px, py, pz, mortonCodes);
+        directionCodes8Avx2(nx, ny, nz, (int)numSphereSections, dirCodes);
+
+        for (int j = 0; j < 8; j++)
+        {
+            const uint32_t refMorton = morton_code(positions[i + j]);
+            const int refDir = direction_code(normals[i + j], numSphereSections);
+            if (refMorton != mortonCodes[j] || refDir != dirCodes[j])
+            {
+                if (numMismatches < 16)
+                {
+                    const float3& n = normals[i + j];
+                    logWarning("checkCodeKernels: mismatch at normal (" + std::to_string(n.x) + ", " + std::to_string(n.y) + ", " + std::to_string(n.z) + ")"
+                        + " morton " + std::to_string(mortonCodes[j]) + "/" + std::to_string(refMorton) + " dir " + std::to_string(dirCodes[j]) + "/" + std::to_string(refDir));
+                }
+                numMismatches++;
+            }
+        }
+    }
+
+    logInfo("checkCodeKernels: " + std::to_string(positions.size()) + " codes checked, " + std::to_string(numMismatches) + " mismatches.");
+    return numMismatches;
+}
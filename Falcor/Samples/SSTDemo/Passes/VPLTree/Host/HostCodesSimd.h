@@ -0,0 +1,51 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostDirectionCodeLUT.h"
+#include "HostCodes.h"
+#include "HostUtils.h"
+
+using namespace Falcor;
+
+/** AVX2 batch versions of the code functions in HostCodes.h.
+    All kernels process 8 VPLs at once and are bit-exact to the scalar port of Codes.slangh.
+    They fall back to the scalar port if the CPU does not support AVX2.
+*/
+
+/** Returns true if the CPU supports AVX2.
+*/
+bool hasAVX2();
+
+/** Computes the morton codes of 8 positions in [0,1].
+    \param[in] pX, pY, pZ Positions in SoA layout.
+    \param[out] pCodes 8 morton codes.
+*/
+void mortonCodes8(const float* pX, const float* pY, const float* pZ, uint32_t* pCodes);
+
+/** Computes the direction codes of 8 normals.
+    \param[in] pX, pY, pZ Normals in SoA layout.
+    \param[in] sections Number of sphere subdivisions.
+    \param[out] pCodes 8 direction codes.
+*/
+void directionCodes8(const float* pX, const float* pY, const float* pZ, int sections, int* pCodes);
+
+/** Computes the [Morton|Direction|Id] codes of a range of VPLs, see TreeCode.cs.slang.
+    \param[in] pVPLs VPL data.
+    \param[in] count Number of VPLs.
+    \param[in] minExtent, maxExtent Volume used for the morton codes.
+    \param[in] numSphereSections Number of sphere subdivisions used for the direction codes.
+    \param[in] layout Bit layout of the codes. The 64bit version requires a 64bit layout, the 128bit version a 128bit one.
+    \param[out] pCodes count codes. Invalid VPLs get the maximum code.
+    \param[in] useSimd Use the AVX2 kernels if supported. Morton codes with other than 10 bits per axis are computed with the scalar code.
+    \param[in] pDirCodeLUT Optional lookup table for the direction codes. Must be generated for numSphereSections.
+*/
+void computeCodesBatch(const VPLData* pVPLs, size_t count, const float3& minExtent, const float3& maxExtent, uint32_t numSphereSections,
+    const TreeCodeLayout& layout, uint64_t* pCodes, bool useSimd = true, const HostDirectionCodeLUT* pDirCodeLUT = nullptr);
+void computeCodesBatch(const VPLData* pVPLs, size_t count, const float3& minExtent, const float3& maxExtent, uint32_t numSphereSections,
+    const TreeCodeLayout& layout, Key128* pCodes, bool useSimd = true, const HostDirectionCodeLUT* pDirCodeLUT = nullptr);
+
+/** Compares the batch kernels against the scalar port for random and degenerate inputs.
+    \return Number of mismatching codes. Mismatches are logged.
+*/
+size_t checkCodeKernels(size_t numSamples, uint32_t numSphereSections, uint32_t seed = 0);
@@ -0,0 +1,384 @@
+// Encoding of the binary SST into 32 byte nodes, see CompressedTreeNode in VPLTreeStructs.h
+
+#include "HostCompressedTree.h"
+#include "HostPacking.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const float kAABBScale = 255.f;
+    const float kPosScale = 65535.f;
+
+    /** Exact at t = 0 and t = 1, so quantized bounds never shrink at the ends of the parent.
+    */
+    inline float dequantize(float lo, float hi, float t)
+    {
+        return lo * (1.f - t) + hi * t;
+    }
+
+    /** Conservative 8 bit quantization of [vMin, vMax] relative to [pMin, pMax].
+    */
+    inline void quantizeInterval(float vMin, float vMax, float pMin, float pMax, uint32_t& qMin, uint32_t& qMax)
+    {
+        const float extent = pMax - pMin;
+        if (!(extent > 0.f))
+        {
+            qMin = 0;
+            qMax = 0;
+            return;
+        }
+
+        int lo = (int)std::floor((vMin - pMin) / extent * kAABBScale);
+        int hi = (int)std::ceil((vMax - pMin) / extent * kAABBScale);
+        lo = std::min(std::max(lo, 0), 255);
+        hi = std::min(std::max(hi, 0), 255);
+
+        // Fix up float rounding, the decoded interval must contain the original one.
+        while (lo > 0 && dequantize(pMin, pMax, lo / kAABBScale) > vMin) lo--;
+        while (hi < 255 && dequantize(pMin, pMax, hi / kAABBScale) < vMax) hi++;
+        qMin = (uint32_t)lo;
+        qMax = (uint32_t)hi;
+    }
+
+    inline uint32_t quantizePos(float v, float lo, float hi)
+    {
+        const float extent = hi - lo;
+        const float t = extent > 0.f ? std::min(std::max((v - lo) / extent, 0.f), 1.f) : 0.f;
+        return (uint32_t)std::round(t * kPosScale);
+    }
+
+    /** Rounding error of dequantize() in float, deep nodes can have extents of a few ulps.
+    */
+    inline float floatSlack(float a, float b)
+    {
+        return 4.f * FLT_EPSILON * std::max(std::abs(a), std::abs(b));
+    }
+
+    inline float maxComponent(const float3& v)
+    {
+        return std::max(v.x, std::max(v.y, v.z));
+    }
+
+    inline float maxAbsDiff(const float3& a, const float3& b)
+    {
+        return maxComponent(float3(std::abs(a.x - b.x), std::abs(a.y - b.y), std::abs(a.z - b.z)));
+    }
+
+    /** Encodes a node. Returns the decoded bounds of the node in aabbMin/aabbMax.
+    */
+    CompressedTreeNode encodeNode(const VPLData& vpl, const float3& parentMin, const float3& parentMax, float3& aabbMin, float3& aabbMax)
+    {
+        const float3 vMin = vpl.getAABBMin();
+        const float3 vMax = vpl.getAABBMax();
+
+        uint32_t qMin[3], qMax[3];
+        for (int a = 0; a < 3; a++)
+        {
+            quantizeInterval(vMin[a], vMax[a], parentMin[a], parentMax[a], qMin[a], qMax[a]);
+            aabbMin[a] = dequantize(parentMin[a], parentMax[a], qMin[a] / kAABBScale);
+            aabbMax[a] = dequantize(parentMin[a], parentMax[a], qMax[a] / kAABBScale);
+        }
+
+        const bool isLeaf = vpl.numVPLSubTree <= 0;
+        const float3 normW = vpl.getNormW();
+        const bool isOmni = !(dot(normW, normW) > 1e-6f);
+        uint32_t flags = 0;
+        if (isLeaf) flags |= kCompressedLeafFlag;
+        if (vpl.getEarlyStop() > 0.f) flags |= kCompressedEarlyStopFlag;
+        if (isOmni) flags |= kCompressedOmniFlag;
+
+        const float3 posW = vpl.getPosW();
+        CompressedTreeNode node;
+        node.aabb0    = qMin[0] | (qMin[1] << 8) | (qMin[2] << 16) | (qMax[0] << 24);
+        node.aabb1    = qMax[1] | (qMax[2] << 8) | flags;
+        node.posXY    = quantizePos(posW.x, aabbMin.x, aabbMax.x) | (quantizePos(posW.y, aabbMin.y, aabbMax.y) << 16);
+        node.posZ     = quantizePos(posW.z, aabbMin.z, aabbMax.z);
+        node.normW    = isOmni ? 0u : packSnorm2x16(ndir_to_oct_snorm(normalize(normW)));
+        node.color    = packRGB9E5(vpl.getColor());
+        node.variance = packRGB9E5(vpl.getVariance());
+        node.count    = isLeaf ? (uint32_t)vpl.id : (uint32_t)vpl.numVPLSubTree;
+        return node;
+    }
+}
+
+HostCompressedTree::SharedPtr HostCompressedTree::create()
+{
+    return SharedPtr(new HostCompressedTree());
+}
+
+bool HostCompressedTree::build(const std::vector<VPLData>& vplData, int maxVPLs)
+{
+    mNodes.clear();
+    mSourceIdx.clear();
+
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs)
+        return false;
+
+    const VPLData& root = vplData[maxVPLs];
+    mBoundsMin = root.getAABBMin();
+    mBoundsMax = root.getAABBMax();
+
+    const size_t numVPLData = 2 * (size_t)maxVPLs;
+    auto isValidChild = [&](int idx) { return idx >= 0 && (size_t)idx < numVPLData; };
+
+    struct Entry
+    {
+        uint32_t vplIdx;
+        float3 parentMin;
+        float3 parentMax;
+    };
+
+    // Depth-first, left child first. The right child is pushed first so that it ends up behind the left subtree.
+    std::vector<Entry> stack;
+    stack.push_back({ (uint32_t)maxVPLs, mBoundsMin, mBoundsMax });
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+
+        if (mNodes.size() >= numVPLData)
+        {
+            logWarning("HostCompressedTree: Binary tree contains a cycle.");
+            mNodes.clear();
+            mSourceIdx.clear();
+            return false;
+        }
+
+        const VPLData& vpl = vplData[entry.vplIdx];
+        float3 aabbMin, aabbMax;
+        mNodes.push_back(encodeNode(vpl, entry.parentMin, entry.parentMax, aabbMin, aabbMax));
+        mSourceIdx.push_back(entry.vplIdx);
+
+        if (vpl.numVPLSubTree <= 0)
+            continue;
+
+        if (!isValidChild(vpl.idChild1) || !isValidChild(vpl.idChild2))
+        {
+            logWarning("HostCompressedTree: Invalid child index.");
+            mNodes.clear();
+            mSourceIdx.clear();
+            return false;
+        }
+        stack.push_back({ (uint32_t)vpl.idChild2, aabbMin, aabbMax });
+        stack.push_back({ (uint32_t)vpl.idChild1, aabbMin, aabbMax });
+    }
+
+    return true;
+}
+
+HostCompressedTree::Node HostCompressedTree::decode(uint32_t nodeIdx, const float3& parentMin, const float3& parentMax) const
+{
+    const CompressedTreeNode& c = mNodes[nodeIdx];
+    const uint32_t qMin[3] = { c.aabb0 & 0xFF, (c.aabb0 >> 8) & 0xFF, (c.aabb0 >> 16) & 0xFF };
+    const uint32_t qMax[3] = { c.aabb0 >> 24, c.aabb1 & 0xFF, (c.aabb1 >> 8) & 0xFF };
+
+    Node node;
+    for (int a = 0; a < 3; a++)
+    {
+        node.aabbMin[a] = dequantize(parentMin[a], parentMax[a], qMin[a] / kAABBScale);
+        node.aabbMax[a] = dequantize(parentMin[a], parentMax[a], qMax[a] / kAABBScale);
+    }
+
+    const float3 t = float3((float)(c.posXY & 0xFFFF), (float)(c.posXY >> 16), (float)(c.posZ & 0xFFFF)) / kPosScale;
+    for (int a = 0; a < 3; a++)
+        node.posW[a] = dequantize(node.aabbMin[a], node.aabbMax[a], t[a]);
+
+    node.normW     = (c.aabb1 & kCompressedOmniFlag) ? float3(0.f) : oct_to_ndir_snorm(unpackSnorm2x16(c.normW));
+    node.color     = unpackRGB9E5(c.color);
+    node.variance  = unpackRGB9E5(c.variance);
+    node.intensity = luminance(node.color);
+    node.isLeaf    = (c.aabb1 & kCompressedLeafFlag) != 0;
+    node.earlyStop = (c.aabb1 & kCompressedEarlyStopFlag) != 0;
+    node.count     = c.count;
+    return node;
+}
+
+uint32_t HostCompressedTree::getRightChild(uint32_t nodeIdx) const
+{
+    const uint32_t leftIdx = nodeIdx + 1;
+    const CompressedTreeNode& left = mNodes[leftIdx];
+    return leftIdx + ((left.aabb1 & kCompressedLeafFlag) ? 1 : left.count + 1);
+}
+
+HostTreeSample HostCompressedTree::sample(const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed) const
+{
+    HostTreeSample sample;
+    if (mNodes.empty())
+        return sample;
+
+    float p = 1.f;
+    float r = nextRandHost(randSeed);
+    uint32_t nodeIdx = 0;
+    Node node = decode(0, mBoundsMin, mBoundsMax);
+
+    while (!(node.earlyStop || node.isLeaf))
+    {
+        // Both children are fetched anyway, the left one gives the position of the right one.
+        const uint32_t leftIdx = nodeIdx + 1;
+        const Node left = decode(leftIdx, node.aabbMin, node.aabbMax);
+        const uint32_t rightIdx = leftIdx + (left.isLeaf ? 1 : left.count + 1);
+        const Node right = decode(rightIdx, node.aabbMin, node.aabbMax);
+        sample.numSteps++;
+
+        const float w1 = evalNodeWeightHost(left.aabbMin, left.aabbMax, left.posW, left.intensity, sp, params);
+        const float w2 = evalNodeWeightHost(right.aabbMin, right.aabbMax, right.posW, right.intensity, sp, params);
+        if (!(w1 + w2 > 0.f))
+            return sample; // Dead branch
+
+        const float p1 = w1 / (w1 + w2);
+        if (r <= p1)
+        {
+            p *= p1;
+            r = r / p1;
+            nodeIdx = leftIdx;
+            node = left;
+        }
+        else
+        {
+            p *= 1.f - p1;
+            r = (r - p1) / (1.f - p1);
+            nodeIdx = rightIdx;
+            node = right;
+        }
+    }
+
+    sample.pdf = p;
+    sample.nodeIdx = (int)nodeIdx;
+    sample.radiance = evalSelectedNodeHost(node.posW, node.normW, node.color, node.variance, node.aabbMin, node.aabbMax, p, sp, params, randSeed);
+    return sample;
+}
+
+CompressedTreeCheck checkCompressedTree(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers)
+{
+    CompressedTreeCheck result;
+
+    HostCompressedTree::SharedPtr pTree = HostCompressedTree::create();
+    if (!pTree->build(vplData, maxVPLs))
+        return result;
+
+    const auto& nodes = pTree->getNodes();
+    const auto& sourceIdx = pTree->getSourceIndices();
+    result.numNodes = (uint32_t)nodes.size();
+    result.binarySize = 2 * (size_t)maxVPLs * sizeof(VPLData);
+    result.compressedSize = pTree->getMemorySize();
+
+    // Decode depth-first with the decoded bounds of the parents and compare against the binary nodes.
+    struct Entry
+    {
+        uint32_t nodeIdx;
+        float3 parentMin;
+        float3 parentMax;
+    };
+
+    bool valid = true;
+    std::vector<Entry> stack;
+    stack.push_back({ 0, pTree->getBoundsMin(), pTree->getBoundsMax() });
+    uint32_t numVisited = 0;
+
+    while (!stack.empty() && valid)
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        numVisited++;
+
+        const HostCompressedTree::Node node = pTree->decode(entry.nodeIdx, entry.parentMin, entry.parentMax);
+        const VPLData& vpl = vplData[sourceIdx[entry.nodeIdx]];
+
+        // Bounds must contain the original ones and grow by at most one step of the parent grid.
+        const float3 vMin = vpl.getAABBMin();
+        const float3 vMax = vpl.getAABBMax();
+        for (int a = 0; a < 3; a++)
+        {
+            if (node.aabbMin[a] > vMin[a] || node.aabbMax[a] < vMax[a])
+                valid = false;
+            const float extent = entry.parentMax[a] - entry.parentMin[a];
+            const float growth = std::max(vMin[a] - node.aabbMin[a], node.aabbMax[a] - vMax[a]) - floatSlack(entry.parentMin[a], entry.parentMax[a]);
+            if (extent > 0.f)
+                result.maxAABBError = std::max(result.maxAABBError, std::max(growth, 0.f) / extent);
+        }
+
+        // Position relative to the decoded bounds of the node
+        const float3 extent = node.aabbMax - node.aabbMin;
+        const float3 posW = clamp(vpl.getPosW(), node.aabbMin, node.aabbMax);
+        for (int a = 0; a < 3; a++)
+        {
+            const float error = std::abs(node.posW[a] - posW[a]) - floatSlack(node.aabbMin[a], node.aabbMax[a]);
+            if (extent[a] > 0.f)
+                result.maxPosError = std::max(result.maxPosError, std::max(error, 0.f) / extent[a]);
+        }
+
+        const float3 normW = vpl.getNormW();
+        if (dot(normW, normW) > 1e-6f)
+        {
+            const float cosAngle = std::min(std::max(dot(normalize(normW), node.normW), -1.f), 1.f);
+            result.maxNormalError = std::max(result.maxNormalError, std::acos(cosAngle));
+        }
+
+        const float3 color = vpl.getColor();
+        if (maxComponent(color) > 0.f)
+            result.maxColorError = std::max(result.maxColorError, maxAbsDiff(node.color, color) / maxComponent(color));
+
+        const float3 variance = vpl.getVariance();
+        if (maxComponent(variance) > 0.f)
+            result.maxVarianceError = std::max(result.maxVarianceError, maxAbsDiff(node.variance, variance) / maxComponent(variance));
+
+        if (vpl.getIntensity() > 0.f)
+            result.maxIntensityError = std::max(result.maxIntensityError, std::abs(node.intensity - vpl.getIntensity()) / vpl.getIntensity());
+
+        if (node.isLeaf != (vpl.numVPLSubTree <= 0) || node.earlyStop != (vpl.getEarlyStop() > 0.f))
+            valid = false;
+        if (node.isLeaf)
+            continue;
+
+        // The implicit children must be the children of the binary node.
+        const uint32_t leftIdx = entry.nodeIdx + 1;
+        const uint32_t rightIdx = pTree->getRightChild(entry.nodeIdx);
+        if (rightIdx >= nodes.size() || sourceIdx[leftIdx] != (uint32_t)vpl.idChild1 || sourceIdx[rightIdx] != (uint32_t)vpl.idChild2)
+        {
+            valid = false;
+            break;
+        }
+        stack.push_back({ rightIdx, node.aabbMin, node.aabbMax });
+        stack.push_back({ leftIdx, node.aabbMin, node.aabbMax });
+    }
+
+    const float kSlack = 1e-5f;
+    result.valid = valid && numVisited == nodes.size()
+        && result.maxAABBError <= 1.f / kAABBScale + kSlack
+        && result.maxPosError <= 1.f / kPosScale + kSlack
+        && result.maxNormalError <= 1e-3f
+        && result.maxColorError <= 1.f / 512.f + kSlack
+        && result.maxVarianceError <= 1.f / 512.f + kSlack
+        && result.maxIntensityError <= 1e-2f;
+
+    // Traversal bandwidth and estimator error of both layouts
+    const VPLData& root = vplData[maxVPLs];
+    const float offset = length(root.getAABBMax() - root.getAABBMin()) * 1e-3f;
+    const HostSamplingParams params;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, params);
+    const uint32_t kNumEstimates = 64;
+
+    const HostSamplingError binary = estimateSamplingError(vplData, maxVPLs, receivers, reference, nullptr, kNumEstimates);
+    const HostSamplingError compressed = estimateSamplingError(vplData, maxVPLs, receivers, reference,
+        [&](const HostShadingPoint& sp, size_t, uint32_t& seed) { return pTree->sample(sp, params, seed); }, kNumEstimates);
+
+    // Binary: root, two children per step and the selected node. Compressed: root and two children per step.
+    result.binaryBytesPerSample = (2.f + 2.f * binary.avgSteps) * sizeof(VPLData);
+    result.compressedBytesPerSample = (1.f + 2.f * compressed.avgSteps) * sizeof(CompressedTreeNode);
+    result.binaryError = binary.error;
+    result.compressedError = compressed.error;
+
+    const size_t kNumVPLs1M = 1 << 20;
+    const size_t binary1M = 2 * kNumVPLs1M * sizeof(VPLData);
+    const size_t compressed1M = getNumTotalNodes((uint)kNumVPLs1M) * sizeof(CompressedTreeNode);
+
+    logInfo("checkCompressedTree: " + std::string(result.valid ? "valid" : "INVALID") + ", " + std::to_string(result.numNodes) + " nodes, max errors: aabb "
+        + std::to_string(result.maxAABBError) + ", pos " + std::to_string(result.maxPosError) + ", normal " + std::to_string(result.maxNormalError)
+        + " rad, color " + std::to_string(result.maxColorError) + ", variance " + std::to_string(result.maxVarianceError) + ", intensity " + std::to_string(result.maxIntensityError));
+    logInfo("checkCompressedTree: memory " + std::to_string(result.binarySize >> 10) + " KB -> " + std::to_string(result.compressedSize >> 10) + " KB, per sample "
+        + std::to_string(result.binaryBytesPerSample) + " -> " + std::to_string(result.compressedBytesPerSample) + " bytes, error "
+        + std::to_string(result.binaryError) + " -> " + std::to_string(result.compressedError) + ", 1M VPLs: " + std::to_string(binary1M >> 20) + " MB -> "
+        + std::to_string(compressed1M >> 20) + " MB");
+    return result;
+}
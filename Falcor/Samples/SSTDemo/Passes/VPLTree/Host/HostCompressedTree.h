@@ -0,0 +1,111 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** SST in the compressed 32 byte node format (see CompressedTreeNode).
+    Encoded from the binary 64 byte VPLData tree. Decoding a node needs the decoded bounds of its parent,
+    which the traversal has at hand anyway.
+*/
+class HostCompressedTree : public std::enable_shared_from_this<HostCompressedTree>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostCompressedTree>;
+    using SharedConstPtr = std::shared_ptr<const HostCompressedTree>;
+    virtual ~HostCompressedTree() = default;
+
+    /** Decoded node.
+    */
+    struct Node
+    {
+        float3 aabbMin;
+        float3 aabbMax;
+        float3 posW;
+        float3 normW;
+        float3 color;
+        float3 variance;
+        float intensity;
+        bool isLeaf;
+        bool earlyStop;
+        uint32_t count;     ///< Leaf: VPL id. Internal node: number of nodes in the subtree below.
+    };
+
+    /** Create a new (empty) compressed tree.
+    */
+    static SharedPtr create();
+
+    /** Encodes a binary SST.
+        \param[in] vplData VPL data array of the binary tree, root at index maxVPLs.
+        \param[in] maxVPLs Capacity of the leaf range.
+        \return True if successful, false if the binary tree is invalid.
+    */
+    bool build(const std::vector<VPLData>& vplData, int maxVPLs);
+
+    /** Decodes a node.
+        \param[in] nodeIdx Index of the node.
+        \param[in] parentMin Decoded lower corner of the parent, getBoundsMin() for the root.
+        \param[in] parentMax Decoded upper corner of the parent, getBoundsMax() for the root.
+    */
+    Node decode(uint32_t nodeIdx, const float3& parentMin, const float3& parentMax) const;
+
+    /** Returns the index of the right child. The left child is always at nodeIdx + 1.
+        \param[in] nodeIdx Index of an internal node.
+    */
+    uint32_t getRightChild(uint32_t nodeIdx) const;
+
+    /** Takes one sample. Host reference of the traversal on the compressed nodes, same as sampleVPLTreeHost().
+        The returned nodeIdx is the index of the compressed node.
+    */
+    HostTreeSample sample(const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed) const;
+
+    const std::vector<CompressedTreeNode>& getNodes() const { return mNodes; }
+    const std::vector<uint32_t>& getSourceIndices() const { return mSourceIdx; }
+    const float3& getBoundsMin() const { return mBoundsMin; }
+    const float3& getBoundsMax() const { return mBoundsMax; }
+    size_t getMemorySize() const { return mNodes.size() * sizeof(CompressedTreeNode); }
+
+protected:
+    HostCompressedTree() = default;
+
+    std::vector<CompressedTreeNode> mNodes;     ///< Depth-first order, root at index 0.
+    std::vector<uint32_t> mSourceIdx;           ///< Index in the VPL data array of every node.
+    float3 mBoundsMin = float3(0.f);
+    float3 mBoundsMax = float3(0.f);
+};
+
+/** Result of checkCompressedTree(). Errors are the maximum over all nodes.
+*/
+struct CompressedTreeCheck
+{
+    bool valid = false;
+    uint32_t numNodes = 0;
+    float maxAABBError = 0.f;       ///< Growth of the bounds relative to the parent extent (bound: 1/255). Float rounding is excluded.
+    float maxPosError = 0.f;        ///< Position error relative to the node extent (bound: 1/65535).
+    float maxNormalError = 0.f;     ///< Angle between the normals in radians.
+    float maxColorError = 0.f;      ///< Color error relative to the largest channel (bound: 2^-9).
+    float maxVarianceError = 0.f;   ///< Variance error relative to the largest channel (bound: 2^-9).
+    float maxIntensityError = 0.f;  ///< Relative error of the intensity.
+
+    // Memory and traversal bandwidth
+    size_t binarySize = 0;          ///< Bytes of the binary tree (2 * maxVPLs VPLData).
+    size_t compressedSize = 0;      ///< Bytes of the compressed tree.
+    float binaryBytesPerSample = 0.f;
+    float compressedBytesPerSample = 0.f;
+    float binaryError = 0.f;        ///< Relative RMS error of one sample estimates against the sum over all VPLs.
+    float compressedError = 0.f;
+};
+
+/** Encodes a built tree and checks every node against the binary layout: containment of the bounds,
+    topology and the quantization errors against their bounds. Also measures memory and traversal bandwidth
+    and logs them extrapolated to 1M VPLs.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receivers used for the bandwidth and sample error.
+    \return Check result. Results are logged.
+*/
+CompressedTreeCheck checkCompressedTree(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers = 256);
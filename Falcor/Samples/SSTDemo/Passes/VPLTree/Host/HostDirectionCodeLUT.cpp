@@ -0,0 +1,69 @@
+#include "HostDirectionCodeLUT.h"
+#include "HostCodes.h"
+#include "HostPacking.h"
+#include "HostUtils.h"
+#include <random>
+
+HostDirectionCodeLUT::SharedPtr HostDirectionCodeLUT::create()
+{
+    return SharedPtr(new HostDirectionCodeLUT());
+}
+
+void HostDirectionCodeLUT::generate(uint32_t numSphereSections, uint32_t resolution)
+{
+    if (resolution == 0)
+        return;
+    if (mResolution == resolution && mNumSphereSections == numSphereSections && !mData.empty())
+        return;
+
+    mResolution = resolution;
+    mNumSphereSections = numSphereSections;
+    mData.resize((size_t)resolution * resolution);
+
+    // Evaluate the code at the center of every texel.
+    const float invResolution = 1.f / (float)resolution;
+    parallelFor(0, resolution, [&](size_t y)
+    {
+        for (uint32_t x = 0; x < resolution; x++)
+        {
+            const float2 uv = float2(((float)x + 0.5f) * invResolution, ((float)y + 0.5f) * invResolution);
+            const float3 n = oct_to_ndir_unorm(uv);
+            mData[y * resolution + x] = (uint32_t)direction_code(n, (int)numSphereSections);
+        }
+    }, 16);
+}
+
+int HostDirectionCodeLUT::lookup(const float3& n) const
+{
+    if (dot(n, n) < 0.0001f)
+    {
+        // Omnidirectional source, see direction_code()
+        return (1 << (3 + 2 * mNumSphereSections + 1));
+    }
+
+    const float2 uv = ndir_to_oct_unorm(n);
+    const uint32_t x = std::min((uint32_t)std::max(uv.x * mResolution, 0.f), mResolution - 1);
+    const uint32_t y = std::min((uint32_t)std::max(uv.y * mResolution, 0.f), mResolution - 1);
+    return (int)mData[y * mResolution + x];
+}
+
+float HostDirectionCodeLUT::measureMismatchRate(size_t numSamples, uint32_t seed) const
+{
+    if (mData.empty() || numSamples == 0)
+        return 0.f;
+
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> u(-1.f, 1.f);
+
+    size_t numMismatches = 0;
+    for (size_t i = 0; i < numSamples; i++)
+    {
+        float3 n = float3(u(rng), u(rng), u(rng));
+        if (dot(n, n) < 0.0001f)
+            continue;
+        n = normalize(n);
+        if (lookup(n) != direction_code(n, (int)mNumSphereSections))
+            numMismatches++;
+    }
+    return (float)numMismatches / (float)numSamples;
+}
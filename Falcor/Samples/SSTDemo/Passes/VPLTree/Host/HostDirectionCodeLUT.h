@@ -0,0 +1,49 @@
+#pragma once
+
+#include "Falcor.h"
+
+using namespace Falcor;
+
+
+/** Lookup table for direction_code() in Codes.slangh.
+    The codes are baked into an octahedral map (see Packing.slang), so a lookup costs one fetch
+    regardless of the number of sphere sections. Texels along the section borders take the code of
+    their center, so a small fraction of the normals gets the code of a neighbouring section.
+*/
+class HostDirectionCodeLUT : public std::enable_shared_from_this<HostDirectionCodeLUT>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostDirectionCodeLUT>;
+    using SharedConstPtr = std::shared_ptr<const HostDirectionCodeLUT>;
+    virtual ~HostDirectionCodeLUT() = default;
+
+    /** Create a new (empty) lookup table.
+    */
+    static SharedPtr create();
+
+    /** Bakes the direction codes. Does nothing if the table is already up to date.
+        \param[in] numSphereSections Number of sphere subdivisions.
+        \param[in] resolution Width and height of the octahedral map.
+    */
+    void generate(uint32_t numSphereSections, uint32_t resolution);
+
+    /** Returns the direction code of a normal. Same as direction_code_lut() in Codes.slangh.
+    */
+    int lookup(const float3& n) const;
+
+    /** Returns the fraction of random normals whose code differs from direction_code().
+    */
+    float measureMismatchRate(size_t numSamples, uint32_t seed = 0) const;
+
+    const std::vector<uint32_t>& getData() const { return mData; }
+    uint32_t getResolution() const { return mResolution; }
+    uint32_t getNumSphereSections() const { return mNumSphereSections; }
+    bool isValid() const { return !mData.empty(); }
+
+protected:
+    HostDirectionCodeLUT() = default;
+
+    std::vector<uint32_t> mData;    ///< Row major, resolution x resolution codes.
+    uint32_t mResolution = 0;
+    uint32_t mNumSphereSections = 0;
+};
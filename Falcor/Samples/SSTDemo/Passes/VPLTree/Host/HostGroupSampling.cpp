@@ -0,0 +1,123 @@
+// Grouped traversal of the SST, see HostGroupSampling.h
+
+#include "HostGroupSampling.h"
+#include "HostUtils.h"
+
+namespace
+{
+    /** One group of samples that still has to descend from a node.
+    */
+    struct GroupEntry
+    {
+        int nodeIdx;
+        uint32_t count;
+        float p;
+    };
+
+    /** Descends at most kMaxGroupSamples samples, see sampleVPLTreeGroupLobe().
+    */
+    void sampleGroup(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoint& sp, const HostSamplingParams& params,
+        uint32_t numSamples, uint32_t& randSeed, HostGroupSample& result)
+    {
+        GroupEntry stack[kMaxGroupSamples];
+        uint32_t stackSize = 0;
+        GroupEntry group = { rootIndex, numSamples, 1.f };
+
+        while (true)
+        {
+            const VPLData& vpl = vplData[group.nodeIdx];
+            bool finished = true;
+
+            if (vpl.getEarlyStop() > 0.f || vpl.numVPLSubTree <= 0)
+            {
+                for (uint32_t s = 0; s < group.count; s++)
+                    result.radiance += evalSelectedNodeHost(vpl, group.p, sp, params, randSeed);
+            }
+            else
+            {
+                const int child1Id = vpl.idChild1;
+                const int child2Id = vpl.idChild2;
+                const float w1 = evalNodeWeightHost(vplData[child1Id], sp, params);
+                const float w2 = evalNodeWeightHost(vplData[child2Id], sp, params);
+                result.numSteps++;
+
+                if (w1 + w2 > 0.f) // Otherwise a dead branch for all samples of the group
+                {
+                    const float p1 = w1 / (w1 + w2);
+                    const uint32_t n1 = splitSamplesHost(group.count, p1, randSeed);
+                    if (n1 > 0 && n1 < group.count)
+                        stack[stackSize++] = { child2Id, group.count - n1, group.p * (1.f - p1) };
+
+                    if (n1 > 0)
+                        group = { child1Id, n1, group.p * p1 };
+                    else
+                        group = { child2Id, group.count, group.p * (1.f - p1) };
+                    finished = false;
+                }
+            }
+
+            if (finished)
+            {
+                if (stackSize == 0)
+                    break;
+                group = stack[--stackSize];
+            }
+        }
+    }
+}
+
+HostGroupSample sampleVPLTreeGroupHost(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoint& sp, const HostSamplingParams& params,
+    uint32_t numSamples, uint32_t& randSeed)
+{
+    HostGroupSample result;
+    result.numSamples = numSamples;
+    for (uint32_t s = 0; s < numSamples; s += kMaxGroupSamples)
+        sampleGroup(vplData, rootIndex, sp, params, std::min(kMaxGroupSamples, numSamples - s), randSeed, result);
+    return result;
+}
+
+GroupSamplingCheck checkGroupSampling(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers)
+{
+    GroupSamplingCheck result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs || numReceivers == 0)
+        return result;
+
+    const VPLData& root = vplData[maxVPLs];
+    const float offset = length(root.getAABBMax() - root.getAABBMin()) * 1e-3f;
+    const HostSamplingParams params;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    if (receivers.empty())
+        return result;
+
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, params);
+    const uint32_t kNumEstimates = 16;
+    result.numReceivers = (uint32_t)receivers.size();
+
+    for (uint32_t numSamples : { 4u, 8u, 16u })
+    {
+        const HostSamplingError independent = estimateSamplingError(vplData, maxVPLs, receivers, reference, nullptr, kNumEstimates, numSamples);
+
+        // A group sample is a whole estimate of numSamples samples
+        const HostSamplingError group = estimateSamplingError(vplData, maxVPLs, receivers, reference, [&](const HostShadingPoint& sp, size_t, uint32_t& seed)
+        {
+            const HostGroupSample groupSample = sampleVPLTreeGroupHost(vplData, maxVPLs, sp, params, numSamples, seed);
+            HostTreeSample sample;
+            sample.radiance = groupSample.radiance / (float)numSamples;
+            sample.numSteps = groupSample.numSteps;
+            return sample;
+        }, kNumEstimates);
+
+        GroupSamplingCheck::Entry entry;
+        entry.numSamples = numSamples;
+        // Every step evaluates both children
+        entry.independentEvals = 2.f * independent.avgSteps * numSamples;
+        entry.groupEvals = 2.f * group.avgSteps;
+        entry.independentError = independent.error;
+        entry.groupError = group.error;
+        result.entries.push_back(entry);
+
+        logInfo("checkGroupSampling: " + std::to_string(numSamples) + " samples per pixel, node evaluations " + std::to_string(entry.independentEvals)
+            + " -> " + std::to_string(entry.groupEvals) + ", relative error " + std::to_string(entry.independentError) + " -> " + std::to_string(entry.groupError));
+    }
+    return result;
+}
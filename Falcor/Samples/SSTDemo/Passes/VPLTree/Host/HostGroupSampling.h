@@ -0,0 +1,73 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+/** Host port of sampleVPLTreeGroup() in VPLSampling.rt.hlsl. Keep both files in sync!
+    All samples of a pixel descend the SST as one group. At every inner node the children are evaluated once for the
+    whole group and the samples are split between them with a stratified draw, n1 = floor(n * p1 + u), so E[n1] = n * p1.
+    Every sample keeps the probability of its own path, the sum of radiance / pdf is unbiased like numSamples calls of
+    sampleVPLTreeHost(), but the upper levels of the tree are only evaluated once per pixel instead of once per sample.
+*/
+
+/** Number of samples that descend together. Larger sample counts are split into several groups.
+    Bounds the traversal stack, every stacked group holds at least one sample. See MAX_GROUP_SAMPLES.
+*/
+static const uint32_t kMaxGroupSamples = 16;
+
+/** Result of sampleVPLTreeGroupHost().
+*/
+struct HostGroupSample
+{
+    float3 radiance = float3(0.f);  ///< Sum of the contributions divided by their sample probabilities.
+    uint32_t numSteps = 0;          ///< Number of inner nodes whose children were evaluated.
+    uint32_t numSamples = 0;
+};
+
+/** Splits n samples between two children, see splitSamples() in VPLSampling.rt.hlsl.
+    \return Number of samples that go to the first child.
+*/
+inline uint32_t splitSamplesHost(uint32_t n, float p1, uint32_t& randSeed)
+{
+    return std::min(n, (uint32_t)((float)n * p1 + nextRandHost(randSeed)));
+}
+
+/** Takes numSamples samples from the SST that share the traversal.
+    \param[in] vplData VPL data array of the tree.
+    \param[in] rootIndex Index of the root node (maxVPLs).
+    \param[in] sp Receiver.
+    \param[in] params Sampler parameters.
+    \param[in] numSamples Number of samples.
+    \param[in,out] randSeed Random seed, advanced like in the shader.
+*/
+HostGroupSample sampleVPLTreeGroupHost(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoint& sp, const HostSamplingParams& params,
+    uint32_t numSamples, uint32_t& randSeed);
+
+/** Result of checkGroupSampling().
+*/
+struct GroupSamplingCheck
+{
+    struct Entry
+    {
+        uint32_t numSamples = 0;        ///< Samples per pixel.
+        float independentEvals = 0.f;   ///< Node evaluations per pixel of numSamples calls of sampleVPLTreeHost().
+        float groupEvals = 0.f;         ///< Node evaluations per pixel of sampleVPLTreeGroupHost().
+        float independentError = 0.f;  ///< Relative RMS error of the pixel estimate.
+        float groupError = 0.f;
+    };
+
+    uint32_t numReceivers = 0;
+    std::vector<Entry> entries;
+};
+
+/** Compares the node evaluations and the error of independent and grouped sampling at 4, 8 and 16 samples per pixel.
+    A node evaluation is one w = M * A * I of a child node.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receivers, placed on random VPLs.
+    \return Check result. Results are logged.
+*/
+GroupSamplingCheck checkGroupSampling(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers = 4096);
@@ -0,0 +1,163 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+
+/** Host port of the node merge in TreeMergeNodes.cs.slang. Keep both files in sync!
+*/
+
+/** Returns the rows of getRotationMatrixFromAToB() (see VPLUtils.h) in HLSL row order.
+*/
+inline void getRotationRowsFromAToB(const float3& A, const float3& B, float3 rows[3])
+{
+    const float3 v = cross(A, B);
+    const float  c = dot(A, B);
+    const float  f = 1.f / (1.f + c);
+    const float xx = v.x * v.x;
+    const float yy = v.y * v.y;
+    const float zz = v.z * v.z;
+    const float xy = v.x * v.y;
+    const float yz = v.y * v.z;
+    const float xz = v.x * v.z;
+
+    // Special case: A = (-B)
+    if (1.f + c == 0.f)
+    {
+        rows[0] = float3(-1.f, 0.f, 0.f);
+        rows[1] = float3(0.f, -1.f, 0.f);
+        rows[2] = float3(0.f, 0.f, -1.f);
+        return;
+    }
+
+    rows[0] = float3(1.f - (yy + zz) * f, xy * f - v.z, v.y + xz * f);
+    rows[1] = float3(v.z + xy * f, 1.f - (xx + zz) * f, yz * f - v.x);
+    rows[2] = float3(xz * f - v.y, yz * f + v.x, 1.f - (xx + yy) * f);
+}
+
+/** Equivalent of HLSL mul(v, R) for a row vector v.
+*/
+inline float3 mulRowVector(const float3& v, const float3 rows[3])
+{
+    return v.x * rows[0] + v.y * rows[1] + v.z * rows[2];
+}
+
+inline void iterativePlaneWeightedMeanAndVariance(const float3& N, const float3& m1, const float3& m2, const float3& v1, const float3& v2, float w1, float w2, float3& m, float3& v, float& w)
+{
+    w = w1 + w2;
+
+    if (w != 0.f)
+    {
+        // Update mean
+        m = (w1 * m1 + w2 * m2) / w;
+
+        float3 R[3];
+        getRotationRowsFromAToB(float3(0.f, 0.f, 1.f), N, R);
+        const float3 Pm  = mulRowVector(m,  R);
+        const float3 Pm1 = mulRowVector(m1, R);
+        const float3 Pm2 = mulRowVector(m2, R);
+
+        // Update variance
+        float3 d1 = Pm1 - Pm;
+        float3 d2 = Pm2 - Pm;
+        v = (w1 * (v1 + d1 * d1) + w2 * (v2 + d2 * d2)) / w;
+    }
+    else
+    {
+        m = (m1 + m2) * 0.5f;
+        v.x = v.y = v.z = 0.f;
+    }
+}
+
+/** See coneAngleAroundAxis() in TreeMergeNodes.cs.slang.
+*/
+inline float coneAngleAroundAxis(const float3& axis, const float3& n, float angle)
+{
+    const float len = length(axis) * length(n);
+    if (!(len > 0.f))
+        return (float)M_PI;
+    return std::acos(std::max(-1.f, std::min(1.f, dot(axis, n) / len))) + angle;
+}
+
+/** See mergeConeAngle() in TreeMergeNodes.cs.slang.
+*/
+inline float mergeConeAngle(const float3& axis, const float3& n1, float angle1, const float3& n2, float angle2)
+{
+    const float angle = std::max(coneAngleAroundAxis(axis, n1, angle1), coneAngleAroundAxis(axis, n2, angle2));
+    return std::min(angle + kConeAngleEpsilon, (float)M_PI);
+}
+
+inline float computeNormalScore(const float3& n1, const float3& n2)
+{
+    return std::max(0.f, dot(n1, n2));
+}
+
+inline bool evalScores(const float2& approxScore, const TreeApproxParams& approxParams)
+{
+    // Is our approximation good enough? Return true if yes!
+    return
+        (approxScore.x >= approxParams.minNormalScore) &&   // Normal score
+        (approxScore.y <= approxParams.maxNormalZStd);      // Normal Z-Std
+}
+
+/** Merges two child nodes into their parent node.
+    \param[in] lhs First child.
+    \param[in] rhs Second child.
+    \param[in] lhsMerge Approximation scores of the first child.
+    \param[in] rhsMerge Approximation scores of the second child.
+    \param[in] parentVplId Index of the parent node in the VPL data array.
+    \param[in] approxParams Early stop thresholds.
+    \param[out] mergeData Approximation scores of the parent.
+    \return Merged parent node.
+*/
+inline VPLData mergeVPLData(const VPLData& lhs, const VPLData& rhs, const VPLMerge& lhsMerge, const VPLMerge& rhsMerge, uint parentVplId, const TreeApproxParams& approxParams, VPLMerge& mergeData)
+{
+    VPLData merged;
+    merged.posW     = uint2(0);
+    merged.normW    = uint2(0);
+    merged.aabbMin  = uint2(0);
+    merged.aabbMax  = uint2(0);
+    merged.rad      = uint2(0);
+    merged.var      = uint2(0);
+    merged.id       = 0;
+    merged.idChild1 = 0;
+    merged.idChild2 = 0;
+    merged.numVPLSubTree = 0;
+
+    const float lhsIntensity = lhs.getIntensity();
+    const float rhsIntensity = rhs.getIntensity();
+    const float totalIntensity = lhsIntensity + rhsIntensity;
+    const float alpha = totalIntensity > 0.f ? lhsIntensity / totalIntensity : 0.5f;
+
+    merged.setIntensity(totalIntensity);
+    merged.setColor(lhs.getColor() + rhs.getColor());
+
+    const float3 normW = normalize(lerp(lhs.getNormW(), rhs.getNormW(), 1.f - alpha));
+    merged.setNormW(normW);
+
+    // Bounding cone of the child cones around the stored axis
+    merged.setConeAngle(mergeConeAngle(merged.getNormW(), lhs.getNormW(), lhs.getConeAngle(), rhs.getNormW(), rhs.getConeAngle()));
+
+    merged.setAABBMin(min(lhs.getAABBMin(), rhs.getAABBMin()));
+    merged.setAABBMax(max(lhs.getAABBMax(), rhs.getAABBMax()));
+
+    merged.id = parentVplId;
+    merged.idChild1 = lhs.id;
+    merged.idChild2 = rhs.id;
+    merged.numVPLSubTree = lhs.numVPLSubTree + rhs.numVPLSubTree + 2;
+
+    // Compute variance and mean
+    float3 mean, variance;
+    float weight;
+    iterativePlaneWeightedMeanAndVariance(normW, lhs.getPosW(), rhs.getPosW(), lhs.getVariance(), rhs.getVariance(), lhsIntensity, rhsIntensity, mean, variance, weight);
+    merged.setPosW(mean);
+    merged.setVariance(variance);
+
+    // Compute approximation
+    mergeData.ApproxScore.x = lhsMerge.ApproxScore.x * rhsMerge.ApproxScore.x * computeNormalScore(lhs.getNormW(), rhs.getNormW());
+    mergeData.ApproxScore.y = std::sqrt(variance.z);
+
+    merged.setEarlyStop(evalScores(mergeData.ApproxScore, approxParams) ? 1.f : 0.f);
+
+    return merged;
+}
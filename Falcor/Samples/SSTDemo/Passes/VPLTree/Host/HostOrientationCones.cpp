@@ -0,0 +1,151 @@
+// Orientation cone reference, see HostOrientationCones.h
+
+#include "HostOrientationCones.h"
+#include "HostTreeValidation.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kNumEstimates = 16;
+    const uint32_t kSamplesPerEstimate = 4;
+    const uint32_t kMaxCullingReceivers = 64;   // Receivers of the full tree traversal, linear in the tree size each
+
+    // Emitter cosine of a VPL that counts as facing the receiver, above the rounding of a normal exactly at 90 degrees
+    const float kFacingCosine = 1e-4f;
+
+    /** Cosine between the normal of a node and the direction from its position to the receiver.
+    */
+    float emitterCosine(const VPLData& vpl, const float3& P)
+    {
+        const float3 N = vpl.getNormW();
+        const float3 d = P - vpl.getPosW();
+        const float len = length(N) * length(d);
+        return len > 0.f ? dot(N, d) / len : 1.f;
+    }
+
+    struct CullingStats
+    {
+        uint32_t numLeaves = 0;
+        uint32_t numBackFacing = 0;
+        uint32_t numCulled = 0;
+        uint32_t numMissed = 0;
+    };
+
+    /** Visits the whole tree and counts the leaves below nodes the cone bound culls for the receiver.
+    */
+    CullingStats countCulledLeaves(const std::vector<VPLData>& vplData, int rootIndex, const float3& P)
+    {
+        CullingStats stats;
+        std::vector<std::pair<int, bool>> stack;
+        stack.push_back({ rootIndex, false });
+        while (!stack.empty())
+        {
+            const int idx = stack.back().first;
+            const VPLData& vpl = vplData[idx];
+            const bool culled = stack.back().second ||
+                maxEmitterCosConeHost(P, vpl.getNormW(), vpl.getConeAngle(), vpl.getAABBMin(), vpl.getAABBMax()) <= 0.f;
+            stack.pop_back();
+
+            if (vpl.numVPLSubTree > 0)
+            {
+                stack.push_back({ vpl.idChild1, culled });
+                stack.push_back({ vpl.idChild2, culled });
+                continue;
+            }
+
+            const bool facing = emitterCosine(vpl, P) > kFacingCosine;
+            stats.numLeaves++;
+            if (!facing) stats.numBackFacing++;
+            if (culled) stats.numCulled++;
+            if (culled && facing) stats.numMissed++;
+        }
+        return stats;
+    }
+}
+
+OrientationConeCheck checkOrientationCones(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers)
+{
+    OrientationConeCheck result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs || numReceivers == 0)
+        return result;
+
+    const TreeValidationResult validation = validateTree(vplData, maxVPLs);
+    if (!validation.valid)
+        logWarning("checkOrientationCones: " + to_string(validation));
+
+    const VPLData& root = vplData[maxVPLs];
+    const float offset = length(root.getAABBMax() - root.getAABBMin()) * 1e-3f;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    if (receivers.empty())
+        return result;
+    result.numReceivers = (uint32_t)receivers.size();
+
+    // Conservativeness of the bound on a subset of the receivers
+    const size_t numCullingReceivers = std::min(receivers.size(), (size_t)kMaxCullingReceivers);
+    std::vector<CullingStats> culling(numCullingReceivers);
+    parallelFor(0, numCullingReceivers, [&](size_t r)
+    {
+        culling[r] = countCulledLeaves(vplData, maxVPLs, receivers[r].posW);
+    }, 1);
+
+    double numLeaves = 0.0, numBackFacing = 0.0, numCulled = 0.0;
+    for (const CullingStats& stats : culling)
+    {
+        numLeaves += stats.numLeaves;
+        numBackFacing += stats.numBackFacing;
+        numCulled += stats.numCulled;
+        result.numMissedVPLs += stats.numMissed;
+    }
+    result.backFacingVPLs = numLeaves > 0.0 ? (float)(numBackFacing / numLeaves) : 0.f;
+    result.culledVPLs = numLeaves > 0.0 ? (float)(numCulled / numLeaves) : 0.f;
+
+    // Wasted shadow rays and error, [0] without cones, [1] with cones
+    HostSamplingParams params[2];
+    params[1].useOrientationCones = true;
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, params[0]);
+
+    std::vector<uint32_t> wasted[2], backFacing[2];
+    float wastedRays[2], backFacingRays[2], error[2];
+    for (int m = 0; m < 2; m++)
+    {
+        wasted[m].assign(receivers.size(), 0);
+        backFacing[m].assign(receivers.size(), 0);
+        error[m] = estimateSamplingError(vplData, maxVPLs, receivers, reference, [&](const HostShadingPoint& sp, size_t r, uint32_t& seed)
+        {
+            const HostTreeSample sample = sampleVPLTreeHost(vplData, maxVPLs, sp, params[m], seed);
+            if (sample.nodeIdx >= 0) // Dead branches don't trace a shadow ray
+            {
+                if (!(luminance(sample.radiance) > 0.f)) wasted[m][r]++;
+                if (emitterCosine(vplData[sample.nodeIdx], sp.posW) <= 0.f) backFacing[m][r]++;
+            }
+            return sample;
+        }, kNumEstimates, kSamplesPerEstimate).error;
+
+        double totalWasted = 0.0, totalBackFacing = 0.0;
+        for (size_t r = 0; r < receivers.size(); r++)
+        {
+            totalWasted += wasted[m][r];
+            totalBackFacing += backFacing[m][r];
+        }
+        const double numSamples = (double)receivers.size() * kNumEstimates * kSamplesPerEstimate;
+        wastedRays[m] = (float)(totalWasted / numSamples);
+        backFacingRays[m] = (float)(totalBackFacing / numSamples);
+    }
+    result.wastedRays = wastedRays[0];
+    result.coneWastedRays = wastedRays[1];
+    result.backFacingRays = backFacingRays[0];
+    result.coneBackFacingRays = backFacingRays[1];
+    result.error = error[0];
+    result.coneError = error[1];
+    result.valid = validation.valid && result.numMissedVPLs == 0;
+
+    const std::string message = "checkOrientationCones: " + std::to_string(result.numReceivers) + " receivers, culled VPLs " + std::to_string(result.culledVPLs)
+        + " of " + std::to_string(result.backFacingVPLs) + " back-facing, wasted rays per sample " + std::to_string(result.wastedRays) + " -> " + std::to_string(result.coneWastedRays)
+        + ", back-facing " + std::to_string(result.backFacingRays) + " -> " + std::to_string(result.coneBackFacingRays)
+        + ", relative error " + std::to_string(result.error) + " -> " + std::to_string(result.coneError);
+    if (result.valid)
+        logInfo(message);
+    else
+        logWarning(message + ", " + std::to_string(result.numMissedVPLs) + " missed VPLs, invalid");
+    return result;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** Host reference of the orientation cones of the SST.
+    Every node bounds the normals of its subtree with a cone around its normal, see mergeConeAngle() in TreeMergeNodes.cs.slang.
+    With USE_ORIENTATION_CONES (HostSamplingParams::useOrientationCones on the host) the traversal weight is multiplied by
+    maxEmitterCosCone(), an upper bound of the emitter cosine over the cone and the bounds of a node. Subtrees that face away
+    from the receiver get probability 0, so no shadow ray is spent on a VPL that can't contribute.
+*/
+
+/** Result of checkOrientationCones().
+*/
+struct OrientationConeCheck
+{
+    bool valid = false;             ///< validateTree() including the cone containment passed and no culled VPL faces its receiver.
+    uint32_t numReceivers = 0;
+    uint32_t numMissedVPLs = 0;     ///< VPLs facing a receiver below a node with a zero bound, 0 if the bound is conservative.
+    float backFacingVPLs = 0.f;     ///< Fraction of the VPLs that face away from a receiver.
+    float culledVPLs = 0.f;         ///< Fraction of the VPLs below a node with a zero bound, at most backFacingVPLs.
+    float wastedRays = 0.f;         ///< Shadow rays per sample towards a node without contribution, without and with cones.
+    float coneWastedRays = 0.f;
+    float backFacingRays = 0.f;     ///< Shadow rays per sample towards a node that faces away from the receiver, without and with cones.
+    float coneBackFacingRays = 0.f;
+    float error = 0.f;              ///< Relative RMS error of the receiver estimates without and with cones.
+    float coneError = 0.f;
+};
+
+/** Samples the tree with and without orientation cones at receivers near the VPLs and counts the shadow rays that are wasted
+    on nodes without contribution. Visibility is not evaluated, so every wasted ray is caused by the orientation of the
+    receiver or of the VPLs. Also checks that the cone bound never culls a VPL that faces its receiver.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receivers, placed on random VPLs.
+    \return Check result, also logged.
+*/
+OrientationConeCheck checkOrientationCones(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers = 4096);
@@ -0,0 +1,809 @@
+// Out-of-core SST build, see HostOutOfCoreBuilder.h
+
+#include "HostOutOfCoreBuilder.h"
+#include "HostMerge.h"
+#include "HostTreeCache.h"
+#include "HostTreeSampling.h"
+#include "HostTreeValidation.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const size_t kMaxBatchSize = 1 << 16;           // VPLs per read from the source and per write of the leaves (4 MB)
+    const size_t kMinBatchSize = 256;
+    const uint32_t kMaxOpenChunkFiles = 256;        // Chunk files written per pass over the source, the C runtime allows 512 open files
+    const size_t kMaxChunkWriteBatch = 1024;        // VPLs buffered per chunk file
+    const size_t kMinChunkWriteBatch = 16;
+    const uint64_t kMaxOutOfCoreVPLs = 1ull << 30;  // Node ids are ints, the array has 2 * numVPLs elements
+    const uint32_t kInvalidCell = 0xFFFFFFFF;
+
+    inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    /** Writes records at an element offset of the VPL data array.
+    */
+    bool writeRecords(std::ofstream& file, uint64_t dataOffset, uint64_t index, const VPLData* pData, size_t count)
+    {
+        file.seekp((std::streamoff)(dataOffset + index * sizeof(VPLData)));
+        file.write((const char*)pData, (std::streamsize)(count * sizeof(VPLData)));
+        return file.good();
+    }
+
+    VPLData getInvalidRecord()
+    {
+        VPLData vpl = {};
+        vpl.id = -1;
+        vpl.idChild1 = -1;
+        vpl.idChild2 = -1;
+        vpl.numVPLSubTree = 0;
+        return vpl;
+    }
+
+    /** Reads the segment file of a VPL file.
+        \return False if the file exists but can't be read completely.
+    */
+    bool readVPLSegments(const std::string& filename, std::vector<VPLFileSegment>& segments)
+    {
+        segments.clear();
+        std::ifstream file(getVPLSegmentFilename(filename), std::ios::binary | std::ios::ate);
+        if (!file)
+            return true;
+        const uint64_t size = (uint64_t)file.tellg();
+        if (size % sizeof(VPLFileSegment) != 0)
+            return false;
+        segments.resize((size_t)(size / sizeof(VPLFileSegment)));
+        file.seekg(0);
+        return (bool)file.read((char*)segments.data(), (std::streamsize)size);
+    }
+}
+
+int appendVPLFile(const std::string& filename, const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numPaths)
+{
+    // Only the valid leaves, the out-of-core build renumbers them anyway
+    std::vector<VPLData> leaves;
+    for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+    {
+        if (vplData[i].id >= 0)
+            leaves.push_back(vplData[i]);
+    }
+    if (numPaths == 0)
+    {
+        logWarning("appendVPLFile: The trace has no paths, nothing appended to '" + filename + "'.");
+        return -1;
+    }
+
+    // The segments have to cover the whole file, otherwise the earlier traces can't be rescaled
+    uint64_t numRecords = 0;
+    {
+        std::ifstream file(filename, std::ios::binary | std::ios::ate);
+        if (file) numRecords = (uint64_t)file.tellg() / sizeof(VPLData);
+    }
+    std::vector<VPLFileSegment> segments;
+    uint64_t numSegmentRecords = 0;
+    const bool segmentsRead = readVPLSegments(filename, segments);
+    for (const VPLFileSegment& segment : segments) numSegmentRecords += segment.numRecords;
+    if (!segmentsRead || numSegmentRecords != numRecords)
+    {
+        logWarning("appendVPLFile: '" + filename + "' has no matching segment file, the path counts of its traces are unknown. Delete it to start a new bake input.");
+        return -1;
+    }
+
+    VPLFileSegment segment;
+    segment.numRecords = leaves.size();
+    segment.numPaths = numPaths;
+
+    std::ofstream file(filename, std::ios::binary | std::ios::app);
+    file.write((const char*)leaves.data(), (std::streamsize)(leaves.size() * sizeof(VPLData)));
+    std::ofstream segmentFile(getVPLSegmentFilename(filename), std::ios::binary | std::ios::app);
+    segmentFile.write((const char*)&segment, sizeof(VPLFileSegment));
+    if (!file.good() || !segmentFile.good())
+    {
+        logWarning("appendVPLFile: Appending the VPLs to '" + filename + "' failed.");
+        return -1;
+    }
+    return (int)leaves.size();
+}
+
+VPLFileSource::SharedPtr VPLFileSource::create(const std::string& filename)
+{
+    SharedPtr pSource = SharedPtr(new VPLFileSource());
+    pSource->mFilename = filename;
+    pSource->mFile.open(filename, std::ios::binary | std::ios::ate);
+    if (!pSource->mFile)
+    {
+        logWarning("VPLFileSource: Can't open '" + filename + "'.");
+        return nullptr;
+    }
+    const uint64_t size = (uint64_t)pSource->mFile.tellg();
+    if (size % sizeof(VPLData) != 0)
+    {
+        logWarning("VPLFileSource: '" + filename + "' is not an array of VPLData records.");
+        return nullptr;
+    }
+
+    if (!readVPLSegments(filename, pSource->mSegments))
+    {
+        logWarning("VPLFileSource: Can't read '" + getVPLSegmentFilename(filename) + "'.");
+        return nullptr;
+    }
+    uint64_t numRecords = 0, numPaths = 0;
+    for (const VPLFileSegment& segment : pSource->mSegments)
+    {
+        numRecords += segment.numRecords;
+        numPaths += segment.numPaths;
+    }
+    if (!pSource->mSegments.empty() && (numRecords != size / sizeof(VPLData) || numPaths == 0))
+    {
+        logWarning("VPLFileSource: The segments in '" + getVPLSegmentFilename(filename) + "' don't match the records of '" + filename + "'.");
+        return nullptr;
+    }
+
+    // A single trace is already normalized
+    if (pSource->mSegments.size() == 1)
+        pSource->mSegments.clear();
+    for (const VPLFileSegment& segment : pSource->mSegments)
+        pSource->mSegmentScales.push_back((float)((double)segment.numPaths / (double)numPaths));
+
+    pSource->rewind();
+    return pSource;
+}
+
+bool VPLFileSource::rewind()
+{
+    mSegment = 0;
+    mSegmentRecords = 0;
+    mFile.clear();
+    mFile.seekg(0);
+    return mFile.good();
+}
+
+size_t VPLFileSource::read(VPLData* pDst, size_t maxCount)
+{
+    mFile.read((char*)pDst, (std::streamsize)(maxCount * sizeof(VPLData)));
+    const size_t count = (size_t)mFile.gcount() / sizeof(VPLData);
+
+    for (size_t i = 0; i < count && !mSegments.empty(); i++)
+    {
+        while (mSegmentRecords == mSegments[mSegment].numRecords)
+        {
+            mSegment++;
+            mSegmentRecords = 0;
+        }
+        const float scale = mSegmentScales[mSegment];
+        pDst[i].setIntensity(pDst[i].getIntensity() * scale);
+        pDst[i].setColor(pDst[i].getColor() * scale);
+        mSegmentRecords++;
+    }
+    return count;
+}
+
+VPLCallbackSource::SharedPtr VPLCallbackSource::create(uint64_t numRecords, GenerateFunc generate)
+{
+    SharedPtr pSource = SharedPtr(new VPLCallbackSource());
+    pSource->mNumRecords = numRecords;
+    pSource->mGenerate = generate;
+    return pSource;
+}
+
+size_t VPLCallbackSource::read(VPLData* pDst, size_t maxCount)
+{
+    const size_t count = (size_t)std::min<uint64_t>(maxCount, mNumRecords - mNext);
+    if (count > 0)
+        mGenerate(mNext, count, pDst);
+    mNext += count;
+    return count;
+}
+
+HostOutOfCoreBuilder::HostOutOfCoreBuilder()
+{
+    mpBuilder = HostTreeBuilder::create();
+}
+
+HostOutOfCoreBuilder::SharedPtr HostOutOfCoreBuilder::create()
+{
+    return SharedPtr(new HostOutOfCoreBuilder());
+}
+
+size_t HostOutOfCoreBuilder::getChunkBytesPerVPL(const HostTreeBuilder::Desc& buildDesc, uint64_t numVPLs)
+{
+    const TreeCodeLayout layout = computeTreeCodeLayout(buildDesc.mortonBits, buildDesc.numSphereSections, (int)std::min<uint64_t>(numVPLs, (uint64_t)std::numeric_limits<int>::max()), buildDesc.force128BitCodes);
+    const size_t codeBytes = layout.use128Bit ? sizeof(Key128) : sizeof(uint64_t);
+
+    // Node sized buffers have 2 * numVPLs elements, the codes and the radix sort scratch one per VPL
+    return 2 * (sizeof(VPLData) + sizeof(TreeNode) + sizeof(VPLMerge) + sizeof(std::atomic<uint32_t>)) + 2 * codeBytes + sizeof(uint32_t);
+}
+
+bool HostOutOfCoreBuilder::build(const Desc& desc, VPLStreamSource& source, const std::string& filename)
+{
+    mDesc = desc;
+    mStats = Stats();
+    mChunks.clear();
+    mSplitCells.clear();
+    mChunkBufferSize = 0;
+    mTempPrefix = desc.tempPrefix.empty() ? filename + ".chunk" : desc.tempPrefix;
+
+    // The read batch and its cells, or the leaf staging buffer, take at most 1/16 of the budget
+    mBatchSize = std::min(kMaxBatchSize, std::max(kMinBatchSize, mDesc.memoryBudget / 16 / (sizeof(VPLData) + sizeof(uint32_t))));
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+    const bool partitioned = computeBounds(source) && partition(source) && writeChunkFiles(source);
+
+    // The histogram is not needed by the chunk builds
+    std::vector<uint64_t>().swap(mCellCounts);
+    mSplitCells.clear();
+    if (!partitioned)
+    {
+        removeChunkFiles();
+        return false;
+    }
+    auto t1 = CpuTimer::getCurrentTimePoint();
+
+    const uint64_t numVPLs = mStats.numVPLs;
+    OutOfCoreTreeHeader header;
+    header.headerSize        = sizeof(OutOfCoreTreeHeader);
+    header.vplDataStride     = sizeof(VPLData);
+    header.maxVPLs           = (int32_t)numVPLs;
+    header.numChunks         = (uint32_t)mChunks.size();
+    header.numSphereSections = mDesc.buildDesc.numSphereSections;
+    header.vplDataOffset     = alignUp(sizeof(OutOfCoreTreeHeader), kTreeCacheAlignment);
+    header.vplDataCount      = 2 * numVPLs;
+    header.fileSize          = header.vplDataOffset + header.vplDataCount * sizeof(VPLData);
+    header.numInputVPLs      = mStats.numInputVPLs;
+    header.boundsMin         = mBoundsMin;
+    header.boundsMax         = mBoundsMax;
+    header.approxParams      = mDesc.buildDesc.approxParams;
+    mDataOffset = header.vplDataOffset;
+
+    const std::string tempFilename = filename + ".tmp";
+    bool success = false;
+    auto t2 = t1;
+    auto t3 = t1;
+    {
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logWarning("HostOutOfCoreBuilder: Can't open '" + tempFilename + "' for writing.");
+            removeChunkFiles();
+            return false;
+        }
+        file.write((const char*)&header, sizeof(OutOfCoreTreeHeader));
+
+        success = true;
+        for (uint32_t c = 0; c < (uint32_t)mChunks.size() && success; c++)
+            success = buildChunk(c, file);
+        t2 = CpuTimer::getCurrentTimePoint();
+
+        success = success && buildTopLevel(file);
+        t3 = CpuTimer::getCurrentTimePoint();
+        if (success && !file.good())
+        {
+            logWarning("HostOutOfCoreBuilder: Writing '" + tempFilename + "' failed.");
+            success = false;
+        }
+    }
+
+    // Release the chunk buffers, an offline bake doesn't build again soon
+    std::vector<VPLData>().swap(mChunkData);
+    std::vector<uint32_t>().swap(mLeafOrder);
+    std::vector<VPLData>().swap(mStaging);
+    mpBuilder = HostTreeBuilder::create();
+
+    if (!success)
+    {
+        removeChunkFiles();
+        std::remove(tempFilename.c_str());
+        return false;
+    }
+
+    // rename() does not replace existing files on Windows
+    std::remove(filename.c_str());
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+    {
+        logWarning("HostOutOfCoreBuilder: Can't rename '" + tempFilename + "' to '" + filename + "'.");
+        return false;
+    }
+
+    mStats.partitionTime  = (float)CpuTimer::calcDuration(t0, t1);
+    mStats.chunkBuildTime = (float)CpuTimer::calcDuration(t1, t2);
+    mStats.topLevelTime   = (float)CpuTimer::calcDuration(t2, t3);
+    mStats.totalTime      = (float)CpuTimer::calcDuration(t0, t3);
+
+    logInfo("HostOutOfCoreBuilder: " + std::to_string(mStats.numVPLs) + " VPLs in " + std::to_string(mStats.numChunks) + " chunks of at most " +
+        std::to_string(mStats.chunkCapacity) + " VPLs, peak memory " + std::to_string(mStats.peakMemory >> 20) + " MB of " + std::to_string(mDesc.memoryBudget >> 20) +
+        " MB, " + std::to_string(mStats.totalTime) + " ms (partition " + std::to_string(mStats.partitionTime) + " ms, chunks " + std::to_string(mStats.chunkBuildTime) + " ms)");
+    if (mStats.peakMemory > mDesc.memoryBudget)
+        logWarning("HostOutOfCoreBuilder: Peak memory exceeds the budget.");
+    return true;
+}
+
+bool HostOutOfCoreBuilder::computeBounds(VPLStreamSource& source)
+{
+    if (!source.rewind())
+    {
+        logWarning("HostOutOfCoreBuilder: Can't rewind the VPL source.");
+        return false;
+    }
+
+    std::vector<VPLData> batch(mBatchSize);
+    float3 lower = float3(FLT_MAX);
+    float3 upper = float3(-FLT_MAX);
+    size_t count = 0;
+    while ((count = source.read(batch.data(), mBatchSize)) > 0)
+    {
+        mStats.numInputVPLs += count;
+        for (size_t i = 0; i < count; i++)
+        {
+            if (batch[i].id < 0)
+                continue;
+            const float3 position = batch[i].getPosW();
+            lower = min(lower, position);
+            upper = max(upper, position);
+            mStats.numVPLs++;
+        }
+    }
+    updatePeakMemory(batch.capacity() * sizeof(VPLData));
+
+    if (mStats.numVPLs == 0)
+    {
+        logWarning("HostOutOfCoreBuilder: The source has no valid VPLs.");
+        return false;
+    }
+    if (mStats.numVPLs > kMaxOutOfCoreVPLs)
+    {
+        logWarning("HostOutOfCoreBuilder: " + std::to_string(mStats.numVPLs) + " VPLs exceed the limit of " + std::to_string(kMaxOutOfCoreVPLs) + " of the node ids.");
+        return false;
+    }
+
+    mBoundsMin = lower;
+    mBoundsMax = upper;
+    return true;
+}
+
+bool HostOutOfCoreBuilder::partition(VPLStreamSource& source)
+{
+    const HostTreeBuilder::Desc& buildDesc = mDesc.buildDesc;
+
+    // The histogram may take a quarter of the budget. It is freed before the chunk builds.
+    mCellBits = std::min(std::max(mDesc.histogramBitsPerAxis, 1u), 10u);
+    while (mCellBits > 1 && (sizeof(uint64_t) << (3 * mCellBits)) > mDesc.memoryBudget / 4)
+        mCellBits--;
+    mStats.histogramBitsPerAxis = mCellBits;
+
+    // Chunk capacity: the budget minus the staging buffer of the leaves and 1/32 for the sort histograms, at the bytes per VPL of that chunk size
+    const size_t reservedBytes = mBatchSize * sizeof(VPLData) + mDesc.memoryBudget / 32;
+    uint64_t capacity = 0;
+    if (mDesc.memoryBudget > reservedBytes)
+    {
+        const size_t available = mDesc.memoryBudget - reservedBytes;
+        capacity = available / getChunkBytesPerVPL(buildDesc, 1);
+        capacity = available / getChunkBytesPerVPL(buildDesc, capacity);
+    }
+    capacity = std::min(capacity, mStats.numVPLs);
+    if (capacity < std::min<uint64_t>(2, mStats.numVPLs))
+    {
+        logWarning("HostOutOfCoreBuilder: Memory budget of " + std::to_string(mDesc.memoryBudget) + " bytes is too small.");
+        return false;
+    }
+    mStats.chunkCapacity = capacity;
+
+    // Histogram of the morton cells
+    if (!source.rewind())
+    {
+        logWarning("HostOutOfCoreBuilder: Can't rewind the VPL source.");
+        return false;
+    }
+    const size_t numCells = size_t(1) << (3 * mCellBits);
+    mCellCounts.assign(numCells, 0);
+    std::vector<VPLData> batch(mBatchSize);
+    std::vector<uint32_t> cells(mBatchSize);
+    size_t count = 0;
+    while ((count = source.read(batch.data(), mBatchSize)) > 0)
+    {
+        parallelFor(0, count, [&](size_t i) { cells[i] = batch[i].id >= 0 ? getCell(batch[i]) : kInvalidCell; });
+        for (size_t i = 0; i < count; i++)
+        {
+            if (cells[i] != kInvalidCell)
+                mCellCounts[cells[i]]++;
+        }
+    }
+    updatePeakMemory(mCellCounts.capacity() * sizeof(uint64_t) + batch.capacity() * sizeof(VPLData) + cells.capacity() * sizeof(uint32_t));
+
+    // Cut the cells in morton order into chunks. A cell with more VPLs than a chunk holds gets chunks of its own.
+    bool chunkOpen = false;
+    for (size_t cell = 0; cell < numCells; cell++)
+    {
+        const uint64_t cellCount = mCellCounts[cell];
+        if (cellCount == 0)
+            continue;
+
+        if (cellCount > capacity)
+        {
+            mCellCounts[cell] = mChunks.size();
+            mSplitCells[(uint32_t)cell] = 0;
+            for (uint64_t first = 0; first < cellCount; first += capacity)
+            {
+                Chunk chunk;
+                chunk.numVPLs = std::min(capacity, cellCount - first);
+                chunk.firstCell = cell;
+                mChunks.push_back(chunk);
+            }
+            mStats.numSplitCells++;
+            chunkOpen = false;
+            continue;
+        }
+
+        if (!chunkOpen || mChunks.back().numVPLs + cellCount > capacity)
+        {
+            Chunk chunk;
+            chunk.firstCell = cell;
+            mChunks.push_back(chunk);
+            chunkOpen = true;
+        }
+        mChunks.back().numVPLs += cellCount;
+        mCellCounts[cell] = mChunks.size() - 1;
+    }
+
+    // Output layout: [leaves, top-level nodes, internal nodes of the chunks]
+    const uint64_t numChunks = mChunks.size();
+    uint64_t leafBase = 0;
+    uint64_t nodeBase = mStats.numVPLs + numChunks - 1;
+    for (Chunk& chunk : mChunks)
+    {
+        chunk.leafBase = leafBase;
+        chunk.nodeBase = nodeBase;
+        leafBase += chunk.numVPLs;
+        nodeBase += chunk.numVPLs - 1;
+        mStats.largestChunk = std::max(mStats.largestChunk, chunk.numVPLs);
+    }
+    mStats.numChunks = (uint32_t)numChunks;
+    return true;
+}
+
+bool HostOutOfCoreBuilder::writeChunkFiles(VPLStreamSource& source)
+{
+    const uint32_t numChunks = (uint32_t)mChunks.size();
+    // The write buffers take at most a quarter of the budget, small budgets need more passes
+    const size_t bufferBytes = mDesc.memoryBudget / 4;
+    const uint32_t numOpenFiles = (uint32_t)std::max<size_t>(1, std::min<size_t>(std::min(numChunks, kMaxOpenChunkFiles), bufferBytes / (kMinChunkWriteBatch * sizeof(VPLData))));
+    const size_t writeBatch = std::min(kMaxChunkWriteBatch, std::max(kMinChunkWriteBatch, bufferBytes / (numOpenFiles * sizeof(VPLData))));
+
+    std::vector<VPLData> batch(mBatchSize);
+    std::vector<uint32_t> cells(mBatchSize);
+
+    // Every pass over the source writes the files of numOpenFiles chunks
+    for (uint32_t firstChunk = 0; firstChunk < numChunks; firstChunk += numOpenFiles)
+    {
+        const uint32_t endChunk = std::min(firstChunk + numOpenFiles, numChunks);
+        std::vector<std::ofstream> files(endChunk - firstChunk);
+        std::vector<std::vector<VPLData>> buffers(endChunk - firstChunk);
+        for (uint32_t c = firstChunk; c < endChunk; c++)
+        {
+            files[c - firstChunk].open(getChunkFilename(c), std::ios::binary | std::ios::trunc);
+            if (!files[c - firstChunk])
+            {
+                logWarning("HostOutOfCoreBuilder: Can't open '" + getChunkFilename(c) + "' for writing.");
+                return false;
+            }
+            buffers[c - firstChunk].reserve(writeBatch);
+        }
+
+        auto flush = [&](uint32_t local)
+        {
+            files[local].write((const char*)buffers[local].data(), (std::streamsize)(buffers[local].size() * sizeof(VPLData)));
+            buffers[local].clear();
+        };
+
+        for (auto& splitCell : mSplitCells)
+            splitCell.second = 0;
+
+        if (!source.rewind())
+        {
+            logWarning("HostOutOfCoreBuilder: Can't rewind the VPL source.");
+            return false;
+        }
+        size_t count = 0;
+        while ((count = source.read(batch.data(), mBatchSize)) > 0)
+        {
+            parallelFor(0, count, [&](size_t i) { cells[i] = batch[i].id >= 0 ? getCell(batch[i]) : kInvalidCell; });
+            for (size_t i = 0; i < count; i++)
+            {
+                if (cells[i] == kInvalidCell)
+                    continue;
+                // Split cells count their VPLs on every pass, also if the chunk is written by another pass
+                const uint64_t chunkIdx = getChunkIndex(cells[i]);
+                if (chunkIdx < firstChunk || chunkIdx >= endChunk)
+                    continue;
+
+                const uint32_t local = (uint32_t)chunkIdx - firstChunk;
+                buffers[local].push_back(batch[i]);
+                if (buffers[local].size() == writeBatch)
+                    flush(local);
+            }
+        }
+
+        size_t usedBufferBytes = 0;
+        for (uint32_t local = 0; local < (uint32_t)files.size(); local++)
+        {
+            usedBufferBytes += buffers[local].capacity() * sizeof(VPLData);
+            flush(local);
+            files[local].close();
+            if (files[local].fail())
+            {
+                logWarning("HostOutOfCoreBuilder: Writing '" + getChunkFilename(firstChunk + local) + "' failed.");
+                return false;
+            }
+        }
+        updatePeakMemory(mCellCounts.capacity() * sizeof(uint64_t) + batch.capacity() * sizeof(VPLData) + cells.capacity() * sizeof(uint32_t) + usedBufferBytes);
+        mStats.numDistributionPasses++;
+    }
+    return true;
+}
+
+bool HostOutOfCoreBuilder::buildChunk(uint32_t chunkIdx, std::ofstream& file)
+{
+    Chunk& chunk = mChunks[chunkIdx];
+    const int numVPLs = (int)chunk.numVPLs;
+
+    // Allocate the buffers for exactly the largest chunk so far, growing them in place may double their capacity
+    if (chunk.numVPLs > mChunkBufferSize)
+    {
+        mpBuilder = HostTreeBuilder::create();
+        std::vector<VPLData>().swap(mChunkData);
+        std::vector<uint32_t>().swap(mLeafOrder);
+        mChunkData.reserve(2 * (size_t)numVPLs);
+        mLeafOrder.reserve(numVPLs);
+        mChunkBufferSize = chunk.numVPLs;
+    }
+
+    mChunkData.resize(2 * (size_t)numVPLs);
+    {
+        const std::string chunkFilename = getChunkFilename(chunkIdx);
+        std::ifstream chunkFile(chunkFilename, std::ios::binary);
+        chunkFile.read((char*)mChunkData.data(), (std::streamsize)(numVPLs * sizeof(VPLData)));
+        const bool complete = (size_t)chunkFile.gcount() == numVPLs * sizeof(VPLData) && chunkFile.peek() == EOF;
+        chunkFile.close();
+        std::remove(chunkFilename.c_str());
+        if (!complete)
+        {
+            logWarning("HostOutOfCoreBuilder: Chunk file '" + chunkFilename + "' does not match the partition, the source returned different VPLs on another pass.");
+            return false;
+        }
+    }
+
+    // Leaves must be stored at their id
+    for (int i = 0; i < numVPLs; i++)
+        mChunkData[i].id = i;
+
+    HostTreeBuilder::Desc buildDesc = mDesc.buildDesc;
+    buildDesc.minExtent   = mBoundsMin;
+    buildDesc.maxExtent   = mBoundsMax;
+    buildDesc.enableRefit = false;
+    if (!mpBuilder->build(buildDesc, mChunkData, numVPLs, numVPLs))
+    {
+        logWarning("HostOutOfCoreBuilder: Build of chunk " + std::to_string(chunkIdx) + " failed.");
+        return false;
+    }
+
+    // Leaves are written in the morton order of the build
+    const std::vector<TreeNode>& nodes = mpBuilder->getNodes();
+    const uint32_t numInternalNodes = getNumInternalNodes(numVPLs);
+    mLeafOrder.resize(numVPLs);
+    for (int i = 0; i < numVPLs; i++)
+        mLeafOrder[nodes[numInternalNodes + i].vpl_idx] = (uint32_t)i;
+
+    updatePeakMemory(mpBuilder->getMemoryUsage() + mChunkData.capacity() * sizeof(VPLData) + mLeafOrder.capacity() * sizeof(uint32_t) + mBatchSize * sizeof(VPLData));
+
+    auto toOutputIndex = [&](int localIdx)
+    {
+        if (localIdx < 0)
+            return localIdx;
+        return localIdx < numVPLs ? (int)(chunk.leafBase + mLeafOrder[localIdx]) : (int)(chunk.nodeBase + (localIdx - numVPLs));
+    };
+
+    mStaging.resize(mBatchSize);
+    for (int first = 0; first < numVPLs; first += (int)mBatchSize)
+    {
+        const int count = std::min((int)mBatchSize, numVPLs - first);
+        for (int i = 0; i < count; i++)
+        {
+            VPLData& leaf = mStaging[i];
+            leaf = mChunkData[nodes[numInternalNodes + first + i].vpl_idx];
+            leaf.id = (int)(chunk.leafBase + first + i);
+        }
+        if (!writeRecords(file, mDataOffset, chunk.leafBase + first, mStaging.data(), count))
+            return false;
+    }
+
+    // A single VPL is its own root, the copy at index 1 of the build is not needed
+    if (numVPLs == 1)
+    {
+        chunk.root = mStaging[0];
+        chunk.rootMerge.ApproxScore = float2(1.f, 0.f);
+        return true;
+    }
+
+    parallelFor((size_t)numVPLs, 2 * (size_t)numVPLs - 1, [&](size_t i)
+    {
+        VPLData& node = mChunkData[i];
+        node.id       = toOutputIndex(node.id);
+        node.idChild1 = toOutputIndex(node.idChild1);
+        node.idChild2 = toOutputIndex(node.idChild2);
+    });
+    chunk.root = mChunkData[numVPLs];
+    chunk.rootMerge = mpBuilder->getMerge()[numVPLs];
+    return writeRecords(file, mDataOffset, chunk.nodeBase, &mChunkData[numVPLs], numVPLs - 1);
+}
+
+bool HostOutOfCoreBuilder::buildTopLevel(std::ofstream& file)
+{
+    const uint64_t numVPLs = mStats.numVPLs;
+    const VPLData invalid = getInvalidRecord();
+
+    // One chunk is the whole tree. Like HostTreeBuilder a single VPL is copied to the root.
+    if (mChunks.size() == 1)
+    {
+        if (numVPLs == 1)
+            return writeRecords(file, mDataOffset, 1, &mChunks[0].root, 1);
+        return writeRecords(file, mDataOffset, 2 * numVPLs - 1, &invalid, 1);
+    }
+
+    std::vector<VPLData> topNodes;
+    topNodes.reserve(mChunks.size() - 1);
+    VPLData root;
+    VPLMerge rootMerge;
+    buildTopLevelNode(0, (uint32_t)mChunks.size() - 1, topNodes, root, rootMerge);
+
+    return writeRecords(file, mDataOffset, numVPLs, topNodes.data(), topNodes.size()) &&
+           writeRecords(file, mDataOffset, 2 * numVPLs - 1, &invalid, 1);
+}
+
+void HostOutOfCoreBuilder::buildTopLevelNode(uint32_t first, uint32_t last, std::vector<VPLData>& topNodes, VPLData& node, VPLMerge& merge)
+{
+    if (first == last)
+    {
+        node = mChunks[first].root;
+        merge = mChunks[first].rootMerge;
+        return;
+    }
+
+    // Nodes are stored in pre-order, so the root ends up at numVPLs
+    const size_t topIdx = topNodes.size();
+    topNodes.emplace_back();
+
+    // Split at the highest differing bit of the first cells like find_split(), chunks of one cell in the middle
+    const uint64_t firstCode = mChunks[first].firstCell;
+    const uint64_t lastCode  = mChunks[last].firstCell;
+    uint32_t split = (first + last) >> 1;
+    if (firstCode != lastCode)
+    {
+        const int deltaNode = clz64(firstCode ^ lastCode);
+        split = first;
+        for (uint32_t i = first + 1; i < last && clz64(firstCode ^ mChunks[i].firstCell) > deltaNode; i++)
+            split = i;
+    }
+
+    VPLData lhs, rhs;
+    VPLMerge lhsMerge, rhsMerge;
+    buildTopLevelNode(first, split, topNodes, lhs, lhsMerge);
+    buildTopLevelNode(split + 1, last, topNodes, rhs, rhsMerge);
+
+    node = mergeVPLData(lhs, rhs, lhsMerge, rhsMerge, (uint)(mStats.numVPLs + topIdx), mDesc.buildDesc.approxParams, merge);
+    topNodes[topIdx] = node;
+}
+
+uint64_t HostOutOfCoreBuilder::getChunkIndex(uint32_t cell)
+{
+    const auto splitCell = mSplitCells.find(cell);
+    if (splitCell == mSplitCells.end())
+        return mCellCounts[cell];
+
+    // VPLs of a split cell fill its chunks in input order
+    return mCellCounts[cell] + splitCell->second++ / mStats.chunkCapacity;
+}
+
+uint32_t HostOutOfCoreBuilder::getCell(const VPLData& vpl) const
+{
+    const float3 position = (vpl.getPosW() - mBoundsMin) / getCodeExtent(mBoundsMin, mBoundsMax);
+    return (uint32_t)morton_code_bits(position, uint3(mCellBits));
+}
+
+std::string HostOutOfCoreBuilder::getChunkFilename(uint32_t chunkIdx) const
+{
+    return mTempPrefix + std::to_string(chunkIdx);
+}
+
+void HostOutOfCoreBuilder::removeChunkFiles() const
+{
+    for (uint32_t c = 0; c < (uint32_t)mChunks.size(); c++)
+        std::remove(getChunkFilename(c).c_str());
+}
+
+bool readOutOfCoreTree(const std::string& filename, OutOfCoreTreeHeader& header, std::vector<VPLData>& vplData)
+{
+    std::ifstream file(filename, std::ios::binary);
+    if (!file || !file.read((char*)&header, sizeof(OutOfCoreTreeHeader)))
+    {
+        logWarning("readOutOfCoreTree: Can't read '" + filename + "'.");
+        return false;
+    }
+    if (header.magic != kOutOfCoreTreeMagic || header.version != kOutOfCoreTreeVersion || header.headerSize != sizeof(OutOfCoreTreeHeader) ||
+        header.vplDataStride != sizeof(VPLData) || header.maxVPLs <= 0 || header.vplDataCount != 2 * (uint64_t)header.maxVPLs)
+    {
+        logWarning("readOutOfCoreTree: '" + filename + "' is not an out-of-core tree of this build.");
+        return false;
+    }
+
+    vplData.resize((size_t)header.vplDataCount);
+    file.seekg((std::streamoff)header.vplDataOffset);
+    if (!file.read((char*)vplData.data(), (std::streamsize)(vplData.size() * sizeof(VPLData))))
+    {
+        logWarning("readOutOfCoreTree: '" + filename + "' is truncated.");
+        return false;
+    }
+    return true;
+}
+
+OutOfCoreBuildCheck checkOutOfCoreBuild(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, const std::string& filename)
+{
+    OutOfCoreBuildCheck result;
+    if (numVPLs <= 1 || maxVPLs <= 0 || vplData.size() < (size_t)maxVPLs)
+        return result;
+
+    HostTreeBuilder::Desc buildDesc = desc;
+    buildDesc.enableRefit = false;
+
+    std::vector<VPLData> inMemoryData(vplData.begin(), vplData.begin() + maxVPLs);
+    HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+    if (!pBuilder->build(buildDesc, inMemoryData, numVPLs, maxVPLs))
+        return result;
+    result.inMemoryTime = pBuilder->getTimings().total;
+
+    // A quarter of the in-memory build
+    HostOutOfCoreBuilder::Desc outOfCoreDesc;
+    outOfCoreDesc.buildDesc = buildDesc;
+    outOfCoreDesc.memoryBudget = (pBuilder->getMemoryUsage() + inMemoryData.capacity() * sizeof(VPLData)) / 4;
+    result.memoryBudget = outOfCoreDesc.memoryBudget;
+
+    VPLCallbackSource::SharedPtr pSource = VPLCallbackSource::create((uint64_t)maxVPLs, [&](uint64_t first, size_t count, VPLData* pDst)
+    {
+        std::copy(vplData.begin() + (size_t)first, vplData.begin() + (size_t)first + count, pDst);
+    });
+    HostOutOfCoreBuilder::SharedPtr pOutOfCoreBuilder = HostOutOfCoreBuilder::create();
+    if (!pOutOfCoreBuilder->build(outOfCoreDesc, *pSource, filename))
+        return result;
+
+    const HostOutOfCoreBuilder::Stats& stats = pOutOfCoreBuilder->getStats();
+    result.numChunks = stats.numChunks;
+    result.peakMemory = stats.peakMemory;
+    result.outOfCoreTime = stats.totalTime;
+
+    OutOfCoreTreeHeader header;
+    std::vector<VPLData> outOfCoreData;
+    const bool read = readOutOfCoreTree(filename, header, outOfCoreData);
+    std::remove(filename.c_str());
+    if (!read)
+        return result;
+
+    const TreeValidationResult validation = validateTree(outOfCoreData, header.maxVPLs);
+    result.valid = validation.valid && header.maxVPLs == numVPLs && validation.numValidVPLs == (uint32_t)numVPLs && stats.peakMemory <= result.memoryBudget;
+    if (!validation.valid)
+        logWarning("checkOutOfCoreBuild: " + to_string(validation));
+
+    // Same receivers and reference for both trees, the reference is the sum over all VPLs
+    const float offset = length(desc.maxExtent - desc.minExtent) * 1e-3f;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, 256, offset);
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, HostSamplingParams());
+    result.inMemoryError = estimateSamplingError(inMemoryData, maxVPLs, receivers, reference).error;
+    result.outOfCoreError = estimateSamplingError(outOfCoreData, header.maxVPLs, receivers, reference).error;
+
+    const std::string message = "checkOutOfCoreBuild: " + std::to_string(result.numChunks) + " chunks, peak memory " + std::to_string(result.peakMemory >> 10) + " KB of " +
+        std::to_string(result.memoryBudget >> 10) + " KB, " + std::to_string(result.outOfCoreTime) + " ms (in-memory " + std::to_string(result.inMemoryTime) + " ms), error " +
+        std::to_string(result.outOfCoreError) + " (in-memory " + std::to_string(result.inMemoryError) + ")";
+    if (result.valid)
+        logInfo(message);
+    else
+        logWarning(message + ", invalid");
+    return result;
+}
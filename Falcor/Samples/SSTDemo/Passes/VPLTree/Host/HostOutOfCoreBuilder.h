@@ -0,0 +1,285 @@
+#pragma once
+
+#include "Falcor.h"
+#include <fstream>
+#include <functional>
+#include <unordered_map>
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeBuilder.h"
+
+using namespace Falcor;
+
+
+/** Out-of-core SST build for offline bakes with more VPLs than fit into memory.
+    The VPLs are streamed from a source in three passes: the bounds of the valid VPLs, a histogram over the top morton
+    bits and the distribution into chunk files. A chunk is a run of consecutive morton cells with at most as many VPLs
+    as the memory budget allows. Every chunk is built on its own with HostTreeBuilder, then a top-level tree is built
+    over the chunk roots. Only one chunk is in memory at a time, so the peak memory depends on the budget and not on
+    the number of VPLs.
+
+    The output is a header followed by one VPL data array, the same layout as gVPLData with maxVPLs = number of VPLs:
+    - [leaves (numVPLs), top-level nodes (numChunks - 1), internal nodes of chunk 0, chunk 1, ...], root at numVPLs.
+    - Leaves are stored chunk by chunk in morton order and renumbered, the id of a node is its index in the array.
+    - The array has 2 * numVPLs elements like the GPU buffer, the last element is unused unless there is only one VPL.
+    Leaves and chunk nodes are appended chunk by chunk through two write cursors, the top-level nodes are written last.
+*/
+
+static const uint32_t kOutOfCoreTreeMagic   = 0x4f545353;  // "SSTO"
+static const uint32_t kOutOfCoreTreeVersion = 2;
+
+struct OutOfCoreTreeHeader
+{
+    uint32_t magic = kOutOfCoreTreeMagic;
+    uint32_t version = kOutOfCoreTreeVersion;
+    uint32_t headerSize = 0;                ///< sizeof(OutOfCoreTreeHeader)
+    uint32_t vplDataStride = 0;             ///< sizeof(VPLData)
+    int32_t maxVPLs = 0;                    ///< Number of leaves, the root is at maxVPLs.
+    uint32_t numChunks = 0;
+    uint32_t numSphereSections = 0;         ///< Direction code parameter of the chunk builds.
+    uint32_t pad0 = 0;
+
+    uint64_t vplDataOffset = 0;             ///< Byte offset of the VPL data array, a multiple of kTreeCacheAlignment.
+    uint64_t vplDataCount = 0;
+    uint64_t fileSize = 0;
+    uint64_t numInputVPLs = 0;              ///< Records read from the source, including invalid ones.
+
+    float3 boundsMin = float3(0.f);         ///< Bounds of the valid VPLs the chunks were partitioned in.
+    float pad1 = 0.f;
+    float3 boundsMax = float3(0.f);
+    float pad2 = 0.f;
+    TreeApproxParams approxParams;
+};
+
+/** Sequential VPL input of the out-of-core build. Read three times, so it must be able to start over.
+    Records with a negative id are skipped, the ids of the valid ones are not used.
+*/
+class VPLStreamSource : public std::enable_shared_from_this<VPLStreamSource>
+{
+public:
+    using SharedPtr = std::shared_ptr<VPLStreamSource>;
+    virtual ~VPLStreamSource() = default;
+
+    /** Starts over at the first record.
+        \return True if successful.
+    */
+    virtual bool rewind() = 0;
+
+    /** Reads the next records.
+        \param[out] pDst Destination of at most maxCount records.
+        \param[in] maxCount Capacity of the destination.
+        \return Number of records read, 0 at the end of the input.
+    */
+    virtual size_t read(VPLData* pDst, size_t maxCount) = 0;
+};
+
+/** Records and paths of one trace in a VPL file, see appendVPLFile().
+*/
+struct VPLFileSegment
+{
+    uint64_t numRecords = 0;
+    uint64_t numPaths = 0;      ///< Paths of the trace, the radiance of its records is divided by it.
+};
+
+/** Returns the file of the VPLFileSegment array that belongs to a VPL file.
+*/
+inline std::string getVPLSegmentFilename(const std::string& filename) { return filename + ".segments"; }
+
+/** Appends the valid leaves of a trace to a VPL file and a segment with their number and the path count to its segment file.
+    Appending to a non-empty VPL file without a segment file fails, the path counts of its traces are unknown.
+    \param[in] vplData VPL data array of the trace.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numPaths Paths of the trace, see VPLStats.
+    \return Number of appended VPLs, or -1 if writing failed. Errors are logged.
+*/
+int appendVPLFile(const std::string& filename, const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numPaths);
+
+/** Reads a file of raw VPLData records, e.g. concatenated leaf ranges of gVPLData.
+    A trace divides the radiance of its VPLs by its own path count. If the file holds several traces (see appendVPLFile()),
+    the records of every trace are scaled by its share of all paths, so the VPLs of all traces sum to one estimate.
+    A file without a segment file is read unchanged as a single trace.
+*/
+class VPLFileSource : public VPLStreamSource
+{
+public:
+    using SharedPtr = std::shared_ptr<VPLFileSource>;
+
+    /** Opens the file and its segment file if there is one.
+        \return The source, or nullptr if the file can't be opened, its size is not a multiple of sizeof(VPLData)
+        or the segments don't match the records.
+    */
+    static SharedPtr create(const std::string& filename);
+
+    bool rewind() override;
+    size_t read(VPLData* pDst, size_t maxCount) override;
+
+protected:
+    VPLFileSource() = default;
+
+    std::string mFilename;
+    std::ifstream mFile;
+    std::vector<VPLFileSegment> mSegments;  ///< Empty if the records are read unchanged.
+    std::vector<float> mSegmentScales;      ///< Share of all paths of every segment.
+    size_t mSegment = 0;                    ///< Segment of the next record.
+    uint64_t mSegmentRecords = 0;           ///< Records of the current segment read so far.
+};
+
+/** Generates the records with a callback, e.g. VPLs synthesized or read from another format.
+*/
+class VPLCallbackSource : public VPLStreamSource
+{
+public:
+    using SharedPtr = std::shared_ptr<VPLCallbackSource>;
+
+    /** Writes the records [first, first + count) to pDst. Must return the same records on every pass.
+    */
+    using GenerateFunc = std::function<void(uint64_t first, size_t count, VPLData* pDst)>;
+
+    static SharedPtr create(uint64_t numRecords, GenerateFunc generate);
+
+    bool rewind() override { mNext = 0; return true; }
+    size_t read(VPLData* pDst, size_t maxCount) override;
+
+protected:
+    VPLCallbackSource() = default;
+
+    uint64_t mNumRecords = 0;
+    uint64_t mNext = 0;
+    GenerateFunc mGenerate;
+};
+
+class HostOutOfCoreBuilder : public std::enable_shared_from_this<HostOutOfCoreBuilder>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostOutOfCoreBuilder>;
+    using SharedConstPtr = std::shared_ptr<const HostOutOfCoreBuilder>;
+    virtual ~HostOutOfCoreBuilder() = default;
+
+    /** Build parameters.
+    */
+    struct Desc
+    {
+        HostTreeBuilder::Desc buildDesc;        ///< Parameters of the chunk builds. The extents are replaced by the bounds of the VPLs.
+        size_t memoryBudget = size_t(1) << 30;  ///< Peak bytes of the build: chunk buffers, histogram and IO buffers.
+        uint32_t histogramBitsPerAxis = 7;      ///< Morton bits per axis of the partition cells, reduced if the histogram exceeds 1/4 of the budget.
+        std::string tempPrefix;                 ///< Prefix of the chunk files. Empty: next to the output file.
+    };
+
+    /** Statistics of the last build. Times in milliseconds.
+    */
+    struct Stats
+    {
+        uint64_t numInputVPLs = 0;          ///< Records read from the source.
+        uint64_t numVPLs = 0;               ///< Valid VPLs in the tree.
+        uint32_t numChunks = 0;
+        uint64_t chunkCapacity = 0;         ///< Most VPLs per chunk allowed by the budget.
+        uint64_t largestChunk = 0;
+        uint32_t numSplitCells = 0;         ///< Cells with more VPLs than a chunk holds, split in input order.
+        uint32_t histogramBitsPerAxis = 0;
+        uint32_t numDistributionPasses = 0; ///< Passes over the source to write the chunk files, more than one if not all files fit into the budget.
+        size_t peakMemory = 0;              ///< Largest measured memory of the build buffers.
+        float partitionTime = 0.f;          ///< Bounds, histogram and chunk files.
+        float chunkBuildTime = 0.f;         ///< Chunk builds and writing the output.
+        float topLevelTime = 0.f;
+        float totalTime = 0.f;
+    };
+
+    /** Create a new out-of-core builder.
+    */
+    static SharedPtr create();
+
+    /** Builds the SST of all valid VPLs of the source and writes it to a file.
+        \param[in] desc Build parameters.
+        \param[in] source VPL input, read three times.
+        \param[in] filename Output file. Written to a temporary file first and renamed.
+        \return True if successful. Errors are logged.
+    */
+    bool build(const Desc& desc, VPLStreamSource& source, const std::string& filename);
+
+    const Stats& getStats() const { return mStats; }
+
+    /** Returns the bytes per VPL of a chunk build: VPL data, nodes, merge data, flags, codes and sort scratch.
+    */
+    static size_t getChunkBytesPerVPL(const HostTreeBuilder::Desc& buildDesc, uint64_t numVPLs);
+
+protected:
+    HostOutOfCoreBuilder();
+
+    struct Chunk
+    {
+        uint64_t numVPLs = 0;
+        uint64_t firstCell = 0;             ///< Morton code of the first cell, key of the top-level tree.
+        uint64_t leafBase = 0;              ///< Index of the first leaf in the output.
+        uint64_t nodeBase = 0;              ///< Index of the first internal node in the output.
+        VPLData root;                       ///< Root with output indices.
+        VPLMerge rootMerge;
+    };
+
+    bool computeBounds(VPLStreamSource& source);
+    bool partition(VPLStreamSource& source);
+    bool writeChunkFiles(VPLStreamSource& source);
+    bool buildChunk(uint32_t chunkIdx, std::ofstream& file);
+    bool buildTopLevel(std::ofstream& file);
+    void buildTopLevelNode(uint32_t first, uint32_t last, std::vector<VPLData>& topNodes, VPLData& node, VPLMerge& merge);
+    uint64_t getChunkIndex(uint32_t cell);
+    uint32_t getCell(const VPLData& vpl) const;
+    std::string getChunkFilename(uint32_t chunkIdx) const;
+    void removeChunkFiles() const;
+    void updatePeakMemory(size_t bytes) { mStats.peakMemory = std::max(mStats.peakMemory, bytes); }
+
+    Desc mDesc;
+    Stats mStats;
+    std::string mTempPrefix;
+    size_t mBatchSize = 0;                  ///< VPLs per read from the source and per write of the leaves.
+    uint64_t mDataOffset = 0;
+
+    float3 mBoundsMin = float3(0.f);
+    float3 mBoundsMax = float3(0.f);
+    uint32_t mCellBits = 0;
+
+    std::vector<uint64_t> mCellCounts;      ///< VPLs per cell, replaced by the first chunk of the cell after the partition.
+    std::unordered_map<uint32_t, uint64_t> mSplitCells;    ///< VPLs of a split cell seen in the current pass over the source.
+    std::vector<Chunk> mChunks;
+
+    // Chunk build buffers, reused for every chunk
+    std::vector<VPLData> mChunkData;
+    std::vector<uint32_t> mLeafOrder;       ///< Position of every leaf of the chunk in the morton order.
+    std::vector<VPLData> mStaging;
+    uint64_t mChunkBufferSize = 0;          ///< Largest chunk the buffers were allocated for.
+
+    HostTreeBuilder::SharedPtr mpBuilder;
+};
+
+/** Reads an out-of-core tree file completely. Meant for checks of small builds.
+    \param[in] filename File written by HostOutOfCoreBuilder::build().
+    \param[out] header File header.
+    \param[out] vplData VPL data array.
+    \return True if successful.
+*/
+bool readOutOfCoreTree(const std::string& filename, OutOfCoreTreeHeader& header, std::vector<VPLData>& vplData);
+
+/** Result of checkOutOfCoreBuild().
+*/
+struct OutOfCoreBuildCheck
+{
+    bool valid = false;
+    uint32_t numChunks = 0;
+    size_t memoryBudget = 0;
+    size_t peakMemory = 0;
+    float inMemoryTime = 0.f;       ///< Time of the in-memory build in milliseconds.
+    float outOfCoreTime = 0.f;
+    float inMemoryError = 0.f;      ///< Relative RMS error of one sample estimates against the sum over all VPLs.
+    float outOfCoreError = 0.f;
+};
+
+/** Streams the VPLs through the out-of-core build with a budget of a quarter of the in-memory build, so that
+    several chunks are built. Validates the file with validateTree() and compares the host sampling error against
+    the in-memory build.
+    \param[in] desc Build parameters of the in-memory build.
+    \param[in] vplData VPL buffer as written by the VPL tracer.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] filename Output file of the out-of-core build, deleted afterwards.
+    \return Check result, also logged.
+*/
+OutOfCoreBuildCheck checkOutOfCoreBuild(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, const std::string& filename);
@@ -0,0 +1,406 @@
+// Packet traversal of the SST, see HostPacketSampling.h
+
+#include "HostPacketSampling.h"
+#include "HostCodesSimd.h"
+#include "HostUtils.h"
+#include <cstring>
+
+#if defined(_MSC_VER)
+#define AVX2_FUNC
+#else
+#define AVX2_FUNC __attribute__((target("avx2")))
+#endif
+#include <immintrin.h>
+
+namespace
+{
+    const uint32_t kPacketSize = 8;
+
+    /** Receiver data of a packet that stays the same during the descent.
+    */
+    struct PacketReceivers
+    {
+        alignas(32) float posX[8], posY[8], posZ[8];
+        alignas(32) float rot[9][8];    ///< Rows of getRotationRowsFromAToB(N, +-z) in maxNdotAABBHost(), row major.
+        alignas(32) float flipZ[8];     ///< 1 if the receiver normal points down.
+        alignas(32) float brdf[8];      ///< Material term without maxNdotAABB, see evalNodeWeightHost().
+    };
+
+    /** One child node per lane. Inactive lanes are zero.
+    */
+    struct PacketNodes
+    {
+        alignas(32) float minX[8], minY[8], minZ[8];
+        alignas(32) float maxX[8], maxY[8], maxZ[8];
+        alignas(32) float posX[8], posY[8], posZ[8];
+        alignas(32) float intensity[8];
+    };
+
+    void setReceiverLane(PacketReceivers& rc, uint32_t lane, const HostShadingPoint& sp)
+    {
+        rc.posX[lane] = sp.posW.x;
+        rc.posY[lane] = sp.posW.y;
+        rc.posZ[lane] = sp.posW.z;
+
+        const float3 brdf = sp.diffuse * (float)M_1_PI;
+        rc.brdf[lane] = std::max(dot(brdf, float3(0.299f, 0.587f, 0.114f)), 0.01f);
+
+        float3 zAxis = float3(0.f, 0.f, 1.f);
+        const bool flipZ = dot(sp.N, zAxis) < 0.f;
+        if (flipZ) zAxis.z = -zAxis.z;
+        float3 R[3];
+        getRotationRowsFromAToB(sp.N, zAxis, R);
+        for (int row = 0; row < 3; row++)
+            for (int col = 0; col < 3; col++)
+                rc.rot[row * 3 + col][lane] = R[row][col];
+        rc.flipZ[lane] = flipZ ? 1.f : 0.f;
+    }
+
+    void setNodeLane(PacketNodes& n, uint32_t lane, const VPLData& vpl)
+    {
+        const float3 aabbMin = vpl.getAABBMin();
+        const float3 aabbMax = vpl.getAABBMax();
+        const float3 posW = vpl.getPosW();
+        n.minX[lane] = aabbMin.x; n.minY[lane] = aabbMin.y; n.minZ[lane] = aabbMin.z;
+        n.maxX[lane] = aabbMax.x; n.maxY[lane] = aabbMax.y; n.maxZ[lane] = aabbMax.z;
+        n.posX[lane] = posW.x;    n.posY[lane] = posW.y;    n.posZ[lane] = posW.z;
+        n.intensity[lane] = vpl.getIntensity();
+    }
+
+    void clearNodeLane(PacketNodes& n, uint32_t lane)
+    {
+        n.minX[lane] = n.minY[lane] = n.minZ[lane] = 0.f;
+        n.maxX[lane] = n.maxY[lane] = n.maxZ[lane] = 0.f;
+        n.posX[lane] = n.posY[lane] = n.posZ[lane] = 0.f;
+        n.intensity[lane] = 0.f;
+    }
+
+    // glm::min/max return the first argument unless the second one is smaller/larger, _mm256_min/max_ps the second one.
+    // The arguments are swapped accordingly to stay bit-exact with the scalar port (signed zeros).
+    AVX2_FUNC inline __m256 glmMin8(__m256 a, __m256 b) { return _mm256_min_ps(b, a); }
+    AVX2_FUNC inline __m256 glmMax8(__m256 a, __m256 b) { return _mm256_max_ps(b, a); }
+
+    AVX2_FUNC inline __m256 abs8(__m256 v)
+    {
+        return _mm256_andnot_ps(_mm256_set1_ps(-0.f), v);
+    }
+
+    // Same operation order as the scalar port: (a * b + c * d) + e * f. No FMA to stay bit-exact.
+    AVX2_FUNC inline __m256 dot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+    {
+        return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+    }
+
+    /** 8 lanes of maxNdotAABBHost() with the same operation order.
+    */
+    AVX2_FUNC __m256 maxNdotAABB8(const PacketReceivers& rc, const PacketNodes& n)
+    {
+        const __m256 px = _mm256_load_ps(rc.posX);
+        const __m256 py = _mm256_load_ps(rc.posY);
+        const __m256 pz = _mm256_load_ps(rc.posZ);
+        const __m256 minX = _mm256_load_ps(n.minX);
+        const __m256 minY = _mm256_load_ps(n.minY);
+        const __m256 minZ = _mm256_load_ps(n.minZ);
+        const __m256 maxX = _mm256_load_ps(n.maxX);
+        const __m256 maxY = _mm256_load_ps(n.maxY);
+        const __m256 maxZ = _mm256_load_ps(n.maxZ);
+
+        // Receiver inside of the box
+        const __m256 eps = _mm256_set1_ps(0.001f);
+        __m256 inside = _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(minX, eps), px, _CMP_LT_OQ), _mm256_cmp_ps(px, _mm256_add_ps(maxX, eps), _CMP_LT_OQ));
+        inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(minY, eps), py, _CMP_LT_OQ), _mm256_cmp_ps(py, _mm256_add_ps(maxY, eps), _CMP_LT_OQ)));
+        inside = _mm256_and_ps(inside, _mm256_and_ps(_mm256_cmp_ps(_mm256_sub_ps(minZ, eps), pz, _CMP_LT_OQ), _mm256_cmp_ps(pz, _mm256_add_ps(maxZ, eps), _CMP_LT_OQ)));
+
+        __m256 R[9];
+        for (int i = 0; i < 9; i++) R[i] = _mm256_load_ps(rc.rot[i]);
+
+        const __m256 half = _mm256_set1_ps(0.5f);
+        const __m256 hx = _mm256_mul_ps(_mm256_sub_ps(maxX, minX), half);
+        const __m256 hy = _mm256_mul_ps(_mm256_sub_ps(maxY, minY), half);
+        const __m256 hz = _mm256_mul_ps(_mm256_sub_ps(maxZ, minZ), half);
+        const __m256 cx = _mm256_sub_ps(_mm256_add_ps(minX, hx), px);
+        const __m256 cy = _mm256_sub_ps(_mm256_add_ps(minY, hy), py);
+        const __m256 cz = _mm256_sub_ps(_mm256_add_ps(minZ, hz), pz);
+        const __m256 centerX = dot8(R[0], R[1], R[2], cx, cy, cz);
+        const __m256 centerY = dot8(R[3], R[4], R[5], cx, cy, cz);
+        const __m256 centerZ = dot8(R[6], R[7], R[8], cx, cy, cz);
+
+        // Rotated corners of the box
+        const __m256 signMask = _mm256_set1_ps(-0.f);
+        __m256 tMinX = _mm256_setzero_ps(), tMinY = _mm256_setzero_ps(), tMinZ = _mm256_setzero_ps();
+        __m256 tMaxX = _mm256_setzero_ps(), tMaxY = _mm256_setzero_ps(), tMaxZ = _mm256_setzero_ps();
+        for (int i = 0; i < 8; i++)
+        {
+            const __m256 sx = (i & 4) ? _mm256_xor_ps(hx, signMask) : hx;
+            const __m256 sy = (i & 2) ? _mm256_xor_ps(hy, signMask) : hy;
+            const __m256 sz = (i & 1) ? _mm256_xor_ps(hz, signMask) : hz;
+            const __m256 vx = dot8(R[0], R[3], R[6], sx, sy, sz);
+            const __m256 vy = dot8(R[1], R[4], R[7], sx, sy, sz);
+            const __m256 vz = dot8(R[2], R[5], R[8], sx, sy, sz);
+            tMinX = glmMin8(tMinX, vx); tMinY = glmMin8(tMinY, vy); tMinZ = glmMin8(tMinZ, vz);
+            tMaxX = glmMax8(tMaxX, vx); tMaxY = glmMax8(tMaxY, vy); tMaxZ = glmMax8(tMaxZ, vz);
+        }
+        tMinX = _mm256_add_ps(tMinX, centerX); tMinY = _mm256_add_ps(tMinY, centerY); tMinZ = _mm256_add_ps(tMinZ, centerZ);
+        tMaxX = _mm256_add_ps(tMaxX, centerX); tMaxY = _mm256_add_ps(tMaxY, centerY); tMaxZ = _mm256_add_ps(tMaxZ, centerZ);
+
+        const __m256 flipZ = _mm256_cmp_ps(_mm256_load_ps(rc.flipZ), _mm256_setzero_ps(), _CMP_NEQ_OQ);
+        const __m256 zMax = _mm256_blendv_ps(glmMax8(tMinZ, tMaxZ), _mm256_xor_ps(glmMin8(tMinZ, tMaxZ), signMask), flipZ);
+        const __m256 belowHorizon = _mm256_cmp_ps(zMax, _mm256_set1_ps(0.00001f), _CMP_LT_OQ);
+
+        // Closest distance to the normal axis, zero if the box straddles it
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 straddleX = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(tMinX, zero, _CMP_LT_OQ), _mm256_cmp_ps(tMaxX, zero, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(tMaxX, zero, _CMP_LT_OQ), _mm256_cmp_ps(tMinX, zero, _CMP_GT_OQ)));
+        const __m256 straddleY = _mm256_or_ps(
+            _mm256_and_ps(_mm256_cmp_ps(tMinY, zero, _CMP_LT_OQ), _mm256_cmp_ps(tMaxY, zero, _CMP_GT_OQ)),
+            _mm256_and_ps(_mm256_cmp_ps(tMaxY, zero, _CMP_LT_OQ), _mm256_cmp_ps(tMinY, zero, _CMP_GT_OQ)));
+        const __m256 xMin = _mm256_blendv_ps(glmMin8(abs8(tMinX), abs8(tMaxX)), zero, straddleX);
+        const __m256 yMin = _mm256_blendv_ps(glmMin8(abs8(tMinY), abs8(tMaxY)), zero, straddleY);
+
+        const __m256 len = _mm256_sqrt_ps(dot8(xMin, yMin, zMax, xMin, yMin, zMax));
+        __m256 result = _mm256_div_ps(zMax, len);
+        result = _mm256_blendv_ps(result, zero, belowHorizon);
+        result = _mm256_blendv_ps(result, _mm256_set1_ps(1.f), inside);
+        return result;
+    }
+
+    /** 8 lanes of evalNodeWeightHost() with the same operation order.
+    */
+    AVX2_FUNC void evalNodeWeights8(const PacketReceivers& rc, const PacketNodes& n, const HostSamplingParams& params, float* pWeights)
+    {
+        const __m256 M = _mm256_mul_ps(_mm256_load_ps(rc.brdf), maxNdotAABB8(rc, n));
+        const __m256 dx = _mm256_sub_ps(_mm256_load_ps(rc.posX), _mm256_load_ps(n.posX));
+        const __m256 dy = _mm256_sub_ps(_mm256_load_ps(rc.posY), _mm256_load_ps(n.posY));
+        const __m256 dz = _mm256_sub_ps(_mm256_load_ps(rc.posZ), _mm256_load_ps(n.posZ));
+        const __m256 A = _mm256_div_ps(_mm256_set1_ps(1.f), glmMax8(dot8(dx, dy, dz, dx, dy, dz), _mm256_set1_ps(params.attenuationEpsilon)));
+        _mm256_store_ps(pWeights, _mm256_mul_ps(_mm256_mul_ps(M, A), _mm256_load_ps(n.intensity)));
+    }
+
+    /** Takes one sample for up to 8 receivers starting at first.
+    */
+    void samplePacket(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoints& points, size_t first, uint32_t count, const HostSamplingParams& params,
+        uint32_t* pSeeds, HostTreeSample* pSamples, const HostVisibilityFunc& visibility, bool useSimd)
+    {
+        PacketReceivers rc;
+        PacketNodes nodes1, nodes2;
+        alignas(32) float w1[8], w2[8];
+
+        HostShadingPoint sp[kPacketSize];
+        int nodeIdx[kPacketSize], child1[kPacketSize], child2[kPacketSize];
+        float p[kPacketSize], r[kPacketSize];
+        bool active[kPacketSize], dead[kPacketSize];
+
+        for (uint32_t l = 0; l < kPacketSize; l++)
+        {
+            active[l] = l < count;
+            dead[l] = false;
+            sp[l] = active[l] ? points.get(first + l) : HostShadingPoint();
+            setReceiverLane(rc, l, sp[l]);
+            nodeIdx[l] = rootIndex;
+            child1[l] = child2[l] = -1;
+            p[l] = 1.f;
+            r[l] = active[l] ? nextRandHost(pSeeds[first + l]) : 0.f;
+            if (active[l]) pSamples[first + l] = HostTreeSample();
+        }
+
+        // Descend until every lane stopped at a node or in a dead branch
+        while (true)
+        {
+            uint32_t numActive = 0;
+            for (uint32_t l = 0; l < kPacketSize; l++)
+            {
+                if (active[l])
+                {
+                    const VPLData& vpl = vplData[nodeIdx[l]];
+                    active[l] = !(vpl.getEarlyStop() > 0.f || vpl.numVPLSubTree <= 0);
+                }
+                if (!active[l])
+                {
+                    clearNodeLane(nodes1, l);
+                    clearNodeLane(nodes2, l);
+                    continue;
+                }
+
+                const VPLData& vpl = vplData[nodeIdx[l]];
+                child1[l] = vpl.idChild1;
+                child2[l] = vpl.idChild2;
+                setNodeLane(nodes1, l, vplData[child1[l]]);
+                setNodeLane(nodes2, l, vplData[child2[l]]);
+                pSamples[first + l].numSteps++;
+                numActive++;
+            }
+            if (numActive == 0)
+                break;
+
+            if (useSimd && !params.useOrientationCones) // The lanes have no cone bound, use the scalar weights
+            {
+                evalNodeWeights8(rc, nodes1, params, w1);
+                evalNodeWeights8(rc, nodes2, params, w2);
+            }
+            else
+            {
+                for (uint32_t l = 0; l < kPacketSize; l++)
+                {
+                    if (!active[l]) continue;
+                    w1[l] = evalNodeWeightHost(vplData[child1[l]], sp[l], params);
+                    w2[l] = evalNodeWeightHost(vplData[child2[l]], sp[l], params);
+                }
+            }
+
+            // Same selection as sampleVPLTreeHost()
+            for (uint32_t l = 0; l < kPacketSize; l++)
+            {
+                if (!active[l]) continue;
+                if (!(w1[l] + w2[l] > 0.f))
+                {
+                    active[l] = false;
+                    dead[l] = true;
+                    continue;
+                }
+
+                const float p1 = w1[l] / (w1[l] + w2[l]);
+                if (r[l] <= p1)
+                {
+                    p[l] *= p1;
+                    r[l] = r[l] / p1;
+                    nodeIdx[l] = child1[l];
+                }
+                else
+                {
+                    p[l] *= 1.f - p1;
+                    r[l] = (r[l] - p1) / (1.f - p1);
+                    nodeIdx[l] = child2[l];
+                }
+            }
+        }
+
+        // Sample a position on every selected node and query the visibility for the packet at once
+        float3 from[kPacketSize], to[kPacketSize];
+        float visible[kPacketSize];
+        uint32_t lanes[kPacketSize];
+        uint32_t numQueries = 0;
+        for (uint32_t l = 0; l < count; l++)
+        {
+            if (dead[l]) continue;
+            const VPLData& vpl = vplData[nodeIdx[l]];
+            from[numQueries] = normalPointOnPlaneHost(vpl.getNormW(), vpl.getPosW(), vpl.getVariance(), vpl.getAABBMin(), vpl.getAABBMax(), pSeeds[first + l]);
+            to[numQueries] = sp[l].posW;
+            visible[numQueries] = 1.f;
+            lanes[numQueries++] = l;
+        }
+        if (visibility && numQueries > 0)
+            visibility(numQueries, from, to, visible);
+
+        for (uint32_t q = 0; q < numQueries; q++)
+        {
+            const uint32_t l = lanes[q];
+            const VPLData& vpl = vplData[nodeIdx[l]];
+            HostTreeSample& sample = pSamples[first + l];
+            sample.pdf = p[l];
+            sample.nodeIdx = nodeIdx[l];
+            sample.radiance = (p[l] > 0.f && visible[q] > 0.f) ? evalVPLDiffuseHost(from[q], vpl.getNormW(), vpl.getColor(), sp[l], params.gMax) / p[l] : float3(0.f);
+        }
+    }
+
+    inline bool sameBits(float a, float b)
+    {
+        return std::memcmp(&a, &b, sizeof(float)) == 0;
+    }
+}
+
+void HostShadingPoints::resize(size_t count)
+{
+    for (auto* v : { &posX, &posY, &posZ, &normX, &normY, &normZ, &diffuseR, &diffuseG, &diffuseB })
+        v->resize(count, 0.f);
+}
+
+void HostShadingPoints::set(size_t i, const HostShadingPoint& sp)
+{
+    posX[i] = sp.posW.x;      posY[i] = sp.posW.y;      posZ[i] = sp.posW.z;
+    normX[i] = sp.N.x;        normY[i] = sp.N.y;        normZ[i] = sp.N.z;
+    diffuseR[i] = sp.diffuse.x; diffuseG[i] = sp.diffuse.y; diffuseB[i] = sp.diffuse.z;
+}
+
+HostShadingPoint HostShadingPoints::get(size_t i) const
+{
+    HostShadingPoint sp;
+    sp.posW = float3(posX[i], posY[i], posZ[i]);
+    sp.N = float3(normX[i], normY[i], normZ[i]);
+    sp.diffuse = float3(diffuseR[i], diffuseG[i], diffuseB[i]);
+    return sp;
+}
+
+void sampleVPLTreeBatch(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoints& points, const HostSamplingParams& params,
+    uint32_t* pSeeds, HostTreeSample* pSamples, const HostVisibilityFunc& visibility, bool useSimd)
+{
+    if (rootIndex < 0 || (size_t)rootIndex >= vplData.size())
+        return;
+
+    const bool simd = useSimd && hasAVX2();
+    const size_t numPackets = (points.size() + kPacketSize - 1) / kPacketSize;
+    parallelFor(0, numPackets, [&](size_t packet)
+    {
+        const size_t first = packet * kPacketSize;
+        const uint32_t count = (uint32_t)std::min<size_t>(kPacketSize, points.size() - first);
+        samplePacket(vplData, rootIndex, points, first, count, params, pSeeds, pSamples, visibility, simd);
+    }, 64);
+}
+
+PacketSamplerCheck checkPacketSampler(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers)
+{
+    PacketSamplerCheck result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs || numReceivers == 0)
+        return result;
+
+    const VPLData& root = vplData[maxVPLs];
+    const float offset = length(root.getAABBMax() - root.getAABBMin()) * 1e-3f;
+    const HostSamplingParams params;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    if (receivers.empty())
+        return result;
+
+    HostShadingPoints points;
+    points.resize(receivers.size());
+    std::vector<uint32_t> scalarSeeds(receivers.size());
+    for (size_t i = 0; i < receivers.size(); i++)
+    {
+        points.set(i, receivers[i]);
+        scalarSeeds[i] = getPixelSeedHost((uint32_t)i, 0, numReceivers, 0);
+    }
+    std::vector<uint32_t> packetSeeds = scalarSeeds;
+
+    std::vector<HostTreeSample> scalarSamples(receivers.size());
+    auto t0 = CpuTimer::getCurrentTimePoint();
+    parallelFor(0, receivers.size(), [&](size_t i)
+    {
+        scalarSamples[i] = sampleVPLTreeHost(vplData, maxVPLs, receivers[i], params, scalarSeeds[i]);
+    }, 512);
+    result.scalarTime = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+
+    std::vector<HostTreeSample> packetSamples(receivers.size());
+    t0 = CpuTimer::getCurrentTimePoint();
+    sampleVPLTreeBatch(vplData, maxVPLs, points, params, packetSeeds.data(), packetSamples.data());
+    result.packetTime = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+
+    result.numSamples = (uint32_t)receivers.size();
+    for (size_t i = 0; i < receivers.size(); i++)
+    {
+        const HostTreeSample& a = scalarSamples[i];
+        const HostTreeSample& b = packetSamples[i];
+        const bool match = a.nodeIdx == b.nodeIdx && a.numSteps == b.numSteps && sameBits(a.pdf, b.pdf) && scalarSeeds[i] == packetSeeds[i]
+            && sameBits(a.radiance.x, b.radiance.x) && sameBits(a.radiance.y, b.radiance.y) && sameBits(a.radiance.z, b.radiance.z);
+        if (match)
+            continue;
+
+        if (result.numMismatches++ < 8)
+        {
+            logWarning("checkPacketSampler: Mismatch at receiver " + std::to_string(i) + ": node " + std::to_string(a.nodeIdx) + " / " + std::to_string(b.nodeIdx)
+                + ", pdf " + std::to_string(a.pdf) + " / " + std::to_string(b.pdf));
+        }
+    }
+
+    logInfo("checkPacketSampler: " + std::to_string(result.numMismatches) + " mismatches in " + std::to_string(result.numSamples) + " samples, scalar "
+        + std::to_string(result.scalarTime) + " ms, packets " + std::to_string(result.packetTime) + " ms" + (hasAVX2() ? "" : " (no AVX2)"));
+    return result;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostTreeSampling.h"
+#include <functional>
+
+using namespace Falcor;
+
+/** Batch version of sampleVPLTreeHost() for many receivers, e.g. a full G-buffer.
+    Receivers are processed in packets of 8 that descend the tree together. The node weights of a packet are
+    evaluated with AVX2 and are bit-exact to the scalar port, so every receiver consumes its random stream
+    exactly like sampleVPLTree() in VPLSampling.rt.hlsl. Falls back to the scalar port if the CPU does not support AVX2.
+*/
+
+/** Receivers in SoA layout.
+*/
+struct HostShadingPoints
+{
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> normX, normY, normZ;
+    std::vector<float> diffuseR, diffuseG, diffuseB;
+
+    size_t size() const { return posX.size(); }
+    void resize(size_t count);
+    void set(size_t i, const HostShadingPoint& sp);
+    HostShadingPoint get(size_t i) const;
+};
+
+/** Visibility callback, same role as shootShadowRay() in VPLSampling.rt.hlsl.
+    Called with up to 8 queries at once and from several threads at the same time.
+    \param[in] count Number of queries.
+    \param[in] pFrom Sampled positions on the selected nodes.
+    \param[in] pTo Receiver positions.
+    \param[out] pVisible 1 if visible, 0 if occluded.
+*/
+using HostVisibilityFunc = std::function<void(uint32_t count, const float3* pFrom, const float3* pTo, float* pVisible)>;
+
+/** Takes one sample from the SST for every receiver on all threads.
+    \param[in] vplData VPL data array of the tree.
+    \param[in] rootIndex Index of the root node (maxVPLs).
+    \param[in] points Receivers.
+    \param[in] params Sampler parameters.
+    \param[in,out] pSeeds One random seed per receiver, advanced like in the shader. See getPixelSeedHost().
+    \param[out] pSamples One sample per receiver.
+    \param[in] visibility Optional visibility callback, everything is visible if empty.
+    \param[in] useSimd Use the AVX2 kernels if supported.
+*/
+void sampleVPLTreeBatch(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoints& points, const HostSamplingParams& params,
+    uint32_t* pSeeds, HostTreeSample* pSamples, const HostVisibilityFunc& visibility = nullptr, bool useSimd = true);
+
+/** Result of checkPacketSampler().
+*/
+struct PacketSamplerCheck
+{
+    uint32_t numSamples = 0;
+    uint32_t numMismatches = 0;     ///< Samples that differ from sampleVPLTreeHost() in node, pdf, radiance or seed.
+    float scalarTime = 0.f;         ///< Time in milliseconds of sampleVPLTreeHost() on all threads.
+    float packetTime = 0.f;         ///< Time in milliseconds of sampleVPLTreeBatch().
+};
+
+/** Compares sampleVPLTreeBatch() against sampleVPLTreeHost() on receivers placed on random VPLs.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receivers.
+    \return Check result. Results and mismatches are logged.
+*/
+PacketSamplerCheck checkPacketSampler(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers = 1 << 16);
@@ -0,0 +1,94 @@
+#pragma once
+
+#include "Falcor.h"
+
+/** Host port of the octahedral mapping in Packing.slang. Keep both files in sync!
+*/
+
+inline float2 oct_wrap(float2 v)
+{
+    return float2((1.f - std::abs(v.y)) * (v.x >= 0.f ? 1.f : -1.f),
+                  (1.f - std::abs(v.x)) * (v.y >= 0.f ? 1.f : -1.f));
+}
+
+inline float2 ndir_to_oct_snorm(float3 n)
+{
+    // Project the sphere onto the octahedron (|x|+|y|+|z| = 1) and then onto the xy-plane.
+    float2 p = float2(n.x, n.y) * (1.f / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z)));
+    p = (n.z < 0.f) ? oct_wrap(p) : p;
+    return p;
+}
+
+inline float2 ndir_to_oct_unorm(float3 n)
+{
+    return ndir_to_oct_snorm(n) * 0.5f + 0.5f;
+}
+
+inline float3 oct_to_ndir_snorm(float2 p)
+{
+    float3 n = float3(p.x, p.y, 1.f - std::abs(p.x) - std::abs(p.y));
+    if (n.z < 0.f)
+    {
+        const float2 w = oct_wrap(float2(n.x, n.y));
+        n.x = w.x;
+        n.y = w.y;
+    }
+    return normalize(n);
+}
+
+inline float3 oct_to_ndir_unorm(float2 p)
+{
+    return oct_to_ndir_snorm(p * 2.f - 1.f);
+}
+
+/** Shared exponent packing of non-negative float3, same bit layout as DXGI_FORMAT_R9G9B9E5_SHAREDEXP.
+    Every channel has a 9 bit mantissa, the exponent of the largest channel is shared.
+*/
+inline uint32_t packRGB9E5(float3 v)
+{
+    const int kMantissaBits = 9;
+    const int kExpBias = 15;
+    const float kMaxValue = (float)((1 << kMantissaBits) - 1) / (float)(1 << kMantissaBits) * (float)(1 << (31 - kExpBias));
+
+    const float r = std::min(std::max(v.x, 0.f), kMaxValue);
+    const float g = std::min(std::max(v.y, 0.f), kMaxValue);
+    const float b = std::min(std::max(v.z, 0.f), kMaxValue);
+    const float maxChannel = std::max(r, std::max(g, b));
+    if (!(maxChannel > 0.f))
+        return 0;
+
+    int exp = std::max(-kExpBias - 1, (int)std::floor(std::log2(maxChannel))) + 1 + kExpBias;
+    float denom = std::ldexp(1.f, exp - kExpBias - kMantissaBits);
+    if ((int)std::floor(maxChannel / denom + 0.5f) == (1 << kMantissaBits))
+    {
+        denom *= 2.f;
+        exp += 1;
+    }
+
+    const uint32_t rm = (uint32_t)std::floor(r / denom + 0.5f);
+    const uint32_t gm = (uint32_t)std::floor(g / denom + 0.5f);
+    const uint32_t bm = (uint32_t)std::floor(b / denom + 0.5f);
+    return rm | (gm << 9) | (bm << 18) | ((uint32_t)exp << 27);
+}
+
+inline float3 unpackRGB9E5(uint32_t u)
+{
+    const float scale = std::ldexp(1.f, (int)(u >> 27) - 15 - 9);
+    return float3((float)(u & 0x1FF), (float)((u >> 9) & 0x1FF), (float)((u >> 18) & 0x1FF)) * scale;
+}
+
+/** Packs two floats in [-1,1] to 16 bit snorm.
+*/
+inline uint32_t packSnorm2x16(float2 v)
+{
+    const int x = (int)std::round(std::min(std::max(v.x, -1.f), 1.f) * 32767.f);
+    const int y = (int)std::round(std::min(std::max(v.y, -1.f), 1.f) * 32767.f);
+    return ((uint32_t)x & 0xFFFF) | ((uint32_t)y << 16);
+}
+
+inline float2 unpackSnorm2x16(uint32_t u)
+{
+    const int16_t x = (int16_t)(u & 0xFFFF);
+    const int16_t y = (int16_t)(u >> 16);
+    return float2(std::max((float)x / 32767.f, -1.f), std::max((float)y / 32767.f, -1.f));
+}
@@ -0,0 +1,196 @@
+#include "HostRadixSort.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kDigitBits = 8;
+    const uint32_t kNumBuckets = 1 << kDigitBits;
+
+    // Below this size a plain comparison sort is faster than setting up the threads.
+    const uint32_t kMinParallelSize = 1 << 14;
+    const size_t kMinChunkSize = 1 << 15;
+
+    inline uint64_t getLowMask(uint32_t numBits)
+    {
+        return numBits >= 64 ? UINT64_MAX : (1ull << numBits) - 1;
+    }
+
+    // Key operations used by the sort
+    template<typename Key> struct KeyTraits;
+
+    template<> struct KeyTraits<uint64_t>
+    {
+        static const int kNumBits = 64;
+        static uint64_t zero() { return 0; }
+        static uint64_t ones() { return UINT64_MAX; }
+        static uint64_t mask(uint32_t lsb, uint32_t numBits) { return getLowMask(numBits) << lsb; }
+        static uint64_t shiftRight(uint64_t key, uint32_t shift) { return key >> shift; }
+    };
+
+    template<> struct KeyTraits<Key128>
+    {
+        static const int kNumBits = 128;
+        static Key128 zero() { return { 0, 0 }; }
+        static Key128 ones() { return { UINT64_MAX, UINT64_MAX }; }
+        static Key128 mask(uint32_t lsb, uint32_t numBits)
+        {
+            const uint32_t end = lsb + numBits;
+            Key128 mask = zero();
+            if (lsb < 64)
+                mask.lo = getLowMask(std::min(end, 64u) - lsb) << lsb;
+            if (end > 64)
+            {
+                const uint32_t hiBegin = std::max(lsb, 64u) - 64;
+                mask.hi = getLowMask(end - 64 - hiBegin) << hiBegin;
+            }
+            return mask;
+        }
+        static uint64_t shiftRight(const Key128& key, uint32_t shift)
+        {
+            if (shift >= 64) return key.hi >> (shift - 64);
+            if (shift == 0) return key.lo;
+            return (key.lo >> shift) | (key.hi << (64 - shift));
+        }
+    };
+
+    template<typename Key>
+    bool radixSort(Key* pData, uint32_t totalSize, int2 bitRange, std::vector<Key>& scratch, std::vector<uint32_t>& histograms, uint32_t& numPasses)
+    {
+        using Traits = KeyTraits<Key>;
+
+        if (bitRange.x >= Traits::kNumBits || bitRange.y < 0 || bitRange.x < bitRange.y)
+            return false;
+
+        if (totalSize <= 1)
+            return true;
+
+        // Setup compare bit mask
+        const uint32_t numBits = bitRange.x - bitRange.y + 1;
+        const Key mask = Traits::mask(bitRange.y, numBits);
+
+        if (totalSize < kMinParallelSize)
+        {
+            std::stable_sort(pData, pData + totalSize, [mask](const Key& a, const Key& b) { return (a & mask) < (b & mask); });
+            return true;
+        }
+
+        const uint32_t numDigits = (numBits + kDigitBits - 1) / kDigitBits;
+        const size_t numChunks = std::max<size_t>(1, std::min<size_t>(4 * getNumHostThreads(), totalSize / kMinChunkSize));
+        const size_t chunkSize = (totalSize + numChunks - 1) / numChunks;
+
+        // Find the bits that differ between the keys. Digits without any of these bits don't change the order.
+        std::vector<Key> chunkAnd(numChunks, Traits::ones());
+        std::vector<Key> chunkOr(numChunks, Traits::zero());
+        parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+        {
+            const size_t begin = chunk * chunkSize;
+            const size_t end = std::min(begin + chunkSize, (size_t)totalSize);
+            Key a = Traits::ones(), o = Traits::zero();
+            for (size_t i = begin; i < end; i++)
+            {
+                a = a & pData[i];
+                o = o | pData[i];
+            }
+            chunkAnd[chunk] = a;
+            chunkOr[chunk] = o;
+        });
+
+        Key allAnd = Traits::ones(), allOr = Traits::zero();
+        for (size_t c = 0; c < numChunks; c++)
+        {
+            allAnd = allAnd & chunkAnd[c];
+            allOr = allOr | chunkOr[c];
+        }
+        const Key liveBits = (allAnd ^ allOr) & mask;
+
+        if (scratch.size() < totalSize)
+            scratch.resize(totalSize);
+        histograms.resize(numChunks * kNumBuckets);
+
+        Key* pSrc = pData;
+        Key* pDst = scratch.data();
+
+        for (uint32_t digit = 0; digit < numDigits; digit++)
+        {
+            const uint32_t shift = bitRange.y + digit * kDigitBits;
+            const uint32_t digitBits = std::min(kDigitBits, numBits - digit * kDigitBits);
+            const uint64_t digitMask = ((1ull << digitBits) - 1);
+
+            if ((Traits::shiftRight(liveBits, shift) & digitMask) == 0)
+                continue;
+
+            // Per chunk histograms
+            parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+            {
+                uint32_t* pHist = &histograms[chunk * kNumBuckets];
+                std::fill(pHist, pHist + kNumBuckets, 0);
+
+                const size_t begin = chunk * chunkSize;
+                const size_t end = std::min(begin + chunkSize, (size_t)totalSize);
+                for (size_t i = begin; i < end; i++)
+                    pHist[Traits::shiftRight(pSrc[i], shift) & digitMask]++;
+            });
+
+            // Exclusive prefix sum in (bucket, chunk) order, so equal digits keep their order.
+            uint32_t offset = 0;
+            for (uint32_t b = 0; b < kNumBuckets; b++)
+            {
+                for (size_t chunk = 0; chunk < numChunks; chunk++)
+                {
+                    const uint32_t count = histograms[chunk * kNumBuckets + b];
+                    histograms[chunk * kNumBuckets + b] = offset;
+                    offset += count;
+                }
+            }
+
+            // Scatter
+            parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+            {
+                uint32_t* pOffsets = &histograms[chunk * kNumBuckets];
+
+                const size_t begin = chunk * chunkSize;
+                const size_t end = std::min(begin + chunkSize, (size_t)totalSize);
+                for (size_t i = begin; i < end; i++)
+                {
+                    const Key key = pSrc[i];
+                    pDst[pOffsets[Traits::shiftRight(key, shift) & digitMask]++] = key;
+                }
+            });
+
+            std::swap(pSrc, pDst);
+            numPasses++;
+        }
+
+        if (pSrc != pData)
+        {
+            parallelFor(0, totalSize, [&](size_t i) { pData[i] = pSrc[i]; }, 1 << 16);
+        }
+
+        return true;
+    }
+}
+
+HostRadixSort::SharedPtr HostRadixSort::create()
+{
+    return SharedPtr(new HostRadixSort());
+}
+
+bool HostRadixSort::execute(std::vector<uint64_t>& data, uint32_t totalSize, int2 bitRange)
+{
+    mNumPasses = 0;
+
+    if (totalSize > data.size())
+        return false;
+
+    return radixSort(data.data(), totalSize, bitRange, mScratch, mHistograms, mNumPasses);
+}
+
+bool HostRadixSort::execute(std::vector<Key128>& data, uint32_t totalSize, int2 bitRange)
+{
+    mNumPasses = 0;
+
+    if (totalSize > data.size())
+        return false;
+
+    return radixSort(data.data(), totalSize, bitRange, mScratch128, mHistograms, mNumPasses);
+}
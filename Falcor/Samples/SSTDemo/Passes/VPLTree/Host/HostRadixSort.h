@@ -0,0 +1,50 @@
+#pragma once
+
+#include "Falcor.h"
+#include "HostUtils.h"
+
+using namespace Falcor;
+
+
+/** Multithreaded LSD radix sort for 64bit and 128bit keys. Host counterpart of BitonicSort.
+*/
+class HostRadixSort : public std::enable_shared_from_this<HostRadixSort>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostRadixSort>;
+    using SharedConstPtr = std::shared_ptr<const HostRadixSort>;
+    virtual ~HostRadixSort() = default;
+
+    /** Create a new radix sort object.
+    */
+    static SharedPtr create();
+
+    /** In-place stable radix sort in ascending order.
+        Only the bits in bitRange are compared (same semantics as BitonicSort::execute). Digits that are equal for all keys are skipped.
+        \param[in,out] data The data to sort in-place.
+        \param[in] totalSize The number of elements to sort, starting at the front of data.
+        \param[in] bitRange The most and least-significant bit index for comparision.
+        \return True if successful, false if an error occured.
+    */
+    bool execute(std::vector<uint64_t>& data, uint32_t totalSize, int2 bitRange);
+
+    /** In-place stable radix sort of 128bit keys. Bit indices 64 to 127 are in the high word.
+    */
+    bool execute(std::vector<Key128>& data, uint32_t totalSize, int2 bitRange);
+
+    /** Returns the number of scatter passes of the last execute call.
+    */
+    uint32_t getNumPasses() const { return mNumPasses; }
+
+    /** Returns the bytes of the scratch buffers.
+    */
+    size_t getMemoryUsage() const { return mScratch.capacity() * sizeof(uint64_t) + mScratch128.capacity() * sizeof(Key128) + mHistograms.capacity() * sizeof(uint32_t); }
+
+protected:
+    HostRadixSort() = default;
+
+    std::vector<uint64_t> mScratch;
+    std::vector<Key128> mScratch128;
+    std::vector<uint32_t> mHistograms;  ///< Per chunk histograms / scatter offsets.
+    uint32_t mNumPasses = 0;
+};
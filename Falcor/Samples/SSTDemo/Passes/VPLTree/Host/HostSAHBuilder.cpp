@@ -0,0 +1,338 @@
+// Top-down binned SST build for static scenes, see HostSAHBuilder.h
+
+#include "HostSAHBuilder.h"
+#include "HostUtils.h"
+#include "HostMerge.h"
+#include "HostTreeSampling.h"
+
+namespace
+{
+    const uint32_t kInvalidIndex = 0xFFFFFFFF;
+    const uint32_t kMaxBins = 64;
+    const uint32_t kNumAxes = 6;    // Position x/y/z, normal x/y/z
+
+    /** Bounds, intensity and intensity weighted normal of a set of VPLs.
+    */
+    struct Cluster
+    {
+        float3 aabbMin = float3(FLT_MAX);
+        float3 aabbMax = float3(-FLT_MAX);
+        float3 normW = float3(0.f);
+        float intensity = 0.f;
+        uint32_t count = 0;
+
+        void add(const float3& itemMin, const float3& itemMax, const float3& itemNormW, float itemIntensity)
+        {
+            aabbMin = min(aabbMin, itemMin);
+            aabbMax = max(aabbMax, itemMax);
+            normW += itemNormW * itemIntensity;
+            intensity += itemIntensity;
+            count++;
+        }
+
+        void add(const Cluster& c)
+        {
+            aabbMin = min(aabbMin, c.aabbMin);
+            aabbMax = max(aabbMax, c.aabbMax);
+            normW += c.normW;
+            intensity += c.intensity;
+            count += c.count;
+        }
+
+        float cost() const
+        {
+            if (count == 0 || !(intensity > 0.f))
+                return 0.f;
+            const float spread = 1.f - std::min(length(normW) / intensity, 1.f);
+            return intensity * length(aabbMax - aabbMin) * (1.f + spread);
+        }
+    };
+
+    inline float axisValue(const float3& posW, const float3& normW, uint32_t axis)
+    {
+        return axis < 3 ? posW[axis] : normW[axis - 3];
+    }
+}
+
+HostSAHBuilder::SharedPtr HostSAHBuilder::create()
+{
+    return SharedPtr(new HostSAHBuilder());
+}
+
+bool HostSAHBuilder::build(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs)
+{
+    if (maxVPLs <= 0 || numVPLs < 0 || numVPLs > maxVPLs)
+        return false;
+
+    mDesc    = desc;
+    mDesc.numBins = std::max(2u, std::min(mDesc.numBins, kMaxBins));
+    mNumVPLs = numVPLs;
+    mMaxVPLs = maxVPLs;
+
+    if (vplData.size() < 2 * (size_t)maxVPLs)
+        vplData.resize(2 * (size_t)maxVPLs);
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+
+    const uint32_t numInternalNodes = getNumInternalNodes(maxVPLs);
+    const size_t numTotalNodes = getNumTotalNodes(maxVPLs);
+    mNodes.resize(numTotalNodes);
+    mMerge.resize(numTotalNodes);
+    parallelFor(0, numTotalNodes, [&](size_t i)
+    {
+        TreeNode& node = mNodes[i];
+        node.parent_idx = kInvalidIndex;
+        node.left_idx   = kInvalidIndex;
+        node.right_idx  = kInvalidIndex;
+        node.vpl_idx    = kInvalidIndex;
+        node.flag       = 0;
+        mMerge[i].ApproxScore = float2(1.f, 0.f); // Normal score / Normal Z std
+    });
+
+    // Gather the valid leaves. The tracer hands out the ids with an atomic counter, so this is [0, numVPLs).
+    mItems.clear();
+    mItems.reserve(numVPLs);
+    for (int i = 0; i < maxVPLs; i++)
+    {
+        const VPLData& vpl = vplData[i];
+        if (vpl.id < 0)
+            continue;
+        Item item;
+        item.aabbMin   = vpl.getAABBMin();
+        item.aabbMax   = vpl.getAABBMax();
+        item.posW      = vpl.getPosW();
+        item.normW     = vpl.getNormW();
+        item.intensity = vpl.getIntensity();
+        item.vplId     = (uint32_t)i;
+        mItems.push_back(item);
+    }
+
+    if (mItems.size() != (size_t)numVPLs)
+    {
+        logWarning("HostSAHBuilder: Number of valid VPLs does not match numVPLs.");
+        return false;
+    }
+
+    if (numVPLs == 0)
+    {
+        mBuildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+        return true;
+    }
+
+    // A single VPL has no internal nodes. Copy it to the root so that the sampler finds it.
+    if (numVPLs == 1)
+    {
+        mNodes[numInternalNodes].vpl_idx = mItems[0].vplId;
+        vplData[maxVPLs] = vplData[mItems[0].vplId];
+        mBuildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+        return true;
+    }
+
+    // Split the top of the tree serially until there are enough subtrees for all threads.
+    mMaxTaskSize = std::max<size_t>(1024, (size_t)numVPLs / (8 * getNumHostThreads()));
+    std::vector<Task> tasks;
+    split(0, (uint32_t)numVPLs, 0, kInvalidIndex, &tasks);
+
+    // A subtree with k leaves owns the internal nodes [internalIdx, internalIdx + k - 1). Children always
+    // have a higher index than their parent, so merging in reverse order visits the children first.
+    parallelForChunks(tasks.size(), [&](size_t t, uint32_t)
+    {
+        const Task& task = tasks[t];
+        split(task.begin, task.end, task.internalIdx, task.parentIdx, nullptr);
+        for (uint32_t i = task.internalIdx + (task.end - task.begin) - 1; i-- > task.internalIdx;)
+            mergeNode(i, vplData);
+    });
+
+    // Merge the top of the tree. Internal nodes of the tasks are already merged.
+    std::vector<uint8_t> merged(numVPLs - 1, 0);
+    for (const Task& task : tasks)
+        std::fill(merged.begin() + task.internalIdx, merged.begin() + task.internalIdx + (task.end - task.begin) - 1, 1);
+    for (uint32_t i = (uint32_t)numVPLs - 1; i-- > 0;)
+    {
+        if (!merged[i])
+            mergeNode(i, vplData);
+    }
+
+    mBuildTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    return true;
+}
+
+void HostSAHBuilder::split(uint32_t begin, uint32_t end, uint32_t internalIdx, uint32_t parentIdx, std::vector<Task>* pTasks)
+{
+    const uint32_t numInternalNodes = getNumInternalNodes(mMaxVPLs);
+
+    if (pTasks && end - begin <= mMaxTaskSize)
+    {
+        pTasks->push_back({ begin, end, internalIdx, parentIdx });
+        return;
+    }
+
+    TreeNode& node = mNodes[internalIdx];
+    node.parent_idx = parentIdx;
+    node.vpl_idx    = mMaxVPLs + internalIdx;
+
+    const uint32_t mid = partition(begin, end);
+    const uint32_t numLeft = mid - begin;
+
+    // Left subtree starts right after this node, the right subtree after the left one.
+    if (numLeft == 1)
+    {
+        node.left_idx = numInternalNodes + begin;
+        mNodes[node.left_idx].parent_idx = internalIdx;
+        mNodes[node.left_idx].vpl_idx    = mItems[begin].vplId;
+    }
+    else
+        node.left_idx = internalIdx + 1;
+
+    if (end - mid == 1)
+    {
+        node.right_idx = numInternalNodes + mid;
+        mNodes[node.right_idx].parent_idx = internalIdx;
+        mNodes[node.right_idx].vpl_idx    = mItems[mid].vplId;
+    }
+    else
+        node.right_idx = internalIdx + numLeft;
+
+    if (numLeft > 1)
+        split(begin, mid, internalIdx + 1, internalIdx, pTasks);
+    if (end - mid > 1)
+        split(mid, end, internalIdx + numLeft, internalIdx, pTasks);
+}
+
+uint32_t HostSAHBuilder::partition(uint32_t begin, uint32_t end)
+{
+    if (end - begin == 2)
+        return begin + 1;
+
+    const uint32_t numAxes = mDesc.splitNormals ? kNumAxes : 3;
+    const uint32_t numBins = mDesc.numBins;
+
+    // Bounds of the split keys
+    float keyMin[kNumAxes], keyMax[kNumAxes];
+    for (uint32_t a = 0; a < kNumAxes; a++)
+    {
+        keyMin[a] = FLT_MAX;
+        keyMax[a] = -FLT_MAX;
+    }
+    for (uint32_t i = begin; i < end; i++)
+    {
+        for (uint32_t a = 0; a < numAxes; a++)
+        {
+            const float k = axisValue(mItems[i].posW, mItems[i].normW, a);
+            keyMin[a] = std::min(keyMin[a], k);
+            keyMax[a] = std::max(keyMax[a], k);
+        }
+    }
+
+    // Bin the leaves along every axis and sweep the split planes
+    float bestCost = FLT_MAX;
+    uint32_t bestAxis = kInvalidIndex;
+    uint32_t bestBin = 0;
+
+    for (uint32_t a = 0; a < numAxes; a++)
+    {
+        const float extent = keyMax[a] - keyMin[a];
+        if (!(extent > 1e-6f))
+            continue;
+        const float scale = (float)numBins / extent;
+
+        Cluster bins[kMaxBins];
+        for (uint32_t i = begin; i < end; i++)
+        {
+            const Item& item = mItems[i];
+            const uint32_t b = std::min((uint32_t)((axisValue(item.posW, item.normW, a) - keyMin[a]) * scale), numBins - 1);
+            bins[b].add(item.aabbMin, item.aabbMax, item.normW, item.intensity);
+        }
+
+        float rightCost[kMaxBins];
+        Cluster right;
+        for (uint32_t b = numBins - 1; b > 0; b--)
+        {
+            right.add(bins[b]);
+            rightCost[b] = right.count > 0 ? right.cost() : FLT_MAX;
+        }
+
+        Cluster left;
+        for (uint32_t b = 0; b + 1 < numBins; b++)
+        {
+            left.add(bins[b]);
+            if (left.count == 0 || left.count == end - begin)
+                continue;
+            const float cost = left.cost() + rightCost[b + 1];
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = a;
+                bestBin = b;
+            }
+        }
+    }
+
+    if (bestAxis != kInvalidIndex)
+    {
+        const float scale = (float)numBins / (keyMax[bestAxis] - keyMin[bestAxis]);
+        auto it = std::partition(mItems.begin() + begin, mItems.begin() + end, [&](const Item& item)
+        {
+            return std::min((uint32_t)((axisValue(item.posW, item.normW, bestAxis) - keyMin[bestAxis]) * scale), numBins - 1) <= bestBin;
+        });
+        return (uint32_t)(it - mItems.begin());
+    }
+
+    // All leaves share the same keys, split in the middle.
+    const uint32_t mid = begin + (end - begin) / 2;
+    std::nth_element(mItems.begin() + begin, mItems.begin() + mid, mItems.begin() + end, [](const Item& a, const Item& b) { return a.vplId < b.vplId; });
+    return mid;
+}
+
+void HostSAHBuilder::mergeNode(uint32_t internalIdx, std::vector<VPLData>& vplData)
+{
+    const TreeNode& node = mNodes[internalIdx];
+    const uint32_t lhsVplId = mNodes[node.left_idx].vpl_idx;
+    const uint32_t rhsVplId = mNodes[node.right_idx].vpl_idx;
+
+    VPLMerge mergeData;
+    vplData[node.vpl_idx] = mergeVPLData(vplData[lhsVplId], vplData[rhsVplId], mMerge[lhsVplId], mMerge[rhsVplId], node.vpl_idx, mDesc.approxParams, mergeData);
+    mMerge[node.vpl_idx] = mergeData;
+}
+
+BuilderComparison compareTreeBuilders(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs,
+    uint32_t numReceivers, uint32_t numSamples, uint32_t numEstimates)
+{
+    BuilderComparison result;
+    if (numVPLs <= 0 || numReceivers == 0 || numSamples == 0 || numEstimates == 0)
+        return result;
+
+    std::vector<VPLData> lbvhData = vplData;
+    std::vector<VPLData> sahData = vplData;
+
+    HostTreeBuilder::Desc lbvhDesc = desc;
+    lbvhDesc.enableRefit = false;
+    HostTreeBuilder::SharedPtr pLBVHBuilder = HostTreeBuilder::create();
+    if (!pLBVHBuilder->build(lbvhDesc, lbvhData, numVPLs, maxVPLs))
+        return result;
+
+    HostSAHBuilder::Desc sahDesc;
+    sahDesc.approxParams = desc.approxParams;
+    HostSAHBuilder::SharedPtr pSAHBuilder = HostSAHBuilder::create();
+    if (!pSAHBuilder->build(sahDesc, sahData, numVPLs, maxVPLs))
+        return result;
+
+    result.lbvhBuildTime = pLBVHBuilder->getTimings().total;
+    result.sahBuildTime = pSAHBuilder->getBuildTime();
+
+    // Place the receivers slightly above random VPLs, the reference is the sum over all VPLs
+    const float offset = length(desc.maxExtent - desc.minExtent) * 1e-3f;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, HostSamplingParams());
+
+    const HostSamplingError lbvh = estimateSamplingError(lbvhData, maxVPLs, receivers, reference, nullptr, numEstimates, numSamples);
+    const HostSamplingError sah = estimateSamplingError(sahData, maxVPLs, receivers, reference, nullptr, numEstimates, numSamples);
+    result.lbvhSteps = lbvh.avgSteps;
+    result.lbvhError = lbvh.error;
+    result.sahSteps = sah.avgSteps;
+    result.sahError = sah.error;
+
+    logInfo("compareTreeBuilders: LBVH " + std::to_string(result.lbvhBuildTime) + " ms, " + std::to_string(result.lbvhSteps) + " steps, error " + std::to_string(result.lbvhError)
+        + " / SAH " + std::to_string(result.sahBuildTime) + " ms, " + std::to_string(result.sahSteps) + " steps, error " + std::to_string(result.sahError));
+    return result;
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeBuilder.h"
+
+using namespace Falcor;
+
+
+/** Offline SST builder for static scenes.
+    Splits the VPLs top-down with a binned cost function instead of the morton order of the LBVH.
+    The cost of a cluster is intensity * AABB diagonal * (1 + normal spread), with the normal spread
+    1 - |sum(I * N)| / sum(I). Splits are searched along the position and the normal axes.
+    Slower than HostTreeBuilder, but writes the same TreeNode/VPLData layout, so the sampler is unchanged:
+    - nodes:   [internal nodes (maxVPLs - 1), leaf nodes (maxVPLs)]
+    - vplData: [leaves (maxVPLs), internal nodes (maxVPLs - 1)], root at index maxVPLs.
+*/
+class HostSAHBuilder : public std::enable_shared_from_this<HostSAHBuilder>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostSAHBuilder>;
+    using SharedConstPtr = std::shared_ptr<const HostSAHBuilder>;
+    virtual ~HostSAHBuilder() = default;
+
+    /** Build parameters.
+    */
+    struct Desc
+    {
+        TreeApproxParams approxParams;
+        uint32_t numBins = 16;        ///< Number of bins per axis.
+        bool splitNormals = true;     ///< Also search splits along the normal axes.
+    };
+
+    /** Create a new SAH builder.
+    */
+    static SharedPtr create();
+
+    /** Builds the SST in-place.
+        \param[in] desc Build parameters.
+        \param[in,out] vplData VPL buffer as written by the VPL tracer. Leaves must be stored at their id. Resized to 2 * maxVPLs if smaller.
+        \param[in] numVPLs Number of valid VPLs (VPLStats::numVPLs).
+        \param[in] maxVPLs Capacity of the leaf range. Determines the node layout.
+        \return True if successful, false if the input is invalid.
+    */
+    bool build(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs);
+
+    const std::vector<TreeNode>& getNodes() const { return mNodes; }
+    const std::vector<VPLMerge>& getMerge() const { return mMerge; }
+    float getBuildTime() const { return mBuildTime; }
+
+protected:
+    HostSAHBuilder() = default;
+
+    /** Leaf as seen by the split search.
+    */
+    struct Item
+    {
+        float3 aabbMin;
+        float3 aabbMax;
+        float3 posW;
+        float3 normW;
+        float intensity;
+        uint32_t vplId;
+    };
+
+    /** Subtree that is split on a worker thread.
+    */
+    struct Task
+    {
+        uint32_t begin;
+        uint32_t end;
+        uint32_t internalIdx;
+        uint32_t parentIdx;
+    };
+
+    void split(uint32_t begin, uint32_t end, uint32_t internalIdx, uint32_t parentIdx, std::vector<Task>* pTasks);
+    uint32_t partition(uint32_t begin, uint32_t end);
+    void mergeNode(uint32_t internalIdx, std::vector<VPLData>& vplData);
+
+    Desc mDesc;
+    int mNumVPLs = 0;
+    int mMaxVPLs = 0;
+    size_t mMaxTaskSize = 0;
+
+    std::vector<Item> mItems;
+    std::vector<TreeNode> mNodes;
+    std::vector<VPLMerge> mMerge;
+    float mBuildTime = 0.f;
+};
+
+/** Result of compareTreeBuilders().
+*/
+struct BuilderComparison
+{
+    float lbvhBuildTime = 0.f;    ///< Time in milliseconds.
+    float sahBuildTime = 0.f;     ///< Time in milliseconds.
+    float lbvhSteps = 0.f;        ///< Average traversal steps per sample.
+    float sahSteps = 0.f;
+    float lbvhError = 0.f;        ///< Relative RMS error of the estimate against the sum over all VPLs.
+    float sahError = 0.f;
+};
+
+/** Builds the tree with HostTreeBuilder and HostSAHBuilder and compares sampleVPLTree() on both.
+    The receivers are placed on random VPLs. Every receiver takes numSamples samples per estimate,
+    like gNumIndirectSamples, and the error is measured over numEstimates estimates.
+    \param[in] desc Build parameters of the LBVH. The approximation parameters are also used for the SAH tree.
+    \param[in] vplData VPL buffer as written by the VPL tracer.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receiver points.
+    \param[in] numSamples Number of samples per estimate.
+    \param[in] numEstimates Number of estimates per receiver.
+    \return Comparison result. Results are logged.
+*/
+BuilderComparison compareTreeBuilders(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs,
+    uint32_t numReceivers = 256, uint32_t numSamples = 1, uint32_t numEstimates = 64);
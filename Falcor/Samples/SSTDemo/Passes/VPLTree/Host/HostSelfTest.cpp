@@ -0,0 +1,344 @@
+// Headless regression tests, see HostSelfTest.h
+
+#include "HostSelfTest.h"
+#include "HostCodesSimd.h"
+#include "HostCompressedTree.h"
+#include "HostGroupSampling.h"
+#include "HostOrientationCones.h"
+#include "HostOutOfCoreBuilder.h"
+#include "HostPacketSampling.h"
+#include "HostRadixSort.h"
+#include "HostSAHBuilder.h"
+#include "HostShadowRayBinning.h"
+#include "HostTileCuts.h"
+#include "HostTreeBenchmark.h"
+#include "HostTreeBuilder.h"
+#include "HostTreeCache.h"
+#include "HostTreeValidation.h"
+#include "HostUtils.h"
+#include "HostVPLClustering.h"
+#include "HostWideTree.h"
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <random>
+
+namespace
+{
+    const uint32_t kNumDeterminismBuilds = 100;
+    const uint32_t kMinDeterminismThreads = 8;      // The merge order only varies with several threads
+    const float kMaxErrorRatio = 1.25f;             // Samplers of the same distribution only differ in noise
+    const char kOutOfCoreTestFile[] = "selftest.outofcore";
+
+    struct SelfTest
+    {
+        const char* name;
+        std::function<bool(const HostSelfTestDesc&)> run;
+    };
+
+    /** Bit-exact comparison of the AVX2 code kernels with the scalar port, see checkCodeKernels().
+    */
+    bool testCodeKernels(const HostSelfTestDesc& desc)
+    {
+        return checkCodeKernels(1 << 16, HostTreeBuilder::Desc().numSphereSections, desc.seed) == 0;
+    }
+
+    /** Build parameters of the synthetic VPLs, which lie in the unit cube.
+    */
+    HostTreeBuilder::Desc getBuildDesc()
+    {
+        HostTreeBuilder::Desc buildDesc;
+        buildDesc.minExtent = float3(0.f);
+        buildDesc.maxExtent = float3(1.f);
+        return buildDesc;
+    }
+
+    /** Energy conservation of the VPL clustering, see checkVPLClustering(). Runs with the default cell size and with a
+        target of a quarter of the VPLs, which forces coarser cells.
+    */
+    bool testVPLClustering(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+
+        VPLClusteringDesc clusteringDesc;
+        bool valid = checkVPLClustering(clusteringDesc, getBuildDesc(), vplData, desc.numVPLs, desc.numVPLs).valid;
+        clusteringDesc.targetVPLs = std::max(desc.numVPLs / 4, 1);
+        valid = checkVPLClustering(clusteringDesc, getBuildDesc(), vplData, desc.numVPLs, desc.numVPLs).valid && valid;
+        return valid;
+    }
+
+    /** Bit-reproducibility of the deterministic host build, see checkDeterministicBuild(). Runs with at least
+        kMinDeterminismThreads threads, also on machines with fewer cores.
+    */
+    bool testDeterministicBuild(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+
+        const uint32_t previousOverride = getHostThreadOverride();
+        getHostThreadOverride() = std::max(getNumHostThreads(), kMinDeterminismThreads);
+        const DeterministicBuildCheck check = checkDeterministicBuild(getBuildDesc(), vplData, desc.numVPLs, desc.numVPLs, kNumDeterminismBuilds);
+        getHostThreadOverride() = previousOverride;
+        return check.valid;
+    }
+
+    /** Builds a tree of the synthetic VPLs with the host builder.
+        \return False if the build failed.
+    */
+    bool buildTestTree(const HostSelfTestDesc& desc, std::vector<VPLData>& vplData)
+    {
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+        return HostTreeBuilder::create()->build(getBuildDesc(), vplData, desc.numVPLs, desc.numVPLs);
+    }
+
+    /** Radix sort of random 64bit and 128bit keys against std::stable_sort, also on a partial bit range where equal keys keep their order.
+    */
+    bool testRadixSort(const HostSelfTestDesc& desc)
+    {
+        std::mt19937_64 rng(desc.seed);
+        HostRadixSort::SharedPtr pSort = HostRadixSort::create();
+        bool valid = true;
+
+        for (const int2& bitRange : { int2(63, 0), int2(40, 8) })
+        {
+            std::vector<uint64_t> keys(desc.numVPLs);
+            for (uint64_t& key : keys) key = rng();
+            const uint64_t mask = (~0ull >> (63 - bitRange.x)) & (~0ull << bitRange.y);
+            std::vector<uint64_t> expected = keys;
+            std::stable_sort(expected.begin(), expected.end(), [&](uint64_t a, uint64_t b) { return (a & mask) < (b & mask); });
+            valid = pSort->execute(keys, (uint32_t)keys.size(), bitRange) && keys == expected && valid;
+        }
+
+        std::vector<Key128> keys(desc.numVPLs);
+        for (Key128& key : keys) key = { rng(), rng() };
+        std::vector<Key128> expected = keys;
+        std::stable_sort(expected.begin(), expected.end());
+        valid = pSort->execute(keys, (uint32_t)keys.size(), int2(127, 0)) && keys == expected && valid;
+        return valid;
+    }
+
+    /** Moves every 100th VPL after a build and validates the refitted tree, see HostTreeBuilder::refit().
+    */
+    bool testRefit(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+
+        HostTreeBuilder::Desc buildDesc = getBuildDesc();
+        buildDesc.enableRefit = true;
+        buildDesc.maxRefitCostRatio = FLT_MAX;  // The refit must not fall back to a build
+        HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+        if (!pBuilder->build(buildDesc, vplData, desc.numVPLs, desc.numVPLs))
+            return false;
+
+        const float3 offset = float3(0.01f);
+        for (int i = 0; i < desc.numVPLs; i += 100)
+        {
+            VPLData& vpl = vplData[i];
+            if (vpl.id < 0)
+                continue;
+            vpl.setPosW(vpl.getPosW() + offset);
+            vpl.setAABBMin(vpl.getAABBMin() + offset);
+            vpl.setAABBMax(vpl.getAABBMax() + offset);
+            vpl.setIntensity(vpl.getIntensity() * 1.05f);
+        }
+        return pBuilder->refit(buildDesc, vplData, desc.numVPLs, desc.numVPLs) && validateTree(vplData, desc.numVPLs).valid;
+    }
+
+    /** A built tree is valid, a wrong intensity and a cycle at the root are not. See validateTree().
+    */
+    bool testTreeValidation(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        if (!buildTestTree(desc, vplData) || !validateTree(vplData, desc.numVPLs).valid)
+            return false;
+
+        std::vector<VPLData> corrupted = vplData;
+        VPLData& root = corrupted[desc.numVPLs];
+        root.setIntensity(root.getIntensity() * 2.f);
+        if (validateTree(corrupted, desc.numVPLs).numIntensityErrors == 0)
+            return false;
+
+        corrupted = vplData;
+        corrupted[desc.numVPLs].idChild1 = desc.numVPLs;
+        return validateTree(corrupted, desc.numVPLs).numDoubleVisits > 0;
+    }
+
+    /** Validates a tree of the binned SAH builder, see HostSAHBuilder.
+    */
+    bool testSAHBuilder(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+        return HostSAHBuilder::create()->build(HostSAHBuilder::Desc(), vplData, desc.numVPLs, desc.numVPLs) && validateTree(vplData, desc.numVPLs).valid;
+    }
+
+    /** The 4-wide traversal samples the same distribution as the binary one in fewer steps, see compareWideTraversal().
+    */
+    bool testWideTraversal(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        if (!buildTestTree(desc, vplData))
+            return false;
+        const WideTraversalComparison comparison = compareWideTraversal(vplData, desc.numVPLs);
+        return comparison.wideSteps > 0.f && comparison.wideSteps < comparison.binarySteps && comparison.wideError <= kMaxErrorRatio * comparison.binaryError;
+    }
+
+    /** Topology and quantization error bounds of the 32 byte nodes, see checkCompressedTree().
+    */
+    bool testCompressedTree(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        return buildTestTree(desc, vplData) && checkCompressedTree(vplData, desc.numVPLs).valid;
+    }
+
+    /** The AVX2 packet sampler matches the scalar sampler sample by sample, see checkPacketSampler().
+    */
+    bool testPacketSampler(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        if (!buildTestTree(desc, vplData))
+            return false;
+        const PacketSamplerCheck check = checkPacketSampler(vplData, desc.numVPLs);
+        return check.numSamples > 0 && check.numMismatches == 0;
+    }
+
+    /** Grouped sampling evaluates fewer nodes than independent sampling at the same error, see checkGroupSampling().
+    */
+    bool testGroupSampling(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        if (!buildTestTree(desc, vplData))
+            return false;
+        const GroupSamplingCheck check = checkGroupSampling(vplData, desc.numVPLs);
+        bool valid = !check.entries.empty();
+        for (const GroupSamplingCheck::Entry& entry : check.entries)
+            valid = valid && entry.groupEvals < entry.independentEvals && entry.groupError <= kMaxErrorRatio * entry.independentError;
+        return valid;
+    }
+
+    /** Cone containment and culling of back-facing VPLs, see checkOrientationCones().
+    */
+    bool testOrientationCones(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        return buildTestTree(desc, vplData) && checkOrientationCones(vplData, desc.numVPLs).valid;
+    }
+
+    /** Every tile cut partitions the traversals from the root, see checkTileCuts().
+    */
+    bool testTileCuts(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        return buildTestTree(desc, vplData) && checkTileCuts(vplData, desc.numVPLs).valid;
+    }
+
+    /** Every shadow ray binning is a permutation of the rays, see checkShadowRayBinning().
+    */
+    bool testShadowRayBinning(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        return buildTestTree(desc, vplData) && checkShadowRayBinning(vplData, desc.numVPLs).valid;
+    }
+
+    /** Chunked build within a quarter of the memory, validated and compared to the in-memory build, see checkOutOfCoreBuild().
+    */
+    bool testOutOfCoreBuild(const HostSelfTestDesc& desc)
+    {
+        std::vector<VPLData> vplData;
+        generateBenchmarkVPLs(BenchmarkDistribution::ClusteredSurfaces, desc.numVPLs, desc.numVPLs, vplData, desc.seed);
+        return checkOutOfCoreBuild(getBuildDesc(), vplData, desc.numVPLs, desc.numVPLs, kOutOfCoreTestFile).valid;
+    }
+}
+
+uint32_t runHostSelfTests(const HostSelfTestDesc& desc)
+{
+    const SelfTest tests[] =
+    {
+        { "radix sort", testRadixSort },
+        { "code kernels", testCodeKernels },
+        { "refit", testRefit },
+        { "SAH builder", testSAHBuilder },
+        { "tree validation", testTreeValidation },
+        { "4-wide traversal", testWideTraversal },
+        { "compressed nodes", testCompressedTree },
+        { "packet sampler", testPacketSampler },
+        { "group sampling", testGroupSampling },
+        { "out-of-core build", testOutOfCoreBuild },
+        { "VPL clustering", testVPLClustering },
+        { "orientation cones", testOrientationCones },
+        { "deterministic build", testDeterministicBuild },
+        { "tile cuts", testTileCuts },
+        { "shadow ray binning", testShadowRayBinning },
+    };
+
+    uint32_t numFailed = 0;
+    for (const SelfTest& test : tests)
+    {
+        bool passed = false;
+        try
+        {
+            passed = test.run(desc);
+        }
+        catch (const std::exception& e)
+        {
+            logWarning("runHostSelfTests: " + std::string(test.name) + " threw " + e.what());
+        }
+
+        if (passed)
+            logInfo("runHostSelfTests: " + std::string(test.name) + " passed");
+        else
+            logWarning("runHostSelfTests: " + std::string(test.name) + " failed");
+        numFailed += passed ? 0 : 1;
+    }
+
+    logInfo("runHostSelfTests: " + std::to_string(numFailed) + " of " + std::to_string(sizeof(tests) / sizeof(tests[0])) + " tests failed");
+    return numFailed;
+}
+
+bool validateTreeFile(const std::string& filename)
+{
+    uint32_t magic = 0;
+    {
+        std::ifstream file(filename, std::ios::binary);
+        if (!file || !file.read((char*)&magic, sizeof(magic)))
+        {
+            logWarning("validateTreeFile: Can't read '" + filename + "'.");
+            return false;
+        }
+    }
+
+    std::vector<VPLData> vplData;
+    int maxVPLs = 0;
+    if (magic == kTreeCacheMagic)
+    {
+        MappedTreeCache::SharedPtr pCache = MappedTreeCache::open(filename);
+        if (!pCache || !pCache->verify())
+        {
+            logWarning("validateTreeFile: '" + filename + "' is not a valid tree cache.");
+            return false;
+        }
+        vplData.assign(pCache->getVPLData(), pCache->getVPLData() + pCache->getHeader().vplDataCount);
+        maxVPLs = pCache->getHeader().maxVPLs;
+    }
+    else if (magic == kOutOfCoreTreeMagic)
+    {
+        OutOfCoreTreeHeader header;
+        if (!readOutOfCoreTree(filename, header, vplData))
+            return false;
+        maxVPLs = header.maxVPLs;
+    }
+    else
+    {
+        logWarning("validateTreeFile: '" + filename + "' is neither a tree cache nor an out-of-core tree.");
+        return false;
+    }
+
+    const TreeValidationResult validation = validateTree(vplData, maxVPLs);
+    if (validation.valid)
+        logInfo("validateTreeFile: '" + filename + "': " + to_string(validation));
+    else
+        logWarning("validateTreeFile: '" + filename + "': " + to_string(validation) + ", invalid");
+    return validation.valid;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include "Falcor.h"
+
+using namespace Falcor;
+
+
+/** Headless regression tests of the host SST code.
+    Every host check with a pass criterion runs as a test: the radix sort, code kernels, refit, SAH build, validator, 4-wide,
+    compressed, packet and group sampling, out-of-core, clustering, cone, determinism, tile cut and shadow ray binning checks.
+    They use synthetic VPLs (see generateBenchmarkVPLs()) instead of traced ones, so they don't need a scene or a GPU.
+    The benchmarks and the threshold tuner only measure and are not tests. Run them with "SSTDemo.exe -selfTest [numVPLs]", the process exits
+    with 1 if any test fails. Baked trees are checked with "SSTDemo.exe -validateTree <tree>".
+*/
+
+/** Test parameters.
+*/
+struct HostSelfTestDesc
+{
+    int numVPLs = 1 << 16;      ///< VPLs of the tests that build a tree, maxVPLs is the same.
+    uint32_t seed = 0;          ///< Seed of the random inputs.
+};
+
+/** Runs all tests. Every test is logged as passed or failed.
+    \return Number of failed tests, 0 if all passed.
+*/
+uint32_t runHostSelfTests(const HostSelfTestDesc& desc);
+
+/** Loads a baked tree and runs validateTree() on it. The file is either a tree cache (see HostTreeCache.h), whose payload hash
+    is verified first, or an out-of-core tree (see HostOutOfCoreBuilder.h); the format is detected from the magic number.
+    \param[in] filename Tree file.
+    \return True if the file was read and the tree is valid. The validation result is logged.
+*/
+bool validateTreeFile(const std::string& filename);
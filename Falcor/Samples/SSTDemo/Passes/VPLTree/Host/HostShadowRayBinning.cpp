@@ -0,0 +1,244 @@
+// Binned shadow rays, see HostShadowRayBinning.h
+
+#include "HostShadowRayBinning.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kTileSize = 16;
+    const uint32_t kTilesPerRow = 8;
+
+    /** Accumulated coherence of one warp.
+    */
+    struct WarpStats
+    {
+        uint32_t numRays = 0;
+        double directionCoherence = 0.0;
+        double originSpread = 0.0;
+        double targetSpread = 0.0;
+        uint32_t numNodes = 0;
+        uint32_t numOctants = 0;
+    };
+
+    /** RMS distance of the points to their mean.
+    */
+    double rmsSpread(const std::vector<float3>& points)
+    {
+        float3 mean = float3(0.f);
+        for (const float3& p : points) mean += p;
+        mean /= (float)points.size();
+        double sum = 0.0;
+        for (const float3& p : points) sum += (double)dot(p - mean, p - mean);
+        return std::sqrt(sum / points.size());
+    }
+}
+
+const char* to_string(ShadowRayBinning binning)
+{
+    switch (binning)
+    {
+    case ShadowRayBinning::PixelOrder: return "pixel order";
+    case ShadowRayBinning::Node:       return "node";
+    case ShadowRayBinning::Octant:     return "octant";
+    default:                           return "unknown";
+    }
+}
+
+std::vector<ShadowRayRecord> generateShadowRaysHost(const std::vector<VPLData>& vplData, int maxVPLs, const std::vector<HostShadingPoint>& pixels,
+    uint32_t numSamples, const HostSamplingParams& params)
+{
+    ShadowRayRecord invalid = {};
+    invalid.nodeIdx = -1;
+    std::vector<ShadowRayRecord> records(pixels.size() * numSamples, invalid);
+
+    parallelFor(0, pixels.size(), [&](size_t p)
+    {
+        uint32_t seed = getReceiverSeedHost(p);
+        for (uint32_t s = 0; s < numSamples; s++)
+        {
+            // Samples without a contribution don't need a ray, see sampleVPLTree()
+            const HostTreeSample sample = sampleVPLTreeHost(vplData, maxVPLs, pixels[p], params, seed);
+            const float3& L = sample.radiance;
+            if (sample.nodeIdx < 0 || !(L.x > 0.f || L.y > 0.f || L.z > 0.f))
+                continue;
+
+            ShadowRayRecord& record = records[p * numSamples + s];
+            record.origin = sample.posW;
+            record.nodeIdx = sample.nodeIdx;
+            record.target = pixels[p].posW;
+            record.radiance = sample.radiance;
+        }
+    }, 64);
+    return records;
+}
+
+std::vector<uint32_t> binShadowRaysHost(const std::vector<ShadowRayRecord>& records, ShadowRayBinning binning, HostRadixSort& sort)
+{
+    std::vector<uint64_t> keys(records.size());
+    parallelFor(0, records.size(), [&](size_t i)
+    {
+        keys[i] = getShadowRayKeyHost(records[i], (uint32_t)i, binning);
+    }, 4096);
+
+    // The record index in the low bits keeps the order within a bin, so pixel order only moves the invalid records to the back
+    sort.execute(keys, (uint32_t)keys.size(), int2(63, 0));
+
+    std::vector<uint32_t> order(records.size());
+    for (size_t i = 0; i < keys.size(); i++)
+        order[i] = (uint32_t)(keys[i] & 0xFFFFFFFF);
+    return order;
+}
+
+ShadowRayCoherence computeShadowRayCoherenceHost(const std::vector<ShadowRayRecord>& records, const std::vector<uint32_t>& order, float extent, uint32_t warpSize)
+{
+    ShadowRayCoherence result;
+    if (order.empty() || warpSize == 0)
+        return result;
+
+    const size_t numWarps = (order.size() + warpSize - 1) / warpSize;
+    std::vector<WarpStats> warps(numWarps);
+    parallelFor(0, numWarps, [&](size_t w)
+    {
+        std::vector<float3> origins, targets;
+        std::vector<int> nodes;
+        uint32_t octants = 0;
+        float3 dirSum = float3(0.f);
+
+        const size_t end = std::min(order.size(), (w + 1) * warpSize);
+        for (size_t i = w * warpSize; i < end; i++)
+        {
+            const ShadowRayRecord& record = records[order[i]];
+            if (record.nodeIdx < 0)
+                continue; // Idle lane
+            const float3 dir = record.target - record.origin;
+            const float len = length(dir);
+            if (len > 0.f) dirSum += dir / len;
+            origins.push_back(record.origin);
+            targets.push_back(record.target);
+            nodes.push_back(record.nodeIdx);
+            octants |= 1u << getShadowRayOctantHost(record.origin, record.target);
+        }
+
+        WarpStats& stats = warps[w];
+        stats.numRays = (uint32_t)origins.size();
+        if (stats.numRays == 0)
+            return;
+        std::sort(nodes.begin(), nodes.end());
+        stats.directionCoherence = length(dirSum) / stats.numRays;
+        stats.originSpread = rmsSpread(origins);
+        stats.targetSpread = rmsSpread(targets);
+        stats.numNodes = (uint32_t)(std::unique(nodes.begin(), nodes.end()) - nodes.begin());
+        for (uint32_t o = octants; o; o &= o - 1) stats.numOctants++;
+    }, 256);
+
+    double directionCoherence = 0.0, originSpread = 0.0, targetSpread = 0.0, numNodes = 0.0, numOctants = 0.0;
+    uint32_t numActiveWarps = 0;
+    for (const WarpStats& stats : warps)
+    {
+        if (stats.numRays == 0)
+            continue;
+        result.numRays += stats.numRays;
+        directionCoherence += stats.directionCoherence;
+        originSpread += stats.originSpread;
+        targetSpread += stats.targetSpread;
+        numNodes += stats.numNodes;
+        numOctants += stats.numOctants;
+        numActiveWarps++;
+    }
+    if (numActiveWarps == 0)
+        return result;
+
+    const double scale = extent > 0.f ? 1.0 / extent : 1.0;
+    result.laneOccupancy = (float)((double)result.numRays / ((double)numActiveWarps * warpSize));
+    result.directionCoherence = (float)(directionCoherence / numActiveWarps);
+    result.originSpread = (float)(originSpread * scale / numActiveWarps);
+    result.targetSpread = (float)(targetSpread * scale / numActiveWarps);
+    result.nodesPerWarp = (float)(numNodes / numActiveWarps);
+    result.octantsPerWarp = (float)(numOctants / numActiveWarps);
+    return result;
+}
+
+ShadowRayBinningCheck checkShadowRayBinning(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numTiles, float tileExtent)
+{
+    ShadowRayBinningCheck result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs)
+        return result;
+
+    const uint32_t numRows = numTiles / kTilesPerRow;
+    if (numRows == 0)
+        return result;
+
+    const VPLData& root = vplData[maxVPLs];
+    const float diagonal = length(root.getAABBMax() - root.getAABBMin());
+    const std::vector<HostShadingPoint> centers = generateReceiversHost(vplData, maxVPLs, numRows * kTilesPerRow, diagonal * 1e-3f);
+    if (centers.size() < numRows * kTilesPerRow)
+        return result;
+
+    // Screen of numRows x kTilesPerRow tiles in scanline order, neighbouring tiles show unrelated surfaces
+    const float pitch = diagonal * tileExtent / kTileSize;
+    std::vector<HostPixelTile> tiles(centers.size());
+    for (size_t t = 0; t < centers.size(); t++)
+        tiles[t] = HostPixelTile::create(centers[t], kTileSize, pitch);
+
+    const uint32_t width = kTilesPerRow * kTileSize;
+    const uint32_t height = numRows * kTileSize;
+    std::vector<HostShadingPoint> pixels(width * height);
+    for (uint32_t y = 0; y < height; y++)
+    {
+        for (uint32_t x = 0; x < width; x++)
+            pixels[y * width + x] = tiles[(y / kTileSize) * kTilesPerRow + x / kTileSize].getPixel(x % kTileSize, y % kTileSize);
+    }
+    result.numPixels = (uint32_t)pixels.size();
+    result.valid = true;
+
+    const HostSamplingParams params;
+    HostRadixSort::SharedPtr pSort = HostRadixSort::create();
+
+    for (uint32_t numSamples : { 1u, 4u, 16u })
+    {
+        const std::vector<ShadowRayRecord> records = generateShadowRaysHost(vplData, maxVPLs, pixels, numSamples, params);
+
+        ShadowRayBinningCheck::Entry entry;
+        entry.numSamples = numSamples;
+        for (uint32_t b = 0; b < (uint32_t)ShadowRayBinning::Count; b++)
+        {
+            const ShadowRayBinning binning = (ShadowRayBinning)b;
+            auto t0 = CpuTimer::getCurrentTimePoint();
+            const std::vector<uint32_t> order = binShadowRaysHost(records, binning, *pSort);
+            entry.binTime[b] = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+            entry.coherence[b] = computeShadowRayCoherenceHost(records, order, diagonal);
+
+            // The order has to be a permutation of the records with ascending keys
+            std::vector<uint8_t> visited(records.size(), 0);
+            bool valid = order.size() == records.size();
+            for (size_t i = 0; valid && i < order.size(); i++)
+            {
+                valid = order[i] < records.size() && !visited[order[i]] &&
+                    (i == 0 || getShadowRayKeyHost(records[order[i - 1]], order[i - 1], binning) < getShadowRayKeyHost(records[order[i]], order[i], binning));
+                if (valid) visited[order[i]] = 1;
+            }
+            if (!valid || entry.coherence[b].numRays != entry.coherence[0].numRays)
+            {
+                logWarning("checkShadowRayBinning: " + std::string(to_string(binning)) + " binning of " + std::to_string(numSamples) + " samples per pixel is not a permutation of the rays");
+                result.valid = false;
+            }
+        }
+        result.entries.push_back(entry);
+
+        std::string message = "checkShadowRayBinning: " + std::to_string(result.numPixels) + " pixels, " + std::to_string(numSamples) + " samples per pixel, "
+            + std::to_string(entry.coherence[0].numRays) + " rays";
+        for (uint32_t b = 0; b < (uint32_t)ShadowRayBinning::Count; b++)
+        {
+            const ShadowRayCoherence& c = entry.coherence[b];
+            message += std::string(", ") + to_string((ShadowRayBinning)b) + ": occupancy " + std::to_string(c.laneOccupancy)
+                + ", direction coherence " + std::to_string(c.directionCoherence) + ", origin spread " + std::to_string(c.originSpread)
+                + ", target spread " + std::to_string(c.targetSpread) + ", nodes " + std::to_string(c.nodesPerWarp)
+                + ", octants " + std::to_string(c.octantsPerWarp) + ", " + std::to_string(entry.binTime[b]) + " ms";
+        }
+        if (result.valid)
+            logInfo(message);
+        else
+            logWarning(message + ", invalid");
+    }
+    return result;
+}
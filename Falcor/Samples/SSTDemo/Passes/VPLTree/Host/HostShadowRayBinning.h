@@ -0,0 +1,105 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostRadixSort.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** Host port of the binned shadow rays in VPLSampling.rt.hlsl (writeShadowRay(), getShadowRayBin()). Keep both files in sync!
+    With USE_BINNED_SHADOW_RAYS the samples of a pixel don't trace their shadow rays, they write a ShadowRayRecord each.
+    The records are sorted by a 64 bit key (bin << 32 | record index) and resolveShadowRays() traces them in sorted order,
+    so rays to the same node or in the same direction octant share a warp. Records without a ray sort behind all rays.
+*/
+
+const char* to_string(ShadowRayBinning binning);
+
+/** Octant of the direction from origin to target, see getShadowRayOctant().
+*/
+inline uint32_t getShadowRayOctantHost(const float3& origin, const float3& target)
+{
+    const float3 dir = target - origin;
+    return (dir.x < 0.f ? 1u : 0u) | (dir.y < 0.f ? 2u : 0u) | (dir.z < 0.f ? 4u : 0u);
+}
+
+/** Bin of a record, see getShadowRayBin().
+*/
+inline uint32_t getShadowRayBinHost(const ShadowRayRecord& record, ShadowRayBinning binning)
+{
+    if (record.nodeIdx < 0) return kInvalidShadowRayBin;
+    switch (binning)
+    {
+    case ShadowRayBinning::Node:   return (uint32_t)record.nodeIdx;
+    case ShadowRayBinning::Octant: return getShadowRayOctantHost(record.origin, record.target);
+    default:                       return 0;
+    }
+}
+
+/** Sort key of a record, see writeShadowRay().
+*/
+inline uint64_t getShadowRayKeyHost(const ShadowRayRecord& record, uint32_t recordIdx, ShadowRayBinning binning)
+{
+    return ((uint64_t)getShadowRayBinHost(record, binning) << 32) | recordIdx;
+}
+
+/** Takes numSamples samples per pixel and writes their records like rayGeneration() with USE_BINNED_SHADOW_RAYS.
+    \param[in] pixels Receivers in screen order.
+    \return pixels.size() * numSamples records, record i belongs to pixel i / numSamples.
+*/
+std::vector<ShadowRayRecord> generateShadowRaysHost(const std::vector<VPLData>& vplData, int maxVPLs, const std::vector<HostShadingPoint>& pixels,
+    uint32_t numSamples, const HostSamplingParams& params);
+
+/** Sorts the records by their keys, the host counterpart of the BitonicSort pass in VPLSampling::resolveShadowRays().
+    \param[in] sort Radix sort used for the keys.
+    \return Record indices in the order resolveShadowRays() traces them.
+*/
+std::vector<uint32_t> binShadowRaysHost(const std::vector<ShadowRayRecord>& records, ShadowRayBinning binning, HostRadixSort& sort);
+
+/** Coherence of the shadow rays that are traced together. Lanes are consecutive entries of the trace order, a warp is
+    warpSize lanes; lanes of records without a ray are idle. All values are means over the warps with at least one ray.
+*/
+struct ShadowRayCoherence
+{
+    uint32_t numRays = 0;
+    float laneOccupancy = 0.f;          ///< Share of lanes that trace a ray.
+    float directionCoherence = 0.f;     ///< Length of the mean unit ray direction, 1 for parallel rays.
+    float originSpread = 0.f;           ///< RMS distance of the ray origins to their mean, relative to the given extent.
+    float targetSpread = 0.f;           ///< RMS distance of the ray targets to their mean, relative to the given extent.
+    float nodesPerWarp = 0.f;           ///< Distinct selected nodes.
+    float octantsPerWarp = 0.f;         ///< Distinct direction octants.
+};
+
+/** Measures the coherence of the rays in the given trace order.
+    \param[in] extent Length the spreads are relative to, usually the diagonal of the root bounds.
+*/
+ShadowRayCoherence computeShadowRayCoherenceHost(const std::vector<ShadowRayRecord>& records, const std::vector<uint32_t>& order, float extent, uint32_t warpSize = 32);
+
+/** Result of checkShadowRayBinning().
+*/
+struct ShadowRayBinningCheck
+{
+    struct Entry
+    {
+        uint32_t numSamples = 0;                                                ///< Samples per pixel.
+        ShadowRayCoherence coherence[(uint32_t)ShadowRayBinning::Count];        ///< Indexed by ShadowRayBinning.
+        float binTime[(uint32_t)ShadowRayBinning::Count] = {};                  ///< Host binning time in ms.
+    };
+
+    bool valid = false;             ///< Every binning is a permutation of the records in ascending key order.
+    uint32_t numPixels = 0;
+    std::vector<Entry> entries;
+};
+
+/** Compares the coherence of the shadow rays in pixel order with the node and octant binnings for 1, 4 and 16 samples per pixel.
+    The screen is a grid of 16x16 pixel tiles in scanline order, every tile shows the surface around a random VPL
+    (see HostPixelTile). Visibility is not evaluated.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numTiles Number of tiles, rounded down to full rows of 8 tiles.
+    \param[in] tileExtent Edge of a tile relative to the diagonal of the root bounds.
+    \return Check result, also logged.
+*/
+ShadowRayBinningCheck checkShadowRayBinning(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numTiles = 64, float tileExtent = 0.02f);
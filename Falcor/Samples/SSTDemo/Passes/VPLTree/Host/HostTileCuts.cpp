@@ -0,0 +1,262 @@
+// Screen tile lightcuts, see HostTileCuts.h
+
+#include "HostTileCuts.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kNumEstimates = 16;
+    const uint32_t kSamplesPerEstimate = 4;
+    const uint32_t kErrorPixelsPerTile = 4;    // Pixels per tile with a reference, linear in the number of VPLs each
+
+    /** Cut nodes are split until the traversal would stop, like in sampleVPLTree() for the diffuse lobe.
+    */
+    bool isSplittable(const VPLData& vpl)
+    {
+        return !(vpl.getEarlyStop() > 0.f) && vpl.numVPLSubTree > 0;
+    }
+}
+
+std::vector<TileCutNode> buildTileCutHost(const std::vector<VPLData>& vplData, int rootIndex, const std::vector<HostShadingPoint>& representatives,
+    const HostSamplingParams& params, uint32_t* pNumFetches)
+{
+    const uint32_t numReps = (uint32_t)std::min(representatives.size(), (size_t)kTileCutRepresentatives);
+
+    int cutNode[kMaxTileCutNodes];
+    bool cutSplittable[kMaxTileCutNodes];
+    float cutReach[kMaxTileCutNodes][kTileCutRepresentatives];  // Probability of the representatives to reach the node
+
+    uint32_t numCut = 1;
+    uint32_t numFetches = 1;
+    cutNode[0] = rootIndex;
+    cutSplittable[0] = numReps > 0 && isSplittable(vplData[rootIndex]);
+    for (uint32_t r = 0; r < numReps; r++) cutReach[0][r] = 1.f;
+
+    while (numCut < kMaxTileCutNodes)
+    {
+        // Split the node the representatives reach with the highest probability
+        int best = -1;
+        float bestReach = 0.f;
+        for (uint32_t c = 0; c < numCut; c++)
+        {
+            if (!cutSplittable[c]) continue;
+            float reach = 0.f;
+            for (uint32_t r = 0; r < numReps; r++) reach += cutReach[c][r];
+            if (reach > bestReach)
+            {
+                best = (int)c;
+                bestReach = reach;
+            }
+        }
+        if (best < 0)
+            break;
+
+        const VPLData& node = vplData[cutNode[best]];
+        const VPLData& child1 = vplData[node.idChild1];
+        const VPLData& child2 = vplData[node.idChild2];
+        numFetches += 3;
+
+        for (uint32_t r = 0; r < numReps; r++)
+        {
+            const float w1 = evalNodeWeightHost(child1, representatives[r], params);
+            const float w2 = evalNodeWeightHost(child2, representatives[r], params);
+            const float p1 = w1 + w2 > 0.f ? w1 / (w1 + w2) : 0.f;
+            const float p2 = w1 + w2 > 0.f ? 1.f - p1 : 0.f; // Dead branch for this representative
+            cutReach[numCut][r] = cutReach[best][r] * p2;
+            cutReach[best][r] *= p1;
+        }
+
+        cutNode[numCut] = node.idChild2;
+        cutSplittable[numCut] = isSplittable(child2);
+        cutNode[best] = node.idChild1;
+        cutSplittable[best] = isSplittable(child1);
+        numCut++;
+    }
+
+    float totalReach = 0.f;
+    float nodeReach[kMaxTileCutNodes];
+    for (uint32_t c = 0; c < numCut; c++)
+    {
+        nodeReach[c] = 0.f;
+        for (uint32_t r = 0; r < numReps; r++) nodeReach[c] += cutReach[c][r];
+        totalReach += nodeReach[c];
+    }
+
+    // The pdf is the difference of the stored cdf values, so it matches the binary search exactly
+    std::vector<TileCutNode> cut(kMaxTileCutNodes);
+    float cdf = 0.f;
+    for (uint32_t c = 0; c < kMaxTileCutNodes; c++)
+    {
+        TileCutNode& entry = cut[c];
+        entry.pad = 0.f;
+        if (c < numCut)
+        {
+            const float uniform = 1.f / (float)numCut;
+            const float q = totalReach > 0.f ? (1.f - kTileCutUniformMix) * nodeReach[c] / totalReach + kTileCutUniformMix * uniform : uniform;
+            const float next = c + 1 == numCut ? 1.f : std::min(cdf + q, 1.f);
+            entry.nodeIdx = cutNode[c];
+            entry.pdf = next - cdf;
+            entry.cdf = next;
+            cdf = next;
+        }
+        else
+        {
+            entry.nodeIdx = -1;
+            entry.pdf = 0.f;
+            entry.cdf = 1.f;
+        }
+    }
+
+    if (pNumFetches) *pNumFetches = numFetches;
+    return cut;
+}
+
+bool validateTileCutHost(const std::vector<VPLData>& vplData, int rootIndex, const TileCutNode* pCut)
+{
+    std::vector<int> nodes;
+    float prevCdf = 0.f;
+    for (uint32_t c = 0; c < kMaxTileCutNodes; c++)
+    {
+        const TileCutNode& entry = pCut[c];
+        if (entry.nodeIdx < 0)
+        {
+            if (entry.cdf != 1.f) return false;
+            continue;
+        }
+        if (c > 0 && pCut[c - 1].nodeIdx < 0) return false;   // Unused entries are at the end
+        if (!(entry.pdf > 0.f) || std::abs(entry.cdf - (prevCdf + entry.pdf)) > 1e-6f) return false;
+        if (entry.nodeIdx >= (int)vplData.size()) return false;
+        nodes.push_back(entry.nodeIdx);
+        prevCdf = entry.cdf;
+    }
+    if (nodes.empty() || prevCdf != 1.f)
+        return false;
+    std::sort(nodes.begin(), nodes.end());
+
+    // Every path from the root meets exactly one cut node before the traversal stops
+    uint32_t numCovered = 0;
+    std::vector<int> stack = { rootIndex };
+    while (!stack.empty())
+    {
+        const int idx = stack.back();
+        stack.pop_back();
+        if (std::binary_search(nodes.begin(), nodes.end(), idx))
+        {
+            numCovered++;
+            continue;
+        }
+        const VPLData& vpl = vplData[idx];
+        if (!isSplittable(vpl))
+            return false;
+        stack.push_back(vpl.idChild1);
+        stack.push_back(vpl.idChild2);
+    }
+    return numCovered == nodes.size() && std::adjacent_find(nodes.begin(), nodes.end()) == nodes.end();
+}
+
+TileCutCheck checkTileCuts(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numTiles, float tileExtent)
+{
+    TileCutCheck result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs || numTiles == 0)
+        return result;
+
+    const VPLData& root = vplData[maxVPLs];
+    const float diagonal = length(root.getAABBMax() - root.getAABBMin());
+    const std::vector<HostShadingPoint> centers = generateReceiversHost(vplData, maxVPLs, numTiles, diagonal * 1e-3f);
+    if (centers.empty())
+        return result;
+    result.numTiles = (uint32_t)centers.size();
+    result.valid = true;
+
+    const HostSamplingParams params;
+    const float pitch = diagonal * tileExtent / 16.f;
+
+    for (uint32_t tileSize : { 8u, 16u })
+    {
+        const uint32_t numPixels = tileSize * tileSize;
+        const uint32_t half = tileSize / 2;
+
+        std::vector<TileCutNode> cuts(centers.size() * kMaxTileCutNodes);
+        std::vector<uint32_t> cutSizes(centers.size(), 0), buildFetches(centers.size(), 0);
+        std::vector<double> fetches[2];
+        fetches[0].assign(centers.size(), 0.0);
+        fetches[1].assign(centers.size(), 0.0);
+        std::vector<uint8_t> cutValid(centers.size(), 0);
+        std::vector<HostShadingPoint> errorPixels(centers.size() * kErrorPixelsPerTile);
+
+        parallelFor(0, centers.size(), [&](size_t t)
+        {
+            const HostPixelTile tile = HostPixelTile::create(centers[t], tileSize, pitch);
+
+            // One random representative per quadrant, see buildTileCuts()
+            uint32_t seed = (uint32_t)t * 0x9e3779b9u + tileSize;
+            std::vector<HostShadingPoint> representatives;
+            for (uint32_t i = 0; i < kTileCutRepresentatives; i++)
+            {
+                const uint32_t x = (i & 1) * half + std::min((uint32_t)(nextRandHost(seed) * half), half - 1);
+                const uint32_t y = (i >> 1) * half + std::min((uint32_t)(nextRandHost(seed) * half), half - 1);
+                representatives.push_back(tile.getPixel(x, y));
+            }
+
+            TileCutNode* pCut = &cuts[t * kMaxTileCutNodes];
+            const std::vector<TileCutNode> cut = buildTileCutHost(vplData, maxVPLs, representatives, params, &buildFetches[t]);
+            std::copy(cut.begin(), cut.end(), pCut);
+            cutValid[t] = validateTileCutHost(vplData, maxVPLs, pCut) ? 1 : 0;
+            for (const TileCutNode& entry : cut) cutSizes[t] += entry.nodeIdx >= 0 ? 1 : 0;
+
+            // One sample per pixel for the node fetches, a fetch per start node and two per step
+            for (uint32_t p = 0; p < numPixels; p++)
+            {
+                const HostShadingPoint sp = tile.getPixel(p % tileSize, p / tileSize);
+                uint32_t rootSeed = seed + p;
+                uint32_t cutSeed = seed + p;
+                fetches[0][t] += 1.0 + 2.0 * sampleVPLTreeHost(vplData, maxVPLs, sp, params, rootSeed).numSteps;
+                fetches[1][t] += 1.0 + 2.0 * sampleVPLTreeFromCutHost(vplData, pCut, sp, params, cutSeed).numSteps;
+            }
+
+            for (uint32_t i = 0; i < kErrorPixelsPerTile; i++)
+            {
+                const uint32_t p = std::min((uint32_t)(nextRandHost(seed) * numPixels), numPixels - 1);
+                errorPixels[t * kErrorPixelsPerTile + i] = tile.getPixel(p % tileSize, p / tileSize);
+            }
+        }, 1);
+
+        // Error at a few pixels per tile, [0] from the root, [1] from the cut
+        const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, errorPixels, params);
+        const float rootError = estimateSamplingError(vplData, maxVPLs, errorPixels, reference, nullptr, kNumEstimates, kSamplesPerEstimate).error;
+        const float cutError = estimateSamplingError(vplData, maxVPLs, errorPixels, reference, [&](const HostShadingPoint& sp, size_t i, uint32_t& seed)
+        {
+            return sampleVPLTreeFromCutHost(vplData, &cuts[(i / kErrorPixelsPerTile) * kMaxTileCutNodes], sp, params, seed);
+        }, kNumEstimates, kSamplesPerEstimate).error;
+
+        double totalFetches[2] = {}, totalBuildFetches = 0.0, totalCutSize = 0.0;
+        for (size_t t = 0; t < centers.size(); t++)
+        {
+            totalFetches[0] += fetches[0][t];
+            totalFetches[1] += fetches[1][t];
+            totalBuildFetches += buildFetches[t];
+            totalCutSize += cutSizes[t];
+            result.valid = result.valid && cutValid[t] != 0;
+        }
+
+        const double numSamples = (double)centers.size() * numPixels;
+        TileCutCheck::Entry entry;
+        entry.tileSize = tileSize;
+        entry.cutSize = (float)(totalCutSize / centers.size());
+        entry.rootFetches = (float)(totalFetches[0] / numSamples);
+        entry.cutFetches = (float)(totalFetches[1] / numSamples);
+        entry.lookupFetches = std::log2((float)kMaxTileCutNodes) + 1.f;
+        entry.buildFetches = (float)(totalBuildFetches / numSamples);
+        entry.rootError = rootError;
+        entry.cutError = cutError;
+        result.entries.push_back(entry);
+
+        logInfo("checkTileCuts: " + std::to_string(tileSize) + "x" + std::to_string(tileSize) + " tiles, " + std::to_string(entry.cutSize) + " cut nodes, node fetches per sample "
+            + std::to_string(entry.rootFetches) + " -> " + std::to_string(entry.cutFetches) + " + " + std::to_string(entry.lookupFetches) + " cut lookups + "
+            + std::to_string(entry.buildFetches) + " build, relative error " + std::to_string(entry.rootError) + " -> " + std::to_string(entry.cutError));
+    }
+
+    if (!result.valid)
+        logWarning("checkTileCuts: " + std::to_string(result.numTiles) + " tiles, a cut doesn't partition the tree, invalid");
+    return result;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** Host port of the screen tile lightcuts in VPLSampling.rt.hlsl (buildTileCuts(), sampleTileCut()). Keep both files in sync!
+    Neighbouring pixels on the same surface take almost the same path through the upper levels of the SST. A pre-pass builds
+    a cut of the SST for every screen tile from a few representative G-buffer samples: starting at the root, the cut node the
+    representatives reach with the highest probability is replaced by its children until the cut is full. Leaves and early
+    stop nodes are not split, so the cut nodes partition the samples of the full traversal.
+    The probability of a cut node is the mean probability of the representatives to reach it, mixed with a uniform share so
+    that no node has probability 0. A pixel samples a cut node and descends from there with its own weights. The sample
+    probability is the product of both, so the estimate is unbiased for every pixel of the tile, not just the representatives.
+*/
+
+/** Builds the cut of one tile, see buildTileCuts().
+    \param[in] vplData VPL data array of the tree.
+    \param[in] rootIndex Index of the root node (maxVPLs).
+    \param[in] representatives Representative receivers of the tile, at most kTileCutRepresentatives are used.
+    \param[in] params Sampler parameters.
+    \param[out] pNumFetches If not null, receives the number of node fetches of the build.
+    \return kMaxTileCutNodes entries, unused entries have nodeIdx -1.
+*/
+std::vector<TileCutNode> buildTileCutHost(const std::vector<VPLData>& vplData, int rootIndex, const std::vector<HostShadingPoint>& representatives,
+    const HostSamplingParams& params, uint32_t* pNumFetches = nullptr);
+
+/** Selects a cut node with the binary search of sampleTileCut().
+    \param[in] pCut kMaxTileCutNodes entries of one cut.
+    \param[in] u Uniform random number in [0, 1).
+*/
+inline const TileCutNode& sampleTileCutHost(const TileCutNode* pCut, float u)
+{
+    uint32_t lo = 0, hi = kMaxTileCutNodes - 1;
+    while (lo < hi)
+    {
+        const uint32_t mid = (lo + hi) / 2;
+        if (pCut[mid].cdf > u) hi = mid;
+        else lo = mid + 1;
+    }
+    return pCut[lo];
+}
+
+/** Takes one sample that starts at a node of a tile cut, see sampleVPLTree() with USE_TILE_CUTS.
+    HostTreeSample::numSteps only counts the steps below the cut node.
+*/
+inline HostTreeSample sampleVPLTreeFromCutHost(const std::vector<VPLData>& vplData, const TileCutNode* pCut, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed)
+{
+    const float r = nextRandHost(randSeed);
+    const TileCutNode& node = sampleTileCutHost(pCut, nextRandHost(randSeed));
+    return sampleVPLSubtreeHost(vplData, node.nodeIdx, node.pdf, r, sp, params, randSeed);
+}
+
+/** Checks that the nodes of a cut partition the samples of the traversal from the root and that their probabilities are
+    positive and sum to 1.
+*/
+bool validateTileCutHost(const std::vector<VPLData>& vplData, int rootIndex, const TileCutNode* pCut);
+
+/** Result of checkTileCuts().
+*/
+struct TileCutCheck
+{
+    struct Entry
+    {
+        uint32_t tileSize = 0;      ///< Tile edge in pixels.
+        float cutSize = 0.f;        ///< Mean number of nodes per cut.
+        float rootFetches = 0.f;    ///< Node fetches per sample of the traversal from the root.
+        float cutFetches = 0.f;     ///< Node fetches per sample of the traversal from the cut, without the cut lookup.
+        float lookupFetches = 0.f;  ///< Cut entry fetches per sample of the binary search.
+        float buildFetches = 0.f;   ///< Node fetches of the cut build per pixel.
+        float rootError = 0.f;      ///< Relative RMS error of the pixel estimates.
+        float cutError = 0.f;
+    };
+
+    bool valid = false;             ///< All cuts passed validateTileCutHost().
+    uint32_t numTiles = 0;
+    std::vector<Entry> entries;
+};
+
+/** Compares the traversal from the root with the traversal from 8x8 and 16x16 tile cuts.
+    Tiles are pixel grids in the tangent plane of random VPLs with the same pixel pitch for both tile sizes, the
+    representatives are random pixels of the tile quadrants like in the pre-pass. Visibility is not evaluated.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numTiles Number of tiles per tile size.
+    \param[in] tileExtent Edge of a 16x16 tile relative to the diagonal of the root bounds.
+    \return Check result, also logged.
+*/
+TileCutCheck checkTileCuts(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numTiles = 256, float tileExtent = 0.02f);
@@ -0,0 +1,327 @@
+// Scaling benchmark of the host SST build, see HostTreeBenchmark.h
+
+#include "HostTreeBenchmark.h"
+#include "HostCodesSimd.h"
+#include "HostTreeSampling.h"
+#include "HostTreeValidation.h"
+#include "HostUtils.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include <fstream>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <sys/resource.h>
+#endif
+
+namespace
+{
+    const uint32_t kNumClusters = 64;
+
+    // Intensities are scaled like the radiance / numPaths of traced VPLs. The nodes store the intensity in half precision,
+    // so the sum of 2^24 VPLs must stay below 65504.
+    const float kIntensityScale = 1e-3f;
+
+    /** Random number in [0, 1) of an element, see wangHashHost().
+    */
+    inline float hashToFloat(uint32_t index, uint32_t dimension, uint32_t seed)
+    {
+        const uint32_t h = wangHashHost(wangHashHost(index * 0x9e3779b9u + seed) ^ (dimension * 0x85ebca6bu));
+        return float(h >> 8) / float(1 << 24);
+    }
+
+    inline float3 uniformSphere(float u, float v)
+    {
+        const float z = 1.f - 2.f * u;
+        const float r = std::sqrt(std::max(0.f, 1.f - z * z));
+        const float phi = 2.f * (float)M_PI * v;
+        return float3(r * std::cos(phi), r * std::sin(phi), z);
+    }
+
+    /** Same fields as createVPL() in VPLTracing.rt.hlsl.
+    */
+    inline void setLeaf(VPLData& vpl, int id, const float3& posW, const float3& normW, float intensity)
+    {
+        vpl.setPosW(posW);
+        vpl.setEarlyStop(0.f);
+        vpl.setNormW(normW);
+        vpl.setConeAngle(0.f);
+        vpl.setColor(float3(intensity));
+        vpl.setIntensity(intensity);
+        vpl.setAABBMin(posW);
+        vpl.setAABBMax(posW);
+        vpl.setVariance(float3(0.f));
+        vpl.id = id;
+        vpl.idChild1 = -1;
+        vpl.idChild2 = -1;
+        vpl.numVPLSubTree = 0;
+    }
+
+    /** Position and inward normal of a point on a face of the unit cube.
+    */
+    inline void pointOnCubeFace(uint32_t face, float u, float v, float3& posW, float3& normW)
+    {
+        const uint32_t axis = face % 3;
+        const float side = face < 3 ? 0.f : 1.f;
+        posW = float3(0.f);
+        posW[axis] = side;
+        posW[(axis + 1) % 3] = u;
+        posW[(axis + 2) % 3] = v;
+        normW = float3(0.f);
+        normW[axis] = face < 3 ? 1.f : -1.f;
+    }
+
+    size_t getPeakProcessMemory()
+    {
+#if defined(_WIN32)
+        PROCESS_MEMORY_COUNTERS counters = {};
+        if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+            return counters.PeakWorkingSetSize;
+        return 0;
+#else
+        struct rusage usage = {};
+        if (getrusage(RUSAGE_SELF, &usage) == 0)
+            return (size_t)usage.ru_maxrss * 1024;
+        return 0;
+#endif
+    }
+}
+
+const char* to_string(BenchmarkDistribution distribution)
+{
+    switch (distribution)
+    {
+    case BenchmarkDistribution::UniformBox:        return "uniform_box";
+    case BenchmarkDistribution::ClusteredSurfaces: return "clustered_surfaces";
+    case BenchmarkDistribution::SingleWall:        return "single_wall";
+    case BenchmarkDistribution::SameNormal:        return "same_normal";
+    default:                                       return "unknown";
+    }
+}
+
+void generateBenchmarkVPLs(BenchmarkDistribution distribution, int numVPLs, int maxVPLs, std::vector<VPLData>& vplData, uint32_t seed)
+{
+    vplData.resize(2 * (size_t)maxVPLs);
+    numVPLs = std::min(numVPLs, maxVPLs);
+
+    parallelFor(0, (size_t)maxVPLs, [&](size_t i)
+    {
+        VPLData& vpl = vplData[i];
+        if ((int)i >= numVPLs)
+        {
+            setLeaf(vpl, -1, float3(0.f), float3(0.f), 0.f);
+            return;
+        }
+
+        const uint32_t idx = (uint32_t)i;
+        float3 posW, normW;
+        float intensity = kIntensityScale * (0.5f + hashToFloat(idx, 0, seed));
+
+        switch (distribution)
+        {
+        case BenchmarkDistribution::UniformBox:
+            posW = float3(hashToFloat(idx, 1, seed), hashToFloat(idx, 2, seed), hashToFloat(idx, 3, seed));
+            normW = uniformSphere(hashToFloat(idx, 4, seed), hashToFloat(idx, 5, seed));
+            break;
+        case BenchmarkDistribution::ClusteredSurfaces:
+        {
+            // Most VPLs are in clusters like the bright spots of a lit atrium, the rest is spread over all faces.
+            // Intensities span two orders of magnitude like multi-bounce VPLs.
+            const bool clustered = hashToFloat(idx, 1, seed) < 0.9f;
+            const uint32_t cluster = std::min((uint32_t)(hashToFloat(idx, 2, seed) * kNumClusters), kNumClusters - 1);
+            const uint32_t face = clustered ? cluster % 6 : std::min((uint32_t)(hashToFloat(idx, 2, seed) * 6.f), 5u);
+            float u = hashToFloat(idx, 3, seed);
+            float v = hashToFloat(idx, 4, seed);
+            if (clustered)
+            {
+                const float radius = 0.01f + 0.05f * hashToFloat(cluster, 0, seed ^ 0x5bd1e995u);
+                uint32_t randSeed = wangHashHost(idx + seed);
+                const float2 offset = nextNormal2Host(float2(0.f), float2(radius), randSeed);
+                u = std::min(std::max(hashToFloat(cluster, 1, seed ^ 0x5bd1e995u) + offset.x, 0.f), 1.f);
+                v = std::min(std::max(hashToFloat(cluster, 2, seed ^ 0x5bd1e995u) + offset.y, 0.f), 1.f);
+            }
+            pointOnCubeFace(face, u, v, posW, normW);
+            intensity = kIntensityScale * std::pow(10.f, -2.f * hashToFloat(idx, 5, seed));
+            break;
+        }
+        case BenchmarkDistribution::SingleWall:
+            posW = float3(hashToFloat(idx, 1, seed), hashToFloat(idx, 2, seed), 0.5f);
+            normW = float3(0.f, 0.f, 1.f);
+            break;
+        case BenchmarkDistribution::SameNormal:
+        default:
+            posW = float3(hashToFloat(idx, 1, seed), hashToFloat(idx, 2, seed), hashToFloat(idx, 3, seed));
+            normW = float3(0.f, 1.f, 0.f);
+            break;
+        }
+        setLeaf(vpl, (int)i, posW, normW, intensity);
+    });
+
+    // Internal node range is written by the build
+    parallelFor((size_t)maxVPLs, vplData.size(), [&](size_t i)
+    {
+        setLeaf(vplData[i], -1, float3(0.f), float3(0.f), 0.f);
+    });
+}
+
+bool runTreeBenchmark(const TreeBenchmarkDesc& desc, std::vector<TreeBenchmarkResult>& results)
+{
+    results.clear();
+
+    HostTreeBuilder::Desc buildDesc = desc.buildDesc;
+    buildDesc.minExtent = float3(0.f);
+    buildDesc.maxExtent = float3(1.f);
+    buildDesc.enableRefit = false;
+
+    const uint32_t maxLog2Size = std::min(desc.maxLog2Size, 30u);
+    for (uint32_t log2Size = desc.minLog2Size; log2Size <= maxLog2Size; log2Size++)
+    {
+        const int numVPLs = 1 << log2Size;
+        for (uint32_t d = 0; d < (uint32_t)BenchmarkDistribution::Count; d++)
+        {
+            TreeBenchmarkResult result;
+            result.distribution = (BenchmarkDistribution)d;
+            result.numVPLs = (uint32_t)numVPLs;
+
+            try
+            {
+                // A new builder per size, so the buffers are sized for this build only
+                HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+                std::vector<VPLData> vplData;
+                generateBenchmarkVPLs(result.distribution, numVPLs, numVPLs, vplData);
+
+                for (uint32_t run = 0; run < std::max(desc.numRuns, 1u); run++)
+                {
+                    if (!pBuilder->build(buildDesc, vplData, numVPLs, numVPLs))
+                    {
+                        logWarning("runTreeBenchmark: Build of " + std::to_string(numVPLs) + " VPLs failed.");
+                        return false;
+                    }
+                    if (run == 0 || pBuilder->getTimings().total < result.timings.total)
+                        result.timings = pBuilder->getTimings();
+                }
+
+                result.throughput = result.timings.total > 0.f ? (float)numVPLs / (result.timings.total * 1e3f) : 0.f;
+                result.buildMemory = vplData.capacity() * sizeof(VPLData) + pBuilder->getMemoryUsage();
+                result.peakProcessMemory = getPeakProcessMemory();
+                result.treeCost = pBuilder->computeTreeCost(vplData);
+                result.use128BitCodes = pBuilder->getCodeLayout().use128Bit;
+
+                if (desc.validate)
+                {
+                    const TreeValidationResult validation = validateTree(vplData, numVPLs);
+                    result.valid = validation.valid;
+                    result.maxDepth = validation.maxDepth;
+                    result.numCutNodes = validation.numCutNodes;
+                    result.earlyStopCoverage = validation.earlyStopCoverage;
+
+                    uint64_t depthSum = 0;
+                    for (size_t depth = 0; depth < validation.leavesPerDepth.size(); depth++)
+                        depthSum += depth * validation.leavesPerDepth[depth];
+                    result.avgLeafDepth = validation.numLeaves > 0 ? (float)((double)depthSum / validation.numLeaves) : 0.f;
+                }
+            }
+            catch (const std::bad_alloc&)
+            {
+                logWarning("runTreeBenchmark: Out of memory at " + std::to_string(numVPLs) + " VPLs, stopping.");
+                return true;
+            }
+
+            logInfo("runTreeBenchmark: " + std::string(to_string(result.distribution)) + " " + std::to_string(numVPLs) + " VPLs, "
+                + std::to_string(result.timings.total) + " ms, " + std::to_string(result.throughput) + " MVPL/s, "
+                + std::to_string(result.buildMemory >> 20) + " MB, cost " + std::to_string(result.treeCost) + (result.valid || !desc.validate ? "" : ", INVALID"));
+            results.push_back(result);
+        }
+    }
+    return true;
+}
+
+bool writeTreeBenchmarkJson(const std::string& filename, const TreeBenchmarkDesc& desc, const std::vector<TreeBenchmarkResult>& results)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetIndent(' ', 4);
+
+    // Non-finite values are not valid JSON
+    auto writeDouble = [&](double value)
+    {
+        if (std::isfinite(value)) writer.Double(value);
+        else writer.Null();
+    };
+
+    writer.StartObject();
+    writer.Key("config");
+    writer.StartObject();
+    writer.Key("builder");              writer.String("host");     // The GPU build is not benchmarked
+    writer.Key("numThreads");           writer.Uint(getNumHostThreads());
+    writer.Key("avx2");                 writer.Bool(desc.buildDesc.useSimd && hasAVX2());
+    writer.Key("numSphereSections");    writer.Uint(desc.buildDesc.numSphereSections);
+    writer.Key("mortonBits");
+    writer.StartArray();
+    writer.Uint(desc.buildDesc.mortonBits.x);
+    writer.Uint(desc.buildDesc.mortonBits.y);
+    writer.Uint(desc.buildDesc.mortonBits.z);
+    writer.EndArray();
+    writer.Key("tightBounds");          writer.Bool(desc.buildDesc.useTightBounds);
+    writer.Key("minNormalScore");       writeDouble(desc.buildDesc.approxParams.minNormalScore);
+    writer.Key("maxNormalZStd");        writeDouble(desc.buildDesc.approxParams.maxNormalZStd);
+    writer.Key("numRuns");              writer.Uint(desc.numRuns);
+    writer.EndObject();
+
+    writer.Key("results");
+    writer.StartArray();
+    for (const TreeBenchmarkResult& result : results)
+    {
+        const double numVPLs = (double)result.numVPLs;
+        auto writeStage = [&](const char* name, float time)
+        {
+            writer.Key(name);
+            writer.StartObject();
+            writer.Key("ms");           writeDouble(time);
+            writer.Key("mvplPerSec");   writeDouble(time > 0.f ? numVPLs / (time * 1e3) : 0.0);
+            writer.EndObject();
+        };
+
+        writer.StartObject();
+        writer.Key("distribution");     writer.String(to_string(result.distribution));
+        writer.Key("numVPLs");          writer.Uint(result.numVPLs);
+        writer.Key("codeBits");         writer.Uint(result.use128BitCodes ? 128 : 64);
+        writer.Key("stages");
+        writer.StartObject();
+        writeStage("init", result.timings.init);
+        writeStage("computeCodes", result.timings.computeCodes);
+        writeStage("sortCodes", result.timings.sortCodes);
+        writeStage("assignLeafIndex", result.timings.assignLeafIndex);
+        writeStage("internalNodes", result.timings.internalNodes);
+        writeStage("mergeNodes", result.timings.mergeNodes);
+        writer.EndObject();
+        writer.Key("totalMs");          writeDouble(result.timings.total);
+        writer.Key("mvplPerSec");       writeDouble(result.throughput);
+        writer.Key("buildMemoryBytes"); writer.Uint64(result.buildMemory);
+        writer.Key("peakProcessMemoryBytes"); writer.Uint64(result.peakProcessMemory);
+        writer.Key("quality");
+        writer.StartObject();
+        writer.Key("treeCost");         writeDouble(result.treeCost);
+        writer.Key("valid");            writer.Bool(result.valid);
+        writer.Key("maxDepth");         writer.Uint(result.maxDepth);
+        writer.Key("avgLeafDepth");     writeDouble(result.avgLeafDepth);
+        writer.Key("numCutNodes");      writer.Uint(result.numCutNodes);
+        writer.Key("earlyStopCoverage"); writeDouble(result.earlyStopCoverage);
+        writer.EndObject();
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    std::ofstream file(filename, std::ios::trunc);
+    if (!file)
+    {
+        logWarning("writeTreeBenchmarkJson: Can't open '" + filename + "' for writing.");
+        return false;
+    }
+    file.write(buffer.GetString(), (std::streamsize)buffer.GetSize());
+    return file.good();
+}
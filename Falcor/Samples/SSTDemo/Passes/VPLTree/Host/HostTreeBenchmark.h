@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Falcor.h"
+#include "HostTreeBuilder.h"
+
+using namespace Falcor;
+
+
+/** Scaling benchmark of the host SST build.
+    Synthesizes VPL distributions in the unit cube, builds them at power of two sizes with HostTreeBuilder and
+    records the time of every stage, the memory of the build and the quality of the resulting tree.
+    Run it from the VPLTree GUI or headless with "SSTDemo.exe -treeBenchmark <file.json> [maxLog2Size]", which exits with 1
+    if a build fails. Only the host builder is timed, the GPU build of VPLTree (buildTreeOnGpu()) is not part of the benchmark.
+*/
+
+/** Synthetic VPL distributions. All of them lie in [0, 1]^3.
+*/
+enum class BenchmarkDistribution : uint32_t
+{
+    UniformBox,         ///< Uniform positions in the cube, uniform normals.
+    ClusteredSurfaces,  ///< Sponza-like: clusters of VPLs on the faces of the cube with the face normals and a wide intensity range.
+    SingleWall,         ///< Degenerate: all VPLs on the plane z = 0.5 with the same normal.
+    SameNormal,         ///< Uniform positions in the cube, all normals +y.
+    Count
+};
+
+/** Returns the name of a distribution as used in the JSON output.
+*/
+const char* to_string(BenchmarkDistribution distribution);
+
+/** Generates numVPLs leaves at their id like the VPL tracer, the buffer is resized to 2 * maxVPLs.
+    The result only depends on the arguments, not on the number of threads.
+*/
+void generateBenchmarkVPLs(BenchmarkDistribution distribution, int numVPLs, int maxVPLs, std::vector<VPLData>& vplData, uint32_t seed = 0);
+
+/** Benchmark parameters.
+*/
+struct TreeBenchmarkDesc
+{
+    HostTreeBuilder::Desc buildDesc;    ///< Build parameters, the extents are set to the unit cube.
+    uint32_t minLog2Size = 10;          ///< Smallest number of VPLs, 2^10.
+    uint32_t maxLog2Size = 24;          ///< Largest number of VPLs, 2^24.
+    uint32_t numRuns = 3;               ///< Builds per size and distribution, the fastest one is reported.
+    bool validate = true;               ///< Run validateTree() for the quality metrics.
+};
+
+/** Result of one size and distribution.
+*/
+struct TreeBenchmarkResult
+{
+    BenchmarkDistribution distribution = BenchmarkDistribution::UniformBox;
+    uint32_t numVPLs = 0;
+    HostTreeBuilder::Timings timings;   ///< Stage times in milliseconds of the fastest run.
+    float throughput = 0.f;             ///< Million VPLs per second of the whole build.
+    size_t buildMemory = 0;             ///< Bytes of the VPL data array and the build buffers.
+    size_t peakProcessMemory = 0;       ///< Peak working set of the process so far in bytes, 0 if unknown.
+    bool use128BitCodes = false;        ///< The build used 128bit codes, see computeTreeCodeLayout().
+
+    // Tree quality
+    float treeCost = 0.f;               ///< See HostTreeBuilder::computeTreeCost().
+    bool valid = false;
+    uint32_t maxDepth = 0;
+    float avgLeafDepth = 0.f;
+    uint32_t numCutNodes = 0;
+    float earlyStopCoverage = 0.f;
+};
+
+/** Builds every distribution at all sizes from 2^minLog2Size to 2^maxLog2Size. maxVPLs is the size itself.
+    Stops at the first size that can't be allocated, that is not an error.
+    \param[out] results One result per size and distribution that was built. Results are logged.
+    \return False if a build failed, results holds the sizes before the failure.
+*/
+bool runTreeBenchmark(const TreeBenchmarkDesc& desc, std::vector<TreeBenchmarkResult>& results);
+
+/** Writes the results and the build configuration as JSON.
+    \return True if successful.
+*/
+bool writeTreeBenchmarkJson(const std::string& filename, const TreeBenchmarkDesc& desc, const std::vector<TreeBenchmarkResult>& results);
@@ -0,0 +1,496 @@
+// Host port of the LBVH construction in TreeInternalNodes.cs.slang (based on https://github.com/ToruNiina/lbvh)
+
+#include "HostTreeBuilder.h"
+#include "HostUtils.h"
+#include "HostCodesSimd.h"
+#include "HostMerge.h"
+#include "HostTreeCache.h"
+#include <set>
+#include <sstream>
+
+namespace
+{
+    const uint32_t kInvalidIndex = 0xFFFFFFFF;
+    const uint64_t kInvalidCode  = uint64_t(-1);
+    const Key128 kInvalidCode128 = { uint64_t(-1), uint64_t(-1) };
+
+    inline int common_upper_bits(const uint64_t lhs, const uint64_t rhs)
+    {
+        return clz64(lhs ^ rhs);
+    }
+
+    inline int common_upper_bits(const Key128& lhs, const Key128& rhs)
+    {
+        return clz128(lhs ^ rhs);
+    }
+
+    template<typename Code>
+    uint2 determine_range(const Code* codes, const int num_leaves, int idx)
+    {
+        if (idx == 0)
+            return uint2(0, num_leaves - 1);
+
+        // determine direction of the range
+        const Code self_code = codes[idx];
+        const int L_delta = common_upper_bits(self_code, codes[idx - 1]);
+        const int R_delta = common_upper_bits(self_code, codes[idx + 1]);
+        const int d = (R_delta > L_delta) ? 1 : -1;
+
+        // Compute upper bound for the length of the range
+        const int delta_min = std::min(L_delta, R_delta);
+        int l_max = 2;
+        int delta = -1;
+        int i_tmp = idx + d * l_max;
+        if (0 <= i_tmp && i_tmp < num_leaves)
+        {
+            delta = common_upper_bits(self_code, codes[i_tmp]);
+        }
+        while (delta > delta_min)
+        {
+            l_max <<= 1;
+            i_tmp = idx + d * l_max;
+            delta = -1;
+            if (0 <= i_tmp && i_tmp < num_leaves)
+            {
+                delta = common_upper_bits(self_code, codes[i_tmp]);
+            }
+        }
+
+        // Find the other end by binary search
+        int l = 0;
+        int t = l_max >> 1;
+        while (t > 0)
+        {
+            i_tmp = idx + (l + t) * d;
+            delta = -1;
+            if (0 <= i_tmp && i_tmp < num_leaves)
+            {
+                delta = common_upper_bits(self_code, codes[i_tmp]);
+            }
+            if (delta > delta_min)
+            {
+                l += t;
+            }
+            t >>= 1;
+        }
+        int jdx = idx + l * d;
+        if (d < 0)
+        {
+            std::swap(idx, jdx); // make it sure that idx < jdx
+        }
+        return uint2(idx, jdx);
+    }
+
+    template<typename Code>
+    uint32_t find_split(const Code* codes, const uint32_t first, const uint32_t last)
+    {
+        const Code first_code = codes[first];
+        const Code last_code  = codes[last];
+        if (first_code == last_code)
+        {
+            return (first + last) >> 1;
+        }
+        const int delta_node = common_upper_bits(first_code, last_code);
+
+        // binary search...
+        int split = first;
+        int stride = last - first;
+        do
+        {
+            stride = (stride + 1) >> 1;
+            const int middle = split + stride;
+            if (middle < (int)last)
+            {
+                const int delta = common_upper_bits(first_code, codes[middle]);
+                if (delta > delta_node)
+                {
+                    split = middle;
+                }
+            }
+        } while (stride > 1);
+
+        return split;
+    }
+}
+
+HostTreeBuilder::HostTreeBuilder()
+{
+    mpRadixSort = HostRadixSort::create();
+}
+
+HostTreeBuilder::SharedPtr HostTreeBuilder::create()
+{
+    return SharedPtr(new HostTreeBuilder());
+}
+
+bool HostTreeBuilder::build(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs)
+{
+    if (maxVPLs <= 0 || numVPLs < 0 || numVPLs > maxVPLs)
+        return false;
+
+    mDesc    = desc;
+    mNumVPLs = numVPLs;
+    mMaxVPLs = maxVPLs;
+    mHasRefitState = false;
+
+    // Compute the offsets of our code fields: [Morton|Direction|Id]
+    mLayout = computeTreeCodeLayout(mDesc.mortonBits, mDesc.numSphereSections, maxVPLs, mDesc.force128BitCodes);
+    if (!mLayout.valid)
+    {
+        logWarning("HostTreeBuilder: Invalid morton code bits, the morton and direction codes must fit into 64 bits.");
+        return false;
+    }
+
+    if (mDesc.pDirCodeLUT && (!mDesc.pDirCodeLUT->isValid() || mDesc.pDirCodeLUT->getNumSphereSections() != mDesc.numSphereSections))
+    {
+        logWarning("HostTreeBuilder: Direction code table does not match the number of sphere sections.");
+        return false;
+    }
+
+    if (vplData.size() < 2 * (size_t)maxVPLs)
+        vplData.resize(2 * (size_t)maxVPLs);
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+    init();
+    auto t1 = CpuTimer::getCurrentTimePoint();
+    computeBounds(vplData);
+    computeCodes(vplData);
+    auto t2 = CpuTimer::getCurrentTimePoint();
+    sortCodes();
+    auto t3 = CpuTimer::getCurrentTimePoint();
+    assignLeafIndex();
+    auto t4 = CpuTimer::getCurrentTimePoint();
+    internalNodes();
+    auto t5 = CpuTimer::getCurrentTimePoint();
+    mergeNodes(vplData);
+    auto t6 = CpuTimer::getCurrentTimePoint();
+
+    mTimings.init            = CpuTimer::calcDuration(t0, t1);
+    mTimings.computeCodes    = CpuTimer::calcDuration(t1, t2);
+    mTimings.sortCodes       = CpuTimer::calcDuration(t2, t3);
+    mTimings.assignLeafIndex = CpuTimer::calcDuration(t3, t4);
+    mTimings.internalNodes   = CpuTimer::calcDuration(t4, t5);
+    mTimings.mergeNodes      = CpuTimer::calcDuration(t5, t6);
+    mTimings.total           = CpuTimer::calcDuration(t0, t6);
+
+    if (mDesc.enableRefit)
+        saveRefitState(vplData);
+
+    return true;
+}
+
+void HostTreeBuilder::init()
+{
+    const size_t numTotalNodes = getNumTotalNodes(mMaxVPLs);
+
+    mNodes.resize(numTotalNodes);
+    mMerge.resize(numTotalNodes);
+    // Only the codes of the current layout are kept
+    if (mLayout.use128Bit)
+    {
+        mCodes128.resize(mMaxVPLs);
+        std::vector<uint64_t>().swap(mCodes);
+    }
+    else
+    {
+        mCodes.resize(mMaxVPLs);
+        std::vector<Key128>().swap(mCodes128);
+    }
+
+    if (mNumFlags != numTotalNodes)
+    {
+        mpFlags.reset(new std::atomic<uint32_t>[numTotalNodes]);
+        mNumFlags = numTotalNodes;
+    }
+
+    parallelFor(0, numTotalNodes, [&](size_t i)
+    {
+        TreeNode& node = mNodes[i];
+        node.parent_idx = kInvalidIndex;
+        node.left_idx   = kInvalidIndex;
+        node.right_idx  = kInvalidIndex;
+        node.vpl_idx    = kInvalidIndex;
+        node.flag       = 0;
+        mpFlags[i].store(0, std::memory_order_relaxed);
+
+        mMerge[i].ApproxScore = float2(1.f, 0.f); // Normal score / Normal Z std
+    });
+}
+
+void HostTreeBuilder::computeBounds(const std::vector<VPLData>& vplData)
+{
+    mCodeMin = mDesc.minExtent;
+    mCodeMax = mDesc.maxExtent;
+    if (!mDesc.useTightBounds)
+        return;
+
+    // Min/max reduction over the valid VPLs
+    const size_t kChunkSize = 1 << 16;
+    const size_t numChunks = ((size_t)mMaxVPLs + kChunkSize - 1) / kChunkSize;
+    std::vector<float3> chunkMin(numChunks, float3(FLT_MAX));
+    std::vector<float3> chunkMax(numChunks, float3(-FLT_MAX));
+
+    parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+    {
+        const size_t begin = chunk * kChunkSize;
+        const size_t end = std::min(begin + kChunkSize, (size_t)mMaxVPLs);
+        float3 lower = float3(FLT_MAX);
+        float3 upper = float3(-FLT_MAX);
+        for (size_t i = begin; i < end; i++)
+        {
+            if (vplData[i].id < 0)
+                continue;
+            const float3 position = vplData[i].getPosW();
+            lower = min(lower, position);
+            upper = max(upper, position);
+        }
+        chunkMin[chunk] = lower;
+        chunkMax[chunk] = upper;
+    });
+
+    float3 lower = float3(FLT_MAX);
+    float3 upper = float3(-FLT_MAX);
+    for (size_t c = 0; c < numChunks; c++)
+    {
+        lower = min(lower, chunkMin[c]);
+        upper = max(upper, chunkMax[c]);
+    }
+
+    // Keep the extents if there are no valid VPLs
+    if (lower.x <= upper.x)
+    {
+        mCodeMin = lower;
+        mCodeMax = upper;
+    }
+}
+
+void HostTreeBuilder::computeCodes(const std::vector<VPLData>& vplData)
+{
+    const size_t kBatchSize = 4096;
+    const size_t numBatches = ((size_t)mMaxVPLs + kBatchSize - 1) / kBatchSize;
+
+    parallelForChunks(numBatches, [&](size_t batch, uint32_t)
+    {
+        const size_t begin = batch * kBatchSize;
+        const size_t count = std::min(kBatchSize, (size_t)mMaxVPLs - begin);
+        if (mLayout.use128Bit)
+        {
+            computeCodesBatch(&vplData[begin], count, mCodeMin, mCodeMax, mDesc.numSphereSections,
+                mLayout, &mCodes128[begin], mDesc.useSimd, mDesc.pDirCodeLUT.get());
+        }
+        else
+        {
+            computeCodesBatch(&vplData[begin], count, mCodeMin, mCodeMax, mDesc.numSphereSections,
+                mLayout, &mCodes[begin], mDesc.useSimd, mDesc.pDirCodeLUT.get());
+        }
+    });
+}
+
+void HostTreeBuilder::sortCodes()
+{
+    // Invalid codes are all equal and end up at the back anyway. Move them out of the way
+    // so that the unused upper id bits of the valid codes are skipped by the radix sort.
+    if (mLayout.use128Bit)
+    {
+        const auto validEnd = std::partition(mCodes128.begin(), mCodes128.end(), [](const Key128& code) { return code != kInvalidCode128; });
+        const uint32_t numValidCodes = (uint32_t)(validEnd - mCodes128.begin());
+
+        mpRadixSort->execute(mCodes128, numValidCodes, int2(127, 0));
+        return;
+    }
+
+    const auto validEnd = std::partition(mCodes.begin(), mCodes.end(), [](uint64_t code) { return code != kInvalidCode; });
+    const uint32_t numValidCodes = (uint32_t)(validEnd - mCodes.begin());
+
+    mpRadixSort->execute(mCodes, numValidCodes, int2(63, 0));
+}
+
+void HostTreeBuilder::assignLeafIndex()
+{
+    const uint32_t numInternalNodes = getNumInternalNodes(mMaxVPLs);
+    const uint64_t idMask = getBitMask(mLayout.numIdBits);
+
+    parallelFor(0, mMaxVPLs, [&](size_t i)
+    {
+        // The id is in the low word of 128bit codes
+        const bool invalid = mLayout.use128Bit ? mCodes128[i] == kInvalidCode128 : mCodes[i] == kInvalidCode;
+        if (invalid) // Invalid VPL!
+            return;
+        const uint64_t m64 = mLayout.use128Bit ? mCodes128[i].lo : mCodes[i];
+
+        // Assign vpl index to leaf node (node buffer : [internal nodes, leaf nodes])
+        mNodes[i + numInternalNodes].vpl_idx = (uint32_t)((m64 >> mLayout.beginId) & idMask);
+    });
+}
+
+void HostTreeBuilder::internalNodes()
+{
+    const int numObjects = mNumVPLs;
+    const uint32_t maxVPLs = mMaxVPLs;
+
+    auto buildNodes = [&](const auto* codes)
+    {
+        parallelFor(0, (size_t)std::max(0, numObjects - 1), [&](size_t i)
+        {
+            const int idx = (int)i;
+            TreeNode& node = mNodes[idx];
+
+            node.vpl_idx = maxVPLs + idx; // assign internal node storage
+            const uint2 ij = determine_range(codes, numObjects, idx);
+            const uint32_t gamma = find_split(codes, ij.x, ij.y);
+
+            node.left_idx  = gamma;
+            node.right_idx = gamma + 1;
+
+            if (std::min(ij.x, ij.y) == gamma)
+                node.left_idx += maxVPLs - 1;
+            if (std::max(ij.x, ij.y) == gamma + 1)
+                node.right_idx += maxVPLs - 1;
+
+            // Every node has exactly one parent, so these writes never collide.
+            mNodes[node.left_idx].parent_idx  = idx;
+            mNodes[node.right_idx].parent_idx = idx;
+        });
+    };
+
+    if (mLayout.use128Bit)
+        buildNodes(mCodes128.data());
+    else
+        buildNodes(mCodes.data());
+}
+
+void HostTreeBuilder::mergeNodes(std::vector<VPLData>& vplData)
+{
+    const uint32_t numInternalNodes = getNumInternalNodes(mMaxVPLs);
+
+    // A single VPL has no internal nodes. Copy it to the root so that the sampler finds it.
+    if (mNumVPLs == 1)
+    {
+        const uint32_t leafVplId = mNodes[numInternalNodes].vpl_idx;
+        vplData[mMaxVPLs] = vplData[leafVplId];
+        return;
+    }
+
+    parallelFor(0, mMaxVPLs, [&](size_t i)
+    {
+        const uint32_t idx = (uint32_t)i + numInternalNodes;
+
+        uint32_t parent = mNodes[idx].parent_idx;
+        if (parent == kInvalidIndex) // invalid leaf
+            return;
+
+        uint32_t lhsNodeId = idx;
+        bool firstMerge = true;
+        VPLData  lhs;
+        VPLMerge lhsMerge;
+
+        while (parent != kInvalidIndex)
+        {
+            // The first thread to arrive waits for the other child (see TreeMergeNodes.cs.slang).
+            if (mpFlags[parent].fetch_add(1, std::memory_order_acq_rel) == 0)
+                return;
+
+            const uint32_t lidx = mNodes[parent].left_idx;
+            const uint32_t ridx = mNodes[parent].right_idx;
+
+            // Like the shader the first merge starts at the left child, afterwards the
+            // merged node of this thread is used as left-hand-side.
+            if (firstMerge)
+            {
+                lhsNodeId = lidx;
+                lhs       = vplData[mNodes[lidx].vpl_idx];
+                lhsMerge  = mMerge[mNodes[lidx].vpl_idx];
+                firstMerge = false;
+            }
+
+            const uint32_t rhsNodeId = (lhsNodeId != ridx) ? ridx : lidx;
+            const uint32_t rhsVplId  = mNodes[rhsNodeId].vpl_idx;
+            const uint32_t parentVplId = mNodes[parent].vpl_idx;
+
+            VPLData  rhs      = vplData[rhsVplId];
+            VPLMerge rhsMerge = mMerge[rhsVplId];
+
+            // The merge is not symmetric (normal lerp, child order), merge in tree order so the thread that arrives second doesn't matter
+            if (mDesc.deterministic && lhsNodeId != lidx)
+            {
+                std::swap(lhs, rhs);
+                std::swap(lhsMerge, rhsMerge);
+            }
+
+            VPLMerge mergeData;
+            const VPLData merged = mergeVPLData(lhs, rhs, lhsMerge, rhsMerge, parentVplId, mDesc.approxParams, mergeData);
+
+            vplData[parentVplId] = merged;
+            mMerge[parentVplId]  = mergeData;
+
+            lhs       = merged;
+            lhsMerge  = mergeData;
+            lhsNodeId = parent;
+
+            parent = mNodes[parent].parent_idx;
+        }
+    });
+}
+
+DeterministicBuildCheck checkDeterministicBuild(const HashedBuildFunc& build, uint32_t numBuilds, const std::string& name)
+{
+    DeterministicBuildCheck result;
+
+    // [0] default, [1] deterministic builds
+    std::set<uint64_t> hashes[2];
+    double time[2] = { 0.0, 0.0 };
+    for (int m = 0; m < 2; m++)
+    {
+        for (uint32_t b = 0; b < numBuilds; b++)
+        {
+            const auto t0 = CpuTimer::getCurrentTimePoint();
+            uint64_t hash = 0;
+            if (!build(m == 1, hash))
+            {
+                logWarning("checkDeterministicBuild: " + name + " build failed, invalid");
+                return result;
+            }
+            time[m] += CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+
+            if (m == 1 && b == 0) result.hash = hash;
+            hashes[m].insert(hash);
+        }
+    }
+
+    result.numBuilds = numBuilds;
+    result.numHashes = (uint32_t)hashes[1].size();
+    result.numDefaultHashes = (uint32_t)hashes[0].size();
+    result.time = numBuilds > 0 ? (float)(time[1] / numBuilds) : 0.f;
+    result.defaultTime = numBuilds > 0 ? (float)(time[0] / numBuilds) : 0.f;
+    result.valid = result.numHashes == 1;
+
+    std::stringstream hashString;
+    hashString << "0x" << std::hex << result.hash;
+    const std::string message = "checkDeterministicBuild: " + std::to_string(numBuilds) + " " + name + " builds, " + std::to_string(result.numHashes) + " distinct hashes (default "
+        + std::to_string(result.numDefaultHashes) + "), hash " + hashString.str() + ", " + std::to_string(result.time) + " ms per build (default " + std::to_string(result.defaultTime) + " ms)";
+    if (result.valid)
+        logInfo(message);
+    else
+        logWarning(message + ", invalid");
+    return result;
+}
+
+DeterministicBuildCheck checkDeterministicBuild(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, uint32_t numBuilds)
+{
+    HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+    std::vector<VPLData> tree;
+
+    auto build = [&](bool deterministic, uint64_t& hash)
+    {
+        HostTreeBuilder::Desc buildDesc = desc;
+        buildDesc.deterministic = deterministic;
+        buildDesc.enableRefit = false;
+
+        tree = vplData;
+        if (!pBuilder->build(buildDesc, tree, numVPLs, maxVPLs))
+            return false;
+        hash = hashTreeCacheBytes(tree.data(), tree.size() * sizeof(VPLData));
+        return true;
+    };
+    return checkDeterministicBuild(build, numBuilds, "host");
+}
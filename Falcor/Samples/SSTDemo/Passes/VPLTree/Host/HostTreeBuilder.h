@@ -0,0 +1,217 @@
+#pragma once
+
+#include "Falcor.h"
+#include <atomic>
+#include <functional>
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostRadixSort.h"
+#include "HostDirectionCodeLUT.h"
+#include "HostCodes.h"
+
+using namespace Falcor;
+
+
+/** Multithreaded host implementation of the SST build in VPLTree::onFrameRender.
+    Runs the same stages as the compute pipeline (TreeInit, TreeCode, sort, TreeAssignLeafIndex,
+    TreeInternalNodes, TreeMergeNodes) and writes the same TreeNode/VPLData layout:
+    - nodes:   [internal nodes (maxVPLs - 1), leaf nodes (maxVPLs)]
+    - vplData: [leaves (maxVPLs), internal nodes (maxVPLs - 1)], root at index maxVPLs.
+*/
+class HostTreeBuilder : public std::enable_shared_from_this<HostTreeBuilder>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostTreeBuilder>;
+    using SharedConstPtr = std::shared_ptr<const HostTreeBuilder>;
+    virtual ~HostTreeBuilder() = default;
+
+    /** Build parameters. Mirrors the state of the VPLTree pass.
+    */
+    struct Desc
+    {
+        uint32_t numSphereSections = 3;
+        uint3 mortonBits = uint3(10);     ///< Morton code bits per axis, see computeTreeCodeLayout().
+        TreeApproxParams approxParams;
+        float3 minExtent = float3(0.f);   ///< Lower corner of the volume used for the morton codes.
+        float3 maxExtent = float3(1.f);   ///< Upper corner of the volume used for the morton codes.
+        bool useTightBounds = true;       ///< Compute the morton codes in the bounds of the valid VPLs instead of the extents.
+        bool force128BitCodes = false;    ///< Use 128bit codes even if the 64bit codes fit maxVPLs.
+        bool useSimd = true;              ///< Use the AVX2 code kernels if supported.
+        HostDirectionCodeLUT::SharedConstPtr pDirCodeLUT;   ///< Optional direction code table. Must match numSphereSections.
+        bool enableRefit = false;         ///< Keep the state needed by refit() after a build.
+        float maxRefitCostRatio = 1.25f;  ///< Refit fails if the tree cost grows beyond this factor of the last build.
+        uint32_t maxRefits = 64;          ///< Refit fails after this many refits without a full build.
+        bool deterministic = false;       ///< Merge every node as (left child, right child), so the result doesn't depend on the thread order. See DETERMINISTIC_BUILD.
+    };
+
+    /** Time in milliseconds spent in each stage of the last build.
+    */
+    struct Timings
+    {
+        float init = 0.f;
+        float computeCodes = 0.f;       ///< Includes the bounds reduction.
+        float sortCodes = 0.f;
+        float assignLeafIndex = 0.f;
+        float internalNodes = 0.f;
+        float mergeNodes = 0.f;
+        float total = 0.f;
+    };
+
+    /** Statistics of the last refit.
+    */
+    struct RefitStats
+    {
+        uint32_t numDirtyLeaves = 0;
+        uint32_t numUpdatedNodes = 0;
+        uint32_t numRefits = 0;       ///< Number of refits since the last full build.
+        float costRatio = 1.f;        ///< Tree cost relative to the last full build, see computeTreeCost().
+        float time = 0.f;             ///< Time in milliseconds.
+    };
+
+    /** Create a new host tree builder.
+    */
+    static SharedPtr create();
+
+    /** Builds the SST in-place.
+        \param[in] desc Build parameters.
+        \param[in,out] vplData VPL buffer as written by the VPL tracer. Leaves must be stored at their id. Resized to 2 * maxVPLs if smaller.
+        \param[in] numVPLs Number of valid VPLs (VPLStats::numVPLs).
+        \param[in] maxVPLs Capacity of the leaf range. Determines the node layout.
+        \return True if successful, false if the input is invalid.
+    */
+    bool build(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs);
+
+    /** Updates the tree in-place for changed VPLs. Keeps the leaf order and topology of the last build
+        and only recomputes the merged nodes on the paths from the changed leaves to the root.
+        \param[in] desc Build parameters. Only the approximation parameters and the refit limits are used.
+        \param[in,out] vplData VPL buffer of the last build with updated leaves.
+        \param[in] numVPLs Number of valid VPLs. Must match the last build.
+        \param[in] maxVPLs Capacity of the leaf range. Must match the last build.
+        \return True if successful. False if a full build is required (no refit state, changed set of
+            valid VPLs or degraded tree quality). The vplData is undefined in this case.
+    */
+    bool refit(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs);
+
+    /** Returns the sum of intensity * AABB half area over all internal nodes, relative to the root.
+        Lower is better. Used to detect when refitting degrades the tree.
+    */
+    float computeTreeCost(const std::vector<VPLData>& vplData) const;
+
+    const std::vector<TreeNode>& getNodes() const { return mNodes; }
+    const std::vector<VPLMerge>& getMerge() const { return mMerge; }
+    const std::vector<uint64_t>& getCodes() const { return mCodes; }
+    const std::vector<Key128>& getCodes128() const { return mCodes128; }
+    const TreeCodeLayout& getCodeLayout() const { return mLayout; }
+    const float3& getCodeMin() const { return mCodeMin; }
+    const float3& getCodeMax() const { return mCodeMax; }
+    const Timings& getTimings() const { return mTimings; }
+    const RefitStats& getRefitStats() const { return mRefitStats; }
+
+    /** Returns the bytes of the build and refit buffers, without the VPL data.
+    */
+    size_t getMemoryUsage() const
+    {
+        return mNodes.capacity() * sizeof(TreeNode) + mMerge.capacity() * sizeof(VPLMerge) + mCodes.capacity() * sizeof(uint64_t) + mCodes128.capacity() * sizeof(Key128)
+            + mNumFlags * sizeof(std::atomic<uint32_t>) + mPrevLeaves.capacity() * sizeof(VPLData) + mLeafNodes.capacity() * sizeof(uint32_t)
+            + mDirtyLeaves.capacity() + (mpRadixSort ? mpRadixSort->getMemoryUsage() : 0);
+    }
+
+protected:
+    HostTreeBuilder();
+
+    void init();
+    void computeBounds(const std::vector<VPLData>& vplData);
+    void computeCodes(const std::vector<VPLData>& vplData);
+    void sortCodes();
+    void assignLeafIndex();
+    void internalNodes();
+    void mergeNodes(std::vector<VPLData>& vplData);
+    void saveRefitState(const std::vector<VPLData>& vplData);
+
+    // Build state
+    Desc mDesc;
+    int mNumVPLs = 0;
+    int mMaxVPLs = 0;
+
+    TreeCodeLayout mLayout;
+    float3 mCodeMin = float3(0.f);       ///< Volume the morton codes of the last build were computed in.
+    float3 mCodeMax = float3(1.f);
+
+    // Build buffers
+    std::vector<TreeNode> mNodes;
+    std::vector<VPLMerge> mMerge;
+    std::vector<uint64_t> mCodes;        ///< Sorted codes of 64bit layouts.
+    std::vector<Key128> mCodes128;       ///< Sorted codes of 128bit layouts.
+    std::unique_ptr<std::atomic<uint32_t>[]> mpFlags;
+    size_t mNumFlags = 0;
+
+    Timings mTimings;
+
+    // Refit state
+    bool mHasRefitState = false;
+    std::vector<VPLData> mPrevLeaves;    ///< Leaves of the last build/refit, indexed by VPL id.
+    std::vector<uint32_t> mLeafNodes;    ///< Leaf node index of every VPL id.
+    std::vector<uint8_t> mDirtyLeaves;
+    float mBuildCost = 0.f;
+    RefitStats mRefitStats;
+
+    HostRadixSort::SharedPtr mpRadixSort;
+};
+
+/** Result of benchmarkRefit() for one fraction of changed VPLs.
+*/
+struct RefitBenchmarkResult
+{
+    float dirtyFraction = 0.f;
+    float refitTime = 0.f;      ///< Average refit time in milliseconds.
+    float buildTime = 0.f;      ///< Average full build time in milliseconds.
+    float costRatio = 0.f;      ///< Average tree cost after the refit relative to the build before.
+};
+
+/** Compares the refit against a full build. Moves 0.1% to 100% of the valid VPLs and times both paths.
+    \param[in] desc Build parameters.
+    \param[in] vplData VPL buffer as written by the VPL tracer.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numRuns Number of runs per fraction.
+    \return One result per fraction. Results are logged.
+*/
+std::vector<RefitBenchmarkResult> benchmarkRefit(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, uint32_t numRuns = 5);
+
+/** Result of checkDeterministicBuild().
+*/
+struct DeterministicBuildCheck
+{
+    bool valid = false;             ///< All deterministic builds produced the same bytes.
+    uint32_t numBuilds = 0;         ///< Builds per mode.
+    uint32_t numHashes = 0;         ///< Distinct hashes of the deterministic builds, 1 if the build is reproducible.
+    uint32_t numDefaultHashes = 0;  ///< Distinct hashes of the default builds, for comparison.
+    uint64_t hash = 0;              ///< Hash of the first deterministic build.
+    float time = 0.f;               ///< Average time of a deterministic and of a default build in milliseconds.
+    float defaultTime = 0.f;
+};
+
+/** Builds a tree and returns the hash of the result.
+    \param[in] deterministic Build with Desc::deterministic or DETERMINISTIC_BUILD.
+    \param[out] hash Hash of the built VPL data, see hashTreeCacheBytes().
+    \return True if successful.
+*/
+using HashedBuildFunc = std::function<bool(bool deterministic, uint64_t& hash)>;
+
+/** Builds numBuilds times without and then numBuilds times with the deterministic mode and counts the distinct hashes.
+    The deterministic builds must all have the same hash.
+    \param[in] build Host or GPU build.
+    \param[in] numBuilds Number of builds per mode.
+    \param[in] name Name of the build in the log.
+    \return Check result, also logged.
+*/
+DeterministicBuildCheck checkDeterministicBuild(const HashedBuildFunc& build, uint32_t numBuilds, const std::string& name);
+
+/** Runs checkDeterministicBuild() with the host builder.
+    \param[in] desc Build parameters.
+    \param[in] vplData VPL buffer as written by the VPL tracer.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numBuilds Number of builds per mode.
+*/
+DeterministicBuildCheck checkDeterministicBuild(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, uint32_t numBuilds = 100);
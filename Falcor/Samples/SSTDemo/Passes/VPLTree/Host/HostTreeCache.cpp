@@ -0,0 +1,179 @@
+// On-disk SST cache, see HostTreeCache.h
+
+#include "HostTreeCache.h"
+#include <fstream>
+
+#if defined(_WIN32)
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    inline uint64_t alignUp(uint64_t value, uint64_t alignment)
+    {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+
+    bool writePadding(std::ofstream& file, uint64_t offset)
+    {
+        static const char kZeros[kTreeCacheAlignment] = {};
+        const uint64_t size = offset - (uint64_t)file.tellp();
+        file.write(kZeros, (std::streamsize)size);
+        return file.good();
+    }
+}
+
+uint64_t hashTreeCacheBytes(const void* pData, size_t size, uint64_t hash)
+{
+    const uint8_t* pBytes = (const uint8_t*)pData;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= pBytes[i];
+        hash *= 0x100000001b3ull;
+    }
+    return hash;
+}
+
+bool writeTreeCache(const std::string& filename, TreeCacheHeader header, const std::vector<VPLData>& vplData, const std::vector<TreeNode>& nodes)
+{
+    header.magic          = kTreeCacheMagic;
+    header.version        = kTreeCacheVersion;
+    header.headerSize     = sizeof(TreeCacheHeader);
+    header.vplDataStride  = sizeof(VPLData);
+    header.treeNodeStride = sizeof(TreeNode);
+    header.vplDataCount   = vplData.size();
+    header.treeNodeCount  = nodes.size();
+    header.vplDataOffset  = alignUp(sizeof(TreeCacheHeader), kTreeCacheAlignment);
+    header.treeNodeOffset = alignUp(header.vplDataOffset + vplData.size() * sizeof(VPLData), kTreeCacheAlignment);
+    header.fileSize       = header.treeNodeOffset + nodes.size() * sizeof(TreeNode);
+    header.payloadHash    = hashTreeCacheBytes(nodes.data(), nodes.size() * sizeof(TreeNode), hashTreeCacheBytes(vplData.data(), vplData.size() * sizeof(VPLData)));
+
+    const std::string tempFilename = filename + ".tmp";
+    {
+        std::ofstream file(tempFilename, std::ios::binary | std::ios::trunc);
+        if (!file)
+        {
+            logWarning("TreeCache: Can't open '" + tempFilename + "' for writing.");
+            return false;
+        }
+
+        file.write((const char*)&header, sizeof(TreeCacheHeader));
+        writePadding(file, header.vplDataOffset);
+        file.write((const char*)vplData.data(), (std::streamsize)(vplData.size() * sizeof(VPLData)));
+        writePadding(file, header.treeNodeOffset);
+        file.write((const char*)nodes.data(), (std::streamsize)(nodes.size() * sizeof(TreeNode)));
+        if (!file.good())
+        {
+            logWarning("TreeCache: Writing '" + tempFilename + "' failed.");
+            file.close();
+            std::remove(tempFilename.c_str());
+            return false;
+        }
+    }
+
+    // rename() does not replace existing files on Windows
+    std::remove(filename.c_str());
+    if (std::rename(tempFilename.c_str(), filename.c_str()) != 0)
+    {
+        logWarning("TreeCache: Can't rename '" + tempFilename + "' to '" + filename + "'.");
+        return false;
+    }
+    return true;
+}
+
+MappedTreeCache::~MappedTreeCache()
+{
+#if defined(_WIN32)
+    if (mpData) UnmapViewOfFile(mpData);
+    if (mMapping) CloseHandle(mMapping);
+    if (mFile && mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+#else
+    if (mpData) munmap((void*)mpData, mSize);
+    if (mFile >= 0) close(mFile);
+#endif
+}
+
+MappedTreeCache::SharedPtr MappedTreeCache::open(const std::string& filename)
+{
+    SharedPtr pCache = SharedPtr(new MappedTreeCache());
+    pCache->mFilename = filename;
+
+#if defined(_WIN32)
+    pCache->mFile = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER fileSize = {};
+    if (pCache->mFile == INVALID_HANDLE_VALUE || !GetFileSizeEx(pCache->mFile, &fileSize))
+    {
+        logWarning("TreeCache: Can't open '" + filename + "'.");
+        return nullptr;
+    }
+    pCache->mSize = (size_t)fileSize.QuadPart;
+    if (pCache->mSize >= sizeof(TreeCacheHeader))
+    {
+        pCache->mMapping = CreateFileMappingA(pCache->mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (pCache->mMapping)
+            pCache->mpData = (const uint8_t*)MapViewOfFile(pCache->mMapping, FILE_MAP_READ, 0, 0, 0);
+    }
+#else
+    pCache->mFile = ::open(filename.c_str(), O_RDONLY);
+    struct stat fileStat = {};
+    if (pCache->mFile < 0 || fstat(pCache->mFile, &fileStat) != 0)
+    {
+        logWarning("TreeCache: Can't open '" + filename + "'.");
+        return nullptr;
+    }
+    pCache->mSize = (size_t)fileStat.st_size;
+    if (pCache->mSize >= sizeof(TreeCacheHeader))
+    {
+        void* pData = mmap(nullptr, pCache->mSize, PROT_READ, MAP_PRIVATE, pCache->mFile, 0);
+        if (pData != MAP_FAILED)
+            pCache->mpData = (const uint8_t*)pData;
+    }
+#endif
+
+    if (!pCache->mpData)
+    {
+        logWarning("TreeCache: Can't map '" + filename + "'.");
+        return nullptr;
+    }
+
+    // Only the header is read, the sections are paged in by the upload
+    const TreeCacheHeader& header = pCache->getHeader();
+    std::string error;
+    if (header.magic != kTreeCacheMagic)
+        error = "not a tree cache";
+    else if (header.version != kTreeCacheVersion)
+        error = "version " + std::to_string(header.version) + ", expected " + std::to_string(kTreeCacheVersion);
+    else if (header.headerSize != sizeof(TreeCacheHeader) || header.vplDataStride != sizeof(VPLData) || header.treeNodeStride != sizeof(TreeNode))
+        error = "written with different data layouts";
+    else if (header.fileSize != pCache->mSize)
+        error = "file size does not match the header, the file is truncated";
+    else if (header.vplDataOffset % kTreeCacheAlignment != 0 || header.treeNodeOffset % kTreeCacheAlignment != 0 ||
+             header.vplDataOffset < sizeof(TreeCacheHeader) || header.vplDataOffset + header.vplDataCount * sizeof(VPLData) > header.treeNodeOffset ||
+             header.treeNodeOffset + header.treeNodeCount * sizeof(TreeNode) > header.fileSize)
+        error = "invalid sections";
+    else if (header.maxVPLs <= 0 || header.vplDataCount < 2 * (uint64_t)header.maxVPLs || header.treeNodeCount != getNumTotalNodes(header.maxVPLs))
+        error = "section sizes do not match maxVPLs";
+
+    if (!error.empty())
+    {
+        logWarning("TreeCache: '" + filename + "' is invalid: " + error + ".");
+        return nullptr;
+    }
+    return pCache;
+}
+
+bool MappedTreeCache::verify() const
+{
+    const uint64_t hash = hashTreeCacheBytes(getTreeNodes(), getTreeNodesSize(), hashTreeCacheBytes(getVPLData(), getVPLDataSize()));
+    if (hash != getHeader().payloadHash)
+    {
+        logWarning("TreeCache: Payload hash of '" + mFilename + "' does not match, the file is corrupt.");
+        return false;
+    }
+    return true;
+}
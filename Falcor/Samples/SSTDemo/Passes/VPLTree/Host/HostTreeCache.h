@@ -0,0 +1,109 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+
+using namespace Falcor;
+
+
+/** On-disk cache of a built SST for static lighting.
+    The file is a fixed size header followed by the VPL data array (gVPLData, leaves and internal nodes) and the
+    TreeNode array (gNodes). Both sections start at a multiple of kTreeCacheAlignment and are stored exactly like
+    in the GPU buffers, so a mapped file is uploaded with one setBlob() per buffer and never parsed per element.
+    Files are only valid for the build that wrote them: the version, the element sizes and the scene hash must match.
+*/
+
+static const uint32_t kTreeCacheMagic     = 0x43545353;    // "SSTC"
+static const uint32_t kTreeCacheVersion   = 3;
+static const uint64_t kTreeCacheAlignment = 4096;          // Page size, sections are mapped page aligned
+
+struct TreeCacheHeader
+{
+    uint32_t magic = kTreeCacheMagic;
+    uint32_t version = kTreeCacheVersion;
+    uint32_t headerSize = 0;                ///< sizeof(TreeCacheHeader)
+    uint32_t vplDataStride = 0;             ///< sizeof(VPLData)
+    uint32_t treeNodeStride = 0;            ///< sizeof(TreeNode)
+    int32_t maxVPLs = 0;                    ///< Capacity of the leaf range, the root is at maxVPLs.
+    uint32_t numSphereSections = 0;         ///< Direction code parameter of the build.
+    uint32_t use128BitCodes = 0;            ///< Code width of the build, see TreeCodeLayout.
+    uint3 mortonBits = uint3(0);            ///< Morton code bits per axis of the build.
+    uint32_t useTightBounds = 0;            ///< The morton codes were computed in the bounds of the valid VPLs instead of the scene bounds.
+
+    uint64_t sceneHash = 0;                 ///< See VPLTree, geometry and lights the VPLs were traced in.
+    uint64_t payloadHash = 0;               ///< FNV-1a of both sections, see MappedTreeCache::verify().
+    uint64_t fileSize = 0;
+    uint64_t vplDataOffset = 0;             ///< Byte offset of the VPL data array.
+    uint64_t vplDataCount = 0;
+    uint64_t treeNodeOffset = 0;            ///< Byte offset of the TreeNode array.
+    uint64_t treeNodeCount = 0;
+
+    float3 sceneMin = float3(0.f);          ///< Scene bounds.
+    float pad1 = 0.f;
+    float3 sceneMax = float3(0.f);
+    float pad2 = 0.f;
+    float3 codeMin = float3(0.f);           ///< Volume the morton codes were computed in, see HostTreeBuilder::getCodeMin().
+    float pad3 = 0.f;
+    float3 codeMax = float3(0.f);
+    float pad4 = 0.f;
+    TreeApproxParams approxParams;
+    VPLStats stats;
+};
+
+/** 64 bit FNV-1a hash.
+    \param[in] pData Bytes to hash.
+    \param[in] size Number of bytes.
+    \param[in] hash Hash to continue, the offset basis for a new hash.
+*/
+uint64_t hashTreeCacheBytes(const void* pData, size_t size, uint64_t hash = 0xcbf29ce484222325ull);
+
+/** Writes a cache file. The sections, offsets, sizes and the payload hash of the header are filled in.
+    The file is written to a temporary file first and renamed, so readers never see a partial file.
+    \param[in] filename File to write.
+    \param[in] header Build parameters, scene hash and stats.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] nodes TreeNode array of the build.
+    \return True if successful.
+*/
+bool writeTreeCache(const std::string& filename, TreeCacheHeader header, const std::vector<VPLData>& vplData, const std::vector<TreeNode>& nodes);
+
+/** Read-only memory mapping of a cache file. The sections point into the mapping and stay valid as long as the object lives.
+*/
+class MappedTreeCache : public std::enable_shared_from_this<MappedTreeCache>
+{
+public:
+    using SharedPtr = std::shared_ptr<MappedTreeCache>;
+    using SharedConstPtr = std::shared_ptr<const MappedTreeCache>;
+    virtual ~MappedTreeCache();
+
+    /** Maps a cache file and validates the header against this build and the file size. Section data is not touched.
+        \param[in] filename File to map.
+        \return The mapping, or nullptr if the file is missing or invalid. Errors are logged.
+    */
+    static SharedPtr open(const std::string& filename);
+
+    /** Hashes both sections and compares against the header. Reads the whole file.
+    */
+    bool verify() const;
+
+    const TreeCacheHeader& getHeader() const { return *reinterpret_cast<const TreeCacheHeader*>(mpData); }
+    const VPLData* getVPLData() const { return reinterpret_cast<const VPLData*>(mpData + getHeader().vplDataOffset); }
+    const TreeNode* getTreeNodes() const { return reinterpret_cast<const TreeNode*>(mpData + getHeader().treeNodeOffset); }
+    size_t getVPLDataSize() const { return (size_t)getHeader().vplDataCount * sizeof(VPLData); }
+    size_t getTreeNodesSize() const { return (size_t)getHeader().treeNodeCount * sizeof(TreeNode); }
+    const std::string& getFilename() const { return mFilename; }
+
+protected:
+    MappedTreeCache() = default;
+
+    std::string mFilename;
+    const uint8_t* mpData = nullptr;
+    size_t mSize = 0;
+#if defined(_WIN32)
+    void* mFile = nullptr;
+    void* mMapping = nullptr;
+#else
+    int mFile = -1;
+#endif
+};
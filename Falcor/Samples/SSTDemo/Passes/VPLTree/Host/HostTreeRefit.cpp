@@ -0,0 +1,255 @@
+// Refit of the host SST. Keeps the topology of the last build, see HostTreeBuilder::refit().
+
+#include "HostTreeBuilder.h"
+#include "HostUtils.h"
+#include "HostMerge.h"
+#include <random>
+
+namespace
+{
+    const uint32_t kInvalidIndex = 0xFFFFFFFF;
+
+    inline bool isSameVPL(const VPLData& a, const VPLData& b)
+    {
+        return std::memcmp(&a, &b, sizeof(VPLData)) == 0;
+    }
+
+    inline float halfArea(const float3& aabbMin, const float3& aabbMax)
+    {
+        const float3 d = max(aabbMax - aabbMin, float3(0.f));
+        return d.x * d.y + d.y * d.z + d.z * d.x;
+    }
+}
+
+void HostTreeBuilder::saveRefitState(const std::vector<VPLData>& vplData)
+{
+    const uint32_t numInternalNodes = getNumInternalNodes(mMaxVPLs);
+    const size_t numTotalNodes = getNumTotalNodes(mMaxVPLs);
+
+    mPrevLeaves.assign(vplData.begin(), vplData.begin() + mMaxVPLs);
+    mLeafNodes.assign(mMaxVPLs, kInvalidIndex);
+    mDirtyLeaves.assign(mMaxVPLs, 0);
+
+    parallelFor(0, mMaxVPLs, [&](size_t i)
+    {
+        const uint32_t nodeIdx = numInternalNodes + (uint32_t)i;
+        const uint32_t vplIdx = mNodes[nodeIdx].vpl_idx;
+        if (vplIdx < (uint32_t)mMaxVPLs)
+            mLeafNodes[vplIdx] = nodeIdx;
+    });
+
+    // The refit counts the number of dirty children per node in the flags.
+    parallelFor(0, numTotalNodes, [&](size_t i)
+    {
+        mpFlags[i].store(0, std::memory_order_relaxed);
+    });
+
+    mBuildCost = computeTreeCost(vplData);
+    mRefitStats = RefitStats();
+    mHasRefitState = true;
+}
+
+bool HostTreeBuilder::refit(const Desc& desc, std::vector<VPLData>& vplData, int numVPLs, int maxVPLs)
+{
+    if (!mHasRefitState || numVPLs != mNumVPLs || maxVPLs != mMaxVPLs || vplData.size() < 2 * (size_t)maxVPLs)
+        return false;
+
+    if (mRefitStats.numRefits >= desc.maxRefits)
+    {
+        mHasRefitState = false;
+        return false;
+    }
+
+    mDesc.approxParams      = desc.approxParams;
+    mDesc.maxRefitCostRatio = desc.maxRefitCostRatio;
+    mDesc.maxRefits         = desc.maxRefits;
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+
+    // Find the changed leaves and count the dirty children of every node on their paths to the root.
+    std::atomic<bool> validSetChanged(false);
+    std::atomic<uint32_t> numDirtyLeaves(0);
+    std::atomic<uint32_t> numUpdatedNodes(0);
+
+    parallelFor(0, mMaxVPLs, [&](size_t i)
+    {
+        const VPLData& vpl = vplData[i];
+        const VPLData& prev = mPrevLeaves[i];
+        if ((vpl.id < 0) != (prev.id < 0) || (vpl.id >= 0 && mLeafNodes[i] == kInvalidIndex))
+        {
+            // A VPL appeared or disappeared, the leaf order is not valid anymore.
+            validSetChanged.store(true, std::memory_order_relaxed);
+            return;
+        }
+        if (vpl.id < 0 || isSameVPL(vpl, prev))
+            return;
+
+        mDirtyLeaves[i] = 1;
+        numDirtyLeaves.fetch_add(1, std::memory_order_relaxed);
+
+        uint32_t parent = mNodes[mLeafNodes[i]].parent_idx;
+        while (parent != kInvalidIndex)
+        {
+            // Stop if another leaf already marked the path above.
+            if (mpFlags[parent].fetch_add(1, std::memory_order_relaxed) != 0)
+                break;
+            numUpdatedNodes.fetch_add(1, std::memory_order_relaxed);
+            parent = mNodes[parent].parent_idx;
+        }
+    });
+
+    if (validSetChanged)
+    {
+        mHasRefitState = false;
+        return false;
+    }
+
+    // Merge bottom-up. The last dirty child to arrive at a node merges it, clean children are up to date.
+    parallelFor(0, mMaxVPLs, [&](size_t i)
+    {
+        if (!mDirtyLeaves[i])
+            return;
+
+        mDirtyLeaves[i] = 0;
+        mPrevLeaves[i] = vplData[i];
+
+        uint32_t parent = mNodes[mLeafNodes[i]].parent_idx;
+        while (parent != kInvalidIndex)
+        {
+            if (mpFlags[parent].fetch_sub(1, std::memory_order_acq_rel) != 1)
+                return;
+
+            const TreeNode& node = mNodes[parent];
+            const uint32_t lhsVplId = mNodes[node.left_idx].vpl_idx;
+            const uint32_t rhsVplId = mNodes[node.right_idx].vpl_idx;
+
+            VPLMerge mergeData;
+            vplData[node.vpl_idx] = mergeVPLData(vplData[lhsVplId], vplData[rhsVplId], mMerge[lhsVplId], mMerge[rhsVplId], node.vpl_idx, mDesc.approxParams, mergeData);
+            mMerge[node.vpl_idx] = mergeData;
+
+            parent = node.parent_idx;
+        }
+    });
+
+    // A single VPL has no internal nodes, see mergeNodes().
+    if (mNumVPLs == 1)
+    {
+        const uint32_t leafVplId = mNodes[getNumInternalNodes(mMaxVPLs)].vpl_idx;
+        vplData[mMaxVPLs] = vplData[leafVplId];
+    }
+
+    auto t1 = CpuTimer::getCurrentTimePoint();
+
+    mRefitStats.numDirtyLeaves  = numDirtyLeaves;
+    mRefitStats.numUpdatedNodes = numUpdatedNodes;
+    mRefitStats.numRefits++;
+    mRefitStats.costRatio = mBuildCost > 0.f ? computeTreeCost(vplData) / mBuildCost : 1.f;
+    mRefitStats.time = CpuTimer::calcDuration(t0, t1);
+
+    if (mRefitStats.costRatio > mDesc.maxRefitCostRatio)
+    {
+        mHasRefitState = false;
+        return false;
+    }
+    return true;
+}
+
+float HostTreeBuilder::computeTreeCost(const std::vector<VPLData>& vplData) const
+{
+    if (mNumVPLs < 2 || vplData.size() < 2 * (size_t)mMaxVPLs)
+        return 0.f;
+
+    const VPLData& root = vplData[mMaxVPLs];
+    const float rootCost = root.getIntensity() * halfArea(root.getAABBMin(), root.getAABBMax());
+    if (!(rootCost > 0.f))
+        return 0.f;
+
+    // Internal nodes are stored behind the leaves, see TreeInternalNodes.cs.slang.
+    const size_t numInternalNodes = (size_t)mNumVPLs - 1;
+    const size_t kChunkSize = 4096;
+    const size_t numChunks = (numInternalNodes + kChunkSize - 1) / kChunkSize;
+    std::vector<double> chunkCosts(numChunks, 0.0);
+
+    parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+    {
+        const size_t begin = chunk * kChunkSize;
+        const size_t end = std::min(begin + kChunkSize, numInternalNodes);
+        double cost = 0.0;
+        for (size_t i = begin; i < end; i++)
+        {
+            const VPLData& node = vplData[mMaxVPLs + i];
+            cost += (double)node.getIntensity() * halfArea(node.getAABBMin(), node.getAABBMax());
+        }
+        chunkCosts[chunk] = cost;
+    });
+
+    double cost = 0.0;
+    for (double c : chunkCosts) cost += c;
+    return (float)(cost / rootCost);
+}
+
+std::vector<RefitBenchmarkResult> benchmarkRefit(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, uint32_t numRuns)
+{
+    std::vector<RefitBenchmarkResult> results;
+    if (numVPLs <= 0 || numRuns == 0)
+        return results;
+
+    std::vector<uint32_t> validLeaves;
+    for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+        if (vplData[i].id >= 0) validLeaves.push_back(i);
+
+    HostTreeBuilder::Desc refitDesc = desc;
+    refitDesc.enableRefit = true;
+    refitDesc.maxRefits = ~0u;
+    refitDesc.maxRefitCostRatio = FLT_MAX;
+
+    HostTreeBuilder::Desc buildDesc = desc;
+    buildDesc.enableRefit = false;
+
+    HostTreeBuilder::SharedPtr pRefitBuilder = HostTreeBuilder::create();
+    HostTreeBuilder::SharedPtr pFullBuilder = HostTreeBuilder::create();
+    std::mt19937 rng(0);
+    const float3 jitter = (desc.maxExtent - desc.minExtent) * 0.01f;
+
+    for (float fraction : { 0.001f, 0.01f, 0.1f, 0.5f, 1.f })
+    {
+        const size_t numDirty = std::max<size_t>(1, (size_t)(fraction * validLeaves.size()));
+        RefitBenchmarkResult result;
+        result.dirtyFraction = fraction;
+
+        for (uint32_t run = 0; run < numRuns; run++)
+        {
+            std::vector<VPLData> refitData = vplData;
+            if (!pRefitBuilder->build(refitDesc, refitData, numVPLs, maxVPLs))
+                return results;
+
+            // Move a random subset of the VPLs.
+            std::shuffle(validLeaves.begin(), validLeaves.end(), rng);
+            for (size_t j = 0; j < numDirty; j++)
+            {
+                VPLData& vpl = refitData[validLeaves[j]];
+                const float3 offset = jitter * (float)(run + 1);
+                vpl.setPosW(vpl.getPosW() + offset);
+                vpl.setAABBMin(vpl.getAABBMin() + offset);
+                vpl.setAABBMax(vpl.getAABBMax() + offset);
+                vpl.setIntensity(vpl.getIntensity() * 1.05f);
+            }
+            std::vector<VPLData> buildData = refitData;
+
+            auto t0 = CpuTimer::getCurrentTimePoint();
+            pRefitBuilder->refit(refitDesc, refitData, numVPLs, maxVPLs);
+            auto t1 = CpuTimer::getCurrentTimePoint();
+            pFullBuilder->build(buildDesc, buildData, numVPLs, maxVPLs);
+            auto t2 = CpuTimer::getCurrentTimePoint();
+
+            result.refitTime += CpuTimer::calcDuration(t0, t1) / numRuns;
+            result.buildTime += CpuTimer::calcDuration(t1, t2) / numRuns;
+            result.costRatio += pRefitBuilder->getRefitStats().costRatio / numRuns;
+        }
+
+        logInfo("benchmarkRefit: " + std::to_string(numDirty) + " of " + std::to_string(validLeaves.size()) + " VPLs changed, refit "
+            + std::to_string(result.refitTime) + " ms, build " + std::to_string(result.buildTime) + " ms, cost ratio " + std::to_string(result.costRatio));
+        results.push_back(result);
+    }
+    return results;
+}
@@ -0,0 +1,435 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "HostMerge.h"
+#include "HostUtils.h"
+#include <functional>
+#include <random>
+
+/** Host port of the diffuse path of sampleVPLTree() in VPLSampling.rt.hlsl. Keep both files in sync!
+    Visibility is not evaluated, every VPL is considered visible.
+*/
+
+/** Receiver point. Subset of ShadingDataCompact used by the diffuse path.
+*/
+struct HostShadingPoint
+{
+    float3 posW = float3(0.f);
+    float3 N = float3(0.f, 0.f, 1.f);
+    float3 diffuse = float3(1.f);
+};
+
+/** Sampler parameters. Mirrors the constant buffer of the VPLSampling pass.
+*/
+struct HostSamplingParams
+{
+    float gMax = 10.f;
+    float attenuationEpsilon = 0.05f;
+    bool useOrientationCones = false;   ///< See USE_ORIENTATION_CONES.
+};
+
+/** Result of sampleVPLTreeHost().
+*/
+struct HostTreeSample
+{
+    float3 radiance = float3(0.f);  ///< Contribution divided by the sample probability.
+    float pdf = 0.f;                ///< Probability of the selected node.
+    uint32_t numSteps = 0;          ///< Number of traversal steps (inner nodes visited).
+    int nodeIdx = -1;               ///< Selected node in the VPL data array, -1 for a dead branch.
+    float3 posW = float3(0.f);      ///< Sampled position on the selected node, the origin of the shadow ray.
+};
+
+/** See wang_hash() in Random.slang.
+*/
+inline uint32_t wangHashHost(uint32_t seed)
+{
+    seed = (seed ^ 61u) ^ (seed >> 16);
+    seed *= 9u;
+    seed = seed ^ (seed >> 4);
+    seed *= 0x27d4eb2du;
+    seed = seed ^ (seed >> 15);
+    return seed;
+}
+
+/** See initRand() in Random.slang.
+*/
+inline uint32_t initRandHost(uint32_t val0, uint32_t val1, uint32_t backoff = 16)
+{
+    uint32_t v0 = val0, v1 = val1, s0 = 0;
+    for (uint32_t n = 0; n < backoff; n++)
+    {
+        s0 += 0x9e3779b9u;
+        v0 += ((v1 << 4) + 0xa341316cu) ^ (v1 + s0) ^ ((v1 >> 5) + 0xc8013ea4u);
+        v1 += ((v0 << 4) + 0xad90777du) ^ (v0 + s0) ^ ((v0 >> 5) + 0x7e95761eu);
+    }
+    return v0;
+}
+
+/** Random seed of a pixel, same as in rayGeneration() of VPLSampling.rt.hlsl.
+*/
+inline uint32_t getPixelSeedHost(uint32_t x, uint32_t y, uint32_t width, uint32_t frameCount)
+{
+    return initRandHost(wangHashHost(x + y * width), frameCount, 32);
+}
+
+/** See nextRand() in Random.slang.
+*/
+inline float nextRandHost(uint32_t& s)
+{
+    s = (1664525u * s + 1013904223u);
+    return float(s & 0x00FFFFFF) / float(0x01000000);
+}
+
+/** See nextNormal2() in Random.slang.
+*/
+inline float2 nextNormal2Host(const float2& mean, const float2& std, uint32_t& s)
+{
+    const float u0 = nextRandHost(s);
+    const float u1 = nextRandHost(s);
+    const float r = std::sqrt(-2.f * std::log(u0));
+    const float theta = 2.f * (float)M_PI * u1;
+    return float2(r * std::sin(theta) * std.x + mean.x, r * std::cos(theta) * std.y + mean.y);
+}
+
+/** See maxNdotAABB() in VPLUtils.h.
+*/
+inline float maxNdotAABBHost(const float3& P, const float3& N, const float3& aabbMin, const float3& aabbMax)
+{
+    const float kEpsilon = 0.001f;
+    if (aabbMin.x - kEpsilon < P.x && P.x < aabbMax.x + kEpsilon &&
+        aabbMin.y - kEpsilon < P.y && P.y < aabbMax.y + kEpsilon &&
+        aabbMin.z - kEpsilon < P.z && P.z < aabbMax.z + kEpsilon)
+        return 1.f;
+
+    float3 zAxis = float3(0.f, 0.f, 1.f);
+    const bool flipZ = dot(N, zAxis) < 0.f;
+    if (flipZ) zAxis.z = -zAxis.z;
+    float3 R[3];
+    getRotationRowsFromAToB(N, zAxis, R);
+
+    const float3 hS = (aabbMax - aabbMin) * 0.5f;
+    const float3 c = (aabbMin + hS) - P;
+    const float3 center = float3(dot(R[0], c), dot(R[1], c), dot(R[2], c));
+
+    float3 aabbTMin = float3(0.f);
+    float3 aabbTMax = float3(0.f);
+    for (int i = 0; i < 8; i++)
+    {
+        const float3 s = float3((i & 4) ? -hS.x : hS.x, (i & 2) ? -hS.y : hS.y, (i & 1) ? -hS.z : hS.z);
+        const float3 v = R[0] * s.x + R[1] * s.y + R[2] * s.z;
+        aabbTMin = min(aabbTMin, v);
+        aabbTMax = max(aabbTMax, v);
+    }
+    aabbTMin += center;
+    aabbTMax += center;
+
+    const float zMax = flipZ ? -std::min(aabbTMin.z, aabbTMax.z) : std::max(aabbTMin.z, aabbTMax.z);
+    if (zMax < 0.00001f)
+        return 0.f;
+
+    float xMin, yMin;
+    if ((aabbTMin.x < 0.f && aabbTMax.x > 0.f) || (aabbTMax.x < 0.f && aabbTMin.x > 0.f))
+        xMin = 0.f;
+    else
+        xMin = std::min(std::abs(aabbTMin.x), std::abs(aabbTMax.x));
+
+    if ((aabbTMin.y < 0.f && aabbTMax.y > 0.f) || (aabbTMax.y < 0.f && aabbTMin.y > 0.f))
+        yMin = 0.f;
+    else
+        yMin = std::min(std::abs(aabbTMin.y), std::abs(aabbTMax.y));
+
+    return zMax / length(float3(xMin, yMin, zMax));
+}
+
+/** See maxEmitterCosCone() in VPLUtils.h.
+*/
+inline float maxEmitterCosConeHost(const float3& P, const float3& axis, float coneAngle, const float3& aabbMin, const float3& aabbMax)
+{
+    const float3 center = (aabbMin + aabbMax) * 0.5f;
+    const float radius = length(aabbMax - aabbMin) * 0.5f;
+    const float3 d = P - center;
+    const float dist = length(d);
+    const float axisLength = length(axis);
+    if (dist <= radius || !(axisLength > 0.f))
+        return 1.f;
+
+    const float theta = std::acos(std::max(-1.f, std::min(1.f, dot(axis, d) / (axisLength * dist))));
+    const float angle = theta - coneAngle - std::asin(radius / dist);
+    if (angle <= 0.f)
+        return 1.f;
+    return angle < (float)M_PI * 0.5f ? std::cos(angle) : 0.f;
+}
+
+/** Diffuse contribution of a VPL at a receiver. See evalVPL() and evalDiffuse() in VPLShading.slang.
+*/
+inline float3 evalVPLDiffuseHost(const float3& vplPosW, const float3& vplNormW, const float3& vplColor, const HostShadingPoint& sp, float gMax)
+{
+    float3 L = vplPosW - sp.posW;
+    const float distSquared = dot(L, L);
+    L = (distSquared > 1e-5f) ? normalize(L) : float3(0.f);
+
+    const float NdotL = std::max(0.f, std::min(1.f, dot(sp.N, L)));
+    if (NdotL <= 0.f)
+        return float3(0.f);
+
+    const float falloff = 1.f / ((0.01f * 0.01f) + distSquared);
+    const float LdotLN = std::max(0.f, std::min(1.f, -dot(L, vplNormW)));
+    const float3 intensity = vplColor * std::min(LdotLN * falloff, gMax);
+    return intensity * NdotL * sp.diffuse * (float)M_1_PI;
+}
+
+/** Importance of a node for a receiver (w = M * A * I in sampleVPLTree()).
+    \param[in] emitterCos Bound of maxEmitterCosConeHost() if orientation cones are used, otherwise 1.
+*/
+inline float evalNodeWeightHost(const float3& aabbMin, const float3& aabbMax, const float3& posW, float intensity, const HostShadingPoint& sp, const HostSamplingParams& params, float emitterCos = 1.f)
+{
+    const float3 brdf = sp.diffuse * (float)M_1_PI;
+    const float M = std::max(dot(brdf, float3(0.299f, 0.587f, 0.114f)), 0.01f) * maxNdotAABBHost(sp.posW, sp.N, aabbMin, aabbMax) * emitterCos;
+    const float3 d = sp.posW - posW;
+    const float A = 1.f / std::max(dot(d, d), params.attenuationEpsilon);
+    return M * A * intensity;
+}
+
+inline float evalNodeWeightHost(const VPLData& vpl, const HostShadingPoint& sp, const HostSamplingParams& params)
+{
+    const float emitterCos = params.useOrientationCones
+        ? maxEmitterCosConeHost(sp.posW, vpl.getNormW(), vpl.getConeAngle(), vpl.getAABBMin(), vpl.getAABBMax()) : 1.f;
+    return evalNodeWeightHost(vpl.getAABBMin(), vpl.getAABBMax(), vpl.getPosW(), vpl.getIntensity(), sp, params, emitterCos);
+}
+
+/** See normalPointOnPlane() in VPLSampling.rt.hlsl.
+*/
+inline float3 normalPointOnPlaneHost(const float3& normW, const float3& posW, const float3& variance, const float3& aabbMin, const float3& aabbMax, uint32_t& randSeed)
+{
+    const float2 xy = nextNormal2Host(float2(0.f), float2(std::sqrt(variance.x), std::sqrt(variance.y)), randSeed);
+    float3 R[3];
+    getRotationRowsFromAToB(normW, float3(0.f, 0.f, 1.f), R);
+    return clamp(posW + R[0] * xy.x + R[1] * xy.y, aabbMin, aabbMax);
+}
+
+/** Samples a position on the plane of the selected node (see normalPointOnPlane()) and evaluates it.
+    \param[in] p Probability of the selected node.
+    \param[out] pSamplePosW If not null, receives the sampled position.
+*/
+inline float3 evalSelectedNodeHost(const float3& posW, const float3& normW, const float3& color, const float3& variance, const float3& aabbMin, const float3& aabbMax,
+    float p, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed, float3* pSamplePosW = nullptr)
+{
+    const float3 samplePosW = normalPointOnPlaneHost(normW, posW, variance, aabbMin, aabbMax, randSeed);
+    if (pSamplePosW) *pSamplePosW = samplePosW;
+    return p > 0.f ? evalVPLDiffuseHost(samplePosW, normW, color, sp, params.gMax) / p : float3(0.f);
+}
+
+inline float3 evalSelectedNodeHost(const VPLData& vpl, float p, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed, float3* pSamplePosW = nullptr)
+{
+    return evalSelectedNodeHost(vpl.getPosW(), vpl.getNormW(), vpl.getColor(), vpl.getVariance(), vpl.getAABBMin(), vpl.getAABBMax(), p, sp, params, randSeed, pSamplePosW);
+}
+
+/** Descends the SST from a start node, see sampleVPLTree().
+    \param[in] vplData VPL data array of the tree.
+    \param[in] startIdx Index of the first node, the root or a node of a tile cut.
+    \param[in] pStart Probability of starting at startIdx.
+    \param[in] r Random number of the traversal.
+    \param[in] sp Receiver.
+    \param[in] params Sampler parameters.
+    \param[in,out] randSeed Random seed, advanced like in the shader.
+*/
+inline HostTreeSample sampleVPLSubtreeHost(const std::vector<VPLData>& vplData, int startIdx, float pStart, float r, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed)
+{
+    HostTreeSample sample;
+    int parentIdx = startIdx;
+    float p = pStart;
+
+    const VPLData* pVpl = &vplData[parentIdx];
+    while (!(pVpl->getEarlyStop() > 0.f || pVpl->numVPLSubTree <= 0))
+    {
+        const int child1Id = pVpl->idChild1;
+        const int child2Id = pVpl->idChild2;
+        const float w1 = evalNodeWeightHost(vplData[child1Id], sp, params);
+        const float w2 = evalNodeWeightHost(vplData[child2Id], sp, params);
+        sample.numSteps++;
+
+        if (!(w1 + w2 > 0.f))
+            return sample; // Dead branch
+
+        const float p1 = w1 / (w1 + w2);
+        if (r <= p1)
+        {
+            p *= p1;
+            r = r / p1;
+            parentIdx = child1Id;
+        }
+        else
+        {
+            p *= 1.f - p1;
+            r = (r - p1) / (1.f - p1);
+            parentIdx = child2Id;
+        }
+        pVpl = &vplData[parentIdx];
+    }
+
+    sample.pdf = p;
+    sample.nodeIdx = parentIdx;
+    sample.radiance = evalSelectedNodeHost(*pVpl, p, sp, params, randSeed, &sample.posW);
+    return sample;
+}
+
+/** Takes one sample from the SST.
+    \param[in] vplData VPL data array of the tree.
+    \param[in] rootIndex Index of the root node (maxVPLs).
+    \param[in] sp Receiver.
+    \param[in] params Sampler parameters.
+    \param[in,out] randSeed Random seed, advanced like in the shader.
+*/
+inline HostTreeSample sampleVPLTreeHost(const std::vector<VPLData>& vplData, int rootIndex, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed)
+{
+    const float r = nextRandHost(randSeed);
+    return sampleVPLSubtreeHost(vplData, rootIndex, 1.f, r, sp, params, randSeed);
+}
+
+/** Places receivers slightly above random valid VPLs, facing along the VPL normal.
+    \param[in] offset Distance of the receivers to the VPLs.
+*/
+inline std::vector<HostShadingPoint> generateReceiversHost(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers, float offset, uint32_t seed = 0)
+{
+    std::vector<uint32_t> validLeaves;
+    for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+        if (vplData[i].id >= 0) validLeaves.push_back(i);
+
+    std::vector<HostShadingPoint> receivers;
+    if (validLeaves.empty())
+        return receivers;
+
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<size_t> pick(0, validLeaves.size() - 1);
+    receivers.resize(numReceivers);
+    for (HostShadingPoint& sp : receivers)
+    {
+        const VPLData& vpl = vplData[validLeaves[pick(rng)]];
+        const float3 N = vpl.getNormW();
+        sp.N = dot(N, N) > 0.f ? normalize(N) : float3(0.f, 1.f, 0.f);
+        sp.posW = vpl.getPosW() + sp.N * offset;
+    }
+    return receivers;
+}
+
+/** Square pixel grid in the tangent plane of a receiver, stands in for a screen tile that shows a single surface.
+*/
+struct HostPixelTile
+{
+    float3 origin = float3(0.f);    ///< Center of pixel (0, 0).
+    float3 dx = float3(0.f);        ///< Offset between neighbouring pixels.
+    float3 dy = float3(0.f);
+    float3 N = float3(0.f, 0.f, 1.f);
+
+    /** Centers a tile of tileSize x tileSize pixels with the given pixel pitch on a receiver.
+    */
+    static HostPixelTile create(const HostShadingPoint& center, uint32_t tileSize, float pitch)
+    {
+        float3 R[3];
+        getRotationRowsFromAToB(center.N, float3(0.f, 0.f, 1.f), R);
+        HostPixelTile tile;
+        tile.N = center.N;
+        tile.dx = R[0] * pitch;
+        tile.dy = R[1] * pitch;
+        tile.origin = center.posW - (tile.dx + tile.dy) * ((float)tileSize - 1.f) * 0.5f;
+        return tile;
+    }
+
+    HostShadingPoint getPixel(uint32_t x, uint32_t y) const
+    {
+        HostShadingPoint sp;
+        sp.posW = origin + dx * (float)x + dy * (float)y;
+        sp.N = N;
+        return sp;
+    }
+};
+
+/** Returns the luminance of the sum over all valid VPLs for every receiver.
+*/
+inline std::vector<float> computeReferenceHost(const std::vector<VPLData>& vplData, int maxVPLs, const std::vector<HostShadingPoint>& receivers, const HostSamplingParams& params)
+{
+    std::vector<float> reference(receivers.size(), 0.f);
+    parallelFor(0, receivers.size(), [&](size_t r)
+    {
+        float3 sum = float3(0.f);
+        for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+        {
+            const VPLData& vpl = vplData[i];
+            if (vpl.id >= 0)
+                sum += evalVPLDiffuseHost(vpl.getPosW(), vpl.getNormW(), vpl.getColor(), receivers[r], params.gMax);
+        }
+        reference[r] = luminance(sum);
+    }, 1);
+    return reference;
+}
+
+/** Seed of the random numbers of a receiver. The error measurements seed every receiver the same way, so estimators that
+    consume the same random numbers are compared on the same samples.
+*/
+inline uint32_t getReceiverSeedHost(size_t receiverIdx)
+{
+    return (uint32_t)receiverIdx * 0x9e3779b9u + 1u;
+}
+
+/** Takes one sample for a receiver.
+    \param[in] sp The receiver.
+    \param[in] receiverIdx Index of the receiver, receivers are processed in parallel but every receiver by a single thread.
+    \param[in,out] randSeed Random number state of the receiver.
+*/
+using HostSampleFunc = std::function<HostTreeSample(const HostShadingPoint& sp, size_t receiverIdx, uint32_t& randSeed)>;
+
+/** Result of estimateSamplingError().
+*/
+struct HostSamplingError
+{
+    float error = 0.f;      ///< Relative RMS error of the estimates, averaged over the receivers with a positive reference.
+    float avgSteps = 0.f;   ///< Mean HostTreeSample::numSteps per sample.
+};
+
+/** Measures the error of an estimator against computeReferenceHost(). Every receiver takes numEstimates estimates, each
+    the mean luminance of numSamples samples.
+    \param[in] sampler Sampler under test, sampleVPLTreeHost() with default parameters if empty.
+*/
+inline HostSamplingError estimateSamplingError(const std::vector<VPLData>& vplData, int maxVPLs, const std::vector<HostShadingPoint>& receivers,
+    const std::vector<float>& reference, const HostSampleFunc& sampler = nullptr, uint32_t numEstimates = 16, uint32_t numSamples = 1)
+{
+    HostSamplingError result;
+    if (receivers.empty() || numEstimates == 0 || numSamples == 0)
+        return result;
+
+    const HostSamplingParams params;
+    std::vector<double> steps(receivers.size(), 0.0);
+    std::vector<double> sqError(receivers.size(), 0.0);
+    parallelFor(0, receivers.size(), [&](size_t r)
+    {
+        uint32_t seed = getReceiverSeedHost(r);
+        for (uint32_t e = 0; e < numEstimates; e++)
+        {
+            float3 estimate = float3(0.f);
+            for (uint32_t s = 0; s < numSamples; s++)
+            {
+                const HostTreeSample sample = sampler ? sampler(receivers[r], r, seed) : sampleVPLTreeHost(vplData, maxVPLs, receivers[r], params, seed);
+                estimate += sample.radiance;
+                steps[r] += sample.numSteps;
+            }
+            const double d = (double)luminance(estimate / (float)numSamples) - reference[r];
+            sqError[r] += d * d;
+        }
+    }, 1);
+
+    double totalSteps = 0.0, relError = 0.0;
+    uint32_t numValid = 0;
+    for (size_t r = 0; r < receivers.size(); r++)
+    {
+        totalSteps += steps[r];
+        if (reference[r] > 0.f)
+        {
+            relError += std::sqrt(sqError[r] / numEstimates) / reference[r];
+            numValid++;
+        }
+    }
+    result.avgSteps = (float)(totalSteps / ((double)receivers.size() * numEstimates * numSamples));
+    result.error = numValid > 0 ? (float)(relError / numValid) : 0.f;
+    return result;
+}
@@ -0,0 +1,327 @@
+// Level by level SST validation, see HostTreeValidation.h
+
+#include "HostTreeValidation.h"
+#include "HostMerge.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const size_t kGrainSize = 4096;
+
+    // Intensities are stored as half, the sum of two halves is rounded once more.
+    const float kIntensityTolerance = 2e-3f;
+    const float kIntensityAbsTolerance = 1e-7f;
+
+    // Cones at least this wide cover the sphere, pi is rounded down to half precision.
+    const float kFullConeAngle = 3.14f;
+
+    struct Entry
+    {
+        uint32_t vplIdx;
+        bool covered;   ///< Node or one of its ancestors has an early stop.
+    };
+
+    /** Per chunk part of the result, reduced after every level.
+    */
+    struct ChunkStats
+    {
+        uint32_t numNodes = 0;
+        uint32_t numLeaves = 0;
+        uint32_t numCoveredLeaves = 0;
+        uint32_t numEarlyStopNodes = 0;
+        uint32_t numCutNodes = 0;
+        float maxIntensityError = 0.f;
+
+        uint32_t numInvalidIndices = 0;
+        uint32_t numDoubleVisits = 0;
+        uint32_t numInvalidIds = 0;
+        uint32_t numInvalidLayout = 0;
+        uint32_t numInvalidChildIds = 0;
+        uint32_t numLeavesWithChildren = 0;
+        uint32_t numMissingChildren = 0;
+        uint32_t numSubtreeCountErrors = 0;
+        uint32_t numAABBErrors = 0;
+        uint32_t numIntensityErrors = 0;
+        uint32_t numConeErrors = 0;
+
+        void add(const ChunkStats& o)
+        {
+            numNodes += o.numNodes;
+            numLeaves += o.numLeaves;
+            numCoveredLeaves += o.numCoveredLeaves;
+            numEarlyStopNodes += o.numEarlyStopNodes;
+            numCutNodes += o.numCutNodes;
+            maxIntensityError = std::max(maxIntensityError, o.maxIntensityError);
+            numInvalidIndices += o.numInvalidIndices;
+            numDoubleVisits += o.numDoubleVisits;
+            numInvalidIds += o.numInvalidIds;
+            numInvalidLayout += o.numInvalidLayout;
+            numInvalidChildIds += o.numInvalidChildIds;
+            numLeavesWithChildren += o.numLeavesWithChildren;
+            numMissingChildren += o.numMissingChildren;
+            numSubtreeCountErrors += o.numSubtreeCountErrors;
+            numAABBErrors += o.numAABBErrors;
+            numIntensityErrors += o.numIntensityErrors;
+            numConeErrors += o.numConeErrors;
+        }
+    };
+
+    const uint32_t kInvalidKey = 0xFFFFFFFF;
+
+    /** Maps a half to an unsigned key with the same order, so bounds are compared without unpacking them.
+    */
+    inline uint32_t halfOrderKey(uint32_t h)
+    {
+        h &= 0xFFFF;
+        if ((h & 0x7FFF) > 0x7C00) return kInvalidKey; // NaN
+        if (h == 0x8000) h = 0;                         // -0 == +0
+        return (h & 0x8000) ? (~h & 0x7FFF) : (h | 0x8000);
+    }
+
+    /** Keys of the three halves packed by packFloat3().
+    */
+    inline void halfOrderKeys(const uint2& u, uint32_t keys[3])
+    {
+        keys[0] = halfOrderKey(u.x);
+        keys[1] = halfOrderKey(u.x >> 16);
+        keys[2] = halfOrderKey(u.y >> 16);
+    }
+
+    inline bool contains(const VPLData& parent, const VPLData& child)
+    {
+        uint32_t pMin[3], pMax[3], cMin[3], cMax[3];
+        halfOrderKeys(parent.aabbMin, pMin);
+        halfOrderKeys(parent.aabbMax, pMax);
+        halfOrderKeys(child.aabbMin, cMin);
+        halfOrderKeys(child.aabbMax, cMax);
+        for (int a = 0; a < 3; a++)
+        {
+            if (pMin[a] == kInvalidKey || pMax[a] == kInvalidKey || cMin[a] == kInvalidKey || cMax[a] == kInvalidKey)
+                return false;
+            if (pMin[a] > cMin[a] || pMax[a] < cMax[a])
+                return false;
+        }
+        return true;
+    }
+
+    /** Returns true if the visited bit of the node was already set.
+    */
+    inline bool markVisited(std::vector<std::atomic<uint64_t>>& visited, uint32_t idx)
+    {
+        const uint64_t mask = 1ull << (idx & 63);
+        return (visited[idx >> 6].fetch_or(mask, std::memory_order_relaxed) & mask) != 0;
+    }
+
+    /** Checks a node against its children and appends the children to the next level.
+    */
+    void visitNode(const std::vector<VPLData>& vplData, int maxVPLs, const Entry& entry, std::vector<std::atomic<uint64_t>>& visited, ChunkStats& stats, std::vector<Entry>& next)
+    {
+        if (markVisited(visited, entry.vplIdx))
+        {
+            stats.numDoubleVisits++;
+            return;
+        }
+
+        const VPLData& vpl = vplData[entry.vplIdx];
+        stats.numNodes++;
+
+        if (vpl.id != (int)entry.vplIdx)
+            stats.numInvalidIds++;
+
+        const bool hasChild1 = vpl.idChild1 >= 0;
+        const bool hasChild2 = vpl.idChild2 >= 0;
+        if (hasChild1 != hasChild2)
+            stats.numInvalidChildIds++;
+        if (vpl.numVPLSubTree < 0)
+            stats.numSubtreeCountErrors++;
+        if (vpl.numVPLSubTree <= 0 && (hasChild1 || hasChild2))
+            stats.numLeavesWithChildren++;
+        if (vpl.numVPLSubTree > 0 && !(hasChild1 && hasChild2))
+            stats.numMissingChildren++;
+
+        const bool isLeaf = !hasChild1 && !hasChild2;
+        const bool isInLeafRange = entry.vplIdx < (uint32_t)maxVPLs;
+        if (isLeaf != isInLeafRange)
+            stats.numInvalidLayout++;
+
+        if (isLeaf)
+        {
+            stats.numLeaves++;
+            if (entry.covered) stats.numCoveredLeaves++;
+            else stats.numCutNodes++;
+            return;
+        }
+
+        const bool earlyStop = vpl.getEarlyStop() > 0.f;
+        if (earlyStop)
+        {
+            stats.numEarlyStopNodes++;
+            if (!entry.covered) stats.numCutNodes++;
+        }
+
+        // Only descend into complete nodes, the errors above already cover the rest.
+        if (!hasChild1 || !hasChild2)
+            return;
+        if ((size_t)vpl.idChild1 >= vplData.size() || (size_t)vpl.idChild2 >= vplData.size())
+        {
+            stats.numInvalidIndices++;
+            return;
+        }
+
+        const VPLData& child1 = vplData[vpl.idChild1];
+        const VPLData& child2 = vplData[vpl.idChild2];
+
+        if (vpl.numVPLSubTree != std::max(child1.numVPLSubTree, 0) + std::max(child2.numVPLSubTree, 0) + 2)
+            stats.numSubtreeCountErrors++;
+
+        if (!contains(vpl, child1) || !contains(vpl, child2))
+            stats.numAABBErrors++;
+
+        const float coneAngle = vpl.getConeAngle();
+        if (!(coneAngle >= kFullConeAngle) &&
+            !(coneAngleAroundAxis(vpl.getNormW(), child1.getNormW(), child1.getConeAngle()) <= coneAngle &&
+              coneAngleAroundAxis(vpl.getNormW(), child2.getNormW(), child2.getConeAngle()) <= coneAngle))
+            stats.numConeErrors++;
+
+        const float intensity = vpl.getIntensity();
+        const float sum = child1.getIntensity() + child2.getIntensity();
+        if (std::isfinite(sum) && std::isfinite(intensity))
+        {
+            const float diff = std::abs(intensity - sum);
+            if (sum > 0.f)
+                stats.maxIntensityError = std::max(stats.maxIntensityError, diff / sum);
+            if (diff > kIntensityTolerance * sum + kIntensityAbsTolerance)
+                stats.numIntensityErrors++;
+        }
+        else if (std::isfinite(sum) || !(intensity > 0.f))
+        {
+            // Half overflow is fine as long as the children overflow as well.
+            stats.numIntensityErrors++;
+        }
+
+        next.push_back({ (uint32_t)vpl.idChild1, entry.covered || earlyStop });
+        next.push_back({ (uint32_t)vpl.idChild2, entry.covered || earlyStop });
+    }
+}
+
+TreeValidationResult validateTree(const std::vector<VPLData>& vplData, int maxVPLs)
+{
+    TreeValidationResult result;
+    if (maxVPLs <= 0 || vplData.size() <= (size_t)maxVPLs || vplData.size() > 0xFFFFFFFFull)
+        return result;
+
+    auto t0 = CpuTimer::getCurrentTimePoint();
+
+    std::vector<std::atomic<uint64_t>> visited((vplData.size() + 63) / 64);
+    parallelFor(0, visited.size(), [&](size_t i) { visited[i].store(0, std::memory_order_relaxed); });
+
+    // Valid VPLs, every one of them has to end up as a leaf of the tree.
+    std::vector<uint32_t> chunkValid((maxVPLs + kGrainSize - 1) / kGrainSize, 0);
+    parallelForChunks(chunkValid.size(), [&](size_t chunk, uint32_t)
+    {
+        const size_t end = std::min((chunk + 1) * kGrainSize, (size_t)maxVPLs);
+        for (size_t i = chunk * kGrainSize; i < end; i++)
+            if (vplData[i].id >= 0) chunkValid[chunk]++;
+    });
+    for (uint32_t n : chunkValid) result.numValidVPLs += n;
+
+    ChunkStats total;
+    std::vector<Entry> level = { { (uint32_t)maxVPLs, false } };
+    while (!level.empty())
+    {
+        const size_t numChunks = (level.size() + kGrainSize - 1) / kGrainSize;
+        std::vector<ChunkStats> chunkStats(numChunks);
+        std::vector<std::vector<Entry>> chunkNext(numChunks);
+
+        parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+        {
+            const size_t begin = chunk * kGrainSize;
+            const size_t end = std::min(begin + kGrainSize, level.size());
+            chunkNext[chunk].reserve(2 * (end - begin));
+            for (size_t i = begin; i < end; i++)
+                visitNode(vplData, maxVPLs, level[i], visited, chunkStats[chunk], chunkNext[chunk]);
+        });
+
+        // Reduce in chunk order, so the next level is the same for every run.
+        ChunkStats levelStats;
+        size_t nextSize = 0;
+        for (size_t c = 0; c < numChunks; c++)
+        {
+            levelStats.add(chunkStats[c]);
+            nextSize += chunkNext[c].size();
+        }
+        total.add(levelStats);
+        result.nodesPerDepth.push_back(levelStats.numNodes);
+        result.leavesPerDepth.push_back(levelStats.numLeaves);
+
+        std::vector<Entry> next;
+        next.reserve(nextSize);
+        for (const auto& n : chunkNext)
+            next.insert(next.end(), n.begin(), n.end());
+        level.swap(next);
+    }
+
+    // A level can be empty if all of its nodes were visited before
+    while (!result.nodesPerDepth.empty() && result.nodesPerDepth.back() == 0)
+    {
+        result.nodesPerDepth.pop_back();
+        result.leavesPerDepth.pop_back();
+    }
+    result.maxDepth = result.nodesPerDepth.empty() ? 0 : (uint32_t)result.nodesPerDepth.size() - 1;
+
+    result.numNodes              = total.numNodes;
+    result.numLeaves             = total.numLeaves;
+    result.numEarlyStopNodes     = total.numEarlyStopNodes;
+    result.numCutNodes           = total.numCutNodes;
+    result.earlyStopCoverage     = total.numLeaves > 0 ? (float)total.numCoveredLeaves / total.numLeaves : 0.f;
+    result.maxIntensityError     = total.maxIntensityError;
+    result.numInvalidIndices     = total.numInvalidIndices;
+    result.numDoubleVisits       = total.numDoubleVisits;
+    result.numInvalidIds         = total.numInvalidIds;
+    result.numInvalidLayout      = total.numInvalidLayout;
+    result.numInvalidChildIds    = total.numInvalidChildIds;
+    result.numLeavesWithChildren = total.numLeavesWithChildren;
+    result.numMissingChildren    = total.numMissingChildren;
+    result.numSubtreeCountErrors = total.numSubtreeCountErrors;
+    result.numAABBErrors         = total.numAABBErrors;
+    result.numIntensityErrors    = total.numIntensityErrors;
+    result.numConeErrors         = total.numConeErrors;
+    result.numMissingLeaves      = result.numValidVPLs > total.numLeaves ? result.numValidVPLs - total.numLeaves : 0;
+
+    // The root has to cover all VPLs: numVPLSubTree counts every node below the root.
+    const VPLData& root = vplData[maxVPLs];
+    if (root.numVPLSubTree != (int)total.numNodes - 1)
+        result.numSubtreeCountErrors++;
+
+    result.valid = result.numInvalidIndices == 0 && result.numDoubleVisits == 0 && result.numInvalidIds == 0 && result.numInvalidLayout == 0
+        && result.numInvalidChildIds == 0 && result.numLeavesWithChildren == 0 && result.numMissingChildren == 0 && result.numSubtreeCountErrors == 0
+        && result.numAABBErrors == 0 && result.numIntensityErrors == 0 && result.numConeErrors == 0 && result.numMissingLeaves == 0;
+
+    result.time = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    return result;
+}
+
+std::string to_string(const TreeValidationResult& result)
+{
+    std::string s = std::string(result.valid ? "valid" : "INVALID") + ", " + std::to_string(result.numNodes) + " nodes, " + std::to_string(result.numLeaves) + " leaves, depth "
+        + std::to_string(result.maxDepth) + ", " + std::to_string(result.numCutNodes) + " cut nodes, early stop coverage " + std::to_string(result.earlyStopCoverage)
+        + ", max intensity error " + std::to_string(result.maxIntensityError) + ", " + std::to_string(result.time) + " ms";
+
+    auto addError = [&](uint32_t count, const char* name)
+    {
+        if (count > 0) s += std::string("\n  ") + name + ": " + std::to_string(count);
+    };
+    addError(result.numInvalidIndices, "invalid child indices");
+    addError(result.numDoubleVisits, "double visits");
+    addError(result.numInvalidIds, "invalid ids");
+    addError(result.numInvalidLayout, "invalid layout");
+    addError(result.numInvalidChildIds, "invalid child ids");
+    addError(result.numLeavesWithChildren, "leaves with children");
+    addError(result.numMissingChildren, "missing children");
+    addError(result.numSubtreeCountErrors, "subtree count errors");
+    addError(result.numAABBErrors, "AABB containment errors");
+    addError(result.numIntensityErrors, "intensity errors");
+    addError(result.numConeErrors, "cone containment errors");
+    addError(result.numMissingLeaves, "missing leaves");
+    return s;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+
+using namespace Falcor;
+
+
+/** Result of validateTree(). Every error counter is the number of nodes with that error,
+    the tree is valid if all of them are zero.
+*/
+struct TreeValidationResult
+{
+    bool valid = false;
+
+    // Tree statistics
+    uint32_t numNodes = 0;                  ///< Reachable nodes.
+    uint32_t numLeaves = 0;
+    uint32_t numValidVPLs = 0;              ///< VPLs with a valid id in the leaf range.
+    uint32_t maxDepth = 0;                  ///< Depth of the deepest node, the root has depth 0.
+    std::vector<uint32_t> nodesPerDepth;    ///< Depth histogram of all nodes.
+    std::vector<uint32_t> leavesPerDepth;   ///< Depth histogram of the leaves.
+
+    // Early stop statistics
+    uint32_t numEarlyStopNodes = 0;         ///< Internal nodes with an early stop.
+    uint32_t numCutNodes = 0;               ///< Nodes the diffuse traversal can end at: topmost early stop nodes and leaves without one above them.
+    float earlyStopCoverage = 0.f;          ///< Fraction of the leaves below an early stop node.
+    float maxIntensityError = 0.f;          ///< Largest relative difference of a node's intensity to the sum of its children.
+
+    // Error counters
+    uint32_t numInvalidIndices = 0;         ///< Child index outside of the VPL data array.
+    uint32_t numDoubleVisits = 0;           ///< Node reached twice (cycle or shared child).
+    uint32_t numInvalidIds = 0;             ///< Node id does not match the index in the VPL data array.
+    uint32_t numInvalidLayout = 0;          ///< Leaf outside of [0, maxVPLs) or internal node inside of it.
+    uint32_t numInvalidChildIds = 0;        ///< Exactly one of the child ids is negative.
+    uint32_t numLeavesWithChildren = 0;     ///< numVPLSubTree <= 0 but has children.
+    uint32_t numMissingChildren = 0;        ///< numVPLSubTree > 0 but has no children.
+    uint32_t numSubtreeCountErrors = 0;     ///< numVPLSubTree is negative or not the children's counts + 2.
+    uint32_t numAABBErrors = 0;             ///< Bounds of a child not contained in the bounds of its parent.
+    uint32_t numIntensityErrors = 0;        ///< Intensity of a node not the sum of its children (half precision tolerance).
+    uint32_t numConeErrors = 0;             ///< Orientation cone of a child not contained in the cone of its parent.
+    uint32_t numMissingLeaves = 0;          ///< Valid VPLs not reachable from the root.
+
+    float time = 0.f;                       ///< Validation time in milliseconds.
+};
+
+/** Validates an SST on all threads in linear time.
+    The tree is traversed level by level from the root, visited nodes are tracked in an atomic bitset.
+    Every node is checked against its children, so the checks are local and the traversal never recurses.
+    \param[in] vplData VPL data array of a built tree, root at index maxVPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \return Validation result.
+*/
+TreeValidationResult validateTree(const std::vector<VPLData>& vplData, int maxVPLs);
+
+/** Returns a one line summary of the statistics followed by the non-zero error counters.
+*/
+std::string to_string(const TreeValidationResult& result);
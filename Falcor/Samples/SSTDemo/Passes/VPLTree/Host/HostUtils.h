@@ -0,0 +1,110 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+
+/** Number of worker threads that replaces the hardware concurrency, 0 to use the hardware concurrency.
+    Lets the tests run the multithreaded code paths on machines with few cores.
+*/
+inline std::atomic<uint32_t>& getHostThreadOverride()
+{
+    static std::atomic<uint32_t> numThreads(0);
+    return numThreads;
+}
+
+/** Returns the number of worker threads used by the host tree code.
+*/
+inline uint32_t getNumHostThreads()
+{
+    const uint32_t overrideThreads = getHostThreadOverride();
+    const uint32_t numThreads = overrideThreads > 0 ? overrideThreads : std::thread::hardware_concurrency();
+    return numThreads > 0 ? numThreads : 1;
+}
+
+/** Counts the leading zero bits of a 64bit value. Returns 64 for zero (matches clz64 in TreeInternalNodes.cs.slang).
+*/
+inline int clz64(uint64_t x)
+{
+    if (x == 0) return 64;
+#if defined(_MSC_VER)
+    unsigned long index;
+    _BitScanReverse64(&index, x);
+    return 63 - (int)index;
+#else
+    return __builtin_clzll(x);
+#endif
+}
+
+/** 128bit key stored as (high, low) words, the same layout as the 128bit codes on the GPU.
+*/
+struct Key128
+{
+    uint64_t hi;
+    uint64_t lo;
+
+    bool operator==(const Key128& other) const { return hi == other.hi && lo == other.lo; }
+    bool operator!=(const Key128& other) const { return !(*this == other); }
+    bool operator<(const Key128& other) const { return hi != other.hi ? hi < other.hi : lo < other.lo; }
+    Key128 operator&(const Key128& other) const { return { hi & other.hi, lo & other.lo }; }
+    Key128 operator|(const Key128& other) const { return { hi | other.hi, lo | other.lo }; }
+    Key128 operator^(const Key128& other) const { return { hi ^ other.hi, lo ^ other.lo }; }
+};
+
+/** Counts the leading zero bits of a 128bit value. Returns 128 for zero (matches clz128 in TreeInternalNodes.cs.slang).
+*/
+inline int clz128(const Key128& x)
+{
+    return x.hi != 0 ? clz64(x.hi) : 64 + clz64(x.lo);
+}
+
+/** Runs func(chunkIdx, threadIdx) for every chunk in [0, numChunks) on all hardware threads.
+    Chunks are handed out dynamically, so the per chunk cost may vary.
+*/
+template<typename Func>
+inline void parallelForChunks(size_t numChunks, Func func)
+{
+    const uint32_t numThreads = (uint32_t)std::min<size_t>(getNumHostThreads(), numChunks);
+    if (numThreads <= 1)
+    {
+        for (size_t i = 0; i < numChunks; i++) func(i, 0u);
+        return;
+    }
+
+    std::atomic<size_t> nextChunk(0);
+    auto worker = [&](uint32_t threadIdx)
+    {
+        for (size_t i = nextChunk++; i < numChunks; i = nextChunk++)
+            func(i, threadIdx);
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(numThreads - 1);
+    for (uint32_t t = 1; t < numThreads; t++)
+        threads.emplace_back(worker, t);
+    worker(0);
+    for (auto& t : threads) t.join();
+}
+
+/** Runs func(i) for every i in [begin, end) on all hardware threads.
+    \param[in] grainSize Number of consecutive indices processed by one task.
+*/
+template<typename Func>
+inline void parallelFor(size_t begin, size_t end, Func func, size_t grainSize = 4096)
+{
+    if (end <= begin) return;
+    const size_t numChunks = (end - begin + grainSize - 1) / grainSize;
+    parallelForChunks(numChunks, [&](size_t chunk, uint32_t)
+    {
+        const size_t chunkBegin = begin + chunk * grainSize;
+        const size_t chunkEnd   = std::min(chunkBegin + grainSize, end);
+        for (size_t i = chunkBegin; i < chunkEnd; i++) func(i);
+    });
+}
@@ -0,0 +1,284 @@
+// Clustering of co-located VPLs before the tree build, see HostVPLClustering.h
+
+#include "HostVPLClustering.h"
+#include <unordered_map>
+#include "HostCodes.h"
+#include "HostMerge.h"
+#include "HostTreeSampling.h"
+#include "HostTreeValidation.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kMaxClusteringPasses = 16;
+
+    /** Sums of a cluster. Accumulated in double, the cluster of a bright wall can have many thousand VPLs.
+    */
+    struct Cluster
+    {
+        uint32_t first = 0;             ///< First VPL of the cluster, the output order.
+        uint32_t count = 0;
+        double intensity = 0.0;
+        double color[3] = { 0.0, 0.0, 0.0 };
+        double position[3] = { 0.0, 0.0, 0.0 };     ///< Intensity weighted, or unweighted if the cluster has no intensity.
+        float3 normal = float3(0.f);
+        float3 aabbMin = float3(FLT_MAX);
+        float3 aabbMax = float3(-FLT_MAX);
+        float3 variance = float3(0.f);
+        float coneAngle = 0.f;          ///< Bounds the normals of the members around the stored normal.
+    };
+
+    VPLData getInvalidRecord()
+    {
+        VPLData vpl = {};
+        vpl.id = -1;
+        vpl.idChild1 = -1;
+        vpl.idChild2 = -1;
+        vpl.numVPLSubTree = 0;
+        return vpl;
+    }
+
+    float relativeError(double value, double reference)
+    {
+        return reference != 0.0 ? (float)(std::abs(value - reference) / std::abs(reference)) : (float)std::abs(value);
+    }
+}
+
+int clusterVPLs(const VPLClusteringDesc& desc, std::vector<VPLData>& vplData, int maxVPLs, VPLClusteringStats& stats)
+{
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+    stats = VPLClusteringStats();
+
+    std::vector<uint32_t> valid;
+    float3 boundsMin(FLT_MAX);
+    float3 boundsMax(-FLT_MAX);
+    for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+    {
+        if (vplData[i].id < 0)
+            continue;
+        valid.push_back((uint32_t)i);
+        boundsMin = min(boundsMin, vplData[i].getPosW());
+        boundsMax = max(boundsMax, vplData[i].getPosW());
+        stats.inputIntensity += vplData[i].getIntensity();
+    }
+    const uint32_t numInput = (uint32_t)valid.size();
+    stats.numInputVPLs = (int)numInput;
+    if (numInput == 0)
+        return 0;
+
+    // Cell coordinates and direction code share one 64bit key
+    const uint32_t numDirBits = numDirCodeBits((int)desc.numSphereSections);
+    const uint32_t maxCellBits = std::min(21u, (64 - numDirBits) / 3);
+    const float3 extent = boundsMax - boundsMin;
+    const float diagonal = length(extent);
+    float cellSize = std::max(desc.cellSize * diagonal, 1e-20f);
+
+    std::vector<uint64_t> keys(numInput);
+    std::vector<uint32_t> clusterOf(numInput);
+    std::unordered_map<uint64_t, uint32_t> cellClusters;
+    uint32_t numClusters = 0;
+    for (uint32_t pass = 0; pass < kMaxClusteringPasses; pass++)
+    {
+        uint64_t resolution[3];
+        for (int a = 0; a < 3; a++)
+            resolution[a] = (uint64_t)std::min(std::max(std::ceil(extent[a] / cellSize), 1.f), (float)(1u << maxCellBits));
+
+        parallelFor(0, numInput, [&](size_t i)
+        {
+            const VPLData& vpl = vplData[valid[i]];
+            const float3 cell = (vpl.getPosW() - boundsMin) / cellSize;
+            uint64_t c[3];
+            for (int a = 0; a < 3; a++)
+                c[a] = std::min((uint64_t)std::max(cell[a], 0.f), resolution[a] - 1);
+            const uint64_t cellIndex = (c[0] * resolution[1] + c[1]) * resolution[2] + c[2];
+            keys[i] = cellIndex << numDirBits | (uint64_t)direction_code(vpl.getNormW(), (int)desc.numSphereSections);
+        });
+
+        // Clusters are numbered in the order of their first VPL, so the result doesn't depend on the hash map
+        cellClusters.clear();
+        cellClusters.reserve(numInput);
+        numClusters = 0;
+        for (uint32_t i = 0; i < numInput; i++)
+        {
+            const auto inserted = cellClusters.emplace(keys[i], numClusters);
+            if (inserted.second) numClusters++;
+            clusterOf[i] = inserted.first->second;
+        }
+
+        stats.numPasses = pass + 1;
+        if (desc.targetVPLs <= 0 || (int)numClusters <= desc.targetVPLs)
+            break;
+        cellSize *= 2.f;
+    }
+    stats.cellSize = cellSize;
+    std::unordered_map<uint64_t, uint32_t>().swap(cellClusters);
+    std::vector<uint64_t>().swap(keys);
+
+    // Sums, then the spread around the weighted mean in the frame of the merged normal
+    std::vector<Cluster> clusters(numClusters);
+    for (uint32_t i = 0; i < numInput; i++)
+    {
+        const VPLData& vpl = vplData[valid[i]];
+        Cluster& cluster = clusters[clusterOf[i]];
+        if (cluster.count++ == 0) cluster.first = i;
+
+        const float intensity = vpl.getIntensity();
+        const float3 color = vpl.getColor();
+        const float3 posW = vpl.getPosW();
+        cluster.intensity += intensity;
+        for (int a = 0; a < 3; a++)
+        {
+            cluster.color[a] += color[a];
+            cluster.position[a] += (double)intensity * posW[a];
+        }
+        cluster.normal += intensity * vpl.getNormW();
+        cluster.aabbMin = min(cluster.aabbMin, vpl.getAABBMin());
+        cluster.aabbMax = max(cluster.aabbMax, vpl.getAABBMax());
+    }
+
+    std::vector<float3> means(numClusters);
+    std::vector<VPLData> clustered(numClusters);
+    parallelFor(0, numClusters, [&](size_t c)
+    {
+        const Cluster& cluster = clusters[c];
+        if (cluster.count == 1)
+            return;
+        if (cluster.intensity > 0.0)
+            means[c] = float3(float(cluster.position[0] / cluster.intensity), float(cluster.position[1] / cluster.intensity), float(cluster.position[2] / cluster.intensity));
+        else
+            means[c] = (cluster.aabbMin + cluster.aabbMax) * 0.5f;
+        const float normalLength = length(cluster.normal);
+        clusters[c].normal = normalLength > 0.f ? cluster.normal / normalLength : vplData[valid[cluster.first]].getNormW();
+    });
+
+    for (uint32_t i = 0; i < numInput; i++)
+    {
+        Cluster& cluster = clusters[clusterOf[i]];
+        if (cluster.count == 1)
+            continue;
+        const VPLData& vpl = vplData[valid[i]];
+        cluster.coneAngle = std::max(cluster.coneAngle, coneAngleAroundAxis(cluster.normal, vpl.getNormW(), vpl.getConeAngle()));
+        if (cluster.intensity <= 0.0)
+            continue;
+        float3 R[3];
+        getRotationRowsFromAToB(float3(0.f, 0.f, 1.f), cluster.normal, R);
+        const float3 d = mulRowVector(vpl.getPosW(), R) - mulRowVector(means[clusterOf[i]], R);
+        cluster.variance += vpl.getIntensity() * (vpl.getVariance() + d * d);
+    }
+
+    parallelFor(0, numClusters, [&](size_t c)
+    {
+        const Cluster& cluster = clusters[c];
+        VPLData& vpl = clustered[c];
+        vpl = vplData[valid[cluster.first]];
+        vpl.id = (int)c;
+        if (cluster.count == 1)
+            return;
+
+        vpl.setPosW(means[c]);
+        vpl.setNormW(cluster.normal);
+        vpl.setConeAngle(std::min(cluster.coneAngle + kConeAngleEpsilon, (float)M_PI));
+        vpl.setColor(float3((float)cluster.color[0], (float)cluster.color[1], (float)cluster.color[2]));
+        vpl.setIntensity((float)cluster.intensity);
+        vpl.setAABBMin(cluster.aabbMin);
+        vpl.setAABBMax(cluster.aabbMax);
+        vpl.setVariance(cluster.intensity > 0.0 ? cluster.variance / (float)cluster.intensity : float3(0.f));
+        vpl.setEarlyStop(0.f);
+    });
+
+    // Compact the leaf range
+    const VPLData invalid = getInvalidRecord();
+    for (int i = 0; i < maxVPLs && i < (int)vplData.size(); i++)
+        vplData[i] = i < (int)numClusters ? clustered[i] : invalid;
+
+    for (uint32_t c = 0; c < numClusters; c++)
+    {
+        stats.largestCluster = std::max(stats.largestCluster, clusters[c].count);
+        stats.intensity += clustered[c].getIntensity();
+    }
+    stats.numVPLs = (int)numClusters;
+    stats.time = (float)CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    return (int)numClusters;
+}
+
+VPLClusteringCheck checkVPLClustering(const VPLClusteringDesc& desc, const HostTreeBuilder::Desc& buildDesc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs)
+{
+    VPLClusteringCheck result;
+    if (numVPLs <= 1 || maxVPLs <= 0 || vplData.size() < (size_t)maxVPLs)
+        return result;
+
+    HostTreeBuilder::Desc desc2 = buildDesc;
+    desc2.enableRefit = false;
+
+    std::vector<VPLData> clusteredData(vplData.begin(), vplData.begin() + maxVPLs);
+    VPLClusteringStats stats;
+    const int numClusters = clusterVPLs(desc, clusteredData, maxVPLs, stats);
+    result.numInputVPLs = stats.numInputVPLs;
+    result.numVPLs = numClusters;
+    result.clusteringTime = stats.time;
+
+    // Energy of the input and the result, the color in double to see the rounding of the stored sums
+    double inputColor[3] = { 0.0, 0.0, 0.0 };
+    double color[3] = { 0.0, 0.0, 0.0 };
+    for (int i = 0; i < maxVPLs; i++)
+    {
+        for (int a = 0; a < 3; a++)
+        {
+            if (vplData[i].id >= 0) inputColor[a] += vplData[i].getColor()[a];
+            if (clusteredData[i].id >= 0) color[a] += clusteredData[i].getColor()[a];
+        }
+    }
+    result.intensityError = relativeError(stats.intensity, stats.inputIntensity);
+    for (int a = 0; a < 3; a++)
+        result.colorError = std::max(result.colorError, relativeError(color[a], inputColor[a]));
+
+    // Trees of both sets
+    std::vector<VPLData> treeData(vplData.begin(), vplData.begin() + maxVPLs);
+    HostTreeBuilder::SharedPtr pBuilder = HostTreeBuilder::create();
+    if (!pBuilder->build(desc2, treeData, numVPLs, maxVPLs))
+        return result;
+    result.buildTime = pBuilder->getTimings().total;
+    result.depth = validateTree(treeData, maxVPLs).maxDepth;
+
+    TreeValidationResult validation;
+    if (numClusters > 1)
+    {
+        clusteredData.resize(2 * (size_t)maxVPLs);
+        if (!pBuilder->build(desc2, clusteredData, numClusters, maxVPLs))
+            return result;
+        result.clusteredBuildTime = pBuilder->getTimings().total;
+        validation = validateTree(clusteredData, maxVPLs);
+        result.clusteredDepth = validation.maxDepth;
+        if (!validation.valid)
+            logWarning("checkVPLClustering: " + to_string(validation));
+    }
+
+    // Exact sums over all VPLs at the same receivers, the difference is the bias of the clustering
+    const float offset = length(desc2.maxExtent - desc2.minExtent) * 1e-2f;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, 256, offset);
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, HostSamplingParams());
+    const std::vector<float> clusteredReference = computeReferenceHost(clusteredData, maxVPLs, receivers, HostSamplingParams());
+    double sqError = 0.0;
+    double sqReference = 0.0;
+    for (size_t r = 0; r < receivers.size(); r++)
+    {
+        const double d = (double)clusteredReference[r] - reference[r];
+        sqError += d * d;
+        sqReference += (double)reference[r] * reference[r];
+    }
+    result.irradianceError = sqReference > 0.0 ? (float)std::sqrt(sqError / sqReference) : 0.f;
+
+    // Half precision sums, see validateTree()
+    result.valid = (numClusters <= 1 || validation.valid) && numClusters > 0 && numClusters <= numVPLs &&
+        result.intensityError < 1e-3f && result.colorError < 1e-3f;
+
+    const std::string message = "checkVPLClustering: " + std::to_string(result.numInputVPLs) + " -> " + std::to_string(result.numVPLs) + " VPLs in " +
+        std::to_string(result.clusteringTime) + " ms, intensity error " + std::to_string(result.intensityError) + ", color error " + std::to_string(result.colorError) +
+        ", irradiance error " + std::to_string(result.irradianceError) + ", build " + std::to_string(result.clusteredBuildTime) + " ms (unclustered " +
+        std::to_string(result.buildTime) + " ms), depth " + std::to_string(result.clusteredDepth) + " (unclustered " + std::to_string(result.depth) + ")";
+    if (result.valid)
+        logInfo(message);
+    else
+        logWarning(message + ", invalid");
+    return result;
+}
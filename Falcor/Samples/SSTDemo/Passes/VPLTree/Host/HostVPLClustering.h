@@ -0,0 +1,80 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeBuilder.h"
+
+using namespace Falcor;
+
+
+/** Merges co-located VPLs before the tree build, so the tree has fewer leaves for the same number of paths.
+    VPLs are hashed into a grid over the bounds of the valid VPLs. VPLs in the same cell with the same direction code
+    (see direction_code()) become one VPL:
+    - Intensity and color are summed, so the radiance of the scene is unchanged up to the half precision of the sums.
+    - Position and normal are the intensity weighted means, the variance is the intensity weighted spread in the frame
+      of the normal like in mergeVPLData(), the bounds enclose all merged VPLs.
+    - VPLs alone in their cell are copied unchanged.
+    The result is compacted: VPL i is stored at index i in the order of the first VPL of every cluster, the rest of the
+    leaf range is invalid.
+*/
+
+/** Clustering parameters.
+*/
+struct VPLClusteringDesc
+{
+    float cellSize = 0.002f;            ///< Edge of the grid cells relative to the diagonal of the VPL bounds.
+    uint32_t numSphereSections = 1;     ///< Sphere subdivisions of the direction code, VPLs with different codes are not merged.
+    int targetVPLs = 0;                 ///< If > 0, the cell size is doubled until at most this many VPLs remain.
+};
+
+/** Statistics of clusterVPLs().
+*/
+struct VPLClusteringStats
+{
+    int numInputVPLs = 0;
+    int numVPLs = 0;
+    uint32_t largestCluster = 0;
+    uint32_t numPasses = 0;             ///< Grid resolutions tried to reach targetVPLs.
+    float cellSize = 0.f;               ///< Edge of the cells in world space.
+    double inputIntensity = 0.0;        ///< Sum of the intensities before and after, equal up to the half precision.
+    double intensity = 0.0;
+    float time = 0.f;                   ///< Time in milliseconds.
+};
+
+/** Clusters the valid leaves of a VPL buffer in place.
+    \param[in] desc Clustering parameters.
+    \param[in,out] vplData VPL buffer as written by the VPL tracer. Only the leaf range is changed.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[out] stats Clustering statistics.
+    \return Number of valid VPLs after the clustering.
+*/
+int clusterVPLs(const VPLClusteringDesc& desc, std::vector<VPLData>& vplData, int maxVPLs, VPLClusteringStats& stats);
+
+/** Result of checkVPLClustering().
+*/
+struct VPLClusteringCheck
+{
+    bool valid = false;
+    int numInputVPLs = 0;
+    int numVPLs = 0;
+    float intensityError = 0.f;     ///< Relative error of the summed intensity.
+    float colorError = 0.f;         ///< Largest relative error of the summed color channels.
+    float irradianceError = 0.f;    ///< Relative RMS error of the exact sum over all VPLs at receivers near the VPLs, the bias of the clustering.
+    float clusteringTime = 0.f;     ///< Times in milliseconds.
+    float buildTime = 0.f;
+    float clusteredBuildTime = 0.f;
+    uint32_t depth = 0;             ///< Depth of the tree without and with clustering.
+    uint32_t clusteredDepth = 0;
+};
+
+/** Clusters a copy of the VPLs and checks the energy conservation and the tree built from the result with validateTree().
+    Builds trees of both sets to compare build time and depth.
+    \param[in] desc Clustering parameters.
+    \param[in] buildDesc Build parameters.
+    \param[in] vplData VPL buffer as written by the VPL tracer.
+    \param[in] numVPLs Number of valid VPLs.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \return Check result, also logged.
+*/
+VPLClusteringCheck checkVPLClustering(const VPLClusteringDesc& desc, const HostTreeBuilder::Desc& buildDesc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs);
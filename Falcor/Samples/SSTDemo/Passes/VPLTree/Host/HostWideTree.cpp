@@ -0,0 +1,255 @@
+// Collapse of the binary SST into 4-wide nodes, see HostWideTree.h
+
+#include "HostWideTree.h"
+#include "HostUtils.h"
+
+namespace
+{
+    const uint32_t kInvalidIndex = 0xFFFFFFFF;
+
+    inline bool isLeaf(const VPLData& vpl)
+    {
+        return vpl.numVPLSubTree <= 0;
+    }
+
+    /** The diffuse traversal stops at leaves and at nodes with a good enough approximation.
+    */
+    inline bool stopsTraversal(const VPLData& vpl)
+    {
+        return isLeaf(vpl) || vpl.getEarlyStop() > 0.f;
+    }
+
+    inline float3 unpackHalf3(const uint2& u)
+    {
+        return float3(glm::unpackHalf2x16(u.x), glm::unpackHalf2x16(u.y).y);
+    }
+
+    inline uint2 packHalf3(const float3& v)
+    {
+        uint2 u = uint2(0);
+        packFloat3(v, u);
+        return u;
+    }
+}
+
+HostWideTree::SharedPtr HostWideTree::create()
+{
+    return SharedPtr(new HostWideTree());
+}
+
+bool HostWideTree::build(const std::vector<VPLData>& vplData, int maxVPLs)
+{
+    mNodes.clear();
+    mRootVplIdx = -1;
+    mMaxDepth = 0;
+
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs)
+        return false;
+
+    mRootVplIdx = maxVPLs;
+    if (stopsTraversal(vplData[maxVPLs]))
+        return true;
+
+    const size_t numVPLData = 2 * (size_t)maxVPLs;
+    auto isValidChild = [&](int idx) { return idx >= 0 && (size_t)idx < numVPLData; };
+
+    struct Entry
+    {
+        uint32_t vplIdx;
+        uint32_t nodeIdx;
+        uint32_t depth;
+    };
+
+    std::vector<Entry> stack;
+    mNodes.emplace_back();
+    stack.push_back({ (uint32_t)maxVPLs, 0, 1 });
+
+    while (!stack.empty())
+    {
+        const Entry entry = stack.back();
+        stack.pop_back();
+        mMaxDepth = std::max(mMaxDepth, entry.depth);
+
+        // Every binary node is visited once, more nodes than VPLs means the tree has a cycle.
+        if (mNodes.size() > (size_t)maxVPLs)
+        {
+            logWarning("HostWideTree: Binary tree contains a cycle.");
+            mNodes.clear();
+            return false;
+        }
+
+        // Collapse: replace the largest child that does not stop the traversal by its two children.
+        const VPLData& vpl = vplData[entry.vplIdx];
+        if (!isValidChild(vpl.idChild1) || !isValidChild(vpl.idChild2))
+        {
+            logWarning("HostWideTree: Invalid child index.");
+            mNodes.clear();
+            return false;
+        }
+
+        uint32_t slots[4] = { (uint32_t)vpl.idChild1, (uint32_t)vpl.idChild2, kInvalidIndex, kInvalidIndex };
+        uint32_t numSlots = 2;
+        while (numSlots < 4)
+        {
+            int expand = -1;
+            float maxIntensity = -1.f;
+            for (uint32_t i = 0; i < numSlots; i++)
+            {
+                const VPLData& child = vplData[slots[i]];
+                if (!stopsTraversal(child) && child.getIntensity() > maxIntensity)
+                {
+                    expand = (int)i;
+                    maxIntensity = child.getIntensity();
+                }
+            }
+            if (expand < 0)
+                break;
+
+            const VPLData& child = vplData[slots[expand]];
+            if (!isValidChild(child.idChild1) || !isValidChild(child.idChild2))
+            {
+                logWarning("HostWideTree: Invalid child index.");
+                mNodes.clear();
+                return false;
+            }
+            slots[expand] = (uint32_t)child.idChild1;
+            slots[numSlots++] = (uint32_t)child.idChild2;
+        }
+
+        WideTreeNode node;
+        for (uint32_t i = 0; i < 4; i++)
+        {
+            node.aabbMin[i]   = uint2(0);
+            node.aabbMax[i]   = uint2(0);
+            node.posW[i]      = uint2(0);
+            node.normW[i]     = uint2(0);
+            node.intensity[i] = 0.f;
+            node.child[i]     = -1;
+            node.vplIdx[i]    = kInvalidIndex;
+
+            if (i >= numSlots)
+                continue;
+
+            const VPLData& child = vplData[slots[i]];
+            node.aabbMin[i]   = child.aabbMin;
+            node.aabbMax[i]   = child.aabbMax;
+            node.posW[i]      = child.posW;
+            node.normW[i]     = packHalf3(child.getNormW());
+            node.intensity[i] = child.getIntensity();
+            node.vplIdx[i]    = slots[i] | (child.getEarlyStop() > 0.f ? kWideEarlyStopBit : 0u);
+
+            // Early stop nodes still get a wide node, the specular path continues below them.
+            if (!isLeaf(child))
+            {
+                node.child[i] = (int)mNodes.size();
+                mNodes.emplace_back();
+                stack.push_back({ slots[i], (uint32_t)node.child[i], entry.depth + 1 });
+            }
+        }
+        mNodes[entry.nodeIdx] = node;
+    }
+
+    return true;
+}
+
+HostTreeSample HostWideTree::sample(const std::vector<VPLData>& vplData, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed) const
+{
+    HostTreeSample sample;
+    if (mRootVplIdx < 0)
+        return sample;
+
+    float p = 1.f;
+    float r = nextRandHost(randSeed);
+    uint32_t vplIdx = (uint32_t)mRootVplIdx;
+    int nodeIdx = mNodes.empty() ? -1 : 0;
+
+    while (nodeIdx >= 0)
+    {
+        const WideTreeNode& node = mNodes[nodeIdx];
+        sample.numSteps++;
+
+        float w[4];
+        float sum = 0.f;
+        int last = -1;
+        for (int i = 0; i < 4; i++)
+        {
+            w[i] = node.intensity[i] > 0.f
+                ? evalNodeWeightHost(unpackHalf3(node.aabbMin[i]), unpackHalf3(node.aabbMax[i]), unpackHalf3(node.posW[i]), node.intensity[i], sp, params)
+                : 0.f;
+            sum += w[i];
+            if (w[i] > 0.f) last = i;
+        }
+
+        if (!(sum > 0.f))
+            return sample; // Dead branch
+
+        // Pick a child and rescale the random number to reuse it on the next level.
+        int selected = last;
+        float pSelected = w[last] / sum;
+        float cdf = 0.f;
+        for (int i = 0; i < last; i++)
+        {
+            const float pi = w[i] / sum;
+            if (pi > 0.f && r <= cdf + pi)
+            {
+                selected = i;
+                pSelected = pi;
+                break;
+            }
+            cdf += pi;
+        }
+        r = std::min(std::max((r - cdf) / pSelected, 0.f), 1.f);
+        p *= pSelected;
+
+        vplIdx = node.vplIdx[selected] & ~kWideEarlyStopBit;
+        nodeIdx = (node.vplIdx[selected] & kWideEarlyStopBit) ? -1 : node.child[selected];
+    }
+
+    sample.pdf = p;
+    sample.nodeIdx = (int)vplIdx;
+    sample.radiance = evalSelectedNodeHost(vplData[vplIdx], p, sp, params, randSeed);
+    return sample;
+}
+
+WideTraversalComparison compareWideTraversal(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers, uint32_t numEstimates)
+{
+    WideTraversalComparison result;
+    if (maxVPLs <= 0 || vplData.size() < 2 * (size_t)maxVPLs || numReceivers == 0 || numEstimates == 0)
+        return result;
+
+    HostWideTree::SharedPtr pWideTree = HostWideTree::create();
+    if (!pWideTree->build(vplData, maxVPLs))
+        return result;
+
+    const VPLData& root = vplData[maxVPLs];
+    const float offset = length(root.getAABBMax() - root.getAABBMin()) * 1e-3f;
+    const HostSamplingParams params;
+    const std::vector<HostShadingPoint> receivers = generateReceiversHost(vplData, maxVPLs, numReceivers, offset);
+    const std::vector<float> reference = computeReferenceHost(vplData, maxVPLs, receivers, params);
+    if (receivers.empty())
+        return result;
+
+    // Both samplers go through a HostSampleFunc, so the timings carry the same call overhead
+    auto evaluate = [&](const HostSampleFunc& sampler, float& avgSteps, float& error, float& time)
+    {
+        auto t0 = CpuTimer::getCurrentTimePoint();
+        const HostSamplingError samplingError = estimateSamplingError(vplData, maxVPLs, receivers, reference, sampler, numEstimates);
+        time = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+        avgSteps = samplingError.avgSteps;
+        error = samplingError.error;
+    };
+
+    evaluate([&](const HostShadingPoint& sp, size_t, uint32_t& seed) { return sampleVPLTreeHost(vplData, maxVPLs, sp, params, seed); },
+        result.binarySteps, result.binaryError, result.binaryTime);
+    evaluate([&](const HostShadingPoint& sp, size_t, uint32_t& seed) { return pWideTree->sample(vplData, sp, params, seed); },
+        result.wideSteps, result.wideError, result.wideTime);
+
+    // Binary: root, two children per step and the selected node. Wide: one node per step and the selected node.
+    result.binaryBytes = (2.f + 2.f * result.binarySteps) * sizeof(VPLData);
+    result.wideBytes = result.wideSteps * sizeof(WideTreeNode) + sizeof(VPLData);
+
+    logInfo("compareWideTraversal: binary " + std::to_string(result.binarySteps) + " steps, " + std::to_string(result.binaryBytes) + " bytes, error " + std::to_string(result.binaryError)
+        + ", " + std::to_string(result.binaryTime) + " ms / 4-wide " + std::to_string(result.wideSteps) + " steps, " + std::to_string(result.wideBytes) + " bytes, error "
+        + std::to_string(result.wideError) + ", " + std::to_string(result.wideTime) + " ms, " + std::to_string(pWideTree->getMemorySize() >> 10) + " KB");
+    return result;
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#include "Falcor.h"
+#include "../../Shared/VPLData.h"
+#include "../../Shared/VPLTreeStructs.h"
+#include "HostTreeSampling.h"
+
+using namespace Falcor;
+
+
+/** 4-wide version of a binary SST (see WideTreeNode).
+    Every wide node collapses a binary node and its descendants down to four children. Internal children
+    are expanded largest intensity first, nodes with an early stop are never expanded so that the
+    traversal stops at the same clusters as sampleVPLTree(). The binary VPL data stays the source of the
+    sampled cluster, the wide nodes only replace the descent.
+*/
+class HostWideTree : public std::enable_shared_from_this<HostWideTree>
+{
+public:
+    using SharedPtr = std::shared_ptr<HostWideTree>;
+    using SharedConstPtr = std::shared_ptr<const HostWideTree>;
+    virtual ~HostWideTree() = default;
+
+    /** Create a new (empty) wide tree.
+    */
+    static SharedPtr create();
+
+    /** Converts a binary SST.
+        \param[in] vplData VPL data array of the binary tree, root at index maxVPLs.
+        \param[in] maxVPLs Capacity of the leaf range.
+        \return True if successful, false if the binary tree is invalid.
+    */
+    bool build(const std::vector<VPLData>& vplData, int maxVPLs);
+
+    /** Takes one sample. Host reference of the wide traversal, picks among the children of a wide node
+        with the weights of sampleVPLTreeHost().
+        \param[in] vplData VPL data array of the binary tree the wide tree was built from.
+        \param[in] sp Receiver.
+        \param[in] params Sampler parameters.
+        \param[in,out] randSeed Random seed.
+    */
+    HostTreeSample sample(const std::vector<VPLData>& vplData, const HostShadingPoint& sp, const HostSamplingParams& params, uint32_t& randSeed) const;
+
+    const std::vector<WideTreeNode>& getNodes() const { return mNodes; }
+    uint32_t getMaxDepth() const { return mMaxDepth; }
+    size_t getMemorySize() const { return mNodes.size() * sizeof(WideTreeNode); }
+
+protected:
+    HostWideTree() = default;
+
+    std::vector<WideTreeNode> mNodes;   ///< Root at index 0. Empty if the binary root is a leaf or stops early.
+    int mRootVplIdx = -1;
+    uint32_t mMaxDepth = 0;
+};
+
+/** Result of compareWideTraversal().
+*/
+struct WideTraversalComparison
+{
+    float binarySteps = 0.f;     ///< Average traversal steps per sample.
+    float wideSteps = 0.f;
+    float binaryBytes = 0.f;     ///< Average bytes of node data fetched per sample.
+    float wideBytes = 0.f;
+    float binaryError = 0.f;     ///< Relative RMS error of the estimate against the sum over all VPLs.
+    float wideError = 0.f;
+    float binaryTime = 0.f;      ///< Time in milliseconds for all samples.
+    float wideTime = 0.f;
+};
+
+/** Compares the binary traversal of sampleVPLTreeHost() against the 4-wide traversal on a built tree.
+    The receivers are placed on random VPLs.
+    \param[in] vplData VPL data array of a built tree.
+    \param[in] maxVPLs Capacity of the leaf range.
+    \param[in] numReceivers Number of receiver points.
+    \param[in] numEstimates Number of one sample estimates per receiver.
+    \return Comparison result. Results are logged.
+*/
+WideTraversalComparison compareWideTraversal(const std::vector<VPLData>& vplData, int maxVPLs, uint32_t numReceivers = 256, uint32_t numEstimates = 64);
@@ -63,7 +63,9 @@ BitonicSort::BitonicSort()
 
     // Create shaders
     mProgramDefineList.add("COMP_MASK",  "0xFFFFFFFFFFFFFFFF");
+    mProgramDefineList.add("COMP_MASK_HI", "0xFFFFFFFFFFFFFFFF");
     mProgramDefineList.add("NULL_ITEM" , "0xFFFFFFFFFFFFFFFF");
+    mProgramDefineList.add("SORT_128BIT_KEYS", "0");
 
     const std::string SM = "6_0";
     mSort.pInnerProgram        = ComputeProgram::createFromFile(kInnerShaderFilename,        "main", mProgramDefineList, Shader::CompilerFlags::None, SM);
@@ -84,7 +86,7 @@ BitonicSort::SharedPtr BitonicSort::create()
     return SharedPtr(new BitonicSort());
 }
 
-bool BitonicSort::execute(RenderContext* pRenderContext, StructuredBuffer::SharedPtr pData, uint32_t totalSize, int2 bitRange, uint32_t chunkSize, uint32_t groupSize)
+bool BitonicSort::execute(RenderContext* pRenderContext, StructuredBuffer::SharedPtr pData, uint32_t totalSize, int2 bitRange, uint32_t chunkSize, uint32_t groupSize, bool use128BitKeys)
 {
     PROFILE("BitonicSort");
 
@@ -92,17 +94,31 @@ bool BitonicSort::execute(RenderContext* pRenderContext, StructuredBuffer::Share
     const uint32_t AlignedMaxNumElements = upper_power_of_two(MaxNumElements);
     const uint32_t MaxIterations = log2(std::max(2048u, AlignedMaxNumElements)) - 10;
 
-    // Setup compare bit mask
-    const uint numBits = bitRange.x - bitRange.y + 1;
-    uint64_t mask = numBits == 64 ? UINT64_MAX : (1ull << numBits) - 1;
-    mask <<= bitRange.y;
+    const int maxBit = use128BitKeys ? 127 : 63;
+    if (bitRange.x > maxBit || bitRange.y < 0 || bitRange.x < bitRange.y)
+        return false;
 
-    std::stringstream ss;
-    ss << "0x" << std::hex << mask;
+    // Setup compare bit masks of the low and high word
+    auto getWordMask = [&](int wordBegin) -> uint64_t
+    {
+        const int lsb = std::max(bitRange.y, wordBegin) - wordBegin;
+        const int msb = std::min(bitRange.x, wordBegin + 63) - wordBegin;
+        if (msb < lsb)
+            return 0;
+        const uint numBits = msb - lsb + 1;
+        uint64_t mask = numBits == 64 ? UINT64_MAX : (1ull << numBits) - 1;
+        return mask << lsb;
+    };
+
+    std::stringstream ss, ssHi;
+    ss << "0x" << std::hex << getWordMask(0);
+    ssHi << "0x" << std::hex << getWordMask(64);
 
     // Set program defines
     mProgramDefineList.add("COMP_MASK", ss.str());
+    mProgramDefineList.add("COMP_MASK_HI", ssHi.str());
     mProgramDefineList.add("NULL_ITEM", "0xFFFFFFFFFFFFFFFF");
+    mProgramDefineList.add("SORT_128BIT_KEYS", use128BitKeys ? "1" : "0");
 
     mSort.pIndirectArgsProgram->addDefines(mProgramDefineList);
     mSort.pPreSortProgram->addDefines(mProgramDefineList);
@@ -50,9 +50,10 @@ public:
         \param[in] bitRange  The most and least-significant bit index for comparision.
         \param[in] chunkSize The number of elements per chunk. Each chunk is individually sorted. Must be a power-of-two in the range [1, groupSize].
         \param[in] groupSize Thread group size. Must be a power-of-two in the range [1,1024]. The default group size of 256 is generally the fastest.
+        \param[in] use128BitKeys The buffer holds 128 bit keys as (high, low) pairs of 64 bit elements. totalSize is the number of keys and bitRange goes up to 127.
         \return True if successful, false if an error occured.
     */
-    bool execute(RenderContext* pRenderContext, StructuredBuffer::SharedPtr pData, uint32_t totalSize, int2 bitRange, uint32_t chunkSize, uint32_t groupSize = 256);
+    bool execute(RenderContext* pRenderContext, StructuredBuffer::SharedPtr pData, uint32_t totalSize, int2 bitRange, uint32_t chunkSize, uint32_t groupSize = 256, bool use128BitKeys = false);
 
 protected:
     BitonicSort();
@@ -4,16 +4,30 @@
 #include "VPLTree.h"
 #include "../Shared/VPLTreeStructs.h"
 #include "../Shared/VPLData.h"
+#include "rapidjson/document.h"
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+#include <fstream>
+#include <sstream>
 
 const char* VPLTree::kDesc = "VPL Tree (SST)";
 
 namespace
 {
     const char kInitShaderFile[]          = "Passes/VPLTree/TreeInit.cs.slang";
+    const char kBoundsShaderFile[]        = "Passes/VPLTree/TreeBounds.cs.slang";
     const char kCodeShaderFile[]          = "Passes/VPLTree/TreeCode.cs.slang";
     const char kAssignLeafIdxShaderFile[] = "Passes/VPLTree/TreeAssignLeafIndex.cs.slang";
     const char kInternalNodesShaderFile[] = "Passes/VPLTree/TreeInternalNodes.cs.slang";
     const char kMergeNodesShaderFile[]    = "Passes/VPLTree/TreeMergeNodes.cs.slang";
+
+    const char kTreeCacheExtension[]      = "sstcache";
+    const char kBakeVPLExtension[]        = "vpls";
+
+    // Tuned early stop thresholds in the user section of .fscene files
+    const char kUserDefinedSection[]      = "user_defined";
+    const char kUserVarMinNormalScore[]   = "sst_min_normal_score";
+    const char kUserVarMaxNormalZStd[]    = "sst_max_normal_z_std";
 }
 
 VPLTree::SharedPtr VPLTree::create()
@@ -26,6 +40,10 @@ VPLTree::VPLTree()
 {
     createPrograms();
     mpBitonicSort = BitonicSort::create();
+    mpHostTreeBuilder = HostTreeBuilder::create();
+    mpHostSAHBuilder = HostSAHBuilder::create();
+    mpDirCodeLUT = HostDirectionCodeLUT::create();
+    mpDebugPanel = VPLTreeDebugPanel::create();
 }
 
 void VPLTree::onDataReload()
@@ -35,6 +53,7 @@ void VPLTree::onDataReload()
 
 void VPLTree::onLoad(RenderContext* pRenderContext, PassData& passData)
 {
+    mpPassData = &passData;
 }
 
 void VPLTree::onResizeSwapChain(uint32_t width, uint32_t height, PassData& passData)
@@ -47,6 +66,14 @@ void VPLTree::createPrograms()
 
     mProgramDefineList.add("MAX_VPLS", "0");
     mProgramDefineList.add("NUM_SPHERE_SECTIONS", "0");
+    mProgramDefineList.add("USE_DIR_CODE_LUT", "0");
+    mProgramDefineList.add("USE_TIGHT_BOUNDS", "0");
+    mProgramDefineList.add("USE_128BIT_CODES", "0");
+    mProgramDefineList.add("DETERMINISTIC_BUILD", "0");
+
+    mProgramDefineList.add("MORTON_BITS_X", "10");
+    mProgramDefineList.add("MORTON_BITS_Y", "10");
+    mProgramDefineList.add("MORTON_BITS_Z", "10");
 
     mProgramDefineList.add("NUM_ID_BITS", "0");
     mProgramDefineList.add("NUM_DIR_BITS", "0");
@@ -58,21 +85,23 @@ void VPLTree::createPrograms()
 
     const std::string SM = "6_0";
     mpInitProgram            = ComputeProgram::createFromFile(kInitShaderFile, "treeInit", mProgramDefineList, Shader::CompilerFlags::None, SM);
+    mpBoundsProgram          = ComputeProgram::createFromFile(kBoundsShaderFile, "treeBounds", mProgramDefineList, Shader::CompilerFlags::None, SM);
     mpCodeProgram            = ComputeProgram::createFromFile(kCodeShaderFile, "treeCode", mProgramDefineList, Shader::CompilerFlags::None, SM);
     mpAssignLeafIndexProgram = ComputeProgram::createFromFile(kAssignLeafIdxShaderFile, "treeAssignLeafIndex", mProgramDefineList, Shader::CompilerFlags::None, SM);
     mpInternalNodesProgram   = ComputeProgram::createFromFile(kInternalNodesShaderFile, "treeInternalNodes", mProgramDefineList, Shader::CompilerFlags::None, SM);
     mpMergeNodesProgram      = ComputeProgram::createFromFile(kMergeNodesShaderFile, "treeMergeNodes", mProgramDefineList, Shader::CompilerFlags::None, SM);
 
     mpInitVars            = ComputeVars::create(mpInitProgram->getReflector());
+    mpBoundsVars          = ComputeVars::create(mpBoundsProgram->getReflector());
     mpCodeVars            = ComputeVars::create(mpCodeProgram->getReflector());
     mpAssignLeafIndexVars = ComputeVars::create(mpAssignLeafIndexProgram->getReflector());
     mpInternalNodesVars   = ComputeVars::create(mpInternalNodesProgram->getReflector());
     mpMergeNodesVars      = ComputeVars::create(mpMergeNodesProgram->getReflector());
 }
 
-void VPLTree::createResources(const int maxVPLs)
+void VPLTree::createResources(const int maxVPLs, const bool use128BitCodes)
 {
-    if (mBufferMaxVPLs == maxVPLs)
+    if (mBufferMaxVPLs == maxVPLs && mBuffer128BitCodes == use128BitCodes)
         return;
 
     const int numTotalNodes  = getNumTotalNodes(maxVPLs);
@@ -80,9 +109,22 @@ void VPLTree::createResources(const int maxVPLs)
     auto bindFlags = Resource::BindFlags::ShaderResource | Resource::BindFlags::UnorderedAccess;
     mpBufferNodes  = StructuredBuffer::create(mpInitProgram, "gNodes", numTotalNodes, bindFlags);
     mpBufferMerge  = StructuredBuffer::create(mpInitProgram, "gMerge", numTotalNodes, bindFlags);
-    mpBufferCodes  = StructuredBuffer::create(mpCodeProgram, "gCodes", maxVPLs, bindFlags);
+    mpBufferCodes  = StructuredBuffer::create(mpCodeProgram, "gCodes", use128BitCodes ? 2 * maxVPLs : maxVPLs, bindFlags);
+    mpBufferBounds = StructuredBuffer::create(mpBoundsProgram, "gBounds", 6, bindFlags);
 
     mBufferMaxVPLs = maxVPLs;
+    mBuffer128BitCodes = use128BitCodes;
+}
+
+void VPLTree::updateDirCodeLUT()
+{
+    const uint32_t resolution = (uint32_t)mDirCodeLUTResolution;
+    if (mpDirCodeLUT->isValid() && mpDirCodeLUT->getResolution() == resolution && mpDirCodeLUT->getNumSphereSections() == mNumSphereSections)
+        return;
+
+    mpDirCodeLUT->generate(mNumSphereSections, resolution);
+    mpDirCodeLUTTexture = Texture::create2D(resolution, resolution, ResourceFormat::R32Uint, 1u, 1u, mpDirCodeLUT->getData().data(), Resource::BindFlags::ShaderResource);
+    mDirCodeLUTMismatchRate = mpDirCodeLUT->measureMismatchRate(1 << 16);
 }
 
 void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
@@ -92,14 +134,18 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
     if (!mpScene)
         return;
 
+    // A loaded cache is uploaded once, the VPL tracing pass is skipped while it is active (see setTreeCache())
+    if (mpTreeCache && !mTreeCacheUploaded && !uploadTreeCache(passData))
+        setTreeCache(nullptr);
+    if (mpTreeCache)
+        return;
+
     int VPLUpdate = passData.getVariable<int>("VPLUpdate");
 
     if (VPLUpdate == 0)
         return;
     
     const int maxVPLs = passData.getVariable<int>("maxVPLs");
-    const int numInternalNodes = getNumInternalNodes(maxVPLs);
-    const int numTotalNodes    = getNumTotalNodes(maxVPLs);
 
     if (maxVPLs <= 0 || !mUpdateTree)
         return;
@@ -108,36 +154,84 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
     StructuredBuffer::SharedPtr pBufferVPLPositions = asStructuredBuffer(passData["gVPLPositions"]);
     StructuredBuffer::SharedPtr pBufferVPLStats     = asStructuredBuffer(passData["gVPLStats"]);
 
-    createResources(maxVPLs);
-
-    mNumBitsDirCode = numDirCodeBits(mNumSphereSections);
-    mNumBitsIdCode  = 64 - (mNumBitsMortonCode + mNumBitsDirCode);
-    assert((mNumBitsMortonCode + mNumBitsDirCode + mNumBitsIdCode) == 64);
-
-    // Compute the offsets of our 64bit code fields: [Morton|Direction|Id]
-    mBeginIdCode     = 0;
-    mBeginDirCode    = mNumBitsIdCode;
-    mBeginMortonCode = mNumBitsDirCode + mNumBitsIdCode;
-    assert(64 > mBeginMortonCode && mBeginMortonCode > mBeginDirCode && mBeginDirCode > mBeginIdCode  && mBeginIdCode == 0);
+    // Compute the offsets of our code fields: [Morton|Direction|Id]. Switches to 128bit codes if maxVPLs doesn't fit into 64bit codes.
+    mCodeLayout = computeTreeCodeLayout(uint3(mMortonBits), mNumSphereSections, maxVPLs, mForce128BitCodes);
+    if (!mCodeLayout.valid)
+    {
+        logWarning("VPLTree: The morton and direction codes don't fit into 64 bits, reduce the morton code bits. Tree update disabled.");
+        mUpdateTree = false;
+        return;
+    }
 
-    const uint64_t numMaxSupportedVPLs = (1llu << mNumBitsIdCode) - 1;
-    assert(maxVPLs <= numMaxSupportedVPLs);
+    createResources(maxVPLs, mCodeLayout.use128Bit);
 
     // Set shader defines
     mProgramDefineList.add("MAX_VPLS",            std::to_string(maxVPLs));
     mProgramDefineList.add("NUM_SPHERE_SECTIONS", std::to_string(mNumSphereSections));
+    mProgramDefineList.add("USE_DIR_CODE_LUT",    mUseDirCodeLUT ? "1" : "0");
+    mProgramDefineList.add("USE_TIGHT_BOUNDS",    mUseTightBounds ? "1" : "0");
+    mProgramDefineList.add("USE_128BIT_CODES",    mCodeLayout.use128Bit ? "1" : "0");
+
+    if (mUseDirCodeLUT)
+        updateDirCodeLUT();
 
-    mProgramDefineList.add("NUM_ID_BITS",     std::to_string(mNumBitsIdCode));
-    mProgramDefineList.add("NUM_DIR_BITS",    std::to_string(mNumBitsDirCode));
-    mProgramDefineList.add("NUM_MORTON_BITS", std::to_string(mNumBitsMortonCode));
+    mProgramDefineList.add("MORTON_BITS_X", std::to_string(mCodeLayout.mortonBits.x));
+    mProgramDefineList.add("MORTON_BITS_Y", std::to_string(mCodeLayout.mortonBits.y));
+    mProgramDefineList.add("MORTON_BITS_Z", std::to_string(mCodeLayout.mortonBits.z));
 
-    mProgramDefineList.add("BEGIN_ID_BITS",    std::to_string(mBeginIdCode));
-    mProgramDefineList.add("BEGIN_DIR_BITS",    std::to_string(mBeginDirCode));
-    mProgramDefineList.add("BEGIN_MORTON_BITS", std::to_string(mBeginMortonCode));
+    mProgramDefineList.add("NUM_ID_BITS",     std::to_string(mCodeLayout.numIdBits));
+    mProgramDefineList.add("NUM_DIR_BITS",    std::to_string(mCodeLayout.numDirBits));
+    mProgramDefineList.add("NUM_MORTON_BITS", std::to_string(mCodeLayout.numMortonBits));
+
+    mProgramDefineList.add("BEGIN_ID_BITS",    std::to_string(mCodeLayout.beginId));
+    mProgramDefineList.add("BEGIN_DIR_BITS",    std::to_string(mCodeLayout.beginDir));
+    mProgramDefineList.add("BEGIN_MORTON_BITS", std::to_string(mCodeLayout.beginMorton));
+
+    if (mClusterVPLs || mpDebugPanel->isClusteringCheckPending())
+        clusterVPLsOnHost(passData, maxVPLs);
 
     if (mShowStats)
         mVPLStats = readBuffer<VPLStats>(pBufferVPLStats)[0];
 
+    if (mRunApproxTuning)
+        runApproxTuning(pRenderContext, passData, maxVPLs);
+
+    if (mUseHostBuilder)
+    {
+        buildTreeOnHost(passData, maxVPLs);
+        if (mSaveTreeCache)
+            saveTreeCache(passData, maxVPLs);
+        passData.getVariable<int>("VPLUpdate") = 0;
+        return;
+    }
+
+    // The GPU build overwrites the nodes the host refit is based on.
+    mHostRefitValid = false;
+
+    buildTreeOnGpu(pRenderContext, passData, maxVPLs);
+
+    if (mCheckTree)
+        checkTree(maxVPLs, pBufferVPLData);
+
+    if (mpDebugPanel->isDeterminismCheckPending())
+        checkDeterministicGpuBuild(pRenderContext, passData, maxVPLs);
+
+    if (mSaveTreeCache)
+        saveTreeCache(passData, maxVPLs);
+
+    passData.getVariable<int>("VPLUpdate") = 0;
+}
+
+void VPLTree::buildTreeOnGpu(RenderContext* pRenderContext, PassData& passData, const int maxVPLs)
+{
+    const int numInternalNodes = getNumInternalNodes(maxVPLs);
+    const int numTotalNodes    = getNumTotalNodes(maxVPLs);
+
+    StructuredBuffer::SharedPtr pBufferVPLData  = asStructuredBuffer(passData["gVPLData"]);
+    StructuredBuffer::SharedPtr pBufferVPLStats = asStructuredBuffer(passData["gVPLStats"]);
+
+    mProgramDefineList.add("DETERMINISTIC_BUILD", mDeterministicBuild ? "1" : "0");
+
     // Dispatch buffer initialization.
     {
         PROFILE("Init");
@@ -157,6 +251,27 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
         pRenderContext->uavBarrier(mpBufferMerge.get());
     }
 
+    // Dispatch bounds reduction
+    if (mUseTightBounds)
+    {
+        PROFILE("ComputeBounds");
+        mpBoundsProgram->addDefines(mProgramDefineList);
+
+        pRenderContext->clearUAV(mpBufferBounds->getUAV().get(), uvec4(0xFFFFFFFF));
+
+        mpBoundsVars->setStructuredBuffer("gVPLData", pBufferVPLData);
+        mpBoundsVars->setStructuredBuffer("gBounds", mpBufferBounds);
+
+        const glm::uvec3 numGroups = div_round_up(glm::uvec3(maxVPLs, 1u, 1u), mpBoundsProgram->getReflector()->getThreadGroupSize());
+
+        mpComputeState->setProgram(mpBoundsProgram);
+        pRenderContext->setComputeState(mpComputeState);
+        pRenderContext->setComputeVars(mpBoundsVars);
+        pRenderContext->dispatch(numGroups.x, numGroups.y, numGroups.z);
+
+        pRenderContext->uavBarrier(mpBufferBounds.get());
+    }
+
     // Dispatch compute codes
     {
         PROFILE("ComputeCodes");
@@ -168,6 +283,15 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
         mpCodeVars["CB"]["gMinExtent"] = mpScene->getBoundingBox().getMinPos();
         mpCodeVars["CB"]["gMaxExtent"] = mpScene->getBoundingBox().getMaxPos();
 
+        if (mUseTightBounds)
+            mpCodeVars->setStructuredBuffer("gBounds", mpBufferBounds);
+
+        if (mUseDirCodeLUT)
+        {
+            mpCodeVars->setTexture("gDirCodeLUT", mpDirCodeLUTTexture);
+            mpCodeVars["CB"]["gDirCodeLUTRes"] = (uint32_t)mDirCodeLUTResolution;
+        }
+
         mpComputeState->setProgram(mpCodeProgram);
         const glm::uvec3 numGroups = div_round_up(glm::uvec3(maxVPLs, 1u, 1u), mpCodeProgram->getReflector()->getThreadGroupSize());
 
@@ -182,7 +306,7 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
     // Dispatch code sorting
     {
         PROFILE("SortCodes");
-        mpBitonicSort->execute(pRenderContext, mpBufferCodes, maxVPLs, uint2(63, 0), 128, 256);
+        mpBitonicSort->execute(pRenderContext, mpBufferCodes, maxVPLs, mCodeLayout.use128Bit ? int2(127, 0) : int2(63, 0), 128, 256, mCodeLayout.use128Bit);
 
         if (mCheckCodesSorted)
             mCodesAreSorted = checkCodesSorted(mpBufferCodes);
@@ -246,22 +370,282 @@ void VPLTree::onFrameRender(RenderContext* pRenderContext, PassData& passData)
         pRenderContext->dispatch(numGroups.x, numGroups.y, numGroups.z);
 
         pRenderContext->uavBarrier(pBufferVPLData.get());
+    }
+}
+
+void VPLTree::checkDeterministicGpuBuild(RenderContext* pRenderContext, PassData& passData, const int maxVPLs)
+{
+    StructuredBuffer::SharedPtr pBufferVPLData = asStructuredBuffer(passData["gVPLData"]);
+    const bool deterministicBuild = mDeterministicBuild;
+
+    // Rebuilding is idempotent, the leaves are not changed by the build
+    auto build = [&](bool deterministic, uint64_t& hash)
+    {
+        mDeterministicBuild = deterministic;
+        buildTreeOnGpu(pRenderContext, passData, maxVPLs);
+        const std::vector<VPLData> vplData = readBuffer<VPLData>(pBufferVPLData);
+        hash = hashTreeCacheBytes(vplData.data(), vplData.size() * sizeof(VPLData));
+        return true;
+    };
+    mpDebugPanel->runDeterminismCheck(build, "GPU");
+
+    // The last build was deterministic
+    mDeterministicBuild = deterministicBuild;
+    if (!mDeterministicBuild)
+        buildTreeOnGpu(pRenderContext, passData, maxVPLs);
+}
+
+HostTreeBuilder::Desc VPLTree::getHostBuildDesc() const
+{
+    HostTreeBuilder::Desc desc;
+    desc.numSphereSections = mNumSphereSections;
+    desc.mortonBits        = uint3(mMortonBits);
+    desc.approxParams      = mApproximationParameters;
+    desc.minExtent         = mpScene->getBoundingBox().getMinPos();
+    desc.maxExtent         = mpScene->getBoundingBox().getMaxPos();
+    desc.useTightBounds    = mUseTightBounds;
+    desc.force128BitCodes  = mForce128BitCodes;
+    desc.useSimd           = mHostUseSimd;
+    desc.pDirCodeLUT       = mUseDirCodeLUT ? mpDirCodeLUT : nullptr;
+    return desc;
+}
+
+void VPLTree::buildTreeOnHost(PassData& passData, const int maxVPLs)
+{
+    PROFILE("HostBuild");
+
+    StructuredBuffer::SharedPtr pBufferVPLData  = asStructuredBuffer(passData["gVPLData"]);
+    StructuredBuffer::SharedPtr pBufferVPLStats = asStructuredBuffer(passData["gVPLStats"]);
+
+    std::vector<VPLData> vplData = readBuffer<VPLData>(pBufferVPLData);
+    const VPLStats stats = readBuffer<VPLStats>(pBufferVPLStats)[0];
+
+    HostTreeBuilder::Desc desc = getHostBuildDesc();
+    desc.enableRefit       = mHostRefit;
+    desc.deterministic     = mDeterministicBuild;
+
+    if (mHostSAHBuild)
+    {
+        // Offline quality build, the refit is based on the LBVH topology.
+        mHostRefitValid = false;
+
+        HostSAHBuilder::Desc sahDesc;
+        sahDesc.approxParams = mApproximationParameters;
+        if (!mpHostSAHBuilder->build(sahDesc, vplData, stats.numVPLs, maxVPLs))
+        {
+            logWarning("VPLTree: Host SAH tree build failed.");
+            return;
+        }
+
+        const auto& nodes = mpHostSAHBuilder->getNodes();
+        const auto& merge = mpHostSAHBuilder->getMerge();
+        pBufferVPLData->setBlob(vplData.data(), 0, std::min(pBufferVPLData->getSize(), vplData.size() * sizeof(VPLData)));
+        mpBufferMerge->setBlob(merge.data(), 0, merge.size() * sizeof(VPLMerge));
+        mpBufferNodes->setBlob(nodes.data(), 0, nodes.size() * sizeof(TreeNode));
+    }
+    else
+    {
+        // Refit if possible, the builder falls back to a full build when the tree quality degrades.
+        const bool tryRefit = mHostRefit && mHostRefitValid;
+        const bool refitted = tryRefit && mpHostTreeBuilder->refit(desc, vplData, stats.numVPLs, maxVPLs);
+        if (!refitted)
+        {
+            // A failed refit leaves the VPL data undefined.
+            if (tryRefit)
+                vplData = readBuffer<VPLData>(pBufferVPLData);
+
+            mHostRefitValid = mpHostTreeBuilder->build(desc, vplData, stats.numVPLs, maxVPLs);
+            if (!mHostRefitValid)
+            {
+                logWarning("VPLTree: Host tree build failed.");
+                return;
+            }
+        }
+
+        // Upload the tree so that the following passes can't tell the difference.
+        const auto& nodes = mpHostTreeBuilder->getNodes();
+        const auto& merge = mpHostTreeBuilder->getMerge();
+        const auto& codes = mpHostTreeBuilder->getCodes();
+        pBufferVPLData->setBlob(vplData.data(), 0, std::min(pBufferVPLData->getSize(), vplData.size() * sizeof(VPLData)));
+        mpBufferMerge->setBlob(merge.data(), 0, merge.size() * sizeof(VPLMerge));
+        if (!refitted) // A refit keeps the topology
+        {
+            mpBufferNodes->setBlob(nodes.data(), 0, nodes.size() * sizeof(TreeNode));
+            if (mCodeLayout.use128Bit)
+            {
+                const auto& codes128 = mpHostTreeBuilder->getCodes128();
+                mpBufferCodes->setBlob(codes128.data(), 0, codes128.size() * sizeof(Key128));
+            }
+            else
+            {
+                mpBufferCodes->setBlob(codes.data(), 0, codes.size() * sizeof(uint64_t));
+            }
+        }
 
-        if (mCheckTree)
-            mTreeIsValid = checkTree(maxVPLs, pBufferVPLData);
+        if (mCheckCodesSorted)
+            mCodesAreSorted = checkCodesSorted(mpBufferCodes);
     }
 
-    passData.getVariable<int>("VPLUpdate") = 0;
+    if (mCheckTree)
+        checkTree(maxVPLs, pBufferVPLData);
+
+    mpDebugPanel->runHostChecks(desc, vplData, stats.numVPLs, maxVPLs, mpScene->getFilename() + ".outofcore");
+
+    if (mAppendBakeVPLs)
+        appendBakeVPLs(vplData, maxVPLs, stats.numPaths);
+}
+
+void VPLTree::clusterVPLsOnHost(PassData& passData, const int maxVPLs)
+{
+    PROFILE("ClusterVPLs");
+
+    StructuredBuffer::SharedPtr pBufferVPLData  = asStructuredBuffer(passData["gVPLData"]);
+    StructuredBuffer::SharedPtr pBufferVPLStats = asStructuredBuffer(passData["gVPLStats"]);
+
+    std::vector<VPLData> vplData = readBuffer<VPLData>(pBufferVPLData);
+    VPLStats stats = readBuffer<VPLStats>(pBufferVPLStats)[0];
+
+    if (mpDebugPanel->isClusteringCheckPending())
+        mpDebugPanel->runClusteringCheck(mClusteringDesc, getHostBuildDesc(), vplData, stats.numVPLs, maxVPLs);
+
+    if (!mClusterVPLs)
+        return;
+
+    // The leaves are compacted, numPaths is unchanged because the radiance of the merged VPLs is summed
+    stats.numVPLs = clusterVPLs(mClusteringDesc, vplData, maxVPLs, mClusteringStats);
+
+    std::vector<float3> positions(maxVPLs, float3(FLT_MAX));
+    for (int i = 0; i < stats.numVPLs; i++)
+        positions[i] = vplData[i].getPosW();
+
+    pBufferVPLData->setBlob(vplData.data(), 0, (size_t)maxVPLs * sizeof(VPLData));
+    asStructuredBuffer(passData["gVPLPositions"])->setBlob(positions.data(), 0, positions.size() * sizeof(float3));
+    pBufferVPLStats->setBlob(&stats, 0, sizeof(VPLStats));
 }
 
 void VPLTree::onGuiRender(Gui* pGui)
 {
+    if (mpTreeCache)
+    {
+        pGui->addText(("Tree cache loaded in " + std::to_string(mTreeCacheUploadTime) + " ms").c_str());
+        pGui->addTooltip(mpTreeCache->getFilename().c_str(), true);
+        if (pGui->addButton("Unload tree cache"))
+            setTreeCache(nullptr);
+        pGui->addTooltip("Traces and builds the VPLs every frame again", true);
+        if (mpTreeCache && pGui->addButton("Verify tree cache", true))
+            mRunTreeCacheVerify = true;
+        if (mRunTreeCacheVerify)
+        {
+            mTreeCacheValid = mpTreeCache->verify();
+            mRunTreeCacheVerify = false;
+        }
+        if (mpTreeCache && mTreeCacheValid)
+            pGui->addText("Valid", true);
+        return;
+    }
+
+    if (pGui->addButton("Save tree cache"))
+        mSaveTreeCache = true;
+    pGui->addTooltip(("Writes the VPLs and the tree of the next build to " + getTreeCacheFilename()).c_str(), true);
+    if (pGui->addButton("Load tree cache", true))
+    {
+        std::string filename;
+        if (mpScene && openFileDialog({ { kTreeCacheExtension, "SST cache files" } }, filename))
+            loadTreeCache(filename);
+    }
+    pGui->addCheckBox("Load tree cache with scene", mAutoLoadTreeCache);
+    pGui->addTooltip("Loads <scene>.sstcache if it exists and matches the scene. Skips VPL tracing and tree building", true);
+
     pGui->addCheckBox("Update tree", mUpdateTree);
+    pGui->addCheckBox("Cluster VPLs", mClusterVPLs);
+    pGui->addTooltip("Merges VPLs in the same grid cell with the same direction code before the build. Radiance is summed, so no energy is lost", true);
+    if (mClusterVPLs || mpDebugPanel->getClusteringCheck().numInputVPLs > 0)
+    {
+        pGui->addFloatVar("Cluster cell size", mClusteringDesc.cellSize, 1e-5f, 0.1f, 1e-4f, false, "%.5f");
+        pGui->addTooltip("Edge of the grid cells relative to the diagonal of the VPL bounds", true);
+        int numSphereSections = (int)mClusteringDesc.numSphereSections;
+        if (pGui->addIntVar("Cluster sphere sections", numSphereSections, 0, 4))
+            mClusteringDesc.numSphereSections = (uint32_t)numSphereSections;
+        pGui->addIntVar("Cluster target VPLs", mClusteringDesc.targetVPLs, 0);
+        pGui->addTooltip("Doubles the cell size until at most this many VPLs remain. 0: fixed cell size", true);
+    }
+    if (mClusterVPLs)
+    {
+        pGui->addText(("  " + std::to_string(mClusteringStats.numInputVPLs) + " -> " + std::to_string(mClusteringStats.numVPLs) + " VPLs, " +
+            std::to_string(mClusteringStats.time) + " ms").c_str());
+        pGui->addText(("  largest cluster " + std::to_string(mClusteringStats.largestCluster) + ", cell " + std::to_string(mClusteringStats.cellSize)).c_str());
+    }
+    pGui->addCheckBox("Deterministic build", mDeterministicBuild);
+    pGui->addTooltip("Merges every node as (left child, right child) so that the tree has the same bytes regardless of the thread scheduling", true);
+    pGui->addCheckBox("Build tree on CPU", mUseHostBuilder);
+    pGui->addTooltip("Builds the SST with the multithreaded host builder and uploads the result", true);
+    if (mUseHostBuilder)
+    {
+        const auto& timings = mpHostTreeBuilder->getTimings();
+        pGui->addText(("Host build     = " + std::to_string(timings.total) + " ms").c_str());
+        pGui->addText(("  codes/sort   = " + std::to_string(timings.computeCodes) + " / " + std::to_string(timings.sortCodes) + " ms").c_str());
+        pGui->addText(("  nodes/merge  = " + std::to_string(timings.internalNodes) + " / " + std::to_string(timings.mergeNodes) + " ms").c_str());
+        pGui->addCheckBox("Refit tree", mHostRefit);
+        pGui->addTooltip("Keeps the topology and only updates the nodes above changed VPLs. Rebuilds when the tree quality degrades", true);
+        if (mHostRefit)
+        {
+            const auto& refitStats = mpHostTreeBuilder->getRefitStats();
+            pGui->addText(("  refit        = " + std::to_string(refitStats.time) + " ms, " + std::to_string(refitStats.numDirtyLeaves) + " dirty VPLs").c_str());
+            pGui->addText(("  refits/cost  = " + std::to_string(refitStats.numRefits) + " / " + std::to_string(refitStats.costRatio)).c_str());
+        }
+        pGui->addCheckBox("High quality build (SAH)", mHostSAHBuild);
+        pGui->addTooltip("Splits the VPLs by intensity, extent and normal spread instead of the morton order. Slow, meant for static scenes", true);
+        if (mHostSAHBuild)
+        {
+            pGui->addText(("  SAH build    = " + std::to_string(mpHostSAHBuilder->getBuildTime()) + " ms").c_str());
+        }
+        if (pGui->addButton("Append VPLs to bake input"))
+            mAppendBakeVPLs = true;
+        pGui->addTooltip(("Appends the VPLs of the next build to " + getBakeVPLFilename() + ". Bake them with \"SSTDemo.exe -outOfCoreBuild <vpls> <tree> [memoryMB]\"").c_str(), true);
+        pGui->addCheckBox("Use AVX2 code kernels", mHostUseSimd);
+    }
+
+    pGui->addCheckBox("Use direction code LUT", mUseDirCodeLUT);
+    pGui->addTooltip("Looks up the direction codes in a baked octahedral map instead of running the subdivision loop", true);
+    if (mUseDirCodeLUT)
+    {
+        pGui->addIntVar("LUT resolution", mDirCodeLUTResolution, 64, 4096);
+        pGui->addText(("LUT mismatches = " + std::to_string(mDirCodeLUTMismatchRate * 100.f) + " %").c_str());
+    }
+
+    pGui->addCheckBox("Tight code bounds", mUseTightBounds);
+    pGui->addTooltip("Computes the morton codes in the bounds of the valid VPLs instead of the scene bounds", true);
+    if (pGui->addInt3Var("Morton bits (xyz)", mMortonBits, 1, (int)kMaxMortonBitsPerAxis))
+        mUpdateTree = true;
+    pGui->addTooltip("Morton code bits per axis. Switches to 128bit codes if the id of maxVPLs doesn't fit into 64bit codes anymore", true);
+    pGui->addCheckBox("Force 128bit codes", mForce128BitCodes);
+    if (mCodeLayout.valid)
+    {
+        pGui->addText(("Codes = " + std::string(mCodeLayout.use128Bit ? "128" : "64") + " bit, " + std::to_string(mCodeLayout.numMortonBits) + " morton / "
+            + std::to_string(mCodeLayout.numDirBits) + " dir / " + std::to_string(mCodeLayout.numIdBits) + " id bits").c_str());
+    }
 
     pGui->addText("Approximation Parameters");
 
     pGui->addFloatVar("min normal score", mApproximationParameters.minNormalScore, 0.f, 1.f);
     pGui->addFloatVar("max normal z std", mApproximationParameters.maxNormalZStd, 0.f, 1.f);
+    pGui->addFloatVar("tuning error tolerance", mApproxTuningTolerance, 0.f, 1.f);
+    pGui->addTooltip("Quality target of the tuning: error at most (1 + tolerance) times the error without early stops", true);
+    if (pGui->addButton("Tune approximation parameters"))
+        mRunApproxTuning = true;
+    pGui->addTooltip("Rebuilds the current VPLs on the host for a grid of thresholds, samples them at G-buffer pixels and selects the cheapest setting that meets the quality target", true);
+    if (mApproxTuning.numReceivers > 0)
+    {
+        uint32_t numPareto = 0;
+        for (const auto& point : mApproxTuning.points) numPareto += point.pareto ? 1 : 0;
+        const ApproxTuningPoint& selected = mApproxTuning.selected >= 0 ? mApproxTuning.points[mApproxTuning.selected] : mApproxTuning.fullDepth;
+        pGui->addText(("  full depth: " + std::to_string(mApproxTuning.fullDepth.avgSteps) + " steps, error " + std::to_string(mApproxTuning.fullDepth.error)).c_str());
+        pGui->addText(("  selected:   " + std::to_string(selected.avgSteps) + " steps, error " + std::to_string(selected.error)).c_str());
+        pGui->addText(("  " + std::to_string(numPareto) + " Pareto optimal of " + std::to_string(mApproxTuning.points.size()) + " settings").c_str());
+    }
+    if (mpScene && pGui->addButton("Save parameters to scene"))
+        saveApproxParamsToScene();
+    pGui->addTooltip("Stores the approximation parameters in the user section of the .fscene file, they are applied when the scene is loaded", true);
 
     pGui->addCheckBox("Show VPL stats", mShowStats);
     if (mShowStats)
@@ -270,10 +654,16 @@ void VPLTree::onGuiRender(Gui* pGui)
         pGui->addText(("Num Paths = " + std::to_string(mVPLStats.numPaths)).c_str());
     }
     pGui->addCheckBox("Check tree", mCheckTree);
-    pGui->addTooltip("Verifies the SST (VERY SLOW!)", true);
+    pGui->addTooltip("Validates topology, subtree counts, bounds, intensities and early stops of the SST on all threads", true);
     if (mCheckTree)
     {
-        pGui->addText(mTreeIsValid ? "Valid" : "Invalid", true);
+        const TreeValidationResult& v = mTreeValidation;
+        pGui->addText(v.valid ? "Valid" : "Invalid", true);
+        pGui->addText(("  nodes/leaves = " + std::to_string(v.numNodes) + " / " + std::to_string(v.numLeaves) + ", depth " + std::to_string(v.maxDepth)).c_str());
+        pGui->addText(("  cut nodes    = " + std::to_string(v.numCutNodes) + ", coverage " + std::to_string(v.earlyStopCoverage)).c_str());
+        pGui->addText(("  validation   = " + std::to_string(v.time) + " ms").c_str());
+        if (!v.valid)
+            pGui->addTooltip(to_string(v).c_str(), true);
     }
     pGui->addCheckBox("Check codes sorted", mCheckCodesSorted);
     pGui->addTooltip("Simply checks if the codes are sorted (SLOW!)", true);
@@ -281,9 +671,397 @@ void VPLTree::onGuiRender(Gui* pGui)
     {
         pGui->addText(mCodesAreSorted ? "Valid" : "Invalid", true);
     }
+
+    if (pGui->beginGroup("Checks and benchmarks"))
+    {
+        mpDebugPanel->renderGui(pGui, mUseHostBuilder);
+        pGui->endGroup();
+    }
 }
 
 void VPLTree::setScene(RenderContext* pRenderContext, const Scene::SharedPtr& pScene)
 {
     mpScene = pScene;
+
+    setTreeCache(nullptr);
+    if (mpScene && mAutoLoadTreeCache && doesFileExist(getTreeCacheFilename()))
+        loadTreeCache(getTreeCacheFilename());
+
+    mApproxTuning = ApproxTuningResult();
+    if (mpScene)
+        loadApproxParamsFromScene();
+}
+
+uint64_t VPLTree::computeSceneHash() const
+{
+    // Everything the VPLs and the codes depend on: bounds, geometry layout, instance transforms and lights.
+    // Vertex data is not read back, edited meshes with the same counts need a new cache.
+    auto hashValue = [](const auto& value, uint64_t hash) { return hashTreeCacheBytes(&value, sizeof(value), hash); };
+
+    const float3 sceneBounds[2] = { mpScene->getBoundingBox().getMinPos(), mpScene->getBoundingBox().getMaxPos() };
+    uint64_t hash = hashTreeCacheBytes(sceneBounds, sizeof(sceneBounds));
+
+    for (uint32_t modelId = 0; modelId < mpScene->getModelCount(); modelId++)
+    {
+        const Model* pModel = mpScene->getModel(modelId).get();
+        for (uint32_t meshId = 0; meshId < pModel->getMeshCount(); meshId++)
+        {
+            hash = hashValue(pModel->getMesh(meshId)->getVertexCount(), hash);
+            hash = hashValue(pModel->getMesh(meshId)->getIndexCount(), hash);
+            for (uint32_t i = 0; i < pModel->getMeshInstanceCount(meshId); i++)
+                hash = hashValue(pModel->getMeshInstance(meshId, i)->getTransformMatrix(), hash);
+        }
+        for (uint32_t i = 0; i < mpScene->getModelInstanceCount(modelId); i++)
+            hash = hashValue(mpScene->getModelInstance(modelId, i)->getTransformMatrix(), hash);
+    }
+
+    for (uint32_t i = 0; i < mpScene->getLightCount(); i++)
+    {
+        const LightData& data = mpScene->getLight(i)->getData();
+        hash = hashValue(data.type, hash);
+        hash = hashValue(data.posW, hash);
+        hash = hashValue(data.dirW, hash);
+        hash = hashValue(data.intensity, hash);
+        hash = hashValue(data.openingAngle, hash);
+        hash = hashValue(data.penumbraAngle, hash);
+    }
+
+    for (uint32_t i = 0; i < mpScene->getAreaLightCount(); i++)
+    {
+        const AreaLight* pAreaLight = mpScene->getAreaLight(i).get();
+        const AreaLightData& data = pAreaLight->getAreaLightData();
+        hash = hashValue(data.posW, hash);
+        hash = hashValue(data.dirW, hash);
+        hash = hashValue(data.intensity, hash);
+        hash = hashValue(data.surfaceArea, hash);
+        if (pAreaLight->getModelInstance())
+            hash = hashValue(pAreaLight->getModelInstance()->getTransformMatrix(), hash);
+    }
+
+    return hash;
+}
+
+std::string VPLTree::getTreeCacheFilename() const
+{
+    return mpScene ? mpScene->getFilename() + "." + kTreeCacheExtension : std::string();
+}
+
+std::string VPLTree::getBakeVPLFilename() const
+{
+    return mpScene ? mpScene->getFilename() + "." + kBakeVPLExtension : std::string();
+}
+
+void VPLTree::appendBakeVPLs(const std::vector<VPLData>& vplData, const int maxVPLs, const int numPaths)
+{
+    mAppendBakeVPLs = false;
+
+    // The path count goes into the segment file, the out-of-core build rescales every trace by its share of all paths
+    const std::string filename = getBakeVPLFilename();
+    const int numAppended = appendVPLFile(filename, vplData, maxVPLs, (uint32_t)std::max(numPaths, 0));
+    if (numAppended >= 0)
+        logInfo("VPLTree: Appended " + std::to_string(numAppended) + " VPLs of " + std::to_string(numPaths) + " paths to '" + filename + "'.");
+}
+
+void VPLTree::loadTreeCache(const std::string& filename)
+{
+    MappedTreeCache::SharedPtr pCache = MappedTreeCache::open(filename);
+    if (!pCache)
+        return;
+
+    if (pCache->getHeader().sceneHash != computeSceneHash())
+    {
+        logWarning("VPLTree: Tree cache '" + filename + "' was built for a different scene or lighting.");
+        return;
+    }
+
+    setTreeCache(pCache);
+}
+
+void VPLTree::setTreeCache(const MappedTreeCache::SharedPtr& pCache)
+{
+    mpTreeCache = pCache;
+    mTreeCacheUploaded = false;
+    mTreeCacheValid = false;
+
+    // The VPL tracing pass runs before this one, the flag has to be set before the next frame to skip its tracing
+    if (mpPassData)
+        mpPassData->getVariable<int>("VPLCacheActive") = mpTreeCache ? 1 : 0;
+}
+
+bool VPLTree::uploadTreeCache(PassData& passData)
+{
+    PROFILE("UploadTreeCache");
+
+    const auto t0 = CpuTimer::getCurrentTimePoint();
+    const TreeCacheHeader& header = mpTreeCache->getHeader();
+    const int maxVPLs = passData.getVariable<int>("maxVPLs");
+    if (header.maxVPLs != maxVPLs)
+    {
+        logWarning("VPLTree: Tree cache '" + mpTreeCache->getFilename() + "' holds " + std::to_string(header.maxVPLs) +
+            " VPLs, set Max #VPLs of the VPL generation to that and load it again.");
+        return false;
+    }
+
+    StructuredBuffer::SharedPtr pBufferVPLData      = asStructuredBuffer(passData["gVPLData"]);
+    StructuredBuffer::SharedPtr pBufferVPLPositions = asStructuredBuffer(passData["gVPLPositions"]);
+    StructuredBuffer::SharedPtr pBufferVPLStats     = asStructuredBuffer(passData["gVPLStats"]);
+    if (!pBufferVPLData || !pBufferVPLPositions || !pBufferVPLStats)
+    {
+        logWarning("VPLTree: The VPL buffers don't exist, the tree cache can't be uploaded.");
+        return false;
+    }
+    if (pBufferVPLData->getSize() < mpTreeCache->getVPLDataSize() || header.stats.numVPLs > maxVPLs)
+    {
+        logWarning("VPLTree: VPL buffer is too small for the tree cache.");
+        return false;
+    }
+
+    // Restore the build parameters, so the GUI and a following rebuild match the cached tree. Forcing 128bit codes is
+    // only restored if the code bits alone don't select them
+    const uint3 mortonBits = header.mortonBits;
+    const bool force128BitCodes = header.use128BitCodes && !computeTreeCodeLayout(mortonBits, header.numSphereSections, maxVPLs, false).use128Bit;
+    const TreeCodeLayout codeLayout = computeTreeCodeLayout(mortonBits, header.numSphereSections, maxVPLs, force128BitCodes);
+    if (!codeLayout.valid || codeLayout.use128Bit != (header.use128BitCodes != 0))
+    {
+        logWarning("VPLTree: Tree cache '" + mpTreeCache->getFilename() + "' has an invalid code layout.");
+        return false;
+    }
+    mNumSphereSections = header.numSphereSections;
+    mMortonBits = int3(mortonBits);
+    mUseTightBounds = header.useTightBounds != 0;
+    mForce128BitCodes = force128BitCodes;
+    mCodeLayout = codeLayout;
+    mApproximationParameters = header.approxParams;
+    mVPLStats = header.stats;
+    mHostRefitValid = false;
+
+    // The sections have the layout of the buffers, the mapped pages go straight into the upload heap
+    createResources(maxVPLs, mCodeLayout.use128Bit);
+    pBufferVPLData->setBlob(mpTreeCache->getVPLData(), 0, mpTreeCache->getVPLDataSize());
+    pBufferVPLStats->setBlob(&header.stats, 0, sizeof(VPLStats));
+    mpBufferNodes->setBlob(mpTreeCache->getTreeNodes(), 0, mpTreeCache->getTreeNodesSize());
+
+    // The positions aren't cached, they are the positions of the valid leaves like after ResetVPLs and the tracing
+    const VPLData* pLeaves = mpTreeCache->getVPLData();
+    std::vector<float3> positions(maxVPLs, float3(FLT_MAX));
+    for (int i = 0; i < header.stats.numVPLs; i++)
+        positions[i] = pLeaves[i].getPosW();
+    pBufferVPLPositions->setBlob(positions.data(), 0, positions.size() * sizeof(float3));
+
+    // The code bounds go into gBounds as ordered keys like after TreeBounds.cs.slang
+    const uint32_t boundKeys[6] =
+    {
+        float_to_ordered(header.codeMin.x), float_to_ordered(header.codeMin.y), float_to_ordered(header.codeMin.z),
+        ~float_to_ordered(header.codeMax.x), ~float_to_ordered(header.codeMax.y), ~float_to_ordered(header.codeMax.z),
+    };
+    mpBufferBounds->setBlob(boundKeys, 0, sizeof(boundKeys));
+
+    passData.getVariable<int>("numPaths") = header.stats.numPaths;
+    passData.getVariable<int>("VPLUpdate") = 0;
+
+    mTreeCacheUploaded = true;
+    mTreeCacheUploadTime = CpuTimer::calcDuration(t0, CpuTimer::getCurrentTimePoint());
+    logInfo("VPLTree: Loaded tree cache '" + mpTreeCache->getFilename() + "' with " + std::to_string(header.stats.numVPLs) + " VPLs in " +
+        std::to_string(mTreeCacheUploadTime) + " ms");
+    return true;
+}
+
+void VPLTree::saveTreeCache(PassData& passData, const int maxVPLs)
+{
+    mSaveTreeCache = false;
+
+    TreeCacheHeader header;
+    header.maxVPLs           = maxVPLs;
+    header.numSphereSections = mNumSphereSections;
+    header.sceneHash         = computeSceneHash();
+    header.sceneMin          = mpScene->getBoundingBox().getMinPos();
+    header.sceneMax          = mpScene->getBoundingBox().getMaxPos();
+    header.use128BitCodes    = mCodeLayout.use128Bit ? 1 : 0;
+    header.mortonBits        = mCodeLayout.mortonBits;
+    header.useTightBounds    = mUseTightBounds ? 1 : 0;
+    readCodeBounds(header.codeMin, header.codeMax);
+    header.approxParams      = mApproximationParameters;
+    header.stats             = readBuffer<VPLStats>(asStructuredBuffer(passData["gVPLStats"]))[0];
+
+    const std::vector<VPLData> vplData = readBuffer<VPLData>(asStructuredBuffer(passData["gVPLData"]));
+    const std::vector<TreeNode> nodes = readBuffer<TreeNode>(mpBufferNodes);
+
+    const std::string filename = getTreeCacheFilename();
+    if (writeTreeCache(filename, header, vplData, nodes))
+        logInfo("VPLTree: Saved tree cache '" + filename + "'");
+}
+
+void VPLTree::readCodeBounds(float3& codeMin, float3& codeMax) const
+{
+    // The SAH build doesn't compute codes, the scene bounds are the extents of a following LBVH build
+    codeMin = mpScene->getBoundingBox().getMinPos();
+    codeMax = mpScene->getBoundingBox().getMaxPos();
+    if (mUseHostBuilder && !mHostSAHBuild)
+    {
+        codeMin = mpHostTreeBuilder->getCodeMin();
+        codeMax = mpHostTreeBuilder->getCodeMax();
+    }
+    else if (!mUseHostBuilder && mUseTightBounds)
+    {
+        const std::vector<uint32_t> keys = readBuffer<uint32_t>(mpBufferBounds);
+        codeMin = float3(ordered_to_float(keys[0]), ordered_to_float(keys[1]), ordered_to_float(keys[2]));
+        codeMax = float3(ordered_to_float(~keys[3]), ordered_to_float(~keys[4]), ordered_to_float(~keys[5]));
+    }
+}
+
+std::vector<HostShadingPoint> VPLTree::readGBufferReceivers(RenderContext* pRenderContext, PassData& passData, uint32_t maxReceivers) const
+{
+    std::vector<HostShadingPoint> receivers;
+    Texture::SharedPtr pPosW    = asTexture(passData["gPosW"]);
+    Texture::SharedPtr pPacked1 = asTexture(passData["gPacked1"]);
+    Texture::SharedPtr pPacked2 = asTexture(passData["gPacked2"]);
+    if (!pPosW || !pPacked1 || !pPacked2 || maxReceivers == 0)
+        return receivers;
+
+    const std::vector<uint8> posW    = pRenderContext->readTextureSubresource(pPosW.get(), 0);
+    const std::vector<uint8> packed1 = pRenderContext->readTextureSubresource(pPacked1.get(), 0);
+    const std::vector<uint8> packed2 = pRenderContext->readTextureSubresource(pPacked2.get(), 0);
+
+    const uint32_t width  = pPosW->getWidth();
+    const uint32_t height = pPosW->getHeight();
+    const size_t numPixels = (size_t)width * height;
+    if (posW.size() < numPixels * sizeof(glm::vec4) || packed1.size() < numPixels * sizeof(glm::uvec4) || packed2.size() < numPixels * sizeof(glm::uvec4))
+        return receivers;
+
+    const glm::vec4*  pPosData     = reinterpret_cast<const glm::vec4*>(posW.data());
+    const glm::uvec4* pPacked1Data = reinterpret_cast<const glm::uvec4*>(packed1.data());
+    const glm::uvec4* pPacked2Data = reinterpret_cast<const glm::uvec4*>(packed2.data());
+
+    // Regular grid of pixels. See unpackGBufPacked1() and unpackGBufPacked2() in GBufferUtils.slang
+    const uint32_t stride = std::max(1u, (uint32_t)std::ceil(std::sqrt((double)numPixels / maxReceivers)));
+    for (uint32_t y = stride / 2; y < height; y += stride)
+    {
+        for (uint32_t x = stride / 2; x < width; x += stride)
+        {
+            const size_t i = (size_t)y * width + x;
+            if (pPosData[i].w == 0.f)
+                continue; // No geometry
+
+            const float3 emissive = float3(glm::unpackHalf2x16(pPacked1Data[i].z), glm::unpackHalf2x16(pPacked1Data[i].w).x);
+            if (emissive != float3(0.f))
+                continue; // Emissive surfaces don't sample the VPLs
+
+            HostShadingPoint sp;
+            sp.posW    = float3(pPosData[i]);
+            sp.N       = normalize(float3(glm::unpackHalf2x16(pPacked1Data[i].x), glm::unpackHalf2x16(pPacked1Data[i].y).x));
+            sp.diffuse = float3(glm::unpackHalf2x16(pPacked2Data[i].x), glm::unpackHalf2x16(pPacked2Data[i].y).x);
+            receivers.push_back(sp);
+        }
+    }
+    return receivers;
+}
+
+void VPLTree::runApproxTuning(RenderContext* pRenderContext, PassData& passData, const int maxVPLs)
+{
+    mRunApproxTuning = false;
+
+    const std::vector<VPLData> vplData = readBuffer<VPLData>(asStructuredBuffer(passData["gVPLData"]));
+    const VPLStats stats = readBuffer<VPLStats>(asStructuredBuffer(passData["gVPLStats"]))[0];
+    const std::vector<HostShadingPoint> receivers = readGBufferReceivers(pRenderContext, passData, 4096);
+    if (receivers.empty())
+    {
+        logWarning("VPLTree: No G-buffer samples to tune the approximation parameters with.");
+        return;
+    }
+
+    const HostTreeBuilder::Desc desc = getHostBuildDesc();
+
+    ApproxTuningDesc tuningDesc;
+    tuningDesc.errorTolerance = mApproxTuningTolerance;
+    mApproxTuning = tuneApproxParams(desc, vplData, stats.numVPLs, maxVPLs, receivers, tuningDesc);
+    if (mApproxTuning.numReceivers > 0)
+        mApproximationParameters = mApproxTuning.getSelectedParams();
+}
+
+void VPLTree::loadApproxParamsFromScene()
+{
+    // Looked up by index, getUserVariable(name) warns about missing variables
+    for (uint32_t i = 0; i < mpScene->getUserVariableCount(); i++)
+    {
+        std::string name;
+        const Scene::UserVariable& var = mpScene->getUserVariable(i, name);
+
+        float value = 0.f;
+        if (var.type == Scene::UserVariable::Type::Double)    value = (float)var.d64;
+        else if (var.type == Scene::UserVariable::Type::Uint) value = (float)var.u32;
+        else if (var.type == Scene::UserVariable::Type::Int)  value = (float)var.i32;
+        else continue;
+
+        if (name == kUserVarMinNormalScore)
+            mApproximationParameters.minNormalScore = value;
+        else if (name == kUserVarMaxNormalZStd)
+            mApproximationParameters.maxNormalZStd = value;
+    }
+}
+
+bool VPLTree::saveApproxParamsToScene()
+{
+    const std::string& filename = mpScene->getFilename();
+    if (!hasSuffix(filename, ".fscene", false))
+    {
+        logWarning("VPLTree: '" + filename + "' is not a .fscene file, the approximation parameters can't be stored.");
+        return false;
+    }
+
+    // Only the user section is changed, everything else is written back as it was read
+    std::ifstream inFile(filename);
+    std::stringstream contents;
+    contents << inFile.rdbuf();
+
+    rapidjson::Document document;
+    document.Parse(contents.str().c_str());
+    if (!inFile || document.HasParseError() || !document.IsObject())
+    {
+        logWarning("VPLTree: Can't parse '" + filename + "'.");
+        return false;
+    }
+
+    auto& allocator = document.GetAllocator();
+    if (!document.HasMember(kUserDefinedSection))
+    {
+        rapidjson::Value section(rapidjson::kObjectType);
+        document.AddMember(rapidjson::StringRef(kUserDefinedSection), section, allocator);
+    }
+    rapidjson::Value& section = document[kUserDefinedSection];
+    if (!section.IsObject())
+    {
+        logWarning("VPLTree: The user section of '" + filename + "' is not an object.");
+        return false;
+    }
+
+    auto setValue = [&](const char* name, float value)
+    {
+        if (section.HasMember(name))
+        {
+            section[name].SetDouble(value);
+        }
+        else
+        {
+            rapidjson::Value jsonValue((double)value);
+            section.AddMember(rapidjson::StringRef(name), jsonValue, allocator);
+        }
+        mpScene->addUserVariable(name, value);
+    };
+    setValue(kUserVarMinNormalScore, mApproximationParameters.minNormalScore);
+    setValue(kUserVarMaxNormalZStd, mApproximationParameters.maxNormalZStd);
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.SetIndent(' ', 4);
+    document.Accept(writer);
+
+    std::ofstream outFile(filename, std::ios::trunc);
+    outFile.write(buffer.GetString(), (std::streamsize)buffer.GetSize());
+    if (!outFile.good())
+    {
+        logWarning("VPLTree: Writing '" + filename + "' failed.");
+        return false;
+    }
+    logInfo("VPLTree: Stored the approximation parameters in '" + filename + "'");
+    return true;
 }
@@ -7,6 +7,15 @@
 #include "Passes/Shared/VPLData.h"
 #include "Passes/Shared/VPLTreeStructs.h"
 #include "Sort/BitonicSort.h"
+#include "Host/HostTreeBuilder.h"
+#include "Host/HostSAHBuilder.h"
+#include "Host/HostTreeValidation.h"
+#include "Host/HostTreeCache.h"
+#include "Host/HostApproxTuner.h"
+#include "Host/HostOutOfCoreBuilder.h"
+#include "Host/HostVPLClustering.h"
+#include "Host/HostSelfTest.h"
+#include "VPLTreeDebugPanel.h"
 
 using namespace Falcor;
 
@@ -33,21 +42,53 @@ public:
 private:
     VPLTree();
     void createPrograms();
-    void createResources(const int maxVPLs);
+    void createResources(const int maxVPLs, const bool use128BitCodes);
     bool checkCodesSorted(StructuredBuffer::SharedPtr pBufferCodes);
     bool checkTree(const int rootNodeIndex, StructuredBuffer::SharedPtr pBufferVPLData);
+    void buildTreeOnGpu(RenderContext* pRenderContext, PassData& passData, const int maxVPLs);
+    void buildTreeOnHost(PassData& passData, const int maxVPLs);
+    HostTreeBuilder::Desc getHostBuildDesc() const;
+
+    /** Rebuilds the current VPLs on the GPU for the determinism check of the debug panel and compares the hashes of the trees.
+    */
+    void checkDeterministicGpuBuild(RenderContext* pRenderContext, PassData& passData, const int maxVPLs);
+    void updateDirCodeLUT();
+
+    /** On-disk tree cache. A loaded cache replaces VPL tracing and tree building until it is unloaded.
+    */
+    uint64_t computeSceneHash() const;
+    std::string getTreeCacheFilename() const;
+    void loadTreeCache(const std::string& filename);
+    void setTreeCache(const MappedTreeCache::SharedPtr& pCache);
+    bool uploadTreeCache(PassData& passData);
+    void saveTreeCache(PassData& passData, const int maxVPLs);
+    void readCodeBounds(float3& codeMin, float3& codeMax) const;
+
+    /** Input of offline out-of-core bakes, raw VPLData records of the valid leaves of many builds and their path counts.
+    */
+    std::string getBakeVPLFilename() const;
+    void appendBakeVPLs(const std::vector<VPLData>& vplData, const int maxVPLs, const int numPaths);
+
+    /** Merges co-located VPLs on the host before the build and uploads the compacted leaves and stats.
+    */
+    void clusterVPLsOnHost(PassData& passData, const int maxVPLs);
+
+    /** Early stop threshold tuning on the current VPLs and G-buffer. Tuned thresholds are stored in the user section of the scene file.
+    */
+    std::vector<HostShadingPoint> readGBufferReceivers(RenderContext* pRenderContext, PassData& passData, uint32_t maxReceivers) const;
+    void runApproxTuning(RenderContext* pRenderContext, PassData& passData, const int maxVPLs);
+    void loadApproxParamsFromScene();
+    bool saveApproxParamsToScene();
 
     // Internal state
     Scene::SharedPtr mpScene;
     unsigned int mNumSphereSections = 3;
 
-    const unsigned int mNumBitsMortonCode = 30;
-    unsigned int mNumBitsDirCode;
-    unsigned int mNumBitsIdCode;
-
-    unsigned int mBeginMortonCode;
-    unsigned int mBeginDirCode;
-    unsigned int mBeginIdCode = 0;
+    // Sort codes
+    int3 mMortonBits = int3(10);       ///< Morton code bits per axis.
+    bool mUseTightBounds = true;       ///< Compute the morton codes in the bounds of the valid VPLs instead of the scene bounds.
+    bool mForce128BitCodes = false;
+    TreeCodeLayout mCodeLayout;
 
     TreeApproxParams mApproximationParameters;
     VPLStats mVPLStats;
@@ -56,9 +97,20 @@ private:
     bool mCheckCodesSorted = false;
     bool mCheckTree        = false;
     bool mShowStats        = false;
+    bool mUseHostBuilder   = false;
+    bool mHostUseSimd      = true;
+    bool mUseDirCodeLUT    = false;
+    bool mHostRefit        = false;
+    bool mHostRefitValid   = false;
+    bool mHostSAHBuild     = false;
+    bool mDeterministicBuild = false;
+    bool mAppendBakeVPLs = false;
+    bool mClusterVPLs = false;
+
+    int mDirCodeLUTResolution = 512;
+    float mDirCodeLUTMismatchRate = 0.f;
 
     bool mCodesAreSorted = false;
-    bool mTreeIsValid    = false;
 
     // Tree build compute shaders
     ComputeState::SharedPtr   mpComputeState;
@@ -66,6 +118,9 @@ private:
     ComputeProgram::SharedPtr mpInitProgram;
     ComputeVars::SharedPtr    mpInitVars;
 
+    ComputeProgram::SharedPtr mpBoundsProgram;
+    ComputeVars::SharedPtr    mpBoundsVars;
+
     ComputeProgram::SharedPtr mpCodeProgram;
     ComputeVars::SharedPtr    mpCodeVars;
 
@@ -81,11 +136,46 @@ private:
     Program::DefineList mProgramDefineList;
 
     // Tree building buffers
-    StructuredBuffer::SharedPtr mpBufferCodes;
+    StructuredBuffer::SharedPtr mpBufferCodes;     ///< One element per code, two with 128bit codes.
+    StructuredBuffer::SharedPtr mpBufferBounds;
     StructuredBuffer::SharedPtr mpBufferNodes;
     StructuredBuffer::SharedPtr mpBufferMerge;
 
     int mBufferMaxVPLs = -1;
+    bool mBuffer128BitCodes = false;
 
     BitonicSort::SharedPtr mpBitonicSort;
+
+    // Direction code lookup table
+    HostDirectionCodeLUT::SharedPtr mpDirCodeLUT;
+    Texture::SharedPtr mpDirCodeLUTTexture;
+
+    // Host tree building
+    HostTreeBuilder::SharedPtr mpHostTreeBuilder;
+    HostSAHBuilder::SharedPtr mpHostSAHBuilder;
+
+    // VPL clustering before the build
+    VPLClusteringDesc mClusteringDesc;
+    VPLClusteringStats mClusteringStats;
+
+    // Tree validation
+    TreeValidationResult mTreeValidation;
+
+    // Host checks and benchmarks
+    VPLTreeDebugPanel::SharedPtr mpDebugPanel;
+
+    // On-disk tree cache
+    PassData* mpPassData = nullptr;     // Shared pass data of SSTDemo, sets VPLCacheActive outside of onFrameRender()
+    MappedTreeCache::SharedPtr mpTreeCache;
+    bool mTreeCacheUploaded = false;
+    bool mSaveTreeCache = false;
+    bool mAutoLoadTreeCache = true;
+    bool mRunTreeCacheVerify = false;
+    bool mTreeCacheValid = false;
+    float mTreeCacheUploadTime = 0.f;
+
+    // Early stop threshold tuning
+    bool mRunApproxTuning = false;
+    float mApproxTuningTolerance = 0.05f;
+    ApproxTuningResult mApproxTuning;
 };
@@ -0,0 +1,256 @@
+// Host checks and benchmarks of the VPLTree pass, see VPLTreeDebugPanel.h
+
+#include "VPLTreeDebugPanel.h"
+#include "Host/HostCodesSimd.h"
+
+namespace
+{
+    const uint32_t kNumDeterminismBuilds = 100;    // Builds per merge order of the determinism check
+}
+
+VPLTreeDebugPanel::SharedPtr VPLTreeDebugPanel::create()
+{
+    SharedPtr pPanel = SharedPtr(new VPLTreeDebugPanel());
+    return pPanel;
+}
+
+void VPLTreeDebugPanel::runHostChecks(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, const std::string& outOfCoreFilename)
+{
+    if (mRunRefitBenchmark)
+    {
+        mRefitBenchmarkResults = benchmarkRefit(desc, vplData, numVPLs, maxVPLs);
+        mRunRefitBenchmark = false;
+    }
+
+    if (mRunTreeBenchmark)
+    {
+        TreeBenchmarkDesc benchmarkDesc;
+        benchmarkDesc.buildDesc = desc;
+        benchmarkDesc.maxLog2Size = (uint32_t)mTreeBenchmarkMaxLog2Size;
+        const bool success = runTreeBenchmark(benchmarkDesc, mTreeBenchmarkResults);
+        mRunTreeBenchmark = false;
+
+        std::string filename;
+        if (success && !mTreeBenchmarkResults.empty() && saveFileDialog({ { "json", "Benchmark results" } }, filename))
+            writeTreeBenchmarkJson(filename, benchmarkDesc, mTreeBenchmarkResults);
+    }
+
+    if (mRunBuilderComparison)
+    {
+        mBuilderComparison = compareTreeBuilders(desc, vplData, numVPLs, maxVPLs);
+        mRunBuilderComparison = false;
+    }
+
+    if (mCheckSimdCodes)
+        mSimdCodesValid = checkCodeKernels(1 << 16, desc.numSphereSections) == 0;
+
+    if (mRunWideComparison)
+    {
+        mWideComparison = compareWideTraversal(vplData, maxVPLs);
+        mRunWideComparison = false;
+    }
+
+    if (mRunCompressedCheck)
+    {
+        mCompressedCheck = checkCompressedTree(vplData, maxVPLs);
+        mRunCompressedCheck = false;
+    }
+
+    if (mRunPacketSamplerCheck)
+    {
+        mPacketSamplerCheck = checkPacketSampler(vplData, maxVPLs);
+        mRunPacketSamplerCheck = false;
+    }
+
+    if (mRunGroupSamplingCheck)
+    {
+        mGroupSamplingCheck = checkGroupSampling(vplData, maxVPLs);
+        mRunGroupSamplingCheck = false;
+    }
+
+    if (mRunDeterminismCheck)
+    {
+        mDeterminismCheck = checkDeterministicBuild(desc, vplData, numVPLs, maxVPLs, kNumDeterminismBuilds);
+        mRunDeterminismCheck = false;
+    }
+
+    if (mRunOrientationConeCheck)
+    {
+        mOrientationConeCheck = checkOrientationCones(vplData, maxVPLs);
+        mRunOrientationConeCheck = false;
+    }
+
+    if (mRunTileCutCheck)
+    {
+        mTileCutCheck = checkTileCuts(vplData, maxVPLs);
+        mRunTileCutCheck = false;
+    }
+
+    if (mRunShadowRayBinningCheck)
+    {
+        mShadowRayBinningCheck = checkShadowRayBinning(vplData, maxVPLs);
+        mRunShadowRayBinningCheck = false;
+    }
+
+    if (mRunOutOfCoreCheck)
+    {
+        mOutOfCoreCheck = checkOutOfCoreBuild(desc, vplData, numVPLs, maxVPLs, outOfCoreFilename);
+        mRunOutOfCoreCheck = false;
+    }
+}
+
+void VPLTreeDebugPanel::runClusteringCheck(const VPLClusteringDesc& clusteringDesc, const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs)
+{
+    mClusteringCheck = checkVPLClustering(clusteringDesc, desc, vplData, numVPLs, maxVPLs);
+    mRunClusteringCheck = false;
+}
+
+void VPLTreeDebugPanel::runDeterminismCheck(const HashedBuildFunc& build, const std::string& name)
+{
+    mDeterminismCheck = checkDeterministicBuild(build, kNumDeterminismBuilds, name);
+    mRunDeterminismCheck = false;
+}
+
+void VPLTreeDebugPanel::renderGui(Gui* pGui, bool hostBuilder)
+{
+    if (pGui->addButton("Check VPL clustering"))
+        mRunClusteringCheck = true;
+    pGui->addTooltip("Clusters a copy of the VPLs, checks that the summed radiance is unchanged, validates the tree and compares build time, depth and the exact irradiance at receivers near the VPLs", true);
+    if (mClusteringCheck.numInputVPLs > 0)
+    {
+        pGui->addText(mClusteringCheck.valid ? "  Valid" : "  Invalid");
+        pGui->addText(("  energy error " + std::to_string(std::max(mClusteringCheck.intensityError, mClusteringCheck.colorError)) +
+            ", irradiance error " + std::to_string(mClusteringCheck.irradianceError)).c_str());
+        pGui->addText(("  build " + std::to_string(mClusteringCheck.buildTime) + " -> " + std::to_string(mClusteringCheck.clusteredBuildTime) + " ms, depth " +
+            std::to_string(mClusteringCheck.depth) + " -> " + std::to_string(mClusteringCheck.clusteredDepth)).c_str());
+    }
+
+    if (pGui->addButton("Check deterministic build"))
+        mRunDeterminismCheck = true;
+    pGui->addTooltip(("Builds the current VPLs " + std::to_string(kNumDeterminismBuilds) + " times with the default and the deterministic merge order and hashes the trees. Uses the GPU or the host builder, whichever is active").c_str(), true);
+    if (mDeterminismCheck.numBuilds > 0)
+    {
+        pGui->addText(mDeterminismCheck.valid ? "  Valid" : "  Invalid");
+        pGui->addText(("  " + std::to_string(mDeterminismCheck.numHashes) + " distinct trees in " + std::to_string(mDeterminismCheck.numBuilds) + " builds (default order " + std::to_string(mDeterminismCheck.numDefaultHashes) + ")").c_str());
+        pGui->addText(("  build " + std::to_string(mDeterminismCheck.defaultTime) + " -> " + std::to_string(mDeterminismCheck.time) + " ms").c_str());
+    }
+
+    if (!hostBuilder)
+    {
+        pGui->addText("Enable \"Build tree on CPU\" for the host checks");
+        return;
+    }
+
+    if (pGui->addButton("Benchmark refit"))
+        mRunRefitBenchmark = true;
+    for (const auto& result : mRefitBenchmarkResults)
+    {
+        pGui->addText(("  " + std::to_string(result.dirtyFraction * 100.f) + " %: refit " + std::to_string(result.refitTime) + " ms, build " + std::to_string(result.buildTime) + " ms").c_str());
+    }
+    pGui->addIntVar("Benchmark max size (log2)", mTreeBenchmarkMaxLog2Size, 10, 24);
+    if (pGui->addButton("Benchmark build scaling"))
+        mRunTreeBenchmark = true;
+    pGui->addTooltip("Builds synthetic VPL distributions from 2^10 VPLs to the max size and saves stage times, memory and tree quality as JSON", true);
+    if (!mTreeBenchmarkResults.empty())
+    {
+        const auto& last = mTreeBenchmarkResults.back();
+        pGui->addText(("  " + std::to_string(last.numVPLs) + " VPLs: " + std::to_string(last.timings.total) + " ms, " + std::to_string(last.buildMemory >> 20) + " MB").c_str());
+    }
+    if (pGui->addButton("Compare builders"))
+        mRunBuilderComparison = true;
+    pGui->addTooltip("Samples the LBVH and the SAH tree on the host and compares traversal steps and error", true);
+    if (mBuilderComparison.lbvhBuildTime > 0.f)
+    {
+        pGui->addText(("  LBVH: " + std::to_string(mBuilderComparison.lbvhSteps) + " steps, error " + std::to_string(mBuilderComparison.lbvhError)).c_str());
+        pGui->addText(("  SAH:  " + std::to_string(mBuilderComparison.sahSteps) + " steps, error " + std::to_string(mBuilderComparison.sahError)).c_str());
+    }
+    if (pGui->addButton("Compare 4-wide traversal"))
+        mRunWideComparison = true;
+    pGui->addTooltip("Collapses the tree into 4-wide nodes and compares the host traversal against the binary one", true);
+    if (mWideComparison.binarySteps > 0.f)
+    {
+        pGui->addText(("  binary: " + std::to_string(mWideComparison.binarySteps) + " steps, " + std::to_string(mWideComparison.binaryBytes) + " bytes").c_str());
+        pGui->addText(("  4-wide: " + std::to_string(mWideComparison.wideSteps) + " steps, " + std::to_string(mWideComparison.wideBytes) + " bytes").c_str());
+    }
+    if (pGui->addButton("Check compressed nodes"))
+        mRunCompressedCheck = true;
+    pGui->addTooltip("Encodes the tree into 32 byte nodes, checks the quantization errors and compares the host traversal against the binary one", true);
+    if (mCompressedCheck.numNodes > 0)
+    {
+        pGui->addText(mCompressedCheck.valid ? "  Valid" : "  Invalid");
+        pGui->addText(("  memory: " + std::to_string(mCompressedCheck.binarySize >> 10) + " KB -> " + std::to_string(mCompressedCheck.compressedSize >> 10) + " KB").c_str());
+        pGui->addText(("  per sample: " + std::to_string(mCompressedCheck.binaryBytesPerSample) + " -> " + std::to_string(mCompressedCheck.compressedBytesPerSample) + " bytes").c_str());
+    }
+    if (pGui->addButton("Check packet sampler"))
+        mRunPacketSamplerCheck = true;
+    pGui->addTooltip("Samples the tree with the AVX2 packet traversal and compares it against the scalar host port of sampleVPLTree()", true);
+    if (mPacketSamplerCheck.numSamples > 0)
+    {
+        pGui->addText(("  " + std::to_string(mPacketSamplerCheck.numMismatches) + " mismatches in " + std::to_string(mPacketSamplerCheck.numSamples) + " samples").c_str());
+        pGui->addText(("  scalar/packets = " + std::to_string(mPacketSamplerCheck.scalarTime) + " / " + std::to_string(mPacketSamplerCheck.packetTime) + " ms").c_str());
+    }
+    if (pGui->addButton("Check group sampling"))
+        mRunGroupSamplingCheck = true;
+    pGui->addTooltip("Compares node evaluations per pixel and error of independent and grouped traversal at 4, 8 and 16 samples", true);
+    for (const auto& entry : mGroupSamplingCheck.entries)
+    {
+        pGui->addText(("  " + std::to_string(entry.numSamples) + " spp: " + std::to_string(entry.independentEvals) + " -> " + std::to_string(entry.groupEvals) + " evals").c_str());
+        pGui->addText(("    error " + std::to_string(entry.independentError) + " -> " + std::to_string(entry.groupError)).c_str());
+    }
+    if (pGui->addButton("Check orientation cones"))
+        mRunOrientationConeCheck = true;
+    pGui->addTooltip("Samples the tree with and without the emitter cosine bound of the node cones and counts the shadow rays towards nodes without contribution", true);
+    if (mOrientationConeCheck.numReceivers > 0)
+    {
+        pGui->addText(mOrientationConeCheck.valid ? "  Valid" : "  Invalid");
+        pGui->addText(("  culled VPLs " + std::to_string(mOrientationConeCheck.culledVPLs) + " of " + std::to_string(mOrientationConeCheck.backFacingVPLs) + " back-facing").c_str());
+        pGui->addText(("  wasted rays " + std::to_string(mOrientationConeCheck.wastedRays) + " -> " + std::to_string(mOrientationConeCheck.coneWastedRays)).c_str());
+        pGui->addText(("  error " + std::to_string(mOrientationConeCheck.error) + " -> " + std::to_string(mOrientationConeCheck.coneError)).c_str());
+    }
+    if (pGui->addButton("Check tile cuts"))
+        mRunTileCutCheck = true;
+    pGui->addTooltip("Samples pixel tiles on the surfaces near the VPLs from the root and from 8x8 and 16x16 tile cuts and compares node fetches and error", true);
+    if (mTileCutCheck.numTiles > 0)
+    {
+        pGui->addText(mTileCutCheck.valid ? "  Valid" : "  Invalid");
+        for (const auto& entry : mTileCutCheck.entries)
+        {
+            pGui->addText(("  " + std::to_string(entry.tileSize) + "x" + std::to_string(entry.tileSize) + ": " + std::to_string(entry.rootFetches) + " -> "
+                + std::to_string(entry.cutFetches + entry.lookupFetches + entry.buildFetches) + " fetches").c_str());
+            pGui->addText(("    error " + std::to_string(entry.rootError) + " -> " + std::to_string(entry.cutError)).c_str());
+        }
+    }
+    if (pGui->addButton("Check shadow ray binning"))
+        mRunShadowRayBinningCheck = true;
+    pGui->addTooltip("Samples a screen of pixel tiles on the surfaces near the VPLs with 1, 4 and 16 samples per pixel and compares the coherence of the shadow rays per warp in pixel order, binned by node and binned by octant", true);
+    if (mShadowRayBinningCheck.numPixels > 0)
+    {
+        pGui->addText(mShadowRayBinningCheck.valid ? "  Valid" : "  Invalid");
+        for (const auto& entry : mShadowRayBinningCheck.entries)
+        {
+            const ShadowRayCoherence* c = entry.coherence;
+            pGui->addText(("  " + std::to_string(entry.numSamples) + " spp, " + std::to_string(c[0].numRays) + " rays").c_str());
+            pGui->addText(("    direction coherence " + std::to_string(c[0].directionCoherence) + " -> " + std::to_string(c[1].directionCoherence)
+                + " (node), " + std::to_string(c[2].directionCoherence) + " (octant)").c_str());
+            pGui->addText(("    nodes per warp " + std::to_string(c[0].nodesPerWarp) + " -> " + std::to_string(c[1].nodesPerWarp)
+                + " (node), " + std::to_string(c[2].nodesPerWarp) + " (octant)").c_str());
+            pGui->addText(("    origin spread " + std::to_string(c[0].originSpread) + " -> " + std::to_string(c[1].originSpread)
+                + " (node), " + std::to_string(c[2].originSpread) + " (octant)").c_str());
+        }
+    }
+    if (pGui->addButton("Check out-of-core build"))
+        mRunOutOfCoreCheck = true;
+    pGui->addTooltip("Builds the VPLs in chunks with a quarter of the memory of the in-memory build, validates the merged tree and compares the sampling error", true);
+    if (mOutOfCoreCheck.numChunks > 0)
+    {
+        pGui->addText(mOutOfCoreCheck.valid ? "  Valid" : "  Invalid");
+        pGui->addText(("  " + std::to_string(mOutOfCoreCheck.numChunks) + " chunks, peak " + std::to_string(mOutOfCoreCheck.peakMemory >> 10) + " of " + std::to_string(mOutOfCoreCheck.memoryBudget >> 10) + " KB").c_str());
+        pGui->addText(("  error " + std::to_string(mOutOfCoreCheck.outOfCoreError) + " (in-memory " + std::to_string(mOutOfCoreCheck.inMemoryError) + ")").c_str());
+    }
+    pGui->addCheckBox("Check AVX2 code kernels", mCheckSimdCodes);
+    pGui->addTooltip("Compares the AVX2 code kernels against the scalar port of Codes.slangh", true);
+    if (mCheckSimdCodes)
+    {
+        pGui->addText(mSimdCodesValid ? "Valid" : "Invalid", true);
+    }
+}
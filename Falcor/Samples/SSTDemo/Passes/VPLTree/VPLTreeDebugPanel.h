@@ -0,0 +1,91 @@
+#pragma once
+
+#include "Falcor.h"
+#include "Host/HostTreeBuilder.h"
+#include "Host/HostSAHBuilder.h"
+#include "Host/HostWideTree.h"
+#include "Host/HostCompressedTree.h"
+#include "Host/HostPacketSampling.h"
+#include "Host/HostGroupSampling.h"
+#include "Host/HostOrientationCones.h"
+#include "Host/HostTileCuts.h"
+#include "Host/HostShadowRayBinning.h"
+#include "Host/HostTreeBenchmark.h"
+#include "Host/HostOutOfCoreBuilder.h"
+#include "Host/HostVPLClustering.h"
+
+using namespace Falcor;
+
+
+/** Host checks and benchmarks of the VPLTree pass on the VPLs of the current scene.
+    A button requests a check, the pass runs it on the next tree update and the panel shows the result.
+    The checks with a pass criterion also run on synthetic VPLs with "SSTDemo.exe -selfTest", see HostSelfTest.h.
+*/
+class VPLTreeDebugPanel : public std::enable_shared_from_this<VPLTreeDebugPanel>
+{
+public:
+    using SharedPtr = std::shared_ptr<VPLTreeDebugPanel>;
+    using SharedConstPtr = std::shared_ptr<const VPLTreeDebugPanel>;
+    virtual ~VPLTreeDebugPanel() = default;
+
+    static SharedPtr create();
+
+    /** Runs the requested checks and benchmarks on a tree built by the host builder.
+        \param[in] desc Build parameters of the tree.
+        \param[in] vplData VPL data array of the built tree.
+        \param[in] numVPLs Number of valid VPLs.
+        \param[in] maxVPLs Capacity of the leaf range.
+        \param[in] outOfCoreFilename Temporary file of the out-of-core check.
+    */
+    void runHostChecks(const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs, const std::string& outOfCoreFilename);
+
+    /** Clustering check on the VPLs before the build, see checkVPLClustering().
+    */
+    bool isClusteringCheckPending() const { return mRunClusteringCheck; }
+    void runClusteringCheck(const VPLClusteringDesc& clusteringDesc, const HostTreeBuilder::Desc& desc, const std::vector<VPLData>& vplData, int numVPLs, int maxVPLs);
+    const VPLClusteringCheck& getClusteringCheck() const { return mClusteringCheck; }
+
+    /** Determinism check of a build the panel can't run itself, e.g. the GPU build. The host build is checked by runHostChecks().
+    */
+    bool isDeterminismCheckPending() const { return mRunDeterminismCheck; }
+    void runDeterminismCheck(const HashedBuildFunc& build, const std::string& name);
+
+    /** Renders the buttons and the results.
+        \param[in] hostBuilder The host builder is active. Most checks need the tree of the host builder.
+    */
+    void renderGui(Gui* pGui, bool hostBuilder);
+
+protected:
+    VPLTreeDebugPanel() = default;
+
+    bool mCheckSimdCodes = false;
+    bool mSimdCodesValid = false;
+    bool mRunRefitBenchmark = false;
+    bool mRunTreeBenchmark = false;
+    int mTreeBenchmarkMaxLog2Size = 20;
+    bool mRunBuilderComparison = false;
+    bool mRunWideComparison = false;
+    bool mRunCompressedCheck = false;
+    bool mRunPacketSamplerCheck = false;
+    bool mRunGroupSamplingCheck = false;
+    bool mRunOrientationConeCheck = false;
+    bool mRunTileCutCheck = false;
+    bool mRunShadowRayBinningCheck = false;
+    bool mRunDeterminismCheck = false;
+    bool mRunOutOfCoreCheck = false;
+    bool mRunClusteringCheck = false;
+
+    std::vector<RefitBenchmarkResult> mRefitBenchmarkResults;
+    std::vector<TreeBenchmarkResult> mTreeBenchmarkResults;
+    BuilderComparison mBuilderComparison;
+    WideTraversalComparison mWideComparison;
+    CompressedTreeCheck mCompressedCheck;
+    PacketSamplerCheck mPacketSamplerCheck;
+    GroupSamplingCheck mGroupSamplingCheck;
+    OrientationConeCheck mOrientationConeCheck;
+    TileCutCheck mTileCutCheck;
+    ShadowRayBinningCheck mShadowRayBinningCheck;
+    DeterministicBuildCheck mDeterminismCheck;
+    OutOfCoreBuildCheck mOutOfCoreCheck;
+    VPLClusteringCheck mClusteringCheck;
+};
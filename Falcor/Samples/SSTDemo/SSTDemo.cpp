@@ -2,6 +2,7 @@
 #include "passes/gbuffer/GBufferData.h"
 
 #include <dear_imgui/imgui.h>
+#include <sstream>
 
 
 namespace
@@ -334,6 +335,77 @@ int WINAPI WinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _
     //AttachConsole(GetCurrentProcessId());
     //freopen("CON", "w", stdout);
 
+    // Headless host build benchmark: -treeBenchmark <file.json> [maxLog2Size], exits with 1 if a build fails
+    // Headless out-of-core bake: -outOfCoreBuild <vpls> <tree> [memoryBudgetMB]
+    // Headless distributed bake: -distributedBake <hostscene> <tree> [numWorkers] [maxVPLs]
+    // Worker process of a distributed bake: -vplWorker, started by runDistributedBake()
+    // Headless regression tests of the host code: -selfTest [numVPLs], exits with 1 if a test fails
+    // Headless validation of a baked tree cache or out-of-core tree: -validateTree <tree>, exits with 1 if the tree is invalid
+    std::istringstream args(lpCmdLine ? lpCmdLine : "");
+    std::string arg;
+    while (args >> arg)
+    {
+        if (arg == "-treeBenchmark")
+        {
+            TreeBenchmarkDesc desc;
+            std::string filename = "TreeBenchmark.json";
+            uint32_t maxLog2Size = 0;
+            args >> filename;
+            if (args >> maxLog2Size) desc.maxLog2Size = maxLog2Size;
+            std::vector<TreeBenchmarkResult> results;
+            return runTreeBenchmark(desc, results) && writeTreeBenchmarkJson(filename, desc, results) ? 0 : 1;
+        }
+
+        if (arg == "-outOfCoreBuild")
+        {
+            HostOutOfCoreBuilder::Desc desc;
+            std::string vplFilename, treeFilename;
+            size_t memoryBudgetMB = 0;
+            args >> vplFilename >> treeFilename;
+            if (args >> memoryBudgetMB) desc.memoryBudget = memoryBudgetMB << 20;
+            desc.buildDesc.deterministic = true;
+            VPLFileSource::SharedPtr pSource = VPLFileSource::create(vplFilename);
+            return pSource && HostOutOfCoreBuilder::create()->build(desc, *pSource, treeFilename) ? 0 : 1;
+        }
+
+        if (arg == "-distributedBake")
+        {
+            DistributedBakeDesc desc;
+            std::string treeFilename;
+            uint32_t numWorkers = 0;
+            int maxVPLs = 0;
+            args >> desc.sceneFilename >> treeFilename;
+            desc.numWorkers = args >> numWorkers ? numWorkers : std::max(std::thread::hardware_concurrency(), 1u);
+            if (args >> maxVPLs) desc.tracerDesc.maxVPLs = maxVPLs;
+            desc.compactLeaves = true;
+            desc.buildDesc.deterministic = true;
+
+            std::vector<VPLData> vplData;
+            VPLStats stats;
+            DistributedBakeStats bakeStats;
+            return runDistributedBake(desc, vplData, stats, bakeStats) &&
+                writeDistributedBake(treeFilename, desc, vplData, bakeStats.maxVPLs, (uint32_t)bakeStats.workers.size()) ? 0 : 1;
+        }
+
+        if (arg == "-vplWorker")
+            return runVPLBakeWorker(args);
+
+        if (arg == "-selfTest")
+        {
+            HostSelfTestDesc desc;
+            int numVPLs = 0;
+            if (args >> numVPLs) desc.numVPLs = numVPLs;
+            return runHostSelfTests(desc) == 0 ? 0 : 1;
+        }
+
+        if (arg == "-validateTree")
+        {
+            std::string treeFilename;
+            args >> treeFilename;
+            return validateTreeFile(treeFilename) ? 0 : 1;
+        }
+    }
+
     SSTDemo::UniquePtr pSSTDemo = std::make_unique<SSTDemo>();
     SampleConfig config;
 